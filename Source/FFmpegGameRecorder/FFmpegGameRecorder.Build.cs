@@ -46,6 +46,7 @@ public class FFmpegGameRecorder : ModuleRules
                 "HTTP",
                 "RHI",
                 "RenderCore",
+                "Json",
 
                 "OpenSSL",
 				"FFmpeg",
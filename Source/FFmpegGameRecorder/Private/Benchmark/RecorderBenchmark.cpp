@@ -0,0 +1,1524 @@
+﻿#include "CoreMinimal.h"
+#include "Async/Async.h"
+#include "Containers/Queue.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#include "Encoder/FileWriter.h"
+#include "Encoder/FrameRing.h"
+#include "Encoder/OutputSink.h"
+#include "Encoder/PixelConvert.h"
+#include "Encoder/ReplayBuffer.h"
+#include "Encoder/VideoEncoderBackend.h"
+#include "FFmpegExt/FFmpegExtension.h"
+
+#if !UE_BUILD_SHIPPING
+
+/**
+ * 录制管线的微基准，全部以控制台命令的形式提供，结果输出到 LogRecorder
+ */
+namespace RecorderBenchmark
+{
+	/** 与 FAVBufferedEncoder 默认配置一致的槽位数量：队列深度 6 + 2 */
+	constexpr int32 SlotCount = 8;
+
+	/** 加锁的 TQueue，对应原先 VideoMutex 的设计意图 */
+	struct FLockedQueue
+	{
+		bool Enqueue(int32 Item)
+		{
+			FScopeLock Lock(&Mutex);
+			return Queue.Enqueue(Item);
+		}
+
+		bool Dequeue(int32& OutItem)
+		{
+			FScopeLock Lock(&Mutex);
+			return Queue.Dequeue(OutItem);
+		}
+
+		FCriticalSection Mutex;
+		TQueue<int32> Queue;
+	};
+
+	/**
+	 * 模拟渲染线程与编码线程之间的帧交接：当前线程从空闲队列取槽位放入待编码队列，
+	 * 另一个线程从待编码队列取出再还回空闲队列
+	 * @return 耗时（秒）
+	 */
+	template <typename QueueType>
+	double RunHandoff(QueueType& Free, QueueType& Ready, int32 Iterations)
+	{
+		for (int32 Index = 0; Index < SlotCount; ++Index)
+		{
+			Free.Enqueue(Index);
+		}
+
+		const double StartTime = FPlatformTime::Seconds();
+		TFuture<void> Consumer = Async(EAsyncExecution::Thread, [&Free, &Ready, Iterations]()
+		{
+			int32 Item;
+			int32 Consumed = 0;
+			while (Consumed < Iterations)
+			{
+				if (Ready.Dequeue(Item))
+				{
+					Free.Enqueue(Item);
+					++Consumed;
+				}
+				else
+				{
+					FPlatformProcess::Yield();
+				}
+			}
+		});
+
+		int32 Item;
+		int32 Produced = 0;
+		while (Produced < Iterations)
+		{
+			if (Free.Dequeue(Item))
+			{
+				Ready.Enqueue(Item);
+				++Produced;
+			}
+			else
+			{
+				FPlatformProcess::Yield();
+			}
+		}
+		Consumer.Wait();
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	void LogResult(const TCHAR* Name, double Seconds, int32 Iterations)
+	{
+		UE_LOG(LogRecorder, Display, TEXT("[Bench] %-24s %8.2f ms total, %8.1f ns/frame"),
+		       Name, Seconds * 1000.0, Seconds * 1e9 / FMath::Max(1, Iterations))
+	}
+
+	void BenchFrameRing(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1000000;
+
+		{
+			TSpscRing<int32> Free;
+			TSpscRing<int32> Ready;
+			Free.Initialize(SlotCount);
+			Ready.Initialize(SlotCount);
+			LogResult(TEXT("TSpscRing"), RunHandoff(Free, Ready, Iterations), Iterations);
+		}
+		{
+			TQueue<int32, EQueueMode::Spsc> Free;
+			TQueue<int32, EQueueMode::Spsc> Ready;
+			LogResult(TEXT("TQueue<Spsc>"), RunHandoff(Free, Ready, Iterations), Iterations);
+		}
+		{
+			FLockedQueue Free;
+			FLockedQueue Ready;
+			LogResult(TEXT("TQueue + FCriticalSection"), RunHandoff(Free, Ready, Iterations), Iterations);
+		}
+	}
+
+	static FAutoConsoleCommand CmdBenchFrameRing(
+		TEXT("rec.bench.FrameRing"),
+		TEXT("Compare render/encoder thread frame handoff: TSpscRing vs TQueue. Usage: rec.bench.FrameRing [Iterations]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchFrameRing));
+
+	/** 一帧 I420 输出，按 libyuv 的习惯 Y 平面满宽，UV 平面宽高各取一半向上取整 */
+	struct FI420Buffer
+	{
+		FI420Buffer(int32 Width, int32 Height)
+			: StrideY(Width), StrideUV((Width + 1) / 2)
+		{
+			Y.SetNumZeroed(StrideY * Height);
+			U.SetNumZeroed(StrideUV * ((Height + 1) / 2));
+			V.SetNumZeroed(StrideUV * ((Height + 1) / 2));
+		}
+
+		recorder::FI420Planes GetPlanes()
+		{
+			return {Y.GetData(), StrideY, U.GetData(), StrideUV, V.GetData(), StrideUV};
+		}
+
+		int32 CountMismatches(const FI420Buffer& Other) const
+		{
+			int32 Mismatches = 0;
+			const TArray<uint8>* Planes[] = {&Y, &U, &V};
+			const TArray<uint8>* OtherPlanes[] = {&Other.Y, &Other.U, &Other.V};
+			for (int32 Index = 0; Index < 3; ++Index)
+			{
+				for (int32 Byte = 0; Byte < Planes[Index]->Num(); ++Byte)
+				{
+					Mismatches += (*Planes[Index])[Byte] != (*OtherPlanes[Index])[Byte];
+				}
+			}
+			return Mismatches;
+		}
+
+		int32 StrideY;
+		int32 StrideUV;
+		TArray<uint8> Y;
+		TArray<uint8> U;
+		TArray<uint8> V;
+	};
+
+	/** 原先的两趟实现：逐像素重新量化到 RGBA 中转缓存，再由 libyuv 转换 */
+	void ConvertViaRGBA(const uint8* Src, int32 SrcStride, TArray<uint8>& RGBA, FI420Buffer& Dst, int32 Width,
+	                    int32 Height)
+	{
+		uint8* DestPtr = RGBA.GetData();
+		for (int32 Y = 0; Y < Height; ++Y)
+		{
+			const uint32* SrcPtr = reinterpret_cast<const uint32*>(Src + Y * SrcStride);
+			for (int32 X = 0; X < Width; ++X)
+			{
+				const uint32 Pixel = SrcPtr[X];
+				DestPtr[0] = recorder::Requantize10To8(Pixel & 0x3FF);
+				DestPtr[1] = recorder::Requantize10To8((Pixel >> 10) & 0x3FF);
+				DestPtr[2] = recorder::Requantize10To8((Pixel >> 20) & 0x3FF);
+				DestPtr[3] = recorder::Requantize10To8(Pixel >> 30);
+				DestPtr += 4;
+			}
+		}
+		libyuv::ABGRToI420(RGBA.GetData(), Width * 4, Dst.Y.GetData(), Dst.StrideY, Dst.U.GetData(), Dst.StrideUV,
+		                   Dst.V.GetData(), Dst.StrideUV, Width, Height);
+	}
+
+	template <typename FunctionType>
+	double MeasureFrames(int32 Iterations, FunctionType&& Function)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Index = 0; Index < Iterations; ++Index)
+		{
+			Function();
+		}
+		return FPlatformTime::Seconds() - StartTime;
+	}
+
+	void BenchPixelConvertAt(int32 Width, int32 Height, int32 Iterations)
+	{
+		// 源帧比输出多出一圈边框，模拟 CaptureRect 只覆盖 back buffer 的一部分
+		constexpr int32 Border = 8;
+		const int32 SrcWidth = Width + Border * 2;
+		const int32 SrcStride = SrcWidth * 4;
+		TArray<uint32> Source;
+		Source.SetNumUninitialized(SrcWidth * (Height + Border * 2));
+		FRandomStream Random(Width ^ Height);
+		for (uint32& Pixel : Source)
+		{
+			Pixel = static_cast<uint32>(Random.GetUnsignedInt());
+		}
+		const uint8* Src = reinterpret_cast<const uint8*>(Source.GetData()) + Border * SrcStride + Border * 4;
+
+		FI420Buffer Reference(Width, Height);
+		FI420Buffer Fused(Width, Height);
+		FI420Buffer TwoPass(Width, Height);
+		TArray<uint8> RGBA;
+		RGBA.SetNumUninitialized(Width * Height * 4);
+
+		recorder::ConvertA2B10G10R10ToI420_Scalar(Src, SrcStride, Reference.GetPlanes(), Width, Height);
+		recorder::ConvertA2B10G10R10ToI420(Src, SrcStride, Fused.GetPlanes(), Width, Height);
+		ConvertViaRGBA(Src, SrcStride, RGBA, TwoPass, Width, Height);
+
+		const int32 Mismatches = Fused.CountMismatches(Reference);
+		UE_LOG(LogRecorder, Display, TEXT("[Bench] PixelConvert %dx%d: %s vs scalar %d mismatched bytes%s, vs libyuv %d"),
+		       Width, Height, recorder::GetPixelConvertImplementationName(), Mismatches,
+		       Mismatches ? TEXT(" (FAILED)") : TEXT(""), TwoPass.CountMismatches(Reference))
+
+		// 奇数尺寸只走一遍正确性检查，覆盖每行和最后一行的尾部处理
+		FI420Buffer OddReference(Width - 3, Height - 1);
+		FI420Buffer OddFused(Width - 3, Height - 1);
+		recorder::ConvertA2B10G10R10ToI420_Scalar(Src, SrcStride, OddReference.GetPlanes(), Width - 3, Height - 1);
+		recorder::ConvertA2B10G10R10ToI420(Src, SrcStride, OddFused.GetPlanes(), Width - 3, Height - 1);
+		if (const int32 OddMismatches = OddFused.CountMismatches(OddReference))
+		{
+			UE_LOG(LogRecorder, Error, TEXT("[Bench] PixelConvert %dx%d: %d mismatched bytes (FAILED)"),
+			       Width - 3, Height - 1, OddMismatches)
+		}
+
+		const FString Size = FString::Printf(TEXT("%dx%d"), Width, Height);
+		LogResult(*(Size + TEXT(" fused")), MeasureFrames(Iterations, [&]()
+		{
+			recorder::ConvertA2B10G10R10ToI420(Src, SrcStride, Fused.GetPlanes(), Width, Height);
+		}), Iterations);
+		LogResult(*(Size + TEXT(" scalar")), MeasureFrames(Iterations, [&]()
+		{
+			recorder::ConvertA2B10G10R10ToI420_Scalar(Src, SrcStride, Reference.GetPlanes(), Width, Height);
+		}), Iterations);
+		LogResult(*(Size + TEXT(" RGBA + libyuv")), MeasureFrames(Iterations, [&]()
+		{
+			ConvertViaRGBA(Src, SrcStride, RGBA, TwoPass, Width, Height);
+		}), Iterations);
+	}
+
+	void BenchPixelConvert(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 100;
+		BenchPixelConvertAt(1920, 1080, Iterations);
+		BenchPixelConvertAt(2560, 1440, Iterations);
+	}
+
+	static FAutoConsoleCommand CmdBenchPixelConvert(
+		TEXT("rec.bench.PixelConvert"),
+		TEXT("Check the SIMD A2B10G10R10 -> I420 kernel against the scalar reference and time it against RGBA + libyuv at 1080p/1440p. Usage: rec.bench.PixelConvert [Iterations]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchPixelConvert));
+
+	/** 一帧 NV12 输出，UV 平面每行是 U、V 交错的 (Width + 1) / 2 对 */
+	struct FNV12Buffer
+	{
+		FNV12Buffer(int32 Width, int32 Height)
+			: StrideY(Width), StrideUV((Width + 1) / 2 * 2)
+		{
+			Y.SetNumZeroed(StrideY * Height);
+			UV.SetNumZeroed(StrideUV * ((Height + 1) / 2));
+		}
+
+		recorder::FNV12Planes GetPlanes()
+		{
+			return {Y.GetData(), StrideY, UV.GetData(), StrideUV};
+		}
+
+		/** 与同样尺寸的 I420 结果逐字节比较 */
+		int32 CountMismatches(const FI420Buffer& Other) const
+		{
+			int32 Mismatches = 0;
+			for (int32 Byte = 0; Byte < Y.Num(); ++Byte)
+			{
+				Mismatches += Y[Byte] != Other.Y[Byte];
+			}
+			for (int32 Chroma = 0; Chroma < Other.U.Num(); ++Chroma)
+			{
+				Mismatches += UV[Chroma * 2] != Other.U[Chroma];
+				Mismatches += UV[Chroma * 2 + 1] != Other.V[Chroma];
+			}
+			return Mismatches;
+		}
+
+		/** 与同样尺寸的 NV12 结果逐字节比较 */
+		int32 CountMismatches(const FNV12Buffer& Other) const
+		{
+			int32 Mismatches = 0;
+			for (int32 Byte = 0; Byte < Y.Num(); ++Byte)
+			{
+				Mismatches += Y[Byte] != Other.Y[Byte];
+			}
+			for (int32 Byte = 0; Byte < UV.Num(); ++Byte)
+			{
+				Mismatches += UV[Byte] != Other.UV[Byte];
+			}
+			return Mismatches;
+		}
+
+		int32 StrideY;
+		int32 StrideUV;
+		TArray<uint8> Y;
+		TArray<uint8> UV;
+	};
+
+	void BenchNV12At(int32 Width, int32 Height, int32 Iterations)
+	{
+		TArray<uint32> Source;
+		Source.SetNumUninitialized(Width * Height);
+		FRandomStream Random(Width ^ Height);
+		for (uint32& Pixel : Source)
+		{
+			Pixel = static_cast<uint32>(Random.GetUnsignedInt());
+		}
+		const uint8* Src = reinterpret_cast<const uint8*>(Source.GetData());
+		const int32 SrcStride = Width * 4;
+
+		FI420Buffer I420(Width, Height);
+		FNV12Buffer NV12(Width, Height);
+
+		// 色度值必须与 I420 版本一致，只是排列不同；奇数尺寸覆盖每行和最后一行的尾部
+		for (const FIntPoint Size : {FIntPoint(Width, Height), FIntPoint(Width - 3, Height - 1)})
+		{
+			FI420Buffer Reference(Size.X, Size.Y);
+			FNV12Buffer NV12Reference(Size.X, Size.Y);
+			FNV12Buffer Fused(Size.X, Size.Y);
+			recorder::ConvertA2B10G10R10ToI420_Scalar(Src, SrcStride, Reference.GetPlanes(), Size.X, Size.Y);
+			recorder::ConvertA2B10G10R10ToNV12_Scalar(Src, SrcStride, NV12Reference.GetPlanes(), Size.X, Size.Y);
+			recorder::ConvertA2B10G10R10ToNV12(Src, SrcStride, Fused.GetPlanes(), Size.X, Size.Y);
+			const int32 Mismatches = Fused.CountMismatches(NV12Reference);
+			const int32 LayoutMismatches = NV12Reference.CountMismatches(Reference);
+			UE_LOG(LogRecorder, Display,
+			       TEXT("[Bench] NV12 %dx%d: %s vs scalar NV12 %d mismatched bytes, scalar NV12 vs I420 %d%s"),
+			       Size.X, Size.Y, recorder::GetPixelConvertImplementationName(), Mismatches, LayoutMismatches,
+			       Mismatches || LayoutMismatches ? TEXT(" (FAILED)") : TEXT(""))
+		}
+
+		const FString Size = FString::Printf(TEXT("%dx%d"), Width, Height);
+		LogResult(*(Size + TEXT(" 10bit->I420")), MeasureFrames(Iterations, [&]()
+		{
+			recorder::ConvertA2B10G10R10ToI420(Src, SrcStride, I420.GetPlanes(), Width, Height);
+		}), Iterations);
+		LogResult(*(Size + TEXT(" 10bit->NV12")), MeasureFrames(Iterations, [&]()
+		{
+			recorder::ConvertA2B10G10R10ToNV12(Src, SrcStride, NV12.GetPlanes(), Width, Height);
+		}), Iterations);
+
+		// RGBA 中转缓存的路径，I420 之后再交错一次色度相当于编码器拿到 I420 时内部做的重排
+		LogResult(*(Size + TEXT(" ABGR->I420")), MeasureFrames(Iterations, [&]()
+		{
+			libyuv::ABGRToI420(Src, SrcStride, I420.Y.GetData(), I420.StrideY, I420.U.GetData(), I420.StrideUV,
+			                   I420.V.GetData(), I420.StrideUV, Width, Height);
+		}), Iterations);
+		LogResult(*(Size + TEXT(" ABGR->I420->NV12")), MeasureFrames(Iterations, [&]()
+		{
+			libyuv::ABGRToI420(Src, SrcStride, I420.Y.GetData(), I420.StrideY, I420.U.GetData(), I420.StrideUV,
+			                   I420.V.GetData(), I420.StrideUV, Width, Height);
+			libyuv::I420ToNV12(I420.Y.GetData(), I420.StrideY, I420.U.GetData(), I420.StrideUV,
+			                   I420.V.GetData(), I420.StrideUV, NV12.Y.GetData(), NV12.StrideY,
+			                   NV12.UV.GetData(), NV12.StrideUV, Width, Height);
+		}), Iterations);
+		LogResult(*(Size + TEXT(" ABGR->NV12")), MeasureFrames(Iterations, [&]()
+		{
+			libyuv::ABGRToNV12(Src, SrcStride, NV12.Y.GetData(), NV12.StrideY, NV12.UV.GetData(), NV12.StrideUV,
+			                   Width, Height);
+		}), Iterations);
+	}
+
+	void BenchNV12(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 100;
+		BenchNV12At(1920, 1080, Iterations);
+		BenchNV12At(2560, 1440, Iterations);
+	}
+
+	static FAutoConsoleCommand CmdBenchNV12(
+		TEXT("rec.bench.NV12"),
+		TEXT("Check the fused A2B10G10R10 -> NV12 kernel against the I420 reference and time NV12 output against I420 plus a chroma repack. Usage: rec.bench.NV12 [Iterations]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchNV12));
+
+	/** 颜色转换随线程数的扩展性，条带划分与编码器使用的 ParallelForStripes 一致 */
+	void BenchColorConvert(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 100;
+		const int32 MaxWorkers = Args.Num() > 1
+			                         ? FCString::Atoi(*Args[1])
+			                         : FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+		constexpr int32 Width = 2560;
+		constexpr int32 Height = 1440;
+
+		TArray<uint32> Source;
+		Source.SetNumUninitialized(Width * Height);
+		FRandomStream Random(Width ^ Height);
+		for (uint32& Pixel : Source)
+		{
+			Pixel = static_cast<uint32>(Random.GetUnsignedInt());
+		}
+		const uint8* Src = reinterpret_cast<const uint8*>(Source.GetData());
+		const int32 SrcStride = Width * 4;
+		FI420Buffer Dst(Width, Height);
+
+		for (int32 Workers = 1; Workers <= MaxWorkers; ++Workers)
+		{
+			LogResult(*FString::Printf(TEXT("libyuv x%d"), Workers), MeasureFrames(Iterations, [&]()
+			{
+				recorder::ParallelForStripes(Height, Workers, [&](int32 StartRow, int32 NumRows)
+				{
+					libyuv::ABGRToI420(Src + StartRow * SrcStride, SrcStride,
+					                   Dst.Y.GetData() + StartRow * Dst.StrideY, Dst.StrideY,
+					                   Dst.U.GetData() + StartRow / 2 * Dst.StrideUV, Dst.StrideUV,
+					                   Dst.V.GetData() + StartRow / 2 * Dst.StrideUV, Dst.StrideUV,
+					                   Width, NumRows);
+				});
+			}), Iterations);
+			LogResult(*FString::Printf(TEXT("fused 10bit x%d"), Workers), MeasureFrames(Iterations, [&]()
+			{
+				recorder::ParallelForStripes(Height, Workers, [&](int32 StartRow, int32 NumRows)
+				{
+					const recorder::FI420Planes Planes{
+						Dst.Y.GetData() + StartRow * Dst.StrideY, Dst.StrideY,
+						Dst.U.GetData() + StartRow / 2 * Dst.StrideUV, Dst.StrideUV,
+						Dst.V.GetData() + StartRow / 2 * Dst.StrideUV, Dst.StrideUV,
+					};
+					recorder::ConvertA2B10G10R10ToI420(Src + StartRow * SrcStride, SrcStride, Planes, Width, NumRows);
+				});
+			}), Iterations);
+		}
+	}
+
+	static FAutoConsoleCommand CmdBenchColorConvert(
+		TEXT("rec.bench.ColorConvert"),
+		TEXT("Time 1440p RGB -> I420 conversion split into stripes on 1..N threads. Usage: rec.bench.ColorConvert [Iterations] [MaxWorkers]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchColorConvert));
+
+	/** 与 FAVEncoder::AllocVideoFilter 相同的恒等缩放滤镜图 */
+	struct FScaleGraph
+	{
+		FScaleGraph(int32 Width, int32 Height)
+		{
+			Graph = avfilter_graph_alloc();
+			const FString Args = FString::Printf(TEXT("video_size=%dx%d:pix_fmt=%d:time_base=1/1000000:pixel_aspect=0/1"),
+			                                     Width, Height, static_cast<int32>(AV_PIX_FMT_YUV420P));
+			const FString Descr = FString::Printf(TEXT("[in]scale=%d:%d[out]"), Width, Height);
+			enum AVPixelFormat PixFmts[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE};
+
+			AVFilterInOut* Outputs = avfilter_inout_alloc();
+			AVFilterInOut* Inputs = avfilter_inout_alloc();
+			bool bSuccess = Graph && Outputs && Inputs
+				&& avfilter_graph_create_filter(&Source, avfilter_get_by_name("buffer"), "in",
+				                                TCHAR_TO_ANSI(*Args), nullptr, Graph) >= 0
+				&& avfilter_graph_create_filter(&Sink, avfilter_get_by_name("buffersink"), "out",
+				                                nullptr, nullptr, Graph) >= 0
+				&& av_opt_set_int_list(Sink, "pix_fmts", PixFmts, AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN) >= 0;
+			if (bSuccess)
+			{
+				Outputs->name = av_strdup("in");
+				Outputs->filter_ctx = Source;
+				Inputs->name = av_strdup("out");
+				Inputs->filter_ctx = Sink;
+				bSuccess = avfilter_graph_parse_ptr(Graph, TCHAR_TO_ANSI(*Descr), &Inputs, &Outputs, nullptr) >= 0
+					&& avfilter_graph_config(Graph, nullptr) >= 0;
+			}
+			avfilter_inout_free(&Inputs);
+			avfilter_inout_free(&Outputs);
+			if (!bSuccess)
+			{
+				avfilter_graph_free(&Graph);
+			}
+		}
+
+		~FScaleGraph()
+		{
+			avfilter_graph_free(&Graph);
+		}
+
+		AVFilterGraph* Graph = nullptr;
+		AVFilterContext* Source = nullptr;
+		AVFilterContext* Sink = nullptr;
+	};
+
+	void BenchVideoFilter(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1000;
+		const int32 Width = Args.Num() > 2 ? FCString::Atoi(*Args[1]) : 1920;
+		const int32 Height = Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 1080;
+
+		FScaleGraph ScaleGraph(Width, Height);
+		if (!ScaleGraph.Graph)
+		{
+			UE_LOG(LogRecorder, Error, TEXT("[Bench] VideoFilter: failed to build scale graph"))
+			return;
+		}
+
+		// 与 FAVEncoder::video_frame 一样，用 av_image_alloc 分配、不带引用计数的帧
+		AVFrame* Frame = av_frame_alloc();
+		Frame->width = Width;
+		Frame->height = Height;
+		Frame->format = AV_PIX_FMT_YUV420P;
+		av_image_alloc(Frame->data, Frame->linesize, Width, Height, AV_PIX_FMT_YUV420P, 32);
+		AVFrame* Filtered = av_frame_alloc();
+
+		int32 Received = 0;
+		const double Seconds = MeasureFrames(Iterations, [&]()
+		{
+			Frame->pts = Received;
+			av_buffersrc_add_frame_flags(ScaleGraph.Source, Frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+			while (av_buffersink_get_frame(ScaleGraph.Sink, Filtered) >= 0)
+			{
+				++Received;
+				av_frame_unref(Filtered);
+			}
+		});
+
+		// 直通路径在这里没有任何额外的工作，滤镜图的耗时就是每帧节省下来的时间
+		LogResult(*FString::Printf(TEXT("%dx%d scale graph"), Width, Height), Seconds, Iterations);
+		if (Received != Iterations)
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("[Bench] VideoFilter: %d frames in, %d frames out"), Iterations, Received)
+		}
+
+		av_frame_free(&Filtered);
+		av_freep(&Frame->data[0]);
+		av_frame_free(&Frame);
+	}
+
+	static FAutoConsoleCommand CmdBenchVideoFilter(
+		TEXT("rec.bench.VideoFilter"),
+		TEXT("Per-frame cost of the identity scale filter graph that the direct encoder path skips. Usage: rec.bench.VideoFilter [Iterations] [Width Height]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchVideoFilter));
+
+	void BenchScaleAt(int32 SrcWidth, int32 SrcHeight, int32 DstWidth, int32 DstHeight, int32 Iterations)
+	{
+		FI420Buffer Src(SrcWidth, SrcHeight);
+		FI420Buffer Dst(DstWidth, DstHeight);
+		FRandomStream Random(SrcWidth ^ SrcHeight);
+		for (TArray<uint8>* Plane : {&Src.Y, &Src.U, &Src.V})
+		{
+			for (uint8& Byte : *Plane)
+			{
+				Byte = static_cast<uint8>(Random.RandRange(0, 255));
+			}
+		}
+
+		const FString Size = FString::Printf(TEXT("%dx%d->%dx%d"), SrcWidth, SrcHeight, DstWidth, DstHeight);
+		const TPair<libyuv::FilterMode, const TCHAR*> LibyuvFilters[] = {
+			{libyuv::kFilterBilinear, TEXT("libyuv bilinear")},
+			{libyuv::kFilterBox, TEXT("libyuv box")},
+		};
+		for (const TPair<libyuv::FilterMode, const TCHAR*>& Filter : LibyuvFilters)
+		{
+			LogResult(*FString::Printf(TEXT("%s %s"), *Size, Filter.Value), MeasureFrames(Iterations, [&]()
+			{
+				libyuv::I420Scale(Src.Y.GetData(), Src.StrideY, Src.U.GetData(), Src.StrideUV,
+				                  Src.V.GetData(), Src.StrideUV, SrcWidth, SrcHeight,
+				                  Dst.Y.GetData(), Dst.StrideY, Dst.U.GetData(), Dst.StrideUV,
+				                  Dst.V.GetData(), Dst.StrideUV, DstWidth, DstHeight, Filter.Key);
+			}), Iterations);
+		}
+
+		// 原先滤镜图里的 scale 滤镜用的就是 swscale，默认 bicubic
+		const TPair<int, const TCHAR*> SwsFilters[] = {
+			{SWS_FAST_BILINEAR, TEXT("swscale fast_bilinear")},
+			{SWS_BILINEAR, TEXT("swscale bilinear")},
+			{SWS_AREA, TEXT("swscale area")},
+			{SWS_BICUBIC, TEXT("swscale bicubic")},
+		};
+		for (const TPair<int, const TCHAR*>& Filter : SwsFilters)
+		{
+			SwsContext* Context = sws_getContext(SrcWidth, SrcHeight, AV_PIX_FMT_YUV420P, DstWidth, DstHeight,
+			                                     AV_PIX_FMT_YUV420P, Filter.Key, nullptr, nullptr, nullptr);
+			if (!Context)
+			{
+				UE_LOG(LogRecorder, Warning, TEXT("[Bench] Scale: sws_getContext failed for %s"), Filter.Value)
+				continue;
+			}
+			const uint8* const SrcPlanes[] = {Src.Y.GetData(), Src.U.GetData(), Src.V.GetData()};
+			const int SrcStrides[] = {Src.StrideY, Src.StrideUV, Src.StrideUV};
+			uint8* const DstPlanes[] = {Dst.Y.GetData(), Dst.U.GetData(), Dst.V.GetData()};
+			const int DstStrides[] = {Dst.StrideY, Dst.StrideUV, Dst.StrideUV};
+			LogResult(*FString::Printf(TEXT("%s %s"), *Size, Filter.Value), MeasureFrames(Iterations, [&]()
+			{
+				sws_scale(Context, SrcPlanes, SrcStrides, 0, SrcHeight, DstPlanes, DstStrides);
+			}), Iterations);
+			sws_freeContext(Context);
+		}
+	}
+
+	/** 输出分辨率与截取区域不同时的缩放：libyuv 的 I420Scale 对比原先滤镜图里的 swscale，单线程 */
+	void BenchScale(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 100;
+		BenchScaleAt(3840, 2160, 1920, 1080, Iterations);
+		BenchScaleAt(2560, 1440, 1920, 1080, Iterations);
+		BenchScaleAt(1920, 1080, 1280, 720, Iterations);
+		BenchScaleAt(1920, 1080, 854, 480, Iterations);
+	}
+
+	static FAutoConsoleCommand CmdBenchScale(
+		TEXT("rec.bench.Scale"),
+		TEXT("Compare libyuv I420Scale with swscale for 4K->1080p, 1440p->1080p, 1080p->720p and 1080p->480p. Usage: rec.bench.Scale [Iterations]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchScale));
+
+	/**
+	 * 按录制时封装器的写法往 AVIOContext 里写一串 packet：每个 packet 一次 avio_write，
+	 * 结束前像 mov 写文件尾一样回到文件头改写 mdat 的大小
+	 * @return 每次 avio_write 的耗时（毫秒）
+	 */
+	TArray<double> WritePacketStream(AVIOContext* IOContext, const TArray<uint8>& Payload, const TArray<int32>& Sizes)
+	{
+		TArray<double> Latencies;
+		Latencies.Reserve(Sizes.Num());
+		int32 Offset = 0;
+		for (const int32 Size : Sizes)
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			avio_write(IOContext, Payload.GetData() + Offset, Size);
+			Latencies.Add((FPlatformTime::Seconds() - StartTime) * 1000.0);
+			Offset = (Offset + Size) % (Payload.Num() / 2);
+		}
+
+		const uint8 MdatSize[8] = {0x00, 0x00, 0x00, 0x01, 0x6d, 0x64, 0x61, 0x74};
+		const int64 End = avio_tell(IOContext);
+		avio_seek(IOContext, 8, SEEK_SET);
+		avio_write(IOContext, MdatSize, sizeof(MdatSize));
+		avio_seek(IOContext, End, SEEK_SET);
+		avio_write(IOContext, MdatSize, sizeof(MdatSize));
+		return Latencies;
+	}
+
+	void LogWriteLatencies(const TCHAR* Name, TArray<double>& Latencies, double Seconds, int64 WriteCalls)
+	{
+		Latencies.Sort();
+		const auto Percentile = [&Latencies](double P)
+		{
+			return Latencies[FMath::Min(Latencies.Num() - 1, static_cast<int32>(Latencies.Num() * P))];
+		};
+		UE_LOG(LogRecorder, Display,
+		       TEXT("[Bench] %-24s %8.2f ms total, %6lld write calls, avio_write p50 %.4f ms p99 %.4f ms max %.4f ms"),
+		       Name, Seconds * 1000.0, WriteCalls, Percentile(0.5), Percentile(0.99), Latencies.Last())
+	}
+
+	void BenchFileWriter(const TArray<FString>& Args)
+	{
+		const int32 PacketCount = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 3600;
+		const int32 BufferSizeKB = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 4096;
+
+		// 60fps、一秒一个关键帧、平均 8Mbps 左右的码流
+		FRandomStream Random(PacketCount);
+		TArray<int32> Sizes;
+		for (int32 Index = 0; Index < PacketCount; ++Index)
+		{
+			Sizes.Add(Index % 60 == 0 ? Random.RandRange(150000, 300000) : Random.RandRange(8000, 24000));
+		}
+		TArray<uint8> Payload;
+		Payload.SetNumUninitialized(2 * 1024 * 1024);
+		for (uint8& Byte : Payload)
+		{
+			Byte = static_cast<uint8>(Random.RandHelper(256));
+		}
+
+		const FString Dir = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir());
+		const FString BaselinePath = Dir / TEXT("RecorderBench_avio_open.bin");
+		const FString BufferedPath = Dir / TEXT("RecorderBench_buffered.bin");
+
+		{
+			AVIOContext* IOContext = nullptr;
+			if (avio_open(&IOContext, TCHAR_TO_UTF8(*BaselinePath), AVIO_FLAG_WRITE) < 0)
+			{
+				UE_LOG(LogRecorder, Error, TEXT("[Bench] FileWriter: avio_open %s failed"), *BaselinePath)
+				return;
+			}
+			const double StartTime = FPlatformTime::Seconds();
+			TArray<double> Latencies = WritePacketStream(IOContext, Payload, Sizes);
+			avio_flush(IOContext);
+#if LIBAVFORMAT_VERSION_MAJOR < 60
+			const int64 WriteCalls = IOContext->writeout_count;
+#else
+			const int64 WriteCalls = -1;
+#endif
+			avio_closep(&IOContext);
+			LogWriteLatencies(TEXT("avio_open"), Latencies, FPlatformTime::Seconds() - StartTime, WriteCalls);
+		}
+		{
+			FBufferedFileWriter Writer;
+			if (!Writer.Open(BufferedPath, BufferSizeKB * 1024, 0))
+			{
+				UE_LOG(LogRecorder, Error, TEXT("[Bench] FileWriter: open %s failed"), *BufferedPath)
+				return;
+			}
+			const double StartTime = FPlatformTime::Seconds();
+			TArray<double> Latencies = WritePacketStream(Writer.GetIOContext(), Payload, Sizes);
+			Writer.Close();
+			LogWriteLatencies(*FString::Printf(TEXT("buffered %d KB"), BufferSizeKB), Latencies,
+			                  FPlatformTime::Seconds() - StartTime, Writer.GetWriteCallCount());
+			Writer.GetStats()->Log(TEXT("FileIO"));
+		}
+
+		// 两种写法的文件内容必须完全一致，包括回填的部分
+		TArray<uint8> Baseline;
+		TArray<uint8> Buffered;
+		FFileHelper::LoadFileToArray(Baseline, *BaselinePath);
+		FFileHelper::LoadFileToArray(Buffered, *BufferedPath);
+		if (Baseline.Num() == 0 || Baseline != Buffered)
+		{
+			UE_LOG(LogRecorder, Error, TEXT("[Bench] FileWriter: output differs from avio_open (%d vs %d bytes) (FAILED)"),
+			       Buffered.Num(), Baseline.Num())
+		}
+		IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+		PlatformFile.DeleteFile(*BaselinePath);
+		PlatformFile.DeleteFile(*BufferedPath);
+	}
+
+	static FAutoConsoleCommand CmdBenchFileWriter(
+		TEXT("rec.bench.FileWriter"),
+		TEXT("Write a simulated 60fps packet stream through avio_open and through the write-behind file writer, compare write calls and avio_write latency and check the files match. Usage: rec.bench.FileWriter [Packets] [BufferKB]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchFileWriter));
+
+	void BenchReplayBuffer(const TArray<FString>& Args)
+	{
+		const int32 BufferMB = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1024;
+		const int32 Seconds = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 600;
+		const bool bOnDisk = Args.Num() > 2 ? FCString::Atoi(*Args[2]) != 0 : true;
+
+		const FString Dir = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir());
+		FRecorderConfig Config;
+		Config.ReplayBufferMB = BufferMB;
+		Config.bReplayBufferOnDisk = bOnDisk;
+		Config.SaveFilePath = Dir / TEXT("RecorderBench_replay_ring.mp4");
+		const FString ReplayPath = Dir / TEXT("RecorderBench_replay.mp4");
+
+		// 只需要一路 mp4 能封装的视频流，payload 是随机数据，不会被解码
+		AVFormatContext* Template = nullptr;
+		avformat_alloc_output_context2(&Template, nullptr, "mp4", nullptr);
+		AVStream* Stream = avformat_new_stream(Template, nullptr);
+		Stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+		Stream->codecpar->codec_id = AV_CODEC_ID_MPEG4;
+		Stream->codecpar->width = 1920;
+		Stream->codecpar->height = 1080;
+		Stream->time_base = {1, recorder::TemplateVideoTimeBase};
+		TUniquePtr<FReplayBuffer> Replay = MakeUnique<FReplayBuffer>(Config, Template);
+		avformat_free_context(Template);
+
+		// 60fps、一秒一个关键帧、平均 12Mbps 左右的码流，一次性写入 Seconds 秒
+		FRandomStream Random(Seconds);
+		TArray<uint8> Payload;
+		Payload.SetNumUninitialized(2 * 1024 * 1024);
+		for (uint8& Byte : Payload)
+		{
+			Byte = static_cast<uint8>(Random.RandHelper(256));
+		}
+		const int32 PacketCount = Seconds * 60;
+		const int64 FrameDuration = recorder::TemplateVideoTimeBase / 60;
+		AVPacket* Packet = av_packet_alloc();
+		TArray<double> Latencies;
+		Latencies.Reserve(PacketCount);
+		int64 TotalBytes = 0;
+		const double WriteStartTime = FPlatformTime::Seconds();
+		for (int32 Index = 0; Index < PacketCount; ++Index)
+		{
+			Packet->data = Payload.GetData() + Random.RandHelper(Payload.Num() / 2);
+			Packet->size = Index % 60 == 0 ? Random.RandRange(200000, 400000) : Random.RandRange(15000, 30000);
+			Packet->pts = Packet->dts = Index * FrameDuration;
+			Packet->duration = FrameDuration;
+			Packet->flags = Index % 60 == 0 ? AV_PKT_FLAG_KEY : 0;
+			Packet->stream_index = 0;
+			const double StartTime = FPlatformTime::Seconds();
+			Replay->AddPacket(Packet);
+			Latencies.Add((FPlatformTime::Seconds() - StartTime) * 1000.0);
+			TotalBytes += Packet->size;
+		}
+		const double WriteSeconds = FPlatformTime::Seconds() - WriteStartTime;
+		av_packet_free(&Packet);
+
+		Latencies.Sort();
+		UE_LOG(LogRecorder, Display,
+		       TEXT("[Bench] ReplayBuffer %s %d MB: %.1f MB in %.2f ms (%.1f MB/s), AddPacket p50 %.4f ms p99 %.4f ms max %.4f ms, retained %.1f s"),
+		       Replay->IsMappedToDisk() ? TEXT("mapped") : TEXT("memory"), BufferMB, TotalBytes / 1048576.0,
+		       WriteSeconds * 1000.0, TotalBytes / 1048576.0 / WriteSeconds, Latencies[Latencies.Num() / 2],
+		       Latencies[FMath::Min(Latencies.Num() - 1, static_cast<int32>(Latencies.Num() * 0.99))], Latencies.Last(),
+		       Replay->GetRetainedSeconds())
+
+		// 导出最近 Seconds 秒，析构时等待后台写完
+		const double ExportStartTime = FPlatformTime::Seconds();
+		const bool bStarted = Replay->SaveReplay(ReplayPath, Seconds);
+		Replay.Reset();
+		const double ExportSeconds = FPlatformTime::Seconds() - ExportStartTime;
+		IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+		const int64 ExportedBytes = PlatformFile.FileSize(*ReplayPath);
+		UE_LOG(LogRecorder, Display, TEXT("[Bench] ReplayBuffer export: %.1f MB in %.2f ms%s"),
+		       ExportedBytes / 1048576.0, ExportSeconds * 1000.0,
+		       bStarted && ExportedBytes > 0 ? TEXT("") : TEXT(" (FAILED)"))
+		PlatformFile.DeleteFile(*ReplayPath);
+	}
+
+	static FAutoConsoleCommand CmdBenchReplayBuffer(
+		TEXT("rec.bench.ReplayBuffer"),
+		TEXT("Push a simulated 12 Mbps 60fps stream into the replay ring, report sustained write bandwidth and AddPacket latency, then time exporting the whole window to MP4. Usage: rec.bench.ReplayBuffer [BufferMB] [Seconds] [OnDisk]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchReplayBuffer));
+
+	void BenchOutputSinks(const TArray<FString>& Args)
+	{
+		const int32 PacketCount = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 3600;
+		const FString Dir = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir());
+		// 默认一路本地文件加一路发往本机的 UDP，UDP 不需要对端在监听
+		TArray<FString> Urls;
+		for (int32 Index = 1; Index < Args.Num(); ++Index)
+		{
+			Urls.Add(Args[Index]);
+		}
+		if (Urls.Num() == 0)
+		{
+			Urls.Add(Dir / TEXT("RecorderBench_sink.ts"));
+			Urls.Add(TEXT("udp://127.0.0.1:23000?pkt_size=1316"));
+		}
+
+		AVFormatContext* Template = nullptr;
+		avformat_alloc_output_context2(&Template, nullptr, "mpegts", nullptr);
+		AVStream* Stream = avformat_new_stream(Template, nullptr);
+		Stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+		Stream->codecpar->codec_id = AV_CODEC_ID_MPEG4;
+		Stream->codecpar->width = 1920;
+		Stream->codecpar->height = 1080;
+		Stream->time_base = {1, recorder::TemplateVideoTimeBase};
+
+		FRecorderConfig Config;
+		TArray<TUniquePtr<FOutputSink>> Sinks;
+		for (const FString& Url : Urls)
+		{
+			Sinks.Add_GetRef(MakeUnique<FOutputSink>(Config, Template, Url))->Start();
+		}
+
+		// 60fps、一秒一个关键帧，packet 用引用计数的缓存，和编码器产出的一样
+		FRandomStream Random(PacketCount);
+		const int64 FrameDuration = recorder::TemplateVideoTimeBase / 60;
+		AVPacket* Packet = av_packet_alloc();
+		TArray<double> Latencies;
+		Latencies.Reserve(PacketCount);
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Index = 0; Index < PacketCount; ++Index)
+		{
+			av_new_packet(Packet, Index % 60 == 0 ? Random.RandRange(150000, 300000) : Random.RandRange(8000, 24000));
+			Packet->pts = Packet->dts = Index * FrameDuration;
+			Packet->duration = FrameDuration;
+			Packet->flags = Index % 60 == 0 ? AV_PKT_FLAG_KEY : 0;
+			const double EnqueueStartTime = FPlatformTime::Seconds();
+			for (const TUniquePtr<FOutputSink>& Sink : Sinks)
+			{
+				Sink->Enqueue(Packet);
+			}
+			Latencies.Add((FPlatformTime::Seconds() - EnqueueStartTime) * 1000.0);
+			av_packet_unref(Packet);
+		}
+		av_packet_free(&Packet);
+
+		Latencies.Sort();
+		UE_LOG(LogRecorder, Display,
+		       TEXT("[Bench] OutputSinks %d outputs: %d packets in %.2f ms, fan-out p50 %.4f ms p99 %.4f ms max %.4f ms"),
+		       Sinks.Num(), PacketCount, (FPlatformTime::Seconds() - StartTime) * 1000.0, Latencies[Latencies.Num() / 2],
+		       Latencies[FMath::Min(Latencies.Num() - 1, static_cast<int32>(Latencies.Num() * 0.99))], Latencies.Last())
+		for (const TUniquePtr<FOutputSink>& Sink : Sinks)
+		{
+			Sink->Close();
+		}
+		avformat_free_context(Template);
+		if (Args.Num() <= 1)
+		{
+			FPlatformFileManager::Get().GetPlatformFile().DeleteFile(*Urls[0]);
+		}
+	}
+
+	static FAutoConsoleCommand CmdBenchOutputSinks(
+		TEXT("rec.bench.OutputSinks"),
+		TEXT("Fan a simulated 60fps packet stream out to several outputs (default: a local .ts file and UDP to localhost), report the per-packet fan-out cost on the mux thread and what each output dropped. Usage: rec.bench.OutputSinks [Packets] [Url...]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchOutputSinks));
+
+	/** 编码阶梯基准里的一路输出：一块 I420 缓存，以及可选的 H.264 编码器 */
+	struct FBenchRendition
+	{
+		FBenchRendition(int32 InWidth, int32 InHeight, int32 BitRate)
+			: Width(InWidth), Height(InHeight), Buffer(InWidth, InHeight)
+		{
+			const AVCodec* Codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+			Context = Codec ? avcodec_alloc_context3(Codec) : nullptr;
+			if (!Context)
+			{
+				return;
+			}
+			Context->width = Width;
+			Context->height = Height;
+			Context->pix_fmt = AV_PIX_FMT_YUV420P;
+			Context->time_base = {1, 60};
+			Context->framerate = {60, 1};
+			Context->bit_rate = BitRate;
+			Context->gop_size = 60;
+			Context->max_b_frames = 0;
+			// 单线程编码，测到的就是这一路的 CPU 时间
+			Context->thread_count = 1;
+			av_opt_set(Context->priv_data, "preset", "ultrafast", 0);
+			if (avcodec_open2(Context, Codec, nullptr) < 0)
+			{
+				avcodec_free_context(&Context);
+				return;
+			}
+			Frame = av_frame_alloc();
+			Packet = av_packet_alloc();
+		}
+
+		~FBenchRendition()
+		{
+			av_frame_free(&Frame);
+			av_packet_free(&Packet);
+			avcodec_free_context(&Context);
+		}
+
+		void Encode(int64 Pts)
+		{
+			if (!Context)
+			{
+				return;
+			}
+			Frame->width = Width;
+			Frame->height = Height;
+			Frame->format = AV_PIX_FMT_YUV420P;
+			Frame->data[0] = Buffer.Y.GetData();
+			Frame->data[1] = Buffer.U.GetData();
+			Frame->data[2] = Buffer.V.GetData();
+			Frame->linesize[0] = Buffer.StrideY;
+			Frame->linesize[1] = Buffer.StrideUV;
+			Frame->linesize[2] = Buffer.StrideUV;
+			Frame->pts = Pts;
+			avcodec_send_frame(Context, Frame);
+			while (avcodec_receive_packet(Context, Packet) >= 0)
+			{
+				av_packet_unref(Packet);
+			}
+		}
+
+		void ScaleFrom(const FI420Buffer& Source, int32 SourceWidth, int32 SourceHeight)
+		{
+			libyuv::I420Scale(Source.Y.GetData(), Source.StrideY,
+			                  Source.U.GetData(), Source.StrideUV,
+			                  Source.V.GetData(), Source.StrideUV,
+			                  SourceWidth, SourceHeight,
+			                  Buffer.Y.GetData(), Buffer.StrideY,
+			                  Buffer.U.GetData(), Buffer.StrideUV,
+			                  Buffer.V.GetData(), Buffer.StrideUV,
+			                  Width, Height, libyuv::kFilterBox);
+		}
+
+		int32 Width;
+		int32 Height;
+		FI420Buffer Buffer;
+		AVCodecContext* Context = nullptr;
+		AVFrame* Frame = nullptr;
+		AVPacket* Packet = nullptr;
+	};
+
+	/**
+	 * 1080p 主输出加 720p/480p 两档：编码阶梯只做一次颜色转换，各档从主输出的 I420 缩小；
+	 * 独立的录制器每一个都要从捕获的画面做一次颜色转换（低分辨率的再缩小）
+	 * 全部在当前线程串行执行，总耗时就是总的 CPU 时间
+	 */
+	void BenchRenditions(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 120;
+		constexpr int32 Width = 1920;
+		constexpr int32 Height = 1080;
+
+		TArray<uint32> Source;
+		Source.SetNumUninitialized(Width * Height);
+		FRandomStream Random(Width ^ Height);
+		for (uint32& Pixel : Source)
+		{
+			Pixel = static_cast<uint32>(Random.GetUnsignedInt());
+		}
+		const uint8* Src = reinterpret_cast<const uint8*>(Source.GetData());
+
+		const auto MakeOutputs = [](TArray<TUniquePtr<FBenchRendition>>& Outputs)
+		{
+			Outputs.Add(MakeUnique<FBenchRendition>(Width, Height, 12000000));
+			Outputs.Add(MakeUnique<FBenchRendition>(1280, 720, 4000000));
+			Outputs.Add(MakeUnique<FBenchRendition>(854, 480, 1500000));
+		};
+		TArray<TUniquePtr<FBenchRendition>> Ladder;
+		TArray<TUniquePtr<FBenchRendition>> Independent;
+		MakeOutputs(Ladder);
+		MakeOutputs(Independent);
+		// 独立录制器缩小之前要先有一份自己的全分辨率转换结果
+		TArray<TUniquePtr<FI420Buffer>> IndependentFull;
+		for (int32 Index = 1; Index < Independent.Num(); ++Index)
+		{
+			IndependentFull.Add(MakeUnique<FI420Buffer>(Width, Height));
+		}
+		const bool bEncode = Ladder[0]->Context != nullptr;
+
+		double LadderConvert = 0;
+		double LadderScale = 0;
+		double LadderEncode = 0;
+		double IndependentConvert = 0;
+		double IndependentScale = 0;
+		double IndependentEncode = 0;
+		for (int32 Frame = 0; Frame < Iterations; ++Frame)
+		{
+			double StartTime = FPlatformTime::Seconds();
+			recorder::ConvertA2B10G10R10ToI420(Src, Width * 4, Ladder[0]->Buffer.GetPlanes(), Width, Height);
+			LadderConvert += FPlatformTime::Seconds() - StartTime;
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Index = 1; Index < Ladder.Num(); ++Index)
+			{
+				Ladder[Index]->ScaleFrom(Ladder[0]->Buffer, Width, Height);
+			}
+			LadderScale += FPlatformTime::Seconds() - StartTime;
+			StartTime = FPlatformTime::Seconds();
+			for (const TUniquePtr<FBenchRendition>& Output : Ladder)
+			{
+				Output->Encode(Frame);
+			}
+			LadderEncode += FPlatformTime::Seconds() - StartTime;
+
+			StartTime = FPlatformTime::Seconds();
+			recorder::ConvertA2B10G10R10ToI420(Src, Width * 4, Independent[0]->Buffer.GetPlanes(), Width, Height);
+			for (const TUniquePtr<FI420Buffer>& Full : IndependentFull)
+			{
+				recorder::ConvertA2B10G10R10ToI420(Src, Width * 4, Full->GetPlanes(), Width, Height);
+			}
+			IndependentConvert += FPlatformTime::Seconds() - StartTime;
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Index = 1; Index < Independent.Num(); ++Index)
+			{
+				Independent[Index]->ScaleFrom(*IndependentFull[Index - 1], Width, Height);
+			}
+			IndependentScale += FPlatformTime::Seconds() - StartTime;
+			StartTime = FPlatformTime::Seconds();
+			for (const TUniquePtr<FBenchRendition>& Output : Independent)
+			{
+				Output->Encode(Frame);
+			}
+			IndependentEncode += FPlatformTime::Seconds() - StartTime;
+		}
+
+		const auto LogLayout = [Iterations](const TCHAR* Name, double Convert, double Scale, double Encode)
+		{
+			UE_LOG(LogRecorder, Display,
+			       TEXT("[Bench] Renditions %-12s %8.3f ms/frame CPU: convert %.3f, scale %.3f, encode %.3f"),
+			       Name, (Convert + Scale + Encode) * 1000.0 / Iterations, Convert * 1000.0 / Iterations,
+			       Scale * 1000.0 / Iterations, Encode * 1000.0 / Iterations)
+		};
+		LogLayout(TEXT("ladder"), LadderConvert, LadderScale, LadderEncode);
+		LogLayout(TEXT("independent"), IndependentConvert, IndependentScale, IndependentEncode);
+		if (!bEncode)
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("[Bench] Renditions: no H.264 encoder available, encode not measured"))
+		}
+	}
+
+	static FAutoConsoleCommand CmdBenchRenditions(
+		TEXT("rec.bench.Renditions"),
+		TEXT("Total CPU per frame of a 1080p + 720p + 480p ladder sharing one colour conversion vs three independent recorders each converting the capture. Usage: rec.bench.Renditions [Frames]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchRenditions));
+
+	/** 一帧 16bit 采样的 4:2:0 输出：I010 是三个平面，P010 是 Y 平面加 UV 交错的平面，行宽以字节为单位 */
+	struct FHighBitDepthBuffer
+	{
+		FHighBitDepthBuffer(int32 Width, int32 Height)
+			: ChromaWidth((Width + 1) / 2), ChromaHeight((Height + 1) / 2), StrideY(Width * 2)
+		{
+			Y.SetNumZeroed(Width * Height);
+			Chroma.SetNumZeroed(ChromaWidth * 2 * ChromaHeight);
+		}
+
+		recorder::FI420Planes GetI010Planes()
+		{
+			uint8* U = reinterpret_cast<uint8*>(Chroma.GetData());
+			uint8* V = reinterpret_cast<uint8*>(Chroma.GetData() + ChromaWidth * ChromaHeight);
+			return {reinterpret_cast<uint8*>(Y.GetData()), StrideY, U, ChromaWidth * 2, V, ChromaWidth * 2};
+		}
+
+		recorder::FNV12Planes GetP010Planes()
+		{
+			return {reinterpret_cast<uint8*>(Y.GetData()), StrideY, reinterpret_cast<uint8*>(Chroma.GetData()), ChromaWidth * 4};
+		}
+
+		/** 同样布局的两帧逐个采样比较 */
+		int32 CountMismatches(const FHighBitDepthBuffer& Other) const
+		{
+			int32 Mismatches = 0;
+			for (int32 Index = 0; Index < Y.Num(); ++Index)
+			{
+				Mismatches += Y[Index] != Other.Y[Index];
+			}
+			for (int32 Index = 0; Index < Chroma.Num(); ++Index)
+			{
+				Mismatches += Chroma[Index] != Other.Chroma[Index];
+			}
+			return Mismatches;
+		}
+
+		/** 这一帧按 P010 排列，与 I010 排列的 Other 比较：值应该正好是 Other 左移 6 位 */
+		int32 CountP010Mismatches(const FHighBitDepthBuffer& I010) const
+		{
+			int32 Mismatches = 0;
+			for (int32 Index = 0; Index < Y.Num(); ++Index)
+			{
+				Mismatches += Y[Index] != static_cast<uint16>(I010.Y[Index] << 6);
+			}
+			const int32 ChromaSize = ChromaWidth * ChromaHeight;
+			for (int32 Index = 0; Index < ChromaSize; ++Index)
+			{
+				Mismatches += Chroma[Index * 2] != static_cast<uint16>(I010.Chroma[Index] << 6);
+				Mismatches += Chroma[Index * 2 + 1] != static_cast<uint16>(I010.Chroma[ChromaSize + Index] << 6);
+			}
+			return Mismatches;
+		}
+
+		int32 ChromaWidth;
+		int32 ChromaHeight;
+		int32 StrideY;
+		TArray<uint16> Y;
+		TArray<uint16> Chroma;
+	};
+
+	/** ultrafast、单线程把同一帧编码 Frames 次，返回总耗时；编码器打不开这个格式时返回负数 */
+	double MeasureEncode(const AVCodec* Codec, AVPixelFormat Format, int32 Width, int32 Height,
+	                     uint8* const Data[3], const int32 Linesize[3], int32 Frames)
+	{
+		AVCodecContext* Context = avcodec_alloc_context3(Codec);
+		AVFrame* Frame = av_frame_alloc();
+		AVPacket* Packet = av_packet_alloc();
+		double Seconds = -1;
+		Context->width = Width;
+		Context->height = Height;
+		Context->pix_fmt = Format;
+		Context->time_base = {1, 60};
+		Context->framerate = {60, 1};
+		Context->bit_rate = 12000000;
+		Context->gop_size = 60;
+		Context->max_b_frames = 0;
+		Context->thread_count = 1;
+		av_opt_set(Context->priv_data, "preset", "ultrafast", 0);
+		if (avcodec_open2(Context, Codec, nullptr) >= 0)
+		{
+			Frame->width = Width;
+			Frame->height = Height;
+			Frame->format = Format;
+			for (int32 Plane = 0; Plane < 3; ++Plane)
+			{
+				Frame->data[Plane] = Data[Plane];
+				Frame->linesize[Plane] = Linesize[Plane];
+			}
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Index = 0; Index <= Frames; ++Index)
+			{
+				// 最后一次送空帧冲刷编码器，延迟输出的帧也算在里面
+				Frame->pts = Index;
+				avcodec_send_frame(Context, Index < Frames ? Frame : nullptr);
+				while (avcodec_receive_packet(Context, Packet) >= 0)
+				{
+					av_packet_unref(Packet);
+				}
+			}
+			Seconds = FPlatformTime::Seconds() - StartTime;
+		}
+		av_packet_free(&Packet);
+		av_frame_free(&Frame);
+		avcodec_free_context(&Context);
+		return Seconds;
+	}
+
+	/**
+	 * 10bit 编码的代价：10bit 转换核与标量实现对比，10bit 源转换到 I420 / I010 / P010 的耗时，
+	 * 8bit 源转换成 I420 再扩展的耗时，以及同一个编码器 8bit 和 10bit 输入的编码耗时
+	 */
+	void BenchHighBitDepth(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 100;
+		const int32 EncodeFrames = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 60;
+		constexpr int32 Width = 1920;
+		constexpr int32 Height = 1080;
+
+		TArray<uint32> Source;
+		Source.SetNumUninitialized(Width * Height);
+		FRandomStream Random(Width ^ Height);
+		for (uint32& Pixel : Source)
+		{
+			Pixel = static_cast<uint32>(Random.GetUnsignedInt());
+		}
+		const uint8* Src = reinterpret_cast<const uint8*>(Source.GetData());
+		const int32 SrcStride = Width * 4;
+
+		// 奇数尺寸覆盖每行和最后一行的尾部处理
+		for (const FIntPoint Size : {FIntPoint(Width, Height), FIntPoint(Width - 3, Height - 1)})
+		{
+			FHighBitDepthBuffer Reference(Size.X, Size.Y);
+			FHighBitDepthBuffer I010(Size.X, Size.Y);
+			FHighBitDepthBuffer P010Reference(Size.X, Size.Y);
+			FHighBitDepthBuffer P010(Size.X, Size.Y);
+			recorder::ConvertA2B10G10R10ToI010_Scalar(Src, SrcStride, Reference.GetI010Planes(), Size.X, Size.Y);
+			recorder::ConvertA2B10G10R10ToI010(Src, SrcStride, I010.GetI010Planes(), Size.X, Size.Y);
+			recorder::ConvertA2B10G10R10ToP010_Scalar(Src, SrcStride, P010Reference.GetP010Planes(), Size.X, Size.Y);
+			recorder::ConvertA2B10G10R10ToP010(Src, SrcStride, P010.GetP010Planes(), Size.X, Size.Y);
+			const int32 I010Mismatches = I010.CountMismatches(Reference);
+			const int32 P010Mismatches = P010.CountMismatches(P010Reference);
+			const int32 LayoutMismatches = P010.CountP010Mismatches(Reference);
+			UE_LOG(LogRecorder, Display,
+			       TEXT("[Bench] HighBitDepth %dx%d: %s vs scalar I010 %d, P010 %d mismatched samples, P010 vs I010 %d%s"),
+			       Size.X, Size.Y, recorder::GetPixelConvertImplementationName(), I010Mismatches, P010Mismatches,
+			       LayoutMismatches, I010Mismatches || P010Mismatches || LayoutMismatches ? TEXT(" (FAILED)") : TEXT(""))
+		}
+
+		FI420Buffer I420(Width, Height);
+		FHighBitDepthBuffer I010(Width, Height);
+		FHighBitDepthBuffer P010(Width, Height);
+		LogResult(TEXT("10bit->I420"), MeasureFrames(Iterations, [&]()
+		{
+			recorder::ConvertA2B10G10R10ToI420(Src, SrcStride, I420.GetPlanes(), Width, Height);
+		}), Iterations);
+		LogResult(TEXT("10bit->I010"), MeasureFrames(Iterations, [&]()
+		{
+			recorder::ConvertA2B10G10R10ToI010(Src, SrcStride, I010.GetI010Planes(), Width, Height);
+		}), Iterations);
+		LogResult(TEXT("10bit->P010"), MeasureFrames(Iterations, [&]()
+		{
+			recorder::ConvertA2B10G10R10ToP010(Src, SrcStride, P010.GetP010Planes(), Width, Height);
+		}), Iterations);
+		// 8bit 的后台缓冲在 10bit 编码时的路径，随机数据当作 ABGR 使用
+		LogResult(TEXT("ABGR->I420->P010"), MeasureFrames(Iterations, [&]()
+		{
+			libyuv::ABGRToI420(Src, SrcStride, I420.Y.GetData(), I420.StrideY, I420.U.GetData(), I420.StrideUV,
+			                   I420.V.GetData(), I420.StrideUV, Width, Height);
+			recorder::WidenI420ToP010(I420.GetPlanes(), P010.GetP010Planes(), Width, Height);
+		}), Iterations);
+
+		// 与 FAVEncoder 选择编码器的顺序一致：H.264 接受 10bit 时用 H.264，否则用 HEVC
+		const auto Supports = [](const AVCodec* Codec, AVPixelFormat Format)
+		{
+			for (const AVPixelFormat* Supported = Codec && Codec->pix_fmts ? Codec->pix_fmts : nullptr;
+			     Supported && *Supported != AV_PIX_FMT_NONE; ++Supported)
+			{
+				if (*Supported == Format)
+				{
+					return true;
+				}
+			}
+			return false;
+		};
+		const AVCodec* Codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+		if (!Supports(Codec, AV_PIX_FMT_YUV420P10))
+		{
+			Codec = avcodec_find_encoder(AV_CODEC_ID_HEVC);
+		}
+		if (!Supports(Codec, AV_PIX_FMT_YUV420P10) || !Supports(Codec, AV_PIX_FMT_YUV420P))
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("[Bench] HighBitDepth: no encoder with both 8-bit and 10-bit input, encode not measured"))
+			return;
+		}
+		uint8* const Data8[3] = {I420.Y.GetData(), I420.U.GetData(), I420.V.GetData()};
+		const int32 Linesize8[3] = {I420.StrideY, I420.StrideUV, I420.StrideUV};
+		const recorder::FI420Planes Planes10 = I010.GetI010Planes();
+		uint8* const Data10[3] = {Planes10.Y, Planes10.U, Planes10.V};
+		const int32 Linesize10[3] = {Planes10.StrideY, Planes10.StrideU, Planes10.StrideV};
+		recorder::ConvertA2B10G10R10ToI420(Src, SrcStride, I420.GetPlanes(), Width, Height);
+		recorder::ConvertA2B10G10R10ToI010(Src, SrcStride, I010.GetI010Planes(), Width, Height);
+		const auto LogEncode = [Codec, EncodeFrames](const TCHAR* Format, double Seconds)
+		{
+			const FString Name = FString::Printf(TEXT("%s %s"), UTF8_TO_TCHAR(Codec->name), Format);
+			if (Seconds < 0)
+			{
+				UE_LOG(LogRecorder, Warning, TEXT("[Bench] HighBitDepth: can not open %s"), *Name)
+				return;
+			}
+			LogResult(*Name, Seconds, EncodeFrames);
+		};
+		LogEncode(TEXT("yuv420p"),
+		          MeasureEncode(Codec, AV_PIX_FMT_YUV420P, Width, Height, Data8, Linesize8, EncodeFrames));
+		LogEncode(TEXT("yuv420p10le"),
+		          MeasureEncode(Codec, AV_PIX_FMT_YUV420P10, Width, Height, Data10, Linesize10, EncodeFrames));
+	}
+
+	static FAutoConsoleCommand CmdBenchHighBitDepth(
+		TEXT("rec.bench.HighBitDepth"),
+		TEXT("Check the 10-bit I010/P010 kernels against the scalar reference, time 1080p conversion to I420 vs I010 vs P010, and encode cost of 8-bit vs 10-bit input on the same encoder. Usage: rec.bench.HighBitDepth [Iterations] [EncodeFrames]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchHighBitDepth));
+
+	/** 会动的合成画面：水平渐变上叠一个随帧号移动的亮块，既有平坦区域又有运动 */
+	void FillTestPattern(FI420Buffer& Buffer, int32 Width, int32 Height, int32 FrameIndex)
+	{
+		const int32 BlockSize = Height / 4;
+		const int32 BlockX = FrameIndex * 8 % FMath::Max(1, Width - BlockSize);
+		const int32 BlockY = FrameIndex * 4 % FMath::Max(1, Height - BlockSize);
+		for (int32 Y = 0; Y < Height; ++Y)
+		{
+			uint8* Row = Buffer.Y.GetData() + Y * Buffer.StrideY;
+			for (int32 X = 0; X < Width; ++X)
+			{
+				const bool bBlock = X >= BlockX && X < BlockX + BlockSize && Y >= BlockY && Y < BlockY + BlockSize;
+				Row[X] = bBlock ? 235 : static_cast<uint8>(16 + (X + Y) * 219 / (Width + Height));
+			}
+		}
+		for (int32 Y = 0; Y < (Height + 1) / 2; ++Y)
+		{
+			for (int32 X = 0; X < Buffer.StrideUV; ++X)
+			{
+				Buffer.U[Y * Buffer.StrideUV + X] = static_cast<uint8>(64 + X * 128 / Buffer.StrideUV);
+				Buffer.V[Y * Buffer.StrideUV + X] = static_cast<uint8>(192 - Y * 128 / ((Height + 1) / 2));
+			}
+		}
+	}
+
+	/** Y 平面的 PSNR（dB），完全相同时返回 100 */
+	double ComputeLumaPSNR(const FI420Buffer& Reference, const AVFrame* Decoded, int32 Width, int32 Height)
+	{
+		uint64 SquaredError = 0;
+		for (int32 Y = 0; Y < Height; ++Y)
+		{
+			const uint8* RefRow = Reference.Y.GetData() + Y * Reference.StrideY;
+			const uint8* DecodedRow = Decoded->data[0] + Y * Decoded->linesize[0];
+			for (int32 X = 0; X < Width; ++X)
+			{
+				const int32 Diff = RefRow[X] - DecodedRow[X];
+				SquaredError += Diff * Diff;
+			}
+		}
+		if (SquaredError == 0)
+		{
+			return 100;
+		}
+		const double MeanSquaredError = static_cast<double>(SquaredError) / (static_cast<double>(Width) * Height);
+		return 10 * FMath::LogX(10.0, 255.0 * 255.0 / MeanSquaredError);
+	}
+
+	/**
+	 * 用后端自己的设置编码 Frames 帧合成画面，检查所有后端都必须满足的约定并测吞吐：
+	 * 第一个 packet 是关键帧、dts 严格递增且不超过 pts、解码出来的帧数与送进去的一样、画面没有错位（Y 的 PSNR 不太低），
+	 * 同时报告编码耗时、码率，第一个 packet 出来之前送进去的帧数与后端声明的延迟，以及每一帧从送进去到出 packet 的时间
+	 */
+	void BenchVideoEncoder(const IVideoEncoderBackend& Backend, int32 Width, int32 Height, int32 Frames, bool bLowLatency)
+	{
+		const AVCodec* Codec = Backend.FindCodec();
+		if (!Codec)
+		{
+			UE_LOG(LogRecorder, Display, TEXT("[Bench] VideoEncoders %s: not built into FFmpeg, skipped"), Backend.GetName())
+			return;
+		}
+		FRecorderConfig Config;
+		Config.FrameRate = 60;
+		Config.VideoBitRate = 6000000;
+		Config.bLowLatency = bLowLatency;
+		AVCodecContext* Encoder = Backend.AllocContext(Codec, Config, AV_PIX_FMT_YUV420P, {Width, Height});
+		if (!Encoder || avcodec_open2(Encoder, Codec, nullptr) < 0)
+		{
+			UE_LOG(LogRecorder, Error, TEXT("[Bench] VideoEncoders %s: can not open the encoder (FAILED)"), Backend.GetName())
+			avcodec_free_context(&Encoder);
+			return;
+		}
+		// 没有对应解码器的 FFmpeg 只检查码流本身
+		const AVCodec* DecoderCodec = avcodec_find_decoder(Codec->id);
+		AVCodecContext* Decoder = DecoderCodec ? avcodec_alloc_context3(DecoderCodec) : nullptr;
+		if (Decoder && avcodec_open2(Decoder, DecoderCodec, nullptr) < 0)
+		{
+			avcodec_free_context(&Decoder);
+		}
+
+		FI420Buffer Source(Width, Height);
+		FI420Buffer Reference(Width, Height);
+		AVFrame* Frame = av_frame_alloc();
+		AVFrame* DecodedFrame = av_frame_alloc();
+		AVPacket* Packet = av_packet_alloc();
+		Frame->width = Width;
+		Frame->height = Height;
+		Frame->format = AV_PIX_FMT_YUV420P;
+		Frame->data[0] = Source.Y.GetData();
+		Frame->data[1] = Source.U.GetData();
+		Frame->data[2] = Source.V.GetData();
+		Frame->linesize[0] = Source.StrideY;
+		Frame->linesize[1] = Source.StrideUV;
+		Frame->linesize[2] = Source.StrideUV;
+
+		int32 SentFrames = 0;
+		int32 FramesBeforeFirstPacket = -1;
+		int32 PacketCount = 0;
+		int32 DecodedCount = 0;
+		int64 TotalBytes = 0;
+		int64 LastDts = AV_NOPTS_VALUE;
+		bool bFirstPacketKey = false;
+		bool bTimestampsValid = true;
+		double PSNRSum = 0;
+		double EncodeSeconds = 0;
+		// 与录制时一样按送进去的顺序和 packet 一一对应
+		TArray<uint64> SendCycles;
+		TArray<double> PacketLatencies;
+		SendCycles.Reserve(Frames);
+		PacketLatencies.Reserve(Frames);
+
+		const auto ReceiveDecoded = [&]()
+		{
+			while (avcodec_receive_frame(Decoder, DecodedFrame) >= 0)
+			{
+				// 输出按显示顺序，帧号就是 pts
+				FillTestPattern(Reference, Width, Height, static_cast<int32>(DecodedFrame->pts));
+				PSNRSum += ComputeLumaPSNR(Reference, DecodedFrame, Width, Height);
+				++DecodedCount;
+				av_frame_unref(DecodedFrame);
+			}
+		};
+		const auto ReceivePackets = [&]()
+		{
+			for (;;)
+			{
+				const double StartTime = FPlatformTime::Seconds();
+				const int Result = avcodec_receive_packet(Encoder, Packet);
+				EncodeSeconds += FPlatformTime::Seconds() - StartTime;
+				if (Result < 0)
+				{
+					return;
+				}
+				if (PacketLatencies.Num() < SendCycles.Num())
+				{
+					PacketLatencies.Add(FPlatformTime::ToMilliseconds64(
+						FPlatformTime::Cycles64() - SendCycles[PacketLatencies.Num()]));
+				}
+				if (PacketCount++ == 0)
+				{
+					FramesBeforeFirstPacket = SentFrames - 1;
+					bFirstPacketKey = (Packet->flags & AV_PKT_FLAG_KEY) != 0;
+				}
+				bTimestampsValid &= Packet->pts != AV_NOPTS_VALUE && Packet->dts != AV_NOPTS_VALUE
+					&& Packet->dts <= Packet->pts && (LastDts == AV_NOPTS_VALUE || Packet->dts > LastDts);
+				LastDts = Packet->dts;
+				TotalBytes += Packet->size;
+				if (Decoder && avcodec_send_packet(Decoder, Packet) >= 0)
+				{
+					ReceiveDecoded();
+				}
+				av_packet_unref(Packet);
+			}
+		};
+
+		while (SentFrames < Frames)
+		{
+			FillTestPattern(Source, Width, Height, SentFrames);
+			Frame->pts = SentFrames;
+			SendCycles.Add(FPlatformTime::Cycles64());
+			const double StartTime = FPlatformTime::Seconds();
+			avcodec_send_frame(Encoder, Frame);
+			EncodeSeconds += FPlatformTime::Seconds() - StartTime;
+			++SentFrames;
+			ReceivePackets();
+		}
+		avcodec_send_frame(Encoder, nullptr);
+		ReceivePackets();
+		if (Decoder)
+		{
+			avcodec_send_packet(Decoder, nullptr);
+			ReceiveDecoded();
+		}
+
+		const bool bDecodedAll = !Decoder || DecodedCount == Frames;
+		const double MeanPSNR = DecodedCount > 0 ? PSNRSum / DecodedCount : 0;
+		// 错位或者格式搞错的画面 PSNR 一般在 15dB 以下
+		const bool bPictureValid = !Decoder || MeanPSNR > 25;
+		const bool bPassed = bFirstPacketKey && bTimestampsValid && bDecodedAll && bPictureValid;
+		static const TCHAR* ThreadingNames[] = {TEXT("frame"), TEXT("slice"), TEXT("internal")};
+		const FVideoEncoderTraits& Traits = Backend.GetTraits(bLowLatency);
+		PacketLatencies.Sort();
+		const auto Percentile = [&PacketLatencies](double P)
+		{
+			return PacketLatencies.Num() > 0
+				       ? PacketLatencies[FMath::Min(PacketLatencies.Num() - 1, static_cast<int32>(PacketLatencies.Num() * P))]
+				       : 0.0;
+		};
+		UE_LOG(LogRecorder, Display,
+		       TEXT("[Bench] VideoEncoders %-12s %dx%d%s: %7.2f fps, %6.0f kbps, Y PSNR %5.2f dB, delay %d frames (declared %d, %s threads), ")
+		       TEXT("send to packet p50 %.2f ms p99 %.2f ms, keyframe first %d, timestamps %d, decoded %d/%d%s"),
+		       Backend.GetName(), Width, Height, bLowLatency ? TEXT(" low latency") : TEXT(""),
+		       EncodeSeconds > 0 ? Frames / EncodeSeconds : 0,
+		       TotalBytes * 8.0 * Config.FrameRate / FMath::Max(1, Frames) / 1000.0, MeanPSNR, FramesBeforeFirstPacket,
+		       Traits.DelayFrames, ThreadingNames[static_cast<int32>(Traits.Threading)], Percentile(0.5),
+		       Percentile(0.99), bFirstPacketKey, bTimestampsValid, DecodedCount, Decoder ? Frames : 0,
+		       bPassed ? TEXT("") : TEXT(" (FAILED)"))
+
+		av_packet_free(&Packet);
+		av_frame_free(&DecodedFrame);
+		av_frame_free(&Frame);
+		avcodec_free_context(&Decoder);
+		avcodec_free_context(&Encoder);
+	}
+
+	/** 所有软件编码器后端共用的一致性检查和吞吐基准，编译进 FFmpeg 的后端都会跑一遍 */
+	void BenchVideoEncoders(const TArray<FString>& Args)
+	{
+		const int32 Frames = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 120;
+		const int32 Width = Args.Num() > 1 ? FCString::Atoi(*Args[1]) & ~1 : 1280;
+		const int32 Height = Args.Num() > 2 ? FCString::Atoi(*Args[2]) & ~1 : 720;
+		const bool bLowLatency = Args.Num() > 3 && FCString::Atoi(*Args[3]) != 0;
+		for (const IVideoEncoderBackend* Backend : recorder::GetVideoEncoderBackends())
+		{
+			BenchVideoEncoder(*Backend, Width, Height, Frames, bLowLatency);
+		}
+	}
+
+	static FAutoConsoleCommand CmdBenchVideoEncoders(
+		TEXT("rec.bench.VideoEncoders"),
+		TEXT("Run every software video encoder backend built into FFmpeg through the same conformance checks (keyframe first, monotonic dts, every frame decodes, picture intact) and report fps, bitrate, luma PSNR, delay and send-to-packet p50/p99. LowLatency=1 uses the low-latency profile. Usage: rec.bench.VideoEncoders [Frames] [Width] [Height] [LowLatency]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchVideoEncoders));
+}
+
+#endif
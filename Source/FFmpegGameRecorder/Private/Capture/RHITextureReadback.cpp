@@ -10,7 +10,9 @@ namespace recorder
 	FRHIGPUTextureReadback::FRHIGPUTextureReadback(FName RequestName, FIntPoint Resolution): Resolution(Resolution)
 		, CapturedTime(0)
 		, CapturedDuration(0)
+		, CapturedCycles(0)
 		, CaptureStatus(ECaptureStatus::Idle)
+		, LendReleased(MakeShared<std::atomic_bool, ESPMode::ThreadSafe>(true))
 	{
 		Fence = RHICreateGPUFence(RequestName);
 	}
@@ -123,5 +125,28 @@ namespace recorder
 		CaptureStatus = ECaptureStatus::Idle;
 		CapturedTime = 0;
 		CapturedDuration = 0;
+		CapturedCycles = 0;
+	}
+
+	FMappedFrameViewPtr FRHIGPUTextureReadback::Lend()
+	{
+		check(CaptureStatus == ECaptureStatus::Captured);
+		LendReleased->store(false, std::memory_order_relaxed);
+		CaptureStatus = ECaptureStatus::Encoding;
+		return MakeShared<FMappedFrameView, ESPMode::ThreadSafe>(LendReleased);
+	}
+
+	bool FRHIGPUTextureReadback::TryReclaim()
+	{
+		if (CaptureStatus != ECaptureStatus::Encoding)
+		{
+			return CaptureStatus == ECaptureStatus::Idle;
+		}
+		if (!LendReleased->load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		Unlock();
+		return true;
 	}
 };
@@ -1,6 +1,315 @@
 ﻿
 #include "Capture/RecorderConfig.h"
 
+static TAutoConsoleVariable<int32> CVarVideoQueueDepth(
+	TEXT("rec.VideoQueueDepth"), 6,
+	TEXT("Max number of captured video frames waiting for the encoder."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarVideoQueuePolicy(
+	TEXT("rec.VideoQueuePolicy"), static_cast<int32>(ERecorderQueuePolicy::DropNewest),
+	TEXT("What to do when the video queue is full.\n")
+	TEXT(" 0: drop the newest frame\n")
+	TEXT(" 1: drop the oldest queued frame\n")
+	TEXT(" 2: block the render thread (offline capture)\n")
+	TEXT(" 3: drop pixels and repeat the last encoded frame"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarColorConvertWorkers(
+	TEXT("rec.ColorConvertWorkers"), 0,
+	TEXT("Number of threads used for RGB -> YUV conversion. 0: pick from the core count, 1: convert on the encoder thread only."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarFileWriteBufferSizeKB(
+	TEXT("rec.FileWriteBufferKB"), 4096,
+	TEXT("Size in KB of each write-behind buffer used for local output files. 0: let FFmpeg open the file with avio_open."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarPreallocateFileSizeMB(
+	TEXT("rec.PreallocateFileMB"), 0,
+	TEXT("Disk space in MB reserved for the output file when recording starts (Linux only). 0: no preallocation."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<bool> CVarFragmentedMP4(
+	TEXT("rec.FragmentedMP4"), false,
+	TEXT("Write MP4 output as fragments (empty moov, one fragment per keyframe) so a crash keeps everything up to the last fragment and stopping does not write a full sample table."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarMaxFragmentDurationMs(
+	TEXT("rec.MaxFragmentDurationMs"), 2000,
+	TEXT("Upper bound in milliseconds on the length of one fragment when rec.FragmentedMP4 is on."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarSegmentDurationSec(
+	TEXT("rec.SegmentDurationSec"), 0,
+	TEXT("Start a new output file at the next video keyframe after this many seconds. 0: no time-based segmentation."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarSegmentSizeMB(
+	TEXT("rec.SegmentSizeMB"), 0,
+	TEXT("Start a new output file at the next video keyframe after this many MB. 0: no size-based segmentation."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<bool> CVarWriteHLSPlaylist(
+	TEXT("rec.WriteHLSPlaylist"), false,
+	TEXT("When segmenting, write .ts segments and an HLS .m3u8 playlist next to them."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarMaxSegmentCount(
+	TEXT("rec.MaxSegmentCount"), 0,
+	TEXT("When segmenting, keep at most this many finished segments on disk and delete older ones. 0: keep all."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarReplayBufferMB(
+	TEXT("rec.ReplayBufferMB"), 0,
+	TEXT("Keep encoded packets in an in-memory ring of this many MB instead of writing a file; SaveReplay exports the last seconds to MP4. 0: off."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<bool> CVarReplayBufferOnDisk(
+	TEXT("rec.ReplayBufferOnDisk"), false,
+	TEXT("Back the replay ring with a preallocated memory-mapped file next to the output path instead of process memory, for long replay windows."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarAdditionalOutputs(
+	TEXT("rec.AdditionalOutputs"), TEXT(""),
+	TEXT("Semicolon-separated outputs written in addition to the main file from the same encoder, e.g. \"rtmp://host/app/key;udp://127.0.0.1:1234\". A slow output only drops its own packets."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarOutputResolution(
+	TEXT("rec.OutputResolution"), TEXT(""),
+	TEXT("Encoded resolution as WxH, e.g. \"1920x1080\". Empty: encode at the capture size. Frames are resized with libyuv before the encoder."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarScaleFilter(
+	TEXT("rec.ScaleFilter"), static_cast<int32>(ERecorderScaleFilter::Box),
+	TEXT("Filter used to resize to the output resolution and the renditions.\n")
+	TEXT(" 0: point sampling\n")
+	TEXT(" 1: horizontal linear\n")
+	TEXT(" 2: bilinear\n")
+	TEXT(" 3: box (area average when downscaling)"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<bool> CVarPreferNV12(
+	TEXT("rec.PreferNV12"), true,
+	TEXT("Convert captured frames straight to NV12 when the video encoder accepts it, instead of planar I420."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<bool> CVarHighBitDepth(
+	TEXT("rec.HighBitDepth"), false,
+	TEXT("Encode 10-bit: convert the 10-bit back buffer straight to P010/yuv420p10le and use H.264 High 10, or HEVC Main 10 when the H.264 encoder has no 10-bit input. Falls back to 8-bit when neither is available."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarVideoCodec(
+	TEXT("rec.VideoCodec"), static_cast<int32>(ERecorderVideoCodec::X264),
+	TEXT("Software video encoder, ignored with hardware encoding. Falls back to the first available one that the output format can hold.\n")
+	TEXT(" 0: libx264\n")
+	TEXT(" 1: libopenh264\n")
+	TEXT(" 2: libx265\n")
+	TEXT(" 3: libvpx-vp9 (realtime)\n")
+	TEXT(" 4: libsvtav1"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarVideoPreset(
+	TEXT("rec.VideoPreset"), TEXT("ultrafast"),
+	TEXT("Preset of the main output, named like x264 presets; VP9 and SVT-AV1 map it to their own speed levels."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<bool> CVarLowLatency(
+	TEXT("rec.LowLatency"), false,
+	TEXT("Low-latency profile for streaming: no B-frames or lookahead, zerolatency tuning with slice threads, and a VBV capped to rec.LowLatencyVBVMs of bitrate."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLowLatencyVBVMs(
+	TEXT("rec.LowLatencyVBVMs"), 250,
+	TEXT("VBV buffer size in milliseconds of bitrate in the low-latency profile. Never less than one frame."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarLatencyCsv(
+	TEXT("rec.LatencyCsv"), TEXT(""),
+	TEXT("When recording stops, write the capture-to-packet latency of every frame to this CSV. Empty: only log p50/p99."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarSessionReport(
+	TEXT("rec.SessionReport"), TEXT(""),
+	TEXT("When recording stops, write per-stage latency percentiles, queue high-water marks, drops and bytes written to this file.\n")
+	TEXT("A .csv extension writes CSV, anything else JSON. Empty: no report."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarRenditions(
+	TEXT("rec.Renditions"), TEXT(""),
+	TEXT("Semicolon-separated lower-resolution renditions encoded alongside the main output from the same converted frame, each as WxH@kbps[:preset][=path], e.g. \"1280x720@4000:veryfast;854x480@1500\"."),
+	ECVF_Default);
+
+/** 控制台变量被显式设置过（ini、命令行或控制台）才覆盖配置，否则保留 FRecorderConfig 里已有的值 */
+template <typename T>
+static bool IsSet(const TAutoConsoleVariable<T>& Variable)
+{
+	return (Variable.AsVariable()->GetFlags() & ECVF_SetByMask) > ECVF_SetByConstructor;
+}
+
+/** 解析 rec.Renditions 中的一档：WxH@kbps[:preset][=path] */
+static bool ParseRendition(const FString& Text, FRecorderRendition& OutRendition)
+{
+	FString Spec = Text.TrimStartAndEnd();
+	FString Path;
+	if (Spec.Split(TEXT("="), &Spec, &Path))
+	{
+		OutRendition.SaveFilePath = Path.TrimStartAndEnd();
+	}
+	FString Preset;
+	if (Spec.Split(TEXT(":"), &Spec, &Preset))
+	{
+		OutRendition.Preset = Preset.TrimStartAndEnd();
+	}
+	FString Size;
+	FString BitRate;
+	FString Width;
+	FString Height;
+	if (!Spec.Split(TEXT("@"), &Size, &BitRate) || !Size.Split(TEXT("x"), &Width, &Height))
+	{
+		return false;
+	}
+	// 4:2:0 的宽高必须是偶数
+	OutRendition.Resolution = {FCString::Atoi(*Width) & ~1, FCString::Atoi(*Height) & ~1};
+	OutRendition.VideoBitRate = FCString::Atoi(*BitRate) * 1000;
+	return OutRendition.Resolution.X > 0 && OutRendition.Resolution.Y > 0 && OutRendition.VideoBitRate > 0;
+}
+
+void FRecorderConfig::LoadConsoleVariables()
+{
+	if (IsSet(CVarVideoQueueDepth))
+	{
+		MaxVideoQueueDepth = FMath::Max(1, CVarVideoQueueDepth.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarVideoQueuePolicy))
+	{
+		VideoQueuePolicy = static_cast<ERecorderQueuePolicy>(
+			FMath::Clamp(CVarVideoQueuePolicy.GetValueOnAnyThread(), 0,
+			             static_cast<int32>(ERecorderQueuePolicy::DuplicateLast)));
+	}
+	if (IsSet(CVarColorConvertWorkers))
+	{
+		ColorConvertWorkers = FMath::Max(0, CVarColorConvertWorkers.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarFileWriteBufferSizeKB))
+	{
+		FileWriteBufferSizeKB = FMath::Max(0, CVarFileWriteBufferSizeKB.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarPreallocateFileSizeMB))
+	{
+		PreallocateFileSizeMB = FMath::Max(0, CVarPreallocateFileSizeMB.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarFragmentedMP4))
+	{
+		bFragmentedMP4 = CVarFragmentedMP4.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarMaxFragmentDurationMs))
+	{
+		MaxFragmentDurationMs = FMath::Max(0, CVarMaxFragmentDurationMs.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarSegmentDurationSec))
+	{
+		SegmentDurationSec = FMath::Max(0, CVarSegmentDurationSec.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarSegmentSizeMB))
+	{
+		SegmentSizeMB = FMath::Max(0, CVarSegmentSizeMB.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarWriteHLSPlaylist))
+	{
+		bWriteHLSPlaylist = CVarWriteHLSPlaylist.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarMaxSegmentCount))
+	{
+		MaxSegmentCount = FMath::Max(0, CVarMaxSegmentCount.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarReplayBufferMB))
+	{
+		ReplayBufferMB = FMath::Max(0, CVarReplayBufferMB.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarReplayBufferOnDisk))
+	{
+		bReplayBufferOnDisk = CVarReplayBufferOnDisk.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarAdditionalOutputs))
+	{
+		CVarAdditionalOutputs.GetValueOnAnyThread().ParseIntoArray(AdditionalOutputs, TEXT(";"));
+	}
+	if (IsSet(CVarVideoCodec))
+	{
+		VideoCodec = static_cast<ERecorderVideoCodec>(
+			FMath::Clamp(CVarVideoCodec.GetValueOnAnyThread(), 0, static_cast<int32>(ERecorderVideoCodec::SVTAV1)));
+	}
+	if (IsSet(CVarVideoPreset))
+	{
+		VideoPreset = CVarVideoPreset.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarPreferNV12))
+	{
+		bPreferNV12 = CVarPreferNV12.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarHighBitDepth))
+	{
+		bHighBitDepth = CVarHighBitDepth.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarLowLatency))
+	{
+		bLowLatency = CVarLowLatency.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarLowLatencyVBVMs))
+	{
+		LowLatencyVBVMs = FMath::Max(0, CVarLowLatencyVBVMs.GetValueOnAnyThread());
+	}
+	if (IsSet(CVarLatencyCsv))
+	{
+		LatencyCsvPath = CVarLatencyCsv.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarSessionReport))
+	{
+		SessionReportPath = CVarSessionReport.GetValueOnAnyThread();
+	}
+	if (IsSet(CVarScaleFilter))
+	{
+		ScaleFilter = static_cast<ERecorderScaleFilter>(
+			FMath::Clamp(CVarScaleFilter.GetValueOnAnyThread(), 0, static_cast<int32>(ERecorderScaleFilter::Box)));
+	}
+
+	if (IsSet(CVarOutputResolution))
+	{
+		FString OutputWidth;
+		FString OutputHeight;
+		const FString OutputSize = CVarOutputResolution.GetValueOnAnyThread();
+		if (OutputSize.Split(TEXT("x"), &OutputWidth, &OutputHeight))
+		{
+			OutputResolution = {FCString::Atoi(*OutputWidth), FCString::Atoi(*OutputHeight)};
+		}
+		else if (!OutputSize.IsEmpty())
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("rec.OutputResolution: can not parse \"%s\", expected WxH"), *OutputSize)
+		}
+	}
+
+	if (IsSet(CVarRenditions))
+	{
+		TArray<FString> RenditionSpecs;
+		CVarRenditions.GetValueOnAnyThread().ParseIntoArray(RenditionSpecs, TEXT(";"));
+		Renditions.Reset();
+		for (const FString& Spec : RenditionSpecs)
+		{
+			FRecorderRendition Rendition;
+			if (ParseRendition(Spec, Rendition))
+			{
+				Renditions.Add(Rendition);
+			}
+			else
+			{
+				UE_LOG(LogRecorder, Warning,
+				       TEXT("rec.Renditions: can not parse \"%s\", expected WxH@kbps[:preset][=path]"), *Spec)
+			}
+		}
+	}
+}
+
 FEncodeData::FEncodeData(): StartSec(0), Duration(0)
 {
 }
@@ -7,6 +7,7 @@
 #include "Engine/Engine.h"
 #include "Engine/GameViewportClient.h"
 #include "Framework/Application/SlateApplication.h"
+#include "RenderingThread.h"
 #include "Stats/StatsMisc.h"
 
 void FScreenCaptureTimeManager::Initialize(double InOutputFrameRate)
@@ -113,52 +114,78 @@ void FVideoCapture::Unregister()
 	UE_LOG(LogRecorder, Display, TEXT("Frame receiver stopped."));
 }
 
+void FVideoCapture::Teardown()
+{
+	// 编码线程已经退出，借出去的视图都释放了，在渲染线程上 Unmap 并销毁所有 readback
+	ENQUEUE_RENDER_COMMAND(ReleaseRecorderReadbacks)([this](FRHICommandListImmediate& RHICmdList)
+	{
+		ReclaimReadbacks_RenderThread();
+		PendingReadbacks.Reset();
+		for (auto& Readback : GPUTextureReadback)
+		{
+			ensure(!Readback.IsValid() || Readback->GetCaptureStatus() !=
+				recorder::FRHIGPUTextureReadback::ECaptureStatus::Encoding);
+			Readback.Reset();
+		}
+	});
+	FlushRenderingCommands();
+}
+
 bool FVideoCapture::CopyTextureToQueue_GpuReadToCpu(const FTexture2DRHIRef& BackBuffer, double CaptureTsInSeconds,
                                                     double DurationInSeconds, const FIntRect& RecordArea)
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("CopyTextureToQueue_GpuReadToCpu");
+	const uint64 CaptureCycles = FPlatformTime::Cycles64();
 
 	int w = BackBuffer->GetTexture2D()->GetSizeX();
 	int h = BackBuffer->GetTexture2D()->GetSizeY();
 
 	FRHICommandListImmediate& RHICmdList = GRHICommandList.GetImmediateCommandList();
 
+	// 编码侧已经用完的 readback 先 Unmap，才能再次发起拷贝
+	ReclaimReadbacks_RenderThread();
+
 	// enqueue 到队列中使写入画面
+	bool Rst = true;
+	const int32 CaptureIndex = AcquireReadback_RenderThread();
+	if (CaptureIndex == INDEX_NONE)
 	{
-		if (!GPUTextureReadback[CurrentReadbackIndex].IsValid())
+		// readback 都还在 GPU 拷贝中或者借给了编码侧，这一帧放弃，交给编码侧记录丢帧，保证时间轴连续
+		UE_LOG(LogRecorder, Verbose, TEXT("GPUReadToCpu: no free readback, frame %lf dropped"), CaptureTsInSeconds)
+		Rst = GetOnSendFrame().ExecuteIfBound(FCapturedVideoFrame{
+			.FrameData = nullptr,
+			.PixelFormat = BackBuffer->GetFormat(),
+			.FrameWidth = static_cast<uint16>(w),
+			.FrameHeight = static_cast<uint16>(h),
+			.CaptureRect = RecordArea,
+			.PresentTime = CaptureTsInSeconds,
+			.Duration = DurationInSeconds
+		});
+	}
+	else
+	{
+		if (!GPUTextureReadback[CaptureIndex].IsValid())
 		{
 			static FName RecordName = TEXT("ScreenRecordTextureReadback");
-			GPUTextureReadback[CurrentReadbackIndex].Reset(
+			GPUTextureReadback[CaptureIndex].Reset(
 				new recorder::FRHIGPUTextureReadback(RecordName, BackBuffer->GetTexture2D()->GetSizeXY()));
 		}
-		auto& CurrentGpuReadBack = GPUTextureReadback[CurrentReadbackIndex];
+		auto& CurrentGpuReadBack = GPUTextureReadback[CaptureIndex];
 
 		{
 			// FScopeLogTime timecr(TEXT("EnqueueCopyRDG"));
 			// FResolveRect Rect{RecordArea};
 			FResolveRect Rect{};
-			CurrentGpuReadBack->PreEnqueue(CaptureTsInSeconds, DurationInSeconds);
+			CurrentGpuReadBack->PreEnqueue(CaptureTsInSeconds, DurationInSeconds, CaptureCycles);
 			CurrentGpuReadBack->EnqueueCopy(RHICmdList, BackBuffer->GetTexture2D(), Rect);
 		}
+		PendingReadbacks.Add(CaptureIndex);
 	}
 
-	// READBACK_BUFFER_COUNT - 1 帧前的画面，用于交替读取
-	const int32 PreviousReadbackIndex = (CurrentReadbackIndex + 1) % READBACK_BUFFER_COUNT;
-	CurrentReadbackIndex = PreviousReadbackIndex;
-
-	// 验证用于读取的是否准备好了，没准备好说明还在初始化，先不读
-	if (!GPUTextureReadback[PreviousReadbackIndex].IsValid())
+	// READBACK_LATENCY 帧之前发起的拷贝，按发起顺序依次映射并借给编码侧，这里不做任何逐像素的工作
+	while (PendingReadbacks.Num() > READBACK_LATENCY)
 	{
-		static FName RecordName = TEXT("ScreenRecordTextureReadback");
-		GPUTextureReadback[PreviousReadbackIndex].Reset(
-			new recorder::FRHIGPUTextureReadback(RecordName, BackBuffer->GetTexture2D()->GetSizeXY()));
-		return true;
-	}
-
-	// 下面肯定已经保证了前一帧的 readback 有效
-	bool Rst = false;
-	{
-		auto& PreviousGpuReadback = GPUTextureReadback[PreviousReadbackIndex];
+		auto& PreviousGpuReadback = GPUTextureReadback[PendingReadbacks[0]];
 
 		if (
 			// 这个怎么在 Android 上会始终为 false 啊？
@@ -167,10 +194,12 @@ bool FVideoCapture::CopyTextureToQueue_GpuReadToCpu(const FTexture2DRHIRef& Back
 #endif
 			PreviousGpuReadback->GetCaptureStatus() != recorder::FRHIGPUTextureReadback::ECaptureStatus::Capturing)
 		{
-			UE_LOG(LogRecorder, Error, TEXT("GPUReadToCpu: copy texture is not ready: isReady=%d, CaptureStatus=%d"),
+			// 拷贝还没完成，下一帧再读
+			UE_LOG(LogRecorder, Verbose, TEXT("GPUReadToCpu: copy texture is not ready: isReady=%d, CaptureStatus=%d"),
 			       PreviousGpuReadback->IsReady(), PreviousGpuReadback->GetCaptureStatus())
-			return false;
+			break;
 		}
+		PendingReadbacks.RemoveAt(0, 1, false);
 
 		uint8* TextureData;
 		FIntPoint OutResolution;
@@ -188,6 +217,7 @@ bool FVideoCapture::CopyTextureToQueue_GpuReadToCpu(const FTexture2DRHIRef& Back
 		auto ClippedRect = RecordArea;
 		ClippedRect.Max.ComponentMin(FIntPoint(OutResolution.X, h));
 		{
+			// 映射的内存借给编码侧，视图释放之后才会在 ReclaimReadbacks_RenderThread 中 Unmap
 			Rst = GetOnSendFrame().ExecuteIfBound(FCapturedVideoFrame{
 				.FrameData =  TextureData,
 				.PixelFormat = BackBuffer->GetFormat(),
@@ -195,18 +225,55 @@ bool FVideoCapture::CopyTextureToQueue_GpuReadToCpu(const FTexture2DRHIRef& Back
 				.FrameHeight = static_cast<uint16>(h),
 				.CaptureRect = ClippedRect,
 				.PresentTime = PreviousGpuReadback->CapturedTime,
-				.Duration = PreviousGpuReadback->CapturedDuration
-			});
+				.Duration = PreviousGpuReadback->CapturedDuration,
+				.CaptureCycles = PreviousGpuReadback->CapturedCycles,
+				.View = PreviousGpuReadback->Lend()
+			}) && Rst;
 		}
-		PreviousGpuReadback->Unlock();
 	}
 
 	return Rst;
 }
 
+void FVideoCapture::ReclaimReadbacks_RenderThread()
+{
+	for (auto& Readback : GPUTextureReadback)
+	{
+		if (Readback.IsValid())
+		{
+			Readback->TryReclaim();
+		}
+	}
+}
+
+int32 FVideoCapture::AcquireReadback_RenderThread()
+{
+	for (int32 WaitedMs = 0; ; ++WaitedMs)
+	{
+		for (int32 Offset = 0; Offset < READBACK_BUFFER_COUNT; ++Offset)
+		{
+			const int32 Index = (CurrentReadbackIndex + Offset) % READBACK_BUFFER_COUNT;
+			if (!GPUTextureReadback[Index].IsValid() || GPUTextureReadback[Index]->IsIdle())
+			{
+				CurrentReadbackIndex = (Index + 1) % READBACK_BUFFER_COUNT;
+				return Index;
+			}
+		}
+
+		if (!bWaitForFreeReadback || WaitedMs >= MAX_READBACK_WAIT_MS)
+		{
+			return INDEX_NONE;
+		}
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("WaitFreeReadback");
+		FPlatformProcess::Sleep(0.001f);
+		ReclaimReadbacks_RenderThread();
+	}
+}
+
 bool FVideoCapture::CopyTextureToQueue_LockTextureToCpu(const FTexture2DRHIRef& BackBuffer, double CaptureTsInSeconds,
                                                         double DurationInSeconds, const FIntRect& RecordArea)
 {
+	const uint64 CaptureCycles = FPlatformTime::Cycles64();
 	FRHICommandListImmediate& list = GRHICommandList.GetImmediateCommandList();
 	const int w = BackBuffer->GetTexture2D()->GetSizeX();
 	const int h = BackBuffer->GetTexture2D()->GetSizeY();
@@ -237,7 +304,8 @@ bool FVideoCapture::CopyTextureToQueue_LockTextureToCpu(const FTexture2DRHIRef&
 			.FrameHeight = static_cast<uint16>(h),
 			.CaptureRect = ClippedRect,
 			.PresentTime = CaptureTsInSeconds,
-			.Duration = DurationInSeconds
+			.Duration = DurationInSeconds,
+			.CaptureCycles = CaptureCycles
 		});
 	}
 	list.UnlockTexture2D(BackBuffer, 0, false);
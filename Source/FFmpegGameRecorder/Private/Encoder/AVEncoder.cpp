@@ -1,6 +1,9 @@
 ﻿#include "Encoder/AVEncoder.h"
 
 #include "RHISurfaceDataConversion.h"
+#include "Encoder/PixelConvert.h"
+#include "Encoder/RenditionEncoder.h"
+#include "Misc/ScopeExit.h"
 
 struct FRHIR10G10B10A2;
 
@@ -21,6 +24,12 @@ FAVEncoder::FAVEncoder()
 	  , audio_swr(nullptr)
 	  , audio_frame(nullptr)
 	  , video_frame(nullptr)
+	  , video_frame_pool(nullptr)
+	  , capture_frame(nullptr)
+	  , capture_frame_8bit(nullptr)
+	  , video_packet(nullptr)
+	  , audio_packet(nullptr)
+	  , filtered_video_frame(nullptr)
 {
 	outs[0] = nullptr;
 	outs[1] = nullptr;
@@ -46,29 +55,27 @@ void FAVEncoder::InitializeEncoder(FRecorderConfig InRecordConfig)
 
 	avformat_network_init();
 
+	PendingVideoTimes.SetNum(PENDING_VIDEO_TIME_CAPACITY);
+	// 逐帧的样本最多留一个小时，只有写 CSV 时才需要
+	CaptureLatency.Initialize(RecordConfig.LatencyCsvPath.IsEmpty() ? 0 : RecordConfig.FrameRate * 3600);
+
 	outs[0] = static_cast<uint8_t*>(FMemory::Realloc(outs[0], 1024 * sizeof(float)));
 	outs[1] = static_cast<uint8_t*>(FMemory::Realloc(outs[1], 1024 * sizeof(float)));
 
-	filter_descr = FString::Printf(TEXT("[in]scale=%d:%d[out]"), RecordConfig.Resolution.X, RecordConfig.Resolution.Y);
-
-	int IsUseRTMP = RecordConfig.SaveFilePath.Find("rtmp");
-	if (IsUseRTMP == 0)
-	{
-		if (avformat_alloc_output_context2(&out_format_context, nullptr, "flv",
-		                                   TCHAR_TO_ANSI(*RecordConfig.SaveFilePath))
-			< 0)
-		{
-			check(false);
-		}
-	}
-	else
+	const FIntPoint OutputResolution = RecordConfig.GetOutputResolution();
+	filter_descr = FString::Printf(TEXT("[in]scale=%d:%d[out]"), OutputResolution.X, OutputResolution.Y);
+
+	// 分段输出时按分段的格式创建，即时回放按导出的 MP4 创建，编码器的全局头等设置才能与写出的文件一致
+	const char* FormatName = FReplayBuffer::IsEnabled(RecordConfig)
+		                         ? "mp4"
+		                         : FSegmentedOutput::IsEnabled(RecordConfig)
+		                         ? FSegmentedOutput::GetSegmentFormatName(RecordConfig)
+		                         : recorder::GetOutputFormatName(RecordConfig.SaveFilePath);
+	if (avformat_alloc_output_context2(&out_format_context, nullptr, FormatName,
+	                                   TCHAR_TO_ANSI(*RecordConfig.SaveFilePath)) <
+		0)
 	{
-		if (avformat_alloc_output_context2(&out_format_context, nullptr, nullptr,
-		                                   TCHAR_TO_ANSI(*RecordConfig.SaveFilePath)) <
-			0)
-		{
-			check(false);
-		}
+		check(false);
 	}
 
 	//create audio encoder
@@ -76,9 +83,18 @@ void FAVEncoder::InitializeEncoder(FRecorderConfig InRecordConfig)
 	CreateAudioEncoder("aac");
 
 	//create video encoder
-	CreateVideoEncoder(RecordConfig.bUseHardwareEncoding, TCHAR_TO_ANSI(*RecordConfig.SaveFilePath),
-	                   RecordConfig.VideoBitRate);
-	AllocVideoFilter();
+	CreateVideoEncoder(RecordConfig.bUseHardwareEncoding, TCHAR_TO_ANSI(*RecordConfig.SaveFilePath));
+	if (IsVideoFilterRequired())
+	{
+		AllocVideoFilter();
+	}
+	else
+	{
+		UE_LOG(LogRecorder, Log, TEXT("Video filter %s is an identity, frames go to the encoder directly"), *filter_descr)
+	}
+
+	CreateOutputSinks();
+	StartMuxing();
 }
 
 
@@ -119,6 +135,7 @@ void FAVEncoder::CreateAudioEncoder(const char* audioencoder_name)
 	avcodec_parameters_from_context(out_audio_stream->codecpar, audio_encoder_codec_context);
 
 	audio_frame = av_frame_alloc();
+	audio_packet = av_packet_alloc();
 	audio_frame->nb_samples = audio_encoder_codec_context->frame_size;
 	audio_frame->sample_rate = audio_encoder_codec_context->sample_rate;
 	// UE_LOG(LogRecorder, Warning, TEXT("audio_frame->nb_samples %d"), audio_frame->nb_samples)
@@ -127,19 +144,12 @@ void FAVEncoder::CreateAudioEncoder(const char* audioencoder_name)
 	audio_frame->channel_layout = audio_encoder_codec_context->channel_layout;
 }
 
-void FAVEncoder::CreateVideoEncoder(bool is_use_NGPU, const char* out_file_name, int bit_rate)
+void FAVEncoder::CreateVideoEncoder(bool is_use_NGPU, const char* out_file_name)
 {
-	const AVCodec* encoder_codec;
+	VideoBackend = &SelectVideoBackend(is_use_NGPU);
+	const AVCodec* encoder_codec = VideoBackend->FindCodec();
 	int ret;
 
-	if (is_use_NGPU)
-	{
-		encoder_codec = avcodec_find_encoder_by_name("nvenc_h264");
-	}
-	else
-	{
-		encoder_codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-	}
 	if (!encoder_codec)
 	{
 		check(false);
@@ -148,45 +158,24 @@ void FAVEncoder::CreateVideoEncoder(bool is_use_NGPU, const char* out_file_name,
 
 	video_index = out_video_stream->index;
 
-	video_encoder_codec_context = avcodec_alloc_context3(encoder_codec);
+	VideoInputFormat = NegotiateVideoInputFormat(*VideoBackend, encoder_codec);
+	// 编码器都不接受时只能送 I420，由滤镜图转换成它的第一个格式
+	const AVPixelFormat EncoderFormat = VideoBackend->AcceptsPixelFormat(encoder_codec, VideoInputFormat)
+		                                    ? VideoInputFormat
+		                                    : encoder_codec->pix_fmts[0];
+	// 码控、preset、profile 由后端设置
+	video_encoder_codec_context = VideoBackend->AllocContext(encoder_codec, RecordConfig, EncoderFormat,
+	                                                         RecordConfig.GetOutputResolution());
 	if (!video_encoder_codec_context)
 	{
 		check(false);
 	}
-	video_encoder_codec_context->bit_rate = bit_rate;
-	video_encoder_codec_context->rc_min_rate = bit_rate;
-	video_encoder_codec_context->rc_max_rate = bit_rate;
-	//video_encoder_codec_context->bit_rate_tolerance = bit_rate;
-	//video_encoder_codec_context->rc_buffer_size = bit_rate;
-	//video_encoder_codec_context->rc_initial_buffer_occupancy = bit_rate * 3 / 4;
-	video_encoder_codec_context->width = RecordConfig.Resolution.X;
-	video_encoder_codec_context->height = RecordConfig.Resolution.Y;
-	video_encoder_codec_context->max_b_frames = 2;
-	video_encoder_codec_context->time_base.num = 1;
-	video_encoder_codec_context->time_base.den = RecordConfig.FrameRate;
-	video_encoder_codec_context->pix_fmt = AV_PIX_FMT_YUV420P;
-	video_encoder_codec_context->me_range = 16;
-	video_encoder_codec_context->codec_type = AVMEDIA_TYPE_VIDEO;
-	video_encoder_codec_context->profile = FF_PROFILE_H264_BASELINE;
 	video_encoder_codec_context->frame_number = 1;
-	video_encoder_codec_context->qcompress = 0.8;
-	video_encoder_codec_context->max_qdiff = 4;
-	video_encoder_codec_context->level = 30;
-	video_encoder_codec_context->gop_size = 25;
-	video_encoder_codec_context->qmin = 18;
-	video_encoder_codec_context->qmax = 28;
-	video_encoder_codec_context->me_range = 16;
-	video_encoder_codec_context->framerate = {RecordConfig.FrameRate, 1};
-	// https://blog.csdn.net/wss260046582/article/details/122238453 解决 avcodec_receive_packet 在初始开始录制时会等待缓冲区填满后再读取的问题
-	// av_opt_set(video_encoder_codec_context->priv_data, "tune", "zerolatency", 0);
-
-	if (encoder_codec)
-	{
-		//ultrafast,superfast, veryfast, faster, fast, medium, slow, slower, veryslow,placebo.
-		av_opt_set(video_encoder_codec_context->priv_data, "preset", "ultrafast", 0);
-		const FString Crf = FString::Printf(TEXT("%d"), FMath::Clamp(ConstantRateFactor, 0, 51));
-		av_opt_set(video_encoder_codec_context->priv_data, "crf", TCHAR_TO_UTF8(*Crf), 0);
-	}
+	// avcodec_receive_packet 在开始录制时要等编码器攒够帧才有输出，推流时用 bLowLatency 去掉 B 帧和 lookahead
+	UE_LOG(LogRecorder, Log, TEXT("Video encoder %s%s, %s input, delay %d frames"), VideoBackend->GetName(),
+	       RecordConfig.bLowLatency ? TEXT(" (low latency)") : TEXT(""),
+	       UTF8_TO_TCHAR(av_get_pix_fmt_name(EncoderFormat)),
+	       VideoBackend->GetTraits(RecordConfig.bLowLatency).DelayFrames)
 
 	if (out_format_context->oformat->flags & AVFMT_GLOBALHEADER)
 	{
@@ -206,33 +195,84 @@ void FAVEncoder::CreateVideoEncoder(bool is_use_NGPU, const char* out_file_name,
 	}
 
 	video_frame = av_frame_alloc();
-	if (!video_frame)
+	video_packet = av_packet_alloc();
+	if (!video_frame || !video_packet)
 	{
 		check(false);
 	}
 
-	ret = avio_open(&out_format_context->pb, out_file_name, AVIO_FLAG_WRITE);
-
-	if (ret < 0)
+	if (!InitializeVideoFramePool())
 	{
-		UE_LOG(LogRecorder, Error, TEXT("avio_open:%d; out_file_name:%s"), ret, ANSI_TO_TCHAR(out_file_name));
-
 		check(false);
 	}
-	ret = av_image_alloc(
-		video_frame->data,
-		video_frame->linesize,
-		RecordConfig.Resolution.X,
-		RecordConfig.Resolution.Y,
-		video_encoder_codec_context->pix_fmt,
-		32);
+	if (RecordConfig.GetOutputResolution() != RecordConfig.Resolution)
+	{
+		// 截取区域先转换到这一帧，再缩放进池里的编码器输入帧；只在转换线程使用，整个录制期间复用
+		capture_frame = av_frame_alloc();
+		if (!capture_frame)
+		{
+			check(false);
+		}
+		capture_frame->width = RecordConfig.Resolution.X;
+		capture_frame->height = RecordConfig.Resolution.Y;
+		capture_frame->format = VideoInputFormat;
+		if (av_frame_get_buffer(capture_frame, VIDEO_FRAME_ALIGNMENT) < 0)
+		{
+			check(false);
+		}
+		UE_LOG(LogRecorder, Log, TEXT("Capture %dx%d is scaled to %dx%d before encoding"), RecordConfig.Resolution.X,
+		       RecordConfig.Resolution.Y, RecordConfig.GetOutputResolution().X, RecordConfig.GetOutputResolution().Y)
+	}
+	if (IsHighBitDepthFormat(VideoInputFormat))
+	{
+		// 8bit 的后台缓冲没有 10bit 的转换，先用 libyuv 转换成 I420 再扩展，每个条带只用到这一帧里自己的几行
+		capture_frame_8bit = av_frame_alloc();
+		if (!capture_frame_8bit)
+		{
+			check(false);
+		}
+		capture_frame_8bit->width = RecordConfig.Resolution.X;
+		capture_frame_8bit->height = RecordConfig.Resolution.Y;
+		capture_frame_8bit->format = AV_PIX_FMT_YUV420P;
+		if (av_frame_get_buffer(capture_frame_8bit, VIDEO_FRAME_ALIGNMENT) < 0)
+		{
+			check(false);
+		}
+		UE_LOG(LogRecorder, Log, TEXT("Encoding 10-bit %s with %s"), UTF8_TO_TCHAR(av_get_pix_fmt_name(VideoInputFormat)),
+		       UTF8_TO_TCHAR(encoder_codec->name))
+	}
+
+	if (FReplayBuffer::IsEnabled(RecordConfig) || FSegmentedOutput::IsEnabled(RecordConfig))
+	{
+		// out_format_context 只作为各个分段或者回放文件的模板，不写文件；流的时间基固定下来，写出时再换算
+		out_video_stream->time_base = {1, recorder::TemplateVideoTimeBase};
+		out_audio_stream->time_base = {1, audio_encoder_codec_context->sample_rate};
+		if (FReplayBuffer::IsEnabled(RecordConfig))
+		{
+			ReplayBuffer = MakeUnique<FReplayBuffer>(RecordConfig, out_format_context);
+			return;
+		}
+		SegmentedOutput = MakeUnique<FSegmentedOutput>(RecordConfig, out_format_context);
+		if (!SegmentedOutput->Open())
+		{
+			check(false);
+		}
+		return;
+	}
+
+	ret = recorder::OpenOutputIO(out_format_context, RecordConfig.SaveFilePath, RecordConfig, FileWriter);
 	if (ret < 0)
 	{
+		UE_LOG(LogRecorder, Error, TEXT("avio_open:%d; out_file_name:%s"), ret, ANSI_TO_TCHAR(out_file_name));
+
 		check(false);
 	}
 
+	AVDictionary* MuxerOptions = recorder::MakeMuxerOptions(out_format_context, RecordConfig);
 	UE_LOG(LogRecorder, Warning, TEXT("try to write header"))
-	if (avformat_write_header(out_format_context, nullptr) < 0)
+	ret = avformat_write_header(out_format_context, &MuxerOptions);
+	av_dict_free(&MuxerOptions);
+	if (ret < 0)
 	{
 		check(false);
 	}
@@ -244,23 +284,271 @@ void FAVEncoder::CreateVideoEncoder(bool is_use_NGPU, const char* out_file_name,
 void FAVEncoder::ChangeColorFormat(AVFrame* InVideoFrame, uint8_t* FrameDataInRgb) const
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("ChangeColorFormat");
+	const int32 Width = RecordConfig.Resolution.X;
+	const int32 SrcStride = Width * 4;
+	recorder::ParallelForStripes(RecordConfig.Resolution.Y, RecordConfig.ColorConvertWorkers,
+	                             [&](int32 StartRow, int32 NumRows)
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("ChangeColorFormat_Stripe");
+		const uint8* Src = FrameDataInRgb + StartRow * SrcStride;
+		uint8* DstY = InVideoFrame->data[0] + StartRow * InVideoFrame->linesize[0];
+		uint8* DstU = InVideoFrame->data[1] + StartRow / 2 * InVideoFrame->linesize[1];
+		if (capture_frame_8bit)
+		{
+			// 10bit 编码：条带先转换成 8bit 的 I420，趁还在缓存里扩展到 10bit
+			const recorder::FI420Planes Staging{
+				capture_frame_8bit->data[0] + StartRow * capture_frame_8bit->linesize[0], capture_frame_8bit->linesize[0],
+				capture_frame_8bit->data[1] + StartRow / 2 * capture_frame_8bit->linesize[1], capture_frame_8bit->linesize[1],
+				capture_frame_8bit->data[2] + StartRow / 2 * capture_frame_8bit->linesize[2], capture_frame_8bit->linesize[2],
+			};
+#if PLATFORM_MAC || PLATFORM_IOS
+			libyuv::ARGBToI420(Src, SrcStride,
+			                   Staging.Y, Staging.StrideY,
+			                   Staging.U, Staging.StrideU,
+			                   Staging.V, Staging.StrideV,
+			                   Width, NumRows);
+#else
+			libyuv::ABGRToI420(Src, SrcStride,
+			                   Staging.Y, Staging.StrideY,
+			                   Staging.U, Staging.StrideU,
+			                   Staging.V, Staging.StrideV,
+			                   Width, NumRows);
+#endif
+			if (VideoInputFormat == AV_PIX_FMT_P010)
+			{
+				recorder::WidenI420ToP010(Staging, {DstY, InVideoFrame->linesize[0], DstU, InVideoFrame->linesize[1]},
+				                          Width, NumRows);
+				return;
+			}
+			const recorder::FI420Planes Planes{
+				DstY, InVideoFrame->linesize[0],
+				DstU, InVideoFrame->linesize[1],
+				InVideoFrame->data[2] + StartRow / 2 * InVideoFrame->linesize[2], InVideoFrame->linesize[2],
+			};
+			recorder::WidenI420ToI010(Staging, Planes, Width, NumRows);
+			return;
+		}
+		if (VideoInputFormat == AV_PIX_FMT_NV12)
+		{
+			// 一遍写出交错的 UV 平面，编码器不需要再把 I420 的两个色度平面重排一次
+#if PLATFORM_MAC || PLATFORM_IOS
+			libyuv::ARGBToNV12(Src, SrcStride,
+			                   DstY, InVideoFrame->linesize[0],
+			                   DstU, InVideoFrame->linesize[1],
+			                   Width, NumRows);
+#else
+			libyuv::ABGRToNV12(Src, SrcStride,
+			                   DstY, InVideoFrame->linesize[0],
+			                   DstU, InVideoFrame->linesize[1],
+			                   Width, NumRows);
+#endif
+			return;
+		}
+		uint8* DstV = InVideoFrame->data[2] + StartRow / 2 * InVideoFrame->linesize[2];
 #if PLATFORM_MAC || PLATFORM_IOS
-    libyuv::ARGBToI420(FrameDataInRgb, RecordConfig.Resolution.X * 4,
-        InVideoFrame->data[0], InVideoFrame->linesize[0],
-        InVideoFrame->data[1], InVideoFrame->linesize[1],
-        InVideoFrame->data[2], InVideoFrame->linesize[2],
-        RecordConfig.Resolution.X, RecordConfig.Resolution.Y);
+		libyuv::ARGBToI420(Src, SrcStride,
+		                   DstY, InVideoFrame->linesize[0],
+		                   DstU, InVideoFrame->linesize[1],
+		                   DstV, InVideoFrame->linesize[2],
+		                   Width, NumRows);
+#else
+		libyuv::ABGRToI420(Src, SrcStride,
+		                   DstY, InVideoFrame->linesize[0],
+		                   DstU, InVideoFrame->linesize[1],
+		                   DstV, InVideoFrame->linesize[2],
+		                   Width, NumRows);
+#endif
+	});
+
+	InVideoFrame->width = RecordConfig.Resolution.X;
+	InVideoFrame->height = RecordConfig.Resolution.Y;
+	InVideoFrame->format = VideoInputFormat;
+}
+
+bool FAVEncoder::IsHighBitDepthFormat(AVPixelFormat Format)
+{
+	return Format == AV_PIX_FMT_P010 || Format == AV_PIX_FMT_YUV420P10;
+}
+
+const IVideoEncoderBackend& FAVEncoder::SelectVideoBackend(bool bHardware) const
+{
+	const AVOutputFormat* Format = out_format_context->oformat;
+	const IVideoEncoderBackend* Backend = bHardware
+		                                      ? &recorder::GetHardwareVideoEncoderBackend(false)
+		                                      : &recorder::GetVideoEncoderBackend(RecordConfig.VideoCodec);
+	if (!recorder::IsVideoEncoderBackendUsable(*Backend, Format))
+	{
+		const IVideoEncoderBackend* const* Fallback = recorder::GetVideoEncoderBackends().FindByPredicate(
+			[Format](const IVideoEncoderBackend* Candidate)
+			{
+				return recorder::IsVideoEncoderBackendUsable(*Candidate, Format);
+			});
+		if (!Fallback)
+		{
+			UE_LOG(LogRecorder, Error, TEXT("No video encoder available for %s output"), UTF8_TO_TCHAR(Format->name))
+			return *Backend;
+		}
+		UE_LOG(LogRecorder, Warning, TEXT("%s is not available or can not be written to %s, using %s"),
+		       Backend->GetName(), UTF8_TO_TCHAR(Format->name), (*Fallback)->GetName())
+		Backend = *Fallback;
+	}
+	if (!RecordConfig.bHighBitDepth || Backend->AcceptsHighBitDepth(Backend->FindCodec()))
+	{
+		return *Backend;
+	}
+	// NVENC 的 H.264 不支持 10bit 编码，硬件编码换成 hevc_nvenc
+	const IVideoEncoderBackend& HevcBackend = bHardware
+		                                          ? recorder::GetHardwareVideoEncoderBackend(true)
+		                                          : recorder::GetVideoEncoderBackend(ERecorderVideoCodec::X265);
+	if (recorder::IsVideoEncoderBackendUsable(HevcBackend, Format)
+		&& HevcBackend.AcceptsHighBitDepth(HevcBackend.FindCodec()))
+	{
+		UE_LOG(LogRecorder, Log, TEXT("%s has no 10-bit input, using %s"), Backend->GetName(), HevcBackend.GetName())
+		return HevcBackend;
+	}
+	UE_LOG(LogRecorder, Warning, TEXT("No 10-bit %s/HEVC encoder for %s output, recording in 8-bit"),
+	       Backend->GetName(), UTF8_TO_TCHAR(Format->name))
+	return *Backend;
+}
+
+AVPixelFormat FAVEncoder::NegotiateVideoInputFormat(const IVideoEncoderBackend& Backend, const AVCodec* Codec) const
+{
+	if (RecordConfig.bHighBitDepth)
+	{
+		if (RecordConfig.bPreferNV12 && Backend.AcceptsPixelFormat(Codec, AV_PIX_FMT_P010))
+		{
+			return AV_PIX_FMT_P010;
+		}
+		if (Backend.AcceptsPixelFormat(Codec, AV_PIX_FMT_YUV420P10))
+		{
+			return AV_PIX_FMT_YUV420P10;
+		}
+		if (Backend.AcceptsPixelFormat(Codec, AV_PIX_FMT_P010))
+		{
+			return AV_PIX_FMT_P010;
+		}
+	}
+	if (RecordConfig.bPreferNV12 && Backend.AcceptsPixelFormat(Codec, AV_PIX_FMT_NV12))
+	{
+		UE_LOG(LogRecorder, Log, TEXT("%s accepts NV12, frames are converted to NV12 directly"),
+		       UTF8_TO_TCHAR(Codec->name))
+		return AV_PIX_FMT_NV12;
+	}
+	return AV_PIX_FMT_YUV420P;
+}
+
+bool FAVEncoder::InitializeVideoFramePool()
+{
+	const int32 Width = RecordConfig.GetOutputResolution().X;
+	const int32 Height = RecordConfig.GetOutputResolution().Y;
+	const int32 ChromaHeight = (Height + 1) / 2;
+	// NV12 和 P010 只有两个平面，UV 平面每一行是 U、V 交错的一行色度；10bit 的每个采样占两个字节
+	const bool bNV12 = VideoInputFormat == AV_PIX_FMT_NV12 || VideoInputFormat == AV_PIX_FMT_P010;
+	const int32 BytesPerSample = IsHighBitDepthFormat(VideoInputFormat) ? 2 : 1;
+	VideoFramePlaneCount = bNV12 ? 2 : 3;
+	VideoFrameLinesize[0] = Align(Width * BytesPerSample, VIDEO_FRAME_ALIGNMENT);
+	VideoFrameLinesize[1] = Align((Width + 1) / 2 * (bNV12 ? 2 : 1) * BytesPerSample, VIDEO_FRAME_ALIGNMENT);
+	VideoFrameLinesize[2] = bNV12 ? 0 : VideoFrameLinesize[1];
+	VideoFramePlaneOffset[0] = 0;
+	VideoFramePlaneOffset[1] = static_cast<SIZE_T>(VideoFrameLinesize[0]) * Height;
+	VideoFramePlaneOffset[2] = VideoFramePlaneOffset[1] + static_cast<SIZE_T>(VideoFrameLinesize[1]) * ChromaHeight;
+	const SIZE_T FrameBytes = VideoFramePlaneOffset[2] + static_cast<SIZE_T>(VideoFrameLinesize[2]) * ChromaHeight;
+
+	// av_malloc 的对齐取决于 FFmpeg 的编译选项，多分配一点，取用时再对齐到 64 字节
+	video_frame_pool = av_buffer_pool_init2(FrameBytes + VIDEO_FRAME_ALIGNMENT - 1, this,
+	                                        &FAVEncoder::AllocVideoFrameBuffer, nullptr);
+	return video_frame_pool != nullptr;
+}
+
+template <typename SizeType>
+AVBufferRef* FAVEncoder::AllocVideoFrameBuffer(void* Opaque, SizeType Size)
+{
+	// 池里的缓存都在被编码器引用时才会走到这里
+	return av_buffer_alloc(Size);
+}
+
+bool FAVEncoder::AcquireVideoFrameBuffer(AVFrame* Frame) const
+{
+	// 释放上一帧的引用，编码器还持有的话，等它用完缓存会自动回到池里
+	av_frame_unref(Frame);
+
+	// av_buffer_pool_get 是线程安全的，可以在转换线程调用
+	AVBufferRef* Buffer = av_buffer_pool_get(video_frame_pool);
+	if (!Buffer)
+	{
+		return false;
+	}
+
+	uint8* Base = Align(Buffer->data, VIDEO_FRAME_ALIGNMENT);
+	Frame->buf[0] = Buffer;
+	for (int32 Plane = 0; Plane < VideoFramePlaneCount; ++Plane)
+	{
+		Frame->data[Plane] = Base + VideoFramePlaneOffset[Plane];
+		Frame->linesize[Plane] = VideoFrameLinesize[Plane];
+	}
+	Frame->width = RecordConfig.GetOutputResolution().X;
+	Frame->height = RecordConfig.GetOutputResolution().Y;
+	Frame->format = VideoInputFormat;
+	return true;
+}
+
+bool FAVEncoder::CanConvertDirectly(const FCapturedVideoFrame& VideoFrame)
+{
+#if PLATFORM_WINDOWS
+	return VideoFrame.FrameData && VideoFrame.PixelFormat == EPixelFormat::PF_A2B10G10R10;
 #else
-	libyuv::ABGRToI420(FrameDataInRgb, RecordConfig.Resolution.X * 4,
-	                   InVideoFrame->data[0], InVideoFrame->linesize[0],
-	                   InVideoFrame->data[1], InVideoFrame->linesize[1],
-	                   InVideoFrame->data[2], InVideoFrame->linesize[2],
-	                   RecordConfig.Resolution.X, RecordConfig.Resolution.Y);
+	return false;
 #endif
+}
+
+void FAVEncoder::ConvertCapturedFrame(AVFrame* InVideoFrame, const FCapturedVideoFrame& VideoFrame) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("ConvertCapturedFrame");
+	const FIntRect& CaptureRect = VideoFrame.CaptureRect;
+	const int32 SrcStride = VideoFrame.FrameWidth * 4;
+	const uint8* Src = VideoFrame.FrameData + CaptureRect.Min.Y * SrcStride + CaptureRect.Min.X * 4;
+
+	// 裁剪区域与输出分辨率不一致时只转换重叠的部分，和原先 RGBA 中转缓存的行为一致
+	const int32 Width = FMath::Min(CaptureRect.Width(), RecordConfig.Resolution.X);
+	const int32 Height = FMath::Min(CaptureRect.Height(), RecordConfig.Resolution.Y);
+	recorder::ParallelForStripes(Height, RecordConfig.ColorConvertWorkers, [&](int32 StartRow, int32 NumRows)
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("ConvertCapturedFrame_Stripe");
+		const uint8* StripeSrc = Src + StartRow * SrcStride;
+		if (VideoInputFormat == AV_PIX_FMT_NV12 || VideoInputFormat == AV_PIX_FMT_P010)
+		{
+			const recorder::FNV12Planes Planes{
+				InVideoFrame->data[0] + StartRow * InVideoFrame->linesize[0], InVideoFrame->linesize[0],
+				InVideoFrame->data[1] + StartRow / 2 * InVideoFrame->linesize[1], InVideoFrame->linesize[1],
+			};
+			if (VideoInputFormat == AV_PIX_FMT_P010)
+			{
+				recorder::ConvertA2B10G10R10ToP010(StripeSrc, SrcStride, Planes, Width, NumRows);
+			}
+			else
+			{
+				recorder::ConvertA2B10G10R10ToNV12(StripeSrc, SrcStride, Planes, Width, NumRows);
+			}
+			return;
+		}
+		const recorder::FI420Planes Planes{
+			InVideoFrame->data[0] + StartRow * InVideoFrame->linesize[0], InVideoFrame->linesize[0],
+			InVideoFrame->data[1] + StartRow / 2 * InVideoFrame->linesize[1], InVideoFrame->linesize[1],
+			InVideoFrame->data[2] + StartRow / 2 * InVideoFrame->linesize[2], InVideoFrame->linesize[2],
+		};
+		if (VideoInputFormat == AV_PIX_FMT_YUV420P10)
+		{
+			recorder::ConvertA2B10G10R10ToI010(StripeSrc, SrcStride, Planes, Width, NumRows);
+		}
+		else
+		{
+			recorder::ConvertA2B10G10R10ToI420(StripeSrc, SrcStride, Planes, Width, NumRows);
+		}
+	});
 
 	InVideoFrame->width = RecordConfig.Resolution.X;
 	InVideoFrame->height = RecordConfig.Resolution.Y;
-	InVideoFrame->format = AV_PIX_FMT_YUV420P;
+	InVideoFrame->format = VideoInputFormat;
 }
 
 void FAVEncoder::CreateAudioSwr()
@@ -275,24 +563,195 @@ void FAVEncoder::CreateAudioSwr()
 	swr_init(audio_swr);
 }
 
-void FAVEncoder::EncodeVideoFrame(TQueue<FTimeSeq>& VideoTimeSequence, FEncodeData* rgb)
+bool FAVEncoder::ConvertVideoFrame(FVideoFrameSlot* Slot, AVFrame* OutFrame) const
+{
+	if (!AcquireVideoFrameBuffer(OutFrame))
+	{
+		UE_LOG(LogRecorder, Error, TEXT("ConvertVideoFrame: out of memory, frame %lf dropped"), Slot->StartSec)
+		return false;
+	}
+
+	// 需要缩放时先按截取区域的大小转换，缩放直接写进编码器的输入帧
+	AVFrame* ConvertTarget = capture_frame ? capture_frame : OutFrame;
+	if (Slot->Source.View.IsValid() && CanConvertDirectly(Slot->Source))
+	{
+		ConvertCapturedFrame(ConvertTarget, Slot->Source);
+	}
+	else
+	{
+		ChangeColorFormat(ConvertTarget, Slot->GetRawData());
+	}
+	if (capture_frame)
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("ResizeFrame");
+		return ResizeFrame(capture_frame, OutFrame);
+	}
+	return true;
+}
+
+bool FAVEncoder::ResizeFrame(const AVFrame* Source, AVFrame* OutFrame) const
+{
+	static_assert(static_cast<int32>(ERecorderScaleFilter::Box) == libyuv::kFilterBox,
+	              "ERecorderScaleFilter must match libyuv::FilterMode");
+	const libyuv::FilterMode Filter = static_cast<libyuv::FilterMode>(RecordConfig.ScaleFilter);
+	if (Source->format != OutFrame->format)
+	{
+		return false;
+	}
+	if (Source->format == AV_PIX_FMT_YUV420P10)
+	{
+		// 16bit 版本的行宽以采样为单位
+		return libyuv::I420Scale_16(reinterpret_cast<const uint16*>(Source->data[0]), Source->linesize[0] / 2,
+		                            reinterpret_cast<const uint16*>(Source->data[1]), Source->linesize[1] / 2,
+		                            reinterpret_cast<const uint16*>(Source->data[2]), Source->linesize[2] / 2,
+		                            Source->width, Source->height,
+		                            reinterpret_cast<uint16*>(OutFrame->data[0]), OutFrame->linesize[0] / 2,
+		                            reinterpret_cast<uint16*>(OutFrame->data[1]), OutFrame->linesize[1] / 2,
+		                            reinterpret_cast<uint16*>(OutFrame->data[2]), OutFrame->linesize[2] / 2,
+		                            OutFrame->width, OutFrame->height, Filter) == 0;
+	}
+	if (Source->format == AV_PIX_FMT_P010)
+	{
+		return ResizeP010(Source, OutFrame, Filter);
+	}
+	if (Source->format == AV_PIX_FMT_NV12)
+	{
+		return libyuv::NV12Scale(Source->data[0], Source->linesize[0],
+		                         Source->data[1], Source->linesize[1],
+		                         Source->width, Source->height,
+		                         OutFrame->data[0], OutFrame->linesize[0],
+		                         OutFrame->data[1], OutFrame->linesize[1],
+		                         OutFrame->width, OutFrame->height, Filter) == 0;
+	}
+	return libyuv::I420Scale(Source->data[0], Source->linesize[0],
+	                         Source->data[1], Source->linesize[1],
+	                         Source->data[2], Source->linesize[2],
+	                         Source->width, Source->height,
+	                         OutFrame->data[0], OutFrame->linesize[0],
+	                         OutFrame->data[1], OutFrame->linesize[1],
+	                         OutFrame->data[2], OutFrame->linesize[2],
+	                         OutFrame->width, OutFrame->height, Filter) == 0;
+}
+
+bool FAVEncoder::ResizeP010(const AVFrame* Source, AVFrame* OutFrame, libyuv::FilterMode Filter) const
+{
+	const int32 SrcChromaWidth = (Source->width + 1) / 2;
+	const int32 SrcChromaHeight = (Source->height + 1) / 2;
+	const int32 DstChromaWidth = (OutFrame->width + 1) / 2;
+	const int32 DstChromaHeight = (OutFrame->height + 1) / 2;
+	const int32 SrcChromaSize = SrcChromaWidth * SrcChromaHeight;
+	const int32 DstChromaSize = DstChromaWidth * DstChromaHeight;
+	ResizeChromaScratch.SetNumUninitialized(2 * (SrcChromaSize + DstChromaSize), false);
+	uint16* SrcU = ResizeChromaScratch.GetData();
+	uint16* SrcV = SrcU + SrcChromaSize;
+	uint16* DstU = SrcV + SrcChromaSize;
+	uint16* DstV = DstU + DstChromaSize;
+
+	// 16bit 的行宽以采样为单位；depth 传 16，拆分和交错时都不移位，值保持在高 10 位
+	libyuv::ScalePlane_16(reinterpret_cast<const uint16*>(Source->data[0]), Source->linesize[0] / 2,
+	                      Source->width, Source->height,
+	                      reinterpret_cast<uint16*>(OutFrame->data[0]), OutFrame->linesize[0] / 2,
+	                      OutFrame->width, OutFrame->height, Filter);
+	libyuv::SplitUVPlane_16(reinterpret_cast<const uint16*>(Source->data[1]), Source->linesize[1] / 2,
+	                        SrcU, SrcChromaWidth, SrcV, SrcChromaWidth, SrcChromaWidth, SrcChromaHeight, 16);
+	libyuv::ScalePlane_16(SrcU, SrcChromaWidth, SrcChromaWidth, SrcChromaHeight,
+	                      DstU, DstChromaWidth, DstChromaWidth, DstChromaHeight, Filter);
+	libyuv::ScalePlane_16(SrcV, SrcChromaWidth, SrcChromaWidth, SrcChromaHeight,
+	                      DstV, DstChromaWidth, DstChromaWidth, DstChromaHeight, Filter);
+	libyuv::MergeUVPlane_16(DstU, DstChromaWidth, DstV, DstChromaWidth,
+	                        reinterpret_cast<uint16*>(OutFrame->data[1]), OutFrame->linesize[1] / 2,
+	                        DstChromaWidth, DstChromaHeight, 16);
+	return true;
+}
+
+bool FAVEncoder::ScaleVideoFrame(const AVFrame* Source, AVFrame* OutFrame) const
+{
+	if (!AcquireVideoFrameBuffer(OutFrame))
+	{
+		UE_LOG(LogRecorder, Error, TEXT("ScaleVideoFrame: out of memory"))
+		return false;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("ResizeFrame");
+	return ResizeFrame(Source, OutFrame);
+}
+
+void FAVEncoder::EncodeVideoFrame(AVFrame* Frame, const FTimeSeq& VideoTime)
+{
+	av_frame_unref(video_frame);
+	av_frame_move_ref(video_frame, Frame);
+	SendVideoFrame(VideoTime);
+}
+
+void FAVEncoder::ExtendLastVideoFrame(double ExtraDuration)
+{
+	FPendingVideoTime* Last = NextVideoPts > 0
+		                          ? &PendingVideoTimes[(NextVideoPts - 1) % PENDING_VIDEO_TIME_CAPACITY]
+		                          : nullptr;
+	if (Last && Last->bPending && Last->Pts == NextVideoPts - 1)
+	{
+		Last->Time.Duration += ExtraDuration;
+	}
+	else
+	{
+		// 上一帧的 packet 已经写出去了，只能让音频对齐的时间轴跟上
+		CurrentEncodeVideoTime.store(CurrentEncodeVideoTime.load() + ExtraDuration);
+	}
+	LastSentVideoTime.Duration += ExtraDuration;
+}
+
+void FAVEncoder::RepeatLastVideoFrame(int32 Count, double TotalDuration)
+{
+	// 还没有编码过任何画面，没有可以重复的帧
+	if (Count <= 0 || LastSentVideoTime.Duration <= 0 || !video_frame->buf[0])
+	{
+		return;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("RepeatLastVideoFrame");
+	const double Step = TotalDuration / Count;
+	const double StartTime = LastSentVideoTime.Current + LastSentVideoTime.Duration;
+	for (int32 Index = 0; Index < Count; ++Index)
+	{
+		SendVideoFrame({StartTime + Index * Step, Step});
+	}
+}
+
+void FAVEncoder::SendVideoFrame(const FTimeSeq& InVideoTime)
 {
-	ChangeColorFormat(video_frame, rgb->GetRawData());
+	LastSentVideoTime = InVideoTime;
+	FPendingVideoTime& Pending = PendingVideoTimes[NextVideoPts % PENDING_VIDEO_TIME_CAPACITY];
+	if (Pending.bPending)
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("SendVideoFrame: too many frames pending in encoder, time of %lf lost"),
+		       Pending.Time.Current)
+	}
+	Pending.Time = InVideoTime;
+	Pending.Time.SendCycles = FPlatformTime::Cycles64();
+	Pending.Pts = NextVideoPts;
+	Pending.bPending = true;
+	// 编码器只看到连续的帧序号，真实的时间在产出 packet 时按序号找回；滤镜只做缩放和格式转换，pts 原样带过去
+	video_frame->pts = NextVideoPts++;
 
 	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("Encode_Video_Frame");
-	// use ffmpeg to encode frame
-	AVPacket* video_pkt = av_packet_alloc();
-	AVFrame* filt_frame = av_frame_alloc();
+	++SentVideoFrameCount;
+	// 不需要滤镜时直接送进编码器，省掉滤镜图的调度；
+	// video_frame 的缓存来自引用计数的池，编码器只增加引用，不会拷贝整帧
+	if (!filter_graph)
+	{
+		SendFrameToVideoEncoder(video_frame);
+		return;
+	}
 
+	// video_frame 还要留给 RepeatLastVideoFrame 使用，带引用计数的帧 KEEP_REF 只是多一个引用
 	if (av_buffersrc_add_frame_flags(buffersrc_ctx, video_frame, AV_BUFFERSRC_FLAG_KEEP_REF) < 0)
 	{
 		check(false);
 	}
-	FTimeSeq VideoTime;
 	while (true)
 	{
 		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("ffmpeg_encode_frame");
-		int ret = av_buffersink_get_frame(buffersink_ctx, filt_frame);
+		int ret = av_buffersink_get_frame(buffersink_ctx, filtered_video_frame);
 		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
 		{
 			break;
@@ -301,57 +760,99 @@ void FAVEncoder::EncodeVideoFrame(TQueue<FTimeSeq>& VideoTimeSequence, FEncodeDa
 		{
 			break;
 		}
-		if (ret >= 0)
+		SendFrameToVideoEncoder(filtered_video_frame);
+		av_frame_unref(filtered_video_frame);
+	}
+}
+
+void FAVEncoder::SendFrameToVideoEncoder(AVFrame* InFrame)
+{
+	// use ffmpeg to encode frame
+	AVPacket* video_pkt = video_packet;
+
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("avcodec_send_frame");
+		avcodec_send_frame(video_encoder_codec_context, InFrame);
+	}
+
+	FTimeSeq VideoTime;
+	int ret = 0;
+	while (ret >= 0)
+	{
 		{
+			TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("avcodec_receive_packet");
+			ret = avcodec_receive_packet(video_encoder_codec_context, video_pkt);
+			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
 			{
-				TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("avcodec_send_frame");
-				avcodec_send_frame(video_encoder_codec_context, filt_frame);
+				av_packet_unref(video_pkt);
+				break;
 			}
-			while (ret >= 0)
+			if (ret < 0)
 			{
-				{
-					TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("avcodec_receive_packet");
-					ret = avcodec_receive_packet(video_encoder_codec_context, video_pkt);
-					if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-					{
-						av_packet_unref(video_pkt);
-						break;
-					}
-					if (ret < 0)
-					{
-						av_packet_unref(video_pkt);
-						break;
-					}
-				}
-				// TODO 从队列中取
-				if (VideoTimeSequence.Dequeue(VideoTime))
-				{
-					video_pkt->stream_index = video_index;
-					video_pkt->pts = video_pkt->dts = floor(VideoTime.Current * out_video_stream->time_base.den);
-					video_pkt->duration = VideoTime.Duration * out_video_stream->time_base.den;
-
-					CurrentEncodeVideoTime = VideoTime.Current + VideoTime.Duration;
-
-					UE_LOG(LogRecorder, Log,
-					       TEXT("EncodeVideoFrame: VideoTime=%lf, Duration=%lf, pts=%lld, duration=%lld, den=%d"),
-					       VideoTime.Current, VideoTime.Duration, video_pkt->pts, video_pkt->duration,
-					       out_video_stream->time_base.den)
-
-					{
-						TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("av_write_frame");
-						av_write_frame(out_format_context, video_pkt);
-					}
-				}
+				av_packet_unref(video_pkt);
+				break;
 			}
-			av_packet_unref(video_pkt);
 		}
+		if (StampVideoPacket(video_pkt, VideoTime))
+		{
+			UE_LOG(LogRecorder, Log,
+			       TEXT("EncodeVideoFrame: VideoTime=%lf, Duration=%lf, pts=%lld, duration=%lld, den=%d"),
+			       VideoTime.Current, VideoTime.Duration, video_pkt->pts, video_pkt->duration,
+			       out_video_stream->time_base.den)
+
+			WritePacket(video_pkt, VideoTime.CaptureCycles);
+		}
+		av_packet_unref(video_pkt);
+	}
+}
+
+bool FAVEncoder::StampVideoPacket(AVPacket* Packet, FTimeSeq& OutTime)
+{
+	if (Packet->pts < 0)
+	{
+		return false;
+	}
+	FPendingVideoTime& Pending = PendingVideoTimes[Packet->pts % PENDING_VIDEO_TIME_CAPACITY];
+	if (!Pending.bPending || Pending.Pts != Packet->pts)
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("StampVideoPacket: no pending frame for packet pts %lld"), Packet->pts)
+		return false;
 	}
-	av_frame_unref(filt_frame);
+	Pending.bPending = false;
+	OutTime = Pending.Time;
+
+	CaptureLatency.Record(OutTime.Current, OutTime.CaptureCycles);
+	SendToPacketLatency.Record(FPlatformTime::Cycles64() - OutTime.SendCycles);
 
+	int64 Pts = floor(OutTime.Current * out_video_stream->time_base.den);
+	// 有 B 帧时 dts 比 pts 早几帧，这个差按编码器的时间基换算到输出时间基
+	int64 Dts = Pts;
+	if (Packet->dts != AV_NOPTS_VALUE && Packet->dts < Packet->pts)
+	{
+		Dts -= av_rescale_q(Packet->pts - Packet->dts, video_encoder_codec_context->time_base,
+		                    out_video_stream->time_base);
+	}
+	// 丢帧后帧时长不均匀，换算出的 dts 可能不再递增
+	if (LastVideoDts != INT64_MIN)
 	{
-		av_frame_free(&filt_frame);
-		av_packet_free(&video_pkt);
+		Dts = FMath::Max(Dts, LastVideoDts + 1);
 	}
+	// 往后推过的 dts 可能越过 pts，封装器不接受 pts < dts；丢掉这个 packet 会让引用它的帧花屏，所以把 pts 推到 dts
+	if (Dts > Pts)
+	{
+		UE_LOG(LogRecorder, Verbose, TEXT("StampVideoPacket: pts %lld is before dts %lld, clamped"), Pts, Dts)
+		Pts = Dts;
+	}
+	LastVideoDts = Dts;
+
+	Packet->stream_index = video_index;
+	Packet->pts = Pts;
+	Packet->dts = Dts;
+	Packet->duration = OutTime.Duration * out_video_stream->time_base.den;
+
+	// B 帧的 packet 不按显示顺序产出，已编码的视频时间只往前走
+	CurrentEncodeVideoTime.store(FMath::Max(CurrentEncodeVideoTime.load(), OutTime.Current + OutTime.Duration));
+	return true;
 }
 
 void FAVEncoder::EncodeAudioFrame(TQueue<FTimeSeq>& AudioTimeSequence, FEncodeData* rgb)
@@ -359,7 +860,7 @@ void FAVEncoder::EncodeAudioFrame(TQueue<FTimeSeq>& AudioTimeSequence, FEncodeDa
 	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("Encode_Audio_Frame");
 
 	const uint8_t* data = rgb->GetRawData();
-	AVPacket* audio_pkt = av_packet_alloc();
+	AVPacket* audio_pkt = audio_packet;
 
 	int count = swr_convert(audio_swr, outs, audio_frame->nb_samples * av_get_bytes_per_sample(AV_SAMPLE_FMT_FLTP),
 	                        &data, audio_encoder_codec_context->frame_size);
@@ -421,20 +922,24 @@ void FAVEncoder::EncodeAudioFrame(TQueue<FTimeSeq>& AudioTimeSequence, FEncodeDa
 			       out_audio_stream->time_base.den)
 		}
 
-		av_write_frame(out_format_context, audio_pkt);
-	}
-	av_packet_unref(audio_pkt);
-
-	{
-		// av_frame_free(&audio_frame);
-		av_packet_free(&audio_pkt);
+		WritePacket(audio_pkt);
+		av_packet_unref(audio_pkt);
 	}
 }
 
 void FAVEncoder::EndAudioEncoding(TQueue<FTimeSeq>& AudioTimeSequence)
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("EndAudioEncoding");
-	AVPacket* audio_pkt = av_packet_alloc();
+	// 之后不会再有音频 packet，封装线程不用再为交错等待音频
+	ON_SCOPE_EXIT
+	{
+		AudioMuxQueue.bEnded.store(true);
+		if (MuxStage)
+		{
+			MuxStage->Wake();
+		}
+	};
+	AVPacket* audio_pkt = audio_packet;
 	// av_init_packet(VideoPacket);
 	int ret = avcodec_send_frame(audio_encoder_codec_context, nullptr);
 	if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
@@ -476,7 +981,7 @@ void FAVEncoder::EndAudioEncoding(TQueue<FTimeSeq>& AudioTimeSequence)
 			       TEXT("EndAudioEncoding: AudioTime=%lf, Duration=%lf, pts=%lld, duration=%lld, den=%d"),
 			       Time.Current, Time.Duration, audio_pkt->pts, audio_pkt->duration, out_audio_stream->time_base.den)
 
-			Ret = av_write_frame(out_format_context, audio_pkt);
+			Ret = WritePacket(audio_pkt);
 		}
 
 		if (Ret < 0)
@@ -509,10 +1014,18 @@ void FAVEncoder::EndAudioEncoding(TQueue<FTimeSeq>& AudioTimeSequence)
 	// FMemory::Free(buff_bgr);
 }
 
-void FAVEncoder::EndVideoEncoding(TQueue<FTimeSeq>& VideoTimeSequence)
+void FAVEncoder::EndVideoEncoding()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("EndVideoEncoding");
-	AVPacket* VideoPacket = av_packet_alloc();
+	ON_SCOPE_EXIT
+	{
+		VideoMuxQueue.bEnded.store(true);
+		if (MuxStage)
+		{
+			MuxStage->Wake();
+		}
+	};
+	AVPacket* VideoPacket = video_packet;
 
 	avcodec_send_frame(video_encoder_codec_context, nullptr);
 
@@ -530,21 +1043,15 @@ void FAVEncoder::EndVideoEncoding(TQueue<FTimeSeq>& VideoTimeSequence)
 			av_packet_unref(VideoPacket);
 			break;
 		}
-		VideoPacket->stream_index = video_index;
-
-		if (VideoTimeSequence.Dequeue(Time))
+		if (StampVideoPacket(VideoPacket, Time))
 		{
-			VideoPacket->pts = VideoPacket->dts = floor(Time.Current * out_video_stream->time_base.den);
-			VideoPacket->duration = Time.Duration * out_video_stream->time_base.den;
-
-			CurrentEncodeVideoTime = Time.Current + Time.Duration;
-
 			UE_LOG(LogRecorder, Log,
 			       TEXT("EndVideoEncoding: VideoTime=%lf, Duration=%lf, pts=%lld, duration=%lld, den=%d"),
 			       Time.Current, Time.Duration, VideoPacket->pts, VideoPacket->duration,
 			       out_video_stream->time_base.den)
-			av_write_frame(out_format_context, VideoPacket);
+			WritePacket(VideoPacket, Time.CaptureCycles);
 		}
+		av_packet_unref(VideoPacket);
 	}
 	av_packet_unref(VideoPacket);
 }
@@ -560,7 +1067,15 @@ void FAVEncoder::SetAudioVolume(AVFrame* frame)
 	}
 }
 
-void FAVEncoder::AllocVideoFilter()
+bool FAVEncoder::IsVideoFilterRequired() const
+{
+	// 送进来的画面已经由 libyuv 缩放成输出分辨率、转换成协商好的格式，滤镜图里的 swscale 只剩编码器不接受 I420/NV12 时才需要
+	return video_encoder_codec_context->width != RecordConfig.GetOutputResolution().X
+		|| video_encoder_codec_context->height != RecordConfig.GetOutputResolution().Y
+		|| video_encoder_codec_context->pix_fmt != VideoInputFormat;
+}
+
+void FAVEncoder::AllocVideoFilter()
 {
 	outputs = avfilter_inout_alloc();
 	inputs = avfilter_inout_alloc();
@@ -571,7 +1086,8 @@ void FAVEncoder::AllocVideoFilter()
 	int ret = 0;
 
 	filter_graph = avfilter_graph_alloc();
-	if (!outputs || !inputs || !filter_graph)
+	filtered_video_frame = av_frame_alloc();
+	if (!outputs || !inputs || !filter_graph || !filtered_video_frame)
 	{
 		check(false);
 	}
@@ -580,7 +1096,7 @@ void FAVEncoder::AllocVideoFilter()
 	snprintf(args, sizeof(args),
 	         "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
 	         video_encoder_codec_context->width, video_encoder_codec_context->height,
-	         video_encoder_codec_context->pix_fmt,
+	         VideoInputFormat,
 	         time_base.num, time_base.den,
 	         video_encoder_codec_context->sample_aspect_ratio.num,
 	         video_encoder_codec_context->sample_aspect_ratio.den);
@@ -626,12 +1142,244 @@ void FAVEncoder::AllocVideoFilter()
 	}
 }
 
+void FAVEncoder::CreateOutputSinks()
+{
+	for (const FString& Url : RecordConfig.AdditionalOutputs)
+	{
+		// 主输出的时间基在写文件头时已经确定，额外的输出按它换算
+		TUniquePtr<FOutputSink>& Sink = OutputSinks.Add_GetRef(
+			MakeUnique<FOutputSink>(RecordConfig, out_format_context, Url.TrimStartAndEnd()));
+		Sink->Start();
+	}
+}
+
+void FAVEncoder::StartMuxing()
+{
+	for (FMuxStreamQueue* Queue : {&VideoMuxQueue, &AudioMuxQueue})
+	{
+		Queue->Ready.Initialize(MUX_QUEUE_CAPACITY);
+		Queue->Free.Initialize(MUX_QUEUE_CAPACITY);
+		Queue->Packets.Reset(MUX_QUEUE_CAPACITY);
+		for (uint32 Index = 0; Index < MUX_QUEUE_CAPACITY; ++Index)
+		{
+			AVPacket* Packet = Queue->Packets.Add_GetRef(av_packet_alloc());
+			Queue->Free.Enqueue(Packet);
+		}
+		Queue->FreedEvent = FGenericPlatformProcess::GetSynchEventFromPool();
+		Queue->bEnded.store(false);
+	}
+
+	MuxStage = MakeUnique<FPipelineStage>(TEXT("RecorderMuxThread"),
+	                                      [this]() { return MuxOnePacket_MuxThread(); },
+	                                      [this]()
+	                                      {
+		                                      return !VideoMuxQueue.Ready.IsEmpty() || !AudioMuxQueue.Ready.IsEmpty();
+	                                      });
+	MuxStage->Start();
+}
+
+void FAVEncoder::StopMuxing()
+{
+	if (MuxStage)
+	{
+		MuxStage->RequestStop();
+		MuxStage->Join();
+		MuxStage->GetStats().Log(ReportPrefix + TEXT("Mux"), SessionReport);
+		MuxStage.Reset();
+	}
+	for (FMuxStreamQueue* Queue : {&VideoMuxQueue, &AudioMuxQueue})
+	{
+		if (Queue->FreedEvent)
+		{
+			FGenericPlatformProcess::ReturnSynchEventToPool(Queue->FreedEvent);
+			Queue->FreedEvent = nullptr;
+		}
+		for (AVPacket*& Packet : Queue->Packets)
+		{
+			av_packet_free(&Packet);
+		}
+		Queue->Packets.Empty();
+	}
+}
+
+void FAVEncoder::SetSessionReport(FRecorderSessionReport* Report, const FString& Prefix)
+{
+	SessionReport = Report;
+	ReportPrefix = Prefix;
+}
+
+int FAVEncoder::WritePacket(AVPacket* Packet, uint64 CaptureCycles)
+{
+	// 封装线程已经停了（或者还没启动），直接写
+	if (!MuxStage)
+	{
+		const int Ret = WriteOutputPacket(Packet);
+		RecordMuxLatency(CaptureCycles);
+		return Ret;
+	}
+
+	FMuxStreamQueue& Queue = Packet->stream_index == audio_index ? AudioMuxQueue : VideoMuxQueue;
+	AVPacket* QueuedPacket = nullptr;
+	if (!Queue.Free.Dequeue(QueuedPacket))
+	{
+		// 封装线程跟不上，等它还回 packet，队列有界，内存不会无限增长
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("WaitMuxQueue");
+		const uint64 StallStartCycles = FPlatformTime::Cycles64();
+		while (!Queue.Free.Dequeue(QueuedPacket))
+		{
+			MuxStage->Wake();
+			Queue.FreedEvent->Wait(1);
+		}
+		MuxStage->GetStats().RecordStall(FPlatformTime::Cycles64() - StallStartCycles);
+	}
+	av_packet_move_ref(QueuedPacket, Packet);
+	Queue.Ready.Enqueue({QueuedPacket, FPlatformTime::Cycles64(), CaptureCycles});
+	MuxStage->Wake();
+	return 0;
+}
+
+bool FAVEncoder::MuxOnePacket_MuxThread()
+{
+	FQueuedPacket* VideoHead = VideoMuxQueue.Ready.Peek();
+	FQueuedPacket* AudioHead = AudioMuxQueue.Ready.Peek();
+	if (!VideoHead && !AudioHead)
+	{
+		return false;
+	}
+
+	// 两路都有 packet 时先写 dts 小的，只有一路有时看是否还需要等另一路
+	bool bWriteVideo;
+	if (VideoHead && AudioHead)
+	{
+		bWriteVideo = av_compare_ts(VideoHead->Packet->dts, out_video_stream->time_base,
+		                            AudioHead->Packet->dts, out_audio_stream->time_base) <= 0;
+	}
+	else
+	{
+		bWriteVideo = VideoHead != nullptr;
+		if (!ShouldFlushUnpaired_MuxThread(bWriteVideo))
+		{
+			return false;
+		}
+	}
+	FMuxStreamQueue& Queue = bWriteVideo ? VideoMuxQueue : AudioMuxQueue;
+
+	const uint32 QueueDepth = VideoMuxQueue.Ready.Num() + AudioMuxQueue.Ready.Num();
+	FQueuedPacket Queued;
+	Queue.Ready.Dequeue(Queued);
+
+	const int32 StreamIndex = Queued.Packet->stream_index;
+	const int64 Pts = Queued.Packet->pts;
+	const int Ret = WriteOutputPacket(Queued.Packet);
+	if (Ret < 0)
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("MuxOnePacket_MuxThread: av_write_frame failed (%d), stream %d pts %lld"),
+		       Ret, StreamIndex, Pts)
+	}
+	av_packet_unref(Queued.Packet);
+	MuxStage->GetStats().RecordItem(Queued.EnqueueCycles, QueueDepth);
+	RecordMuxLatency(Queued.CaptureCycles);
+
+	Queue.Free.Enqueue(Queued.Packet);
+	Queue.FreedEvent->Trigger();
+	return true;
+}
+
+int FAVEncoder::WriteOutputPacket(AVPacket* Packet)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("av_write_frame");
+	for (const TUniquePtr<FOutputSink>& Sink : OutputSinks)
+	{
+		Sink->Enqueue(Packet);
+	}
+	MuxedBytes.fetch_add(Packet->size, std::memory_order_relaxed);
+	if (ReplayBuffer)
+	{
+		// 回放缓存复制一份数据，Packet 照常由调用者释放
+		ReplayBuffer->AddPacket(Packet);
+		return 0;
+	}
+	return SegmentedOutput ? SegmentedOutput->WritePacket(Packet) : av_write_frame(out_format_context, Packet);
+}
+
+void FAVEncoder::RecordMuxLatency(uint64 CaptureCycles)
+{
+	if (CaptureCycles != 0)
+	{
+		CaptureToMuxLatency.Record(FPlatformTime::Cycles64() - CaptureCycles);
+	}
+}
+
+bool FAVEncoder::ShouldFlushUnpaired_MuxThread(bool bVideo)
+{
+	FMuxStreamQueue& Queue = bVideo ? VideoMuxQueue : AudioMuxQueue;
+	const FMuxStreamQueue& Other = bVideo ? AudioMuxQueue : VideoMuxQueue;
+	if (Other.bEnded.load() || Queue.Ready.Num() >= MUX_REORDER_DEPTH)
+	{
+		return true;
+	}
+	const FQueuedPacket* Head = Queue.Ready.Peek();
+	return Head && FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - Head->EnqueueCycles) >=
+		MUX_REORDER_WAIT_MS;
+}
+
+bool FAVEncoder::SaveReplay(const FString& Path, double Seconds)
+{
+	if (!ReplayBuffer)
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("SaveReplay: replay buffer is not enabled (rec.ReplayBufferMB)"))
+		return false;
+	}
+	return ReplayBuffer->SaveReplay(Path, Seconds);
+}
+
 void FAVEncoder::EncodeFinish()
 {
+	// 封装线程写完剩下的 packet 后才能写文件尾
+	StopMuxing();
+	for (int32 Index = 0; Index < OutputSinks.Num(); ++Index)
+	{
+		OutputSinks[Index]->Close(SessionReport, FString::Printf(TEXT("%ssink%d"), *ReportPrefix, Index));
+	}
+	OutputSinks.Empty();
+
+	CaptureLatency.Log(RecordConfig.SaveFilePath);
+	if (!RecordConfig.LatencyCsvPath.IsEmpty())
+	{
+		CaptureLatency.WriteCsv(RecordConfig.LatencyCsvPath);
+	}
+	if (SessionReport)
+	{
+		SessionReport->AddLatency(ReportPrefix + TEXT("send_to_packet"), SendToPacketLatency);
+		SessionReport->AddLatency(ReportPrefix + TEXT("capture_to_packet"), CaptureLatency.GetHistogram());
+		SessionReport->AddLatency(ReportPrefix + TEXT("capture_to_mux"), CaptureToMuxLatency);
+		SessionReport->AddCounter(ReportPrefix + TEXT("video_frames_encoded"),
+		                          static_cast<int64>(SentVideoFrameCount.load()));
+		SessionReport->AddCounter(ReportPrefix + TEXT("muxed_bytes"), static_cast<int64>(MuxedBytes.load()));
+	}
+
 	if (out_format_context)
 	{
-		av_write_trailer(out_format_context);
-		avio_close(out_format_context->pb);
+		if (ReplayBuffer)
+		{
+			// 模板上下文没有写过文件头，等还在写的回放文件写完
+			ReplayBuffer.Reset();
+		}
+		else if (SegmentedOutput)
+		{
+			// 模板上下文没有写过文件头，只需要收尾各个分段
+			SegmentedOutput->Close();
+			SegmentedOutput.Reset();
+		}
+		else
+		{
+			av_write_trailer(out_format_context);
+			if (SessionReport && out_format_context->pb)
+			{
+				SessionReport->AddCounter(ReportPrefix + TEXT("file_bytes"), avio_tell(out_format_context->pb));
+			}
+			recorder::CloseOutputIO(out_format_context, FileWriter);
+		}
 		avformat_free_context(out_format_context);
 		out_format_context = nullptr;
 	}
@@ -678,10 +1426,18 @@ void FAVEncoder::EncodeFinish()
 
 	av_frame_free(&video_frame);
 	video_frame = nullptr;
+	// 池里还有被引用的缓存时会延迟到最后一个引用释放后再销毁
+	av_buffer_pool_uninit(&video_frame_pool);
+	av_frame_free(&capture_frame);
+	av_frame_free(&capture_frame_8bit);
 
 	av_frame_free(&audio_frame);
 	audio_frame = nullptr;
 
+	av_frame_free(&filtered_video_frame);
+	av_packet_free(&video_packet);
+	av_packet_free(&audio_packet);
+
 	// if (out_video_stream)
 	// {
 	// 	// if (stream != NULL) {
@@ -701,9 +1457,10 @@ void FAVEncoder::EncodeFinish()
 	// }
 }
 
-FAVBufferedEncoder::FAVBufferedEncoder(): ThreadEvent(nullptr)
+FAVBufferedEncoder::FAVBufferedEncoder(): ThreadEvent(nullptr), VideoSlotEvent(nullptr)
 {
 	ThreadEvent = FGenericPlatformProcess::GetSynchEventFromPool();
+	VideoSlotEvent = FGenericPlatformProcess::GetSynchEventFromPool();
 }
 
 FAVBufferedEncoder::~FAVBufferedEncoder()
@@ -713,32 +1470,26 @@ FAVBufferedEncoder::~FAVBufferedEncoder()
 		FGenericPlatformProcess::ReturnSynchEventToPool(ThreadEvent);
 		ThreadEvent = nullptr;
 	}
-
-	FEncodeData* NewData;
-
+	if (VideoSlotEvent)
 	{
-		FScopeLock Lock(&VideoMutex);
-		while (!VideoBufferPool.IsEmpty())
-		{
-			if (VideoBufferPool.Dequeue(NewData))
-			{
-				delete NewData;
-				NewData = nullptr;
-			}
-		}
+		FGenericPlatformProcess::ReturnSynchEventToPool(VideoSlotEvent);
+		VideoSlotEvent = nullptr;
+	}
 
-		while (!VideoBuffer.IsEmpty())
-		{
-			if (VideoBuffer.Dequeue(NewData))
-			{
-				delete NewData;
-				NewData = nullptr;
-			}
-		}
+	// 正常结束时转换线程和音频编码线程已经在 Finalize 里退出了
+	ConvertStage.Reset();
+	AudioStage.Reset();
+	Renditions.Empty();
 
-		VideoTimeSequence.Empty();
+	// 视频槽位由 VideoSlots 持有，两个环形队列里只有裸指针
+	VideoSlots.Empty();
+	for (AVFrame*& Frame : VideoFrames)
+	{
+		av_frame_free(&Frame);
 	}
+	VideoFrames.Empty();
 
+	FEncodeData* NewData;
 	{
 		FScopeLock Lock(&AudioMutex);
 		while (!AudioBufferPool.IsEmpty())
@@ -762,20 +1513,77 @@ FAVBufferedEncoder::~FAVBufferedEncoder()
 	}
 }
 
-void FAVBufferedEncoder::Initialize(/*TSharedPtr<FAVEncoder>& InAVEncoder*/)
+void FAVBufferedEncoder::Initialize(const FRecorderConfig& InRecordConfig)
 {
-	// Encoder = InAVEncoder;
 	Encoder = MakeShared<FAVEncoder>();
+	Encoder->InitializeEncoder(InRecordConfig);
+	Encoder->SetSessionReport(&SessionReport, FString());
+	for (const FRecorderRendition& Rendition : InRecordConfig.Renditions)
+	{
+		TUniquePtr<FRenditionEncoder>& RenditionEncoder = Renditions.Add_GetRef(
+			MakeUnique<FRenditionEncoder>(InRecordConfig, Rendition));
+		RenditionEncoder->Initialize(&SessionReport);
+	}
+
+	const FIntPoint OutputResolution = InRecordConfig.GetOutputResolution();
+	SessionReport.AddInfo(TEXT("started_at"), FDateTime::UtcNow().ToIso8601());
+	SessionReport.AddInfo(TEXT("output"), recorder::RedactOutputUrl(InRecordConfig.SaveFilePath));
+	SessionReport.AddInfo(TEXT("video_encoder"),
+	                      Encoder->GetVideoBackend() ? Encoder->GetVideoBackend()->GetName() : TEXT("none"));
+	SessionReport.AddInfo(TEXT("resolution"), FString::Printf(TEXT("%dx%d"), OutputResolution.X, OutputResolution.Y));
+	SessionReport.AddInfo(TEXT("frame_rate"), FString::FromInt(InRecordConfig.FrameRate));
+	SessionReport.AddInfo(TEXT("video_bit_rate"), FString::FromInt(InRecordConfig.VideoBitRate));
+	SessionReport.AddInfo(TEXT("low_latency"), InRecordConfig.bLowLatency ? TEXT("true") : TEXT("false"));
+	SessionReport.AddInfo(TEXT("video_queue_policy"),
+	                      FString::FromInt(static_cast<int32>(InRecordConfig.VideoQueuePolicy)));
+	SessionReport.AddInfo(TEXT("video_queue_depth"), FString::FromInt(InRecordConfig.MaxVideoQueueDepth));
+
+	VideoQueuePolicy = InRecordConfig.VideoQueuePolicy;
+	MaxVideoQueueDepth = FMath::Max(1, InRecordConfig.MaxVideoQueueDepth);
+	const uint32 SlotCount = MaxVideoQueueDepth + 2;
+
+	VideoBufferPool.Initialize(SlotCount);
+	VideoBuffer.Initialize(SlotCount);
+	const int32 FrameBytes = InRecordConfig.Resolution.X * InRecordConfig.Resolution.Y * 4;
+	VideoSlots.Reset(SlotCount);
+	for (uint32 Index = 0; Index < SlotCount; ++Index)
+	{
+		TUniquePtr<FVideoFrameSlot>& Slot = VideoSlots.Add_GetRef(MakeUnique<FVideoFrameSlot>());
+		Slot->Data.SetNumUninitialized(FrameBytes);
+		VideoBufferPool.Enqueue(Slot.Get());
+	}
+
+	ConvertedVideoFrames.Initialize(CONVERTED_FRAME_CAPACITY);
+	FreeVideoFrames.Initialize(CONVERTED_FRAME_CAPACITY);
+	VideoFrames.Reset(CONVERTED_FRAME_CAPACITY);
+	for (uint32 Index = 0; Index < CONVERTED_FRAME_CAPACITY; ++Index)
+	{
+		FreeVideoFrames.Enqueue(VideoFrames.Add_GetRef(av_frame_alloc()));
+	}
+
+	ConvertStage = MakeUnique<FPipelineStage>(TEXT("RecorderConvertThread"),
+	                                          [this]() { return ConvertOneVideoFrame_ConvertThread(); },
+	                                          [this]() { return !VideoBuffer.IsEmpty(); });
+	ConvertStage->Start();
+
+	AudioStage = MakeUnique<FPipelineStage>(TEXT("RecorderAudioEncodeThread"),
+	                                        [this]() { return EncodeOneAudioFrame_AudioEncodeThread(); },
+	                                        [this]() { return CanEncodeNextAudioFrame(); });
+	AudioStage->Start();
 }
 
 bool FAVBufferedEncoder::WaitBufferInsert(bool bForce)
 {
-	if (bForce || (VideoBuffer.IsEmpty() && !Encoder->ShouldContinueAudioEncoding()))
+	if (bForce || ConvertedVideoFrames.IsEmpty())
 	{
 		if (ThreadEvent)
 		{
 			TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("EncodeThreadWait");
-			ThreadEvent->Wait();
+			// 捕获停下来时也要按周期采样，否则实时统计会停在最后一次编码时的值
+			if (!ThreadEvent->Wait(static_cast<uint32>(LIVE_STATS_INTERVAL_SEC * 1000)))
+			{
+				UpdateLiveStats_EncoderThread();
+			}
 		}
 	}
 	return true;
@@ -783,7 +1591,7 @@ bool FAVBufferedEncoder::WaitBufferInsert(bool bForce)
 
 bool FAVBufferedEncoder::ReleaseBufferWait(bool bForce)
 {
-	if (bForce || !(VideoBuffer.IsEmpty() && !Encoder->ShouldContinueAudioEncoding()))
+	if (bForce || !ConvertedVideoFrames.IsEmpty())
 	{
 		if (ThreadEvent)
 		{
@@ -797,45 +1605,232 @@ bool FAVBufferedEncoder::ReleaseBufferWait(bool bForce)
 void FAVBufferedEncoder::EncodeFrame_EncoderThread(bool bWaitIfBufferEmpty)
 {
 	EncodeOneVideoFrame_EncoderThread();
-	EncodeAudioFrames_EncoderThread();
+	UpdateLiveStats_EncoderThread();
 	if (bWaitIfBufferEmpty)
 	{
 		WaitBufferInsert();
 	}
 }
 
-void FAVBufferedEncoder::EncodeOneVideoFrame_EncoderThread()
+FRecorderStats FAVBufferedEncoder::GetLiveStats() const
+{
+	FScopeLock Lock(&LiveStatsMutex);
+	return LiveStats;
+}
+
+void FAVBufferedEncoder::UpdateLiveStats_EncoderThread()
+{
+	const uint64 NowCycles = FPlatformTime::Cycles64();
+	if (LastLiveStatsCycles == 0)
+	{
+		LastLiveStatsCycles = NowCycles;
+		return;
+	}
+	const double Seconds = FPlatformTime::ToSeconds64(NowCycles - LastLiveStatsCycles);
+	if (Seconds < LIVE_STATS_INTERVAL_SEC)
+	{
+		return;
+	}
+
+	const uint64 EncodedFrames = Encoder->GetSentVideoFrameCount();
+	const uint64 EncodeItems = EncodeStats.ProcessedCount.load(std::memory_order_relaxed);
+	const uint64 EncodeBusyCycles = EncodeStats.BusyCycles.load(std::memory_order_relaxed);
+	const uint64 MuxedBytes = Encoder->GetMuxedBytes();
+
+	FRecorderStats Stats;
+	Stats.VideoBufferDepth = VideoBuffer.Num();
+	Stats.AudioBufferDepth = PendingAudioFrames.load(std::memory_order_relaxed);
+	Stats.FreeVideoSlots = VideoBufferPool.Num();
+	Stats.EncodedFps = (EncodedFrames - LastEncodedFrames) / Seconds;
+	Stats.EncodeMsPerFrame = EncodeItems > LastEncodeItems
+		                         ? FPlatformTime::ToMilliseconds64(EncodeBusyCycles - LastEncodeBusyCycles) /
+		                         (EncodeItems - LastEncodeItems)
+		                         : 0;
+	Stats.OutputBitrateKbps = (MuxedBytes - LastMuxedBytes) * 8 / 1000.0 / Seconds;
+	Stats.DroppedVideoFrames = GetDroppedVideoFrames();
+	Stats.AVDriftMs = Encoder->GetEncodedAVDrift() * 1000.0;
+
+	LastLiveStatsCycles = NowCycles;
+	LastEncodedFrames = EncodedFrames;
+	LastEncodeItems = EncodeItems;
+	LastEncodeBusyCycles = EncodeBusyCycles;
+	LastMuxedBytes = MuxedBytes;
+
+	{
+		FScopeLock Lock(&LiveStatsMutex);
+		LiveStats = Stats;
+	}
+	recorder::PublishLiveStats(Stats);
+}
+
+bool FAVBufferedEncoder::ConvertOneVideoFrame_ConvertThread()
+{
+	DropOldestVideoFrames_ConvertThread();
+
+	// 先确认有空闲帧再取槽位，编码线程跟不上时槽位留在队列里，由渲染线程按策略丢帧
+	const uint32 QueueDepth = VideoBuffer.Num();
+	if (QueueDepth == 0)
+	{
+		return false;
+	}
+	AVFrame* Frame;
+	if (!FreeVideoFrames.Dequeue(Frame))
+	{
+		return false;
+	}
+	FVideoFrameSlot* Slot;
+	verify(VideoBuffer.Dequeue(Slot));
+
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("ConvertOneVideoFrame_ConvertThread");
+	// 借用的 readback 内存拷贝完立刻释放，渲染线程下一帧就可以 Unmap；
+	// 可以直接转换的格式由编码器从 readback 内存读取，转换后随槽位一起释放
+	if (Slot->Source.View.IsValid() && !FAVEncoder::CanConvertDirectly(Slot->Source))
+	{
+		RepackVideoFrame(Slot->Source, Slot);
+		Slot->Source.View.Reset();
+	}
+	if (!Encoder->ConvertVideoFrame(Slot, Frame))
+	{
+		av_frame_unref(Frame);
+	}
+
+	FConvertedVideoFrame Converted;
+	Converted.Frame = Frame;
+	Converted.Time = {Slot->StartSec, Slot->Duration, Slot->CaptureCycles};
+	Converted.DroppedCount = Slot->DroppedCount + ConvertDroppedCount;
+	Converted.DroppedDuration = Slot->DroppedDuration + ConvertDroppedDuration;
+	Converted.EnqueueCycles = FPlatformTime::Cycles64();
+	ConvertDroppedCount = 0;
+	ConvertDroppedDuration = 0;
+
+	ConvertStage->GetStats().RecordItem(Slot->EnqueueCycles, QueueDepth);
+	ReleaseVideoSlot_ConvertThread(Slot);
+
+	// 帧对象和队列容量一样多，这里不会失败
+	verify(ConvertedVideoFrames.Enqueue(Converted));
+	ReleaseBufferWait();
+	return true;
+}
+
+bool FAVBufferedEncoder::EncodeOneVideoFrame_EncoderThread()
 {
 	check(!IsInRenderingThread())
 
 	UE_LOG(LogRecorder, Verbose, TEXT("EncodeOneVideoFrame_EncoderThread"))
-	if (!VideoBuffer.IsEmpty())
+
+	const uint32 QueueDepth = ConvertedVideoFrames.Num();
+	FConvertedVideoFrame Converted;
+	if (!ConvertedVideoFrames.Dequeue(Converted))
+	{
+		return false;
+	}
+
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+	// 各档先引用这一帧，之后帧的引用会转移给主编码器
+	for (const TUniquePtr<FRenditionEncoder>& RenditionEncoder : Renditions)
 	{
-		FEncodeData* EncodeData;
-		if (VideoBuffer.Dequeue(EncodeData))
+		RenditionEncoder->EnqueueVideoFrame(Converted);
+	}
+	// 先把这一帧之前丢掉的时长补回去，再编码这一帧
+	if (Converted.DroppedCount > 0)
+	{
+		if (VideoQueuePolicy == ERecorderQueuePolicy::DuplicateLast)
+		{
+			Encoder->RepeatLastVideoFrame(Converted.DroppedCount, Converted.DroppedDuration);
+		}
+		else
 		{
-			Encoder->EncodeVideoFrame(VideoTimeSequence, EncodeData);
-			VideoBufferPool.Enqueue(EncodeData);
+			Encoder->ExtendLastVideoFrame(Converted.DroppedDuration);
 		}
 	}
+	if (Converted.Frame->buf[0])
+	{
+		ConvertedToSendLatency.Record(FPlatformTime::Cycles64() - Converted.EnqueueCycles);
+		Encoder->EncodeVideoFrame(Converted.Frame, Converted.Time);
+	}
+	else
+	{
+		// 转换失败的帧
+		++DroppedVideoFrames;
+		Encoder->ExtendLastVideoFrame(Converted.Time.Duration);
+	}
+
+	EncodeStats.RecordBusy(FPlatformTime::Cycles64() - StartCycles);
+	EncodeStats.RecordItem(Converted.EnqueueCycles, QueueDepth);
+
+	// 帧的引用已经转移给编码器，空壳还给转换线程
+	FreeVideoFrames.Enqueue(Converted.Frame);
+	ConvertStage->Wake();
+	return true;
 }
 
-void FAVBufferedEncoder::EncodeAudioFrames_EncoderThread()
+void FAVBufferedEncoder::DropOldestVideoFrames_ConvertThread()
 {
-	check(!IsInAudioThread())
+	if (VideoQueuePolicy != ERecorderQueuePolicy::DropOldest)
+	{
+		return;
+	}
+
+	FVideoFrameSlot* Slot;
+	while (VideoBuffer.Num() > MaxVideoQueueDepth && VideoBuffer.Dequeue(Slot))
+	{
+		++DroppedVideoFrames;
+		UE_LOG(LogRecorder, Verbose, TEXT("DropOldestVideoFrames_ConvertThread: frame %lf dropped"), Slot->StartSec)
+		// 丢掉的时长带到下一个转换好的帧上，由编码线程补回去
+		ConvertDroppedCount += Slot->DroppedCount + 1;
+		ConvertDroppedDuration += Slot->DroppedDuration + Slot->Duration;
+		ReleaseVideoSlot_ConvertThread(Slot);
+	}
+}
 
-	UE_LOG(LogRecorder, Verbose, TEXT("EncodeAudioFrames_EncoderThread"))
+void FAVBufferedEncoder::ReleaseVideoSlot_ConvertThread(FVideoFrameSlot* Slot)
+{
+	Slot->DroppedCount = 0;
+	Slot->DroppedDuration = 0;
+	Slot->Source.View.Reset();
+	Slot->Source.FrameData = nullptr;
+	VideoBufferPool.Enqueue(Slot);
+	if (VideoQueuePolicy == ERecorderQueuePolicy::Block)
+	{
+		VideoSlotEvent->Trigger();
+	}
+}
 
-	// 音频应该直接编码到最新的视频的一帧的时间点
-	while (!AudioBuffer.IsEmpty() && Encoder->ShouldContinueAudioEncoding())
+bool FAVBufferedEncoder::CanEncodeNextAudioFrame()
+{
+	// 音频时间轴向视频时间轴靠近，音频最多比已经捕获的视频长 MAX_AUDIO_LEAD_SECONDS
+	const double VideoTime = CapturedVideoTime.load(std::memory_order_acquire);
+	FEncodeData* NextData = nullptr;
+	if (VideoTime == 0 || !AudioBuffer.Peek(NextData) || !NextData)
 	{
-		FEncodeData* EncodeData;
-		if (AudioBuffer.Dequeue(EncodeData))
-		{
-			Encoder->EncodeAudioFrame(AudioTimeSequence, EncodeData);
-			AudioBufferPool.Enqueue(EncodeData);
-		}
+		return false;
 	}
+	return NextData->StartSec < VideoTime + MAX_AUDIO_LEAD_SECONDS;
+}
+
+bool FAVBufferedEncoder::EncodeOneAudioFrame_AudioEncodeThread()
+{
+	if (!CanEncodeNextAudioFrame())
+	{
+		return false;
+	}
+
+	const uint32 QueueDepth = PendingAudioFrames.load(std::memory_order_relaxed);
+	FEncodeData* EncodeData;
+	if (!AudioBuffer.Dequeue(EncodeData))
+	{
+		return false;
+	}
+	--PendingAudioFrames;
+
+	Encoder->EncodeAudioFrame(AudioTimeSequence, EncodeData);
+	for (const TUniquePtr<FRenditionEncoder>& RenditionEncoder : Renditions)
+	{
+		RenditionEncoder->EncodeAudioFrame(EncodeData);
+	}
+	AudioStage->GetStats().RecordItem(EncodeData->EnqueueCycles, QueueDepth);
+	AudioBufferPool.Enqueue(EncodeData);
+	return true;
 }
 
 void FAVBufferedEncoder::Finalize_EncoderThread()
@@ -843,6 +1838,18 @@ void FAVBufferedEncoder::Finalize_EncoderThread()
 	FinalizeVideoFrames_EncoderThread();
 	FinalizeAudioFrames_EncoderThread();
 	Encoder->EncodeFinish();
+	for (const TUniquePtr<FRenditionEncoder>& RenditionEncoder : Renditions)
+	{
+		RenditionEncoder->Finish();
+	}
+	Renditions.Empty();
+
+	// 录制结束，stat Recorder 里不再留着最后一次采样
+	{
+		FScopeLock Lock(&LiveStatsMutex);
+		LiveStats = FRecorderStats();
+	}
+	recorder::PublishLiveStats(FRecorderStats());
 }
 
 
@@ -850,22 +1857,54 @@ void FAVBufferedEncoder::FinalizeVideoFrames_EncoderThread()
 {
 	UE_LOG(LogRecorder, Verbose, TEXT("FinalizeVideoFrames_EncoderThread"))
 
-	// 清理当前 Buffer 中的视频
-	while (!VideoBuffer.IsEmpty())
+	// 不会再有新的帧了，放开可能还在等待槽位的渲染线程
+	bVideoFinalizing.store(true);
+	VideoSlotEvent->Trigger();
+
+	// 转换线程处理完剩下的槽位后退出，这期间编码线程继续消费，避免转换线程等不到空闲帧
+	ConvertStage->RequestStop();
+	while (!ConvertStage->IsFinished() || !ConvertedVideoFrames.IsEmpty())
 	{
-		EncodeOneVideoFrame_EncoderThread();
+		if (!EncodeOneVideoFrame_EncoderThread())
+		{
+			ThreadEvent->Wait(1);
+		}
 	}
+	ConvertStage->Join();
+	ConvertStage->GetStats().Log(TEXT("Convert"), &SessionReport);
+	EncodeStats.Log(TEXT("Encode"), &SessionReport);
+	SessionReport.AddLatency(TEXT("capture_to_enqueue"), CaptureToEnqueueLatency);
+	SessionReport.AddLatency(TEXT("enqueue_to_converted"), ConvertStage->GetStats().LatencyHistogram);
+	SessionReport.AddLatency(TEXT("converted_to_send"), ConvertedToSendLatency);
 
 	// 清理 buffer
-	Encoder->EndVideoEncoding(VideoTimeSequence);
+	Encoder->EndVideoEncoding();
+	for (const TUniquePtr<FRenditionEncoder>& RenditionEncoder : Renditions)
+	{
+		RenditionEncoder->FinishVideo();
+	}
+
+	if (const uint64 Dropped = GetDroppedVideoFrames())
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("%llu video frames dropped, queue depth %u, policy %d"),
+		       Dropped, MaxVideoQueueDepth, static_cast<int32>(VideoQueuePolicy))
+	}
+	SessionReport.AddCounter(TEXT("video_frames_dropped"), static_cast<int64>(GetDroppedVideoFrames()));
 }
 
 void FAVBufferedEncoder::FinalizeAudioFrames_EncoderThread()
 {
 	UE_LOG(LogRecorder, Verbose, TEXT("FinalizeAudioFrames_EncoderThread"))
 
-	EncodeAudioFrames_EncoderThread();
+	// 视频已经全部入队，音频编码线程把不超过视频结尾的帧编完后退出，之后由编码线程冲刷编码器
+	AudioStage->RequestStop();
+	AudioStage->Join();
+	AudioStage->GetStats().Log(TEXT("Audio"), &SessionReport);
 	Encoder->EndAudioEncoding(AudioTimeSequence);
+	for (const TUniquePtr<FRenditionEncoder>& RenditionEncoder : Renditions)
+	{
+		RenditionEncoder->FinishAudio();
+	}
 }
 
 void FAVBufferedEncoder::EnqueueVideoFrame_RenderThread(FCapturedVideoFrame VideoFrame)
@@ -874,40 +1913,72 @@ void FAVBufferedEncoder::EnqueueVideoFrame_RenderThread(FCapturedVideoFrame Vide
 	// 	FApp::GetCurrentTime(), PresentTime, Duration);
 	// FScopeLogTime timerin(TEXT("InsertVideoToEnqueue"));
 	// UE_LOG(LogRecorder, Display, TEXT("CaptureVideoFrameReadyToSend"));
-	// 后面可以替换一下
-	uint8* FrameData = VideoFrame.FrameData;
-	EPixelFormat PixelFormat = VideoFrame.PixelFormat;
-	uint16 FrameWidth = VideoFrame.FrameWidth;
-	uint16 FrameHeight = VideoFrame.FrameHeight;
-	FIntRect CaptureRect = VideoFrame.CaptureRect;
-	double PresentTime = VideoFrame.PresentTime;
-	double Duration = VideoFrame.Duration;
+	const double PresentTime = VideoFrame.PresentTime;
+	const double Duration = VideoFrame.Duration;
 
-	FEncodeData* NewData = nullptr;
-	if (VideoBufferPool.IsEmpty())
+	// 无论这一帧是否被丢弃，它的时长都会出现在视频轴上，音频可以编码到这里
+	CapturedVideoTime.store(PresentTime + Duration, std::memory_order_release);
+	AudioStage->Wake();
+
+	// 捕获侧没能拿到画面，只记录丢帧
+	if (!VideoFrame)
 	{
-		NewData = new FEncodeData();
-		// NewData->Initialize(DataSize);
+		DropVideoFrame_RenderThread(PresentTime, Duration);
+		return;
+	}
+
+	FVideoFrameSlot* NewData = AcquireVideoSlot_RenderThread(PresentTime, Duration);
+	if (!NewData)
+	{
+		return;
+	}
+
+	NewData->StartSec = PresentTime;
+	NewData->Duration = Duration;
+	NewData->CaptureCycles = VideoFrame.CaptureCycles;
+	NewData->DroppedCount = PendingDroppedCount;
+	NewData->DroppedDuration = PendingDroppedDuration;
+	PendingDroppedCount = 0;
+	PendingDroppedDuration = 0;
+
+	if (VideoFrame.View.IsValid())
+	{
+		// 借来的 readback 内存，裁剪和重新量化放到转换线程做，渲染线程这里没有逐像素的工作
+		NewData->Source = MoveTemp(VideoFrame);
 	}
 	else
 	{
-		VideoBufferPool.Dequeue(NewData);
+		RepackVideoFrame(VideoFrame, NewData);
 	}
 
-	if (NewData)
+	NewData->EnqueueCycles = FPlatformTime::Cycles64();
+	if (NewData->CaptureCycles != 0)
 	{
-		FScopeLock Lock(&NewData->ModifyCS);
-		NewData->StartSec = PresentTime;
-		NewData->Duration = Duration;
+		CaptureToEnqueueLatency.Record(NewData->EnqueueCycles - NewData->CaptureCycles);
+	}
+	VideoBuffer.Enqueue(NewData);
+	ConvertStage->Wake();
+}
+
+void FAVBufferedEncoder::RepackVideoFrame(const FCapturedVideoFrame& VideoFrame, FVideoFrameSlot* Slot)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("RepackVideoFrame");
+	// 后面可以替换一下
+	uint8* FrameData = VideoFrame.FrameData;
+	EPixelFormat PixelFormat = VideoFrame.PixelFormat;
+	uint16 FrameWidth = VideoFrame.FrameWidth;
+	uint16 FrameHeight = VideoFrame.FrameHeight;
+	FIntRect CaptureRect = VideoFrame.CaptureRect;
 
-		NewData->Data.SetNumUninitialized(FrameWidth * FrameHeight);
+	{
+		uint8* Src = FrameData;
+		uint8* Data = Slot->GetRawData();
 #if PLATFORM_WINDOWS
 		if (PixelFormat == EPixelFormat::PF_A2B10G10R10)
 		{
-			auto Src = FrameData;
 			uint32 Stride = FrameWidth * 4;
 			// uint32 Stride = (CaptureRect.Max.X - CaptureRect.Min.X) * 4;
-			uint8* DestPtr = NewData->GetRawData();
+			uint8* DestPtr = Data;
 			uint8* SrcPtr = nullptr;
 
 			// #if PLATFORM_WINDOWS
@@ -928,10 +1999,10 @@ void FAVBufferedEncoder::EnqueueVideoFrame_RenderThread(FCapturedVideoFrame Vide
 				for (int32 X = CaptureRect.Min.X; X < CaptureRect.Max.X; ++X)
 				{
 					Pixel = reinterpret_cast<FRHIR10G10B10A2*>(SrcPtr);
-					*(DestPtr + 0) = Requantize10to8(Pixel->R);
-					*(DestPtr + 1) = Requantize10to8(Pixel->G);
-					*(DestPtr + 2) = Requantize10to8(Pixel->B);
-					*(DestPtr + 3) = Requantize10to8(Pixel->A);
+					*(DestPtr + 0) = recorder::Requantize10To8(Pixel->R);
+					*(DestPtr + 1) = recorder::Requantize10To8(Pixel->G);
+					*(DestPtr + 2) = recorder::Requantize10To8(Pixel->B);
+					*(DestPtr + 3) = recorder::Requantize10To8(Pixel->A);
 					DestPtr += 4;
 					SrcPtr += 4;
 				}
@@ -979,10 +2050,58 @@ void FAVBufferedEncoder::EnqueueVideoFrame_RenderThread(FCapturedVideoFrame Vide
     }
 #endif
 	}
+}
 
-	VideoBuffer.Enqueue(NewData);
-	VideoTimeSequence.Enqueue({PresentTime, Duration});
-	ReleaseBufferWait();
+FVideoFrameSlot* FAVBufferedEncoder::AcquireVideoSlot_RenderThread(double PresentTime, double Duration)
+{
+	FVideoFrameSlot* Slot = nullptr;
+	switch (VideoQueuePolicy)
+	{
+	case ERecorderQueuePolicy::DropOldest:
+		// 编码线程负责把队列裁剪到 MaxVideoQueueDepth，这里只要还有空闲槽位就入队
+		if (VideoBufferPool.Dequeue(Slot))
+		{
+			return Slot;
+		}
+		break;
+	case ERecorderQueuePolicy::Block:
+		{
+			TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("WaitVideoSlot");
+			while (!bVideoFinalizing.load())
+			{
+				if (VideoBuffer.Num() < MaxVideoQueueDepth && VideoBufferPool.Dequeue(Slot))
+				{
+					return Slot;
+				}
+				VideoSlotEvent->Wait(10);
+			}
+		}
+		break;
+	default:
+		if (VideoBuffer.Num() < MaxVideoQueueDepth && VideoBufferPool.Dequeue(Slot))
+		{
+			return Slot;
+		}
+		break;
+	}
+
+	DropVideoFrame_RenderThread(PresentTime, Duration);
+	return nullptr;
+}
+
+void FAVBufferedEncoder::DropVideoFrame_RenderThread(double PresentTime, double Duration)
+{
+	const uint64 Dropped = ++DroppedVideoFrames;
+	PendingDroppedCount += 1;
+	PendingDroppedDuration += Duration;
+
+	// 持续丢帧时不要每帧都打日志
+	if (Dropped == 1 || Dropped % 60 == 0)
+	{
+		UE_LOG(LogRecorder, Warning,
+		       TEXT("EnqueueVideoFrame_RenderThread: video queue full (depth %u), frame %lf dropped, %llu dropped in total"),
+		       MaxVideoQueueDepth, PresentTime, Dropped)
+	}
 }
 
 void FAVBufferedEncoder::EnqueueAudioFrame_AudioThread(float* AudioData, int NumSamples, int32 NumChannels,
@@ -1011,9 +2130,11 @@ void FAVBufferedEncoder::EnqueueAudioFrame_AudioThread(float* AudioData, int Num
 			NumSamples * NumChannels * sizeof(TArray<float>::ElementType));
 		NewData->StartSec = PresentTime;
 		NewData->Duration = Duration;
+		NewData->EnqueueCycles = FPlatformTime::Cycles64();
 	}
 
 	AudioBuffer.Enqueue(NewData);
 	AudioTimeSequence.Enqueue({PresentTime, Duration});
-	ReleaseBufferWait();
+	++PendingAudioFrames;
+	AudioStage->Wake();
 }
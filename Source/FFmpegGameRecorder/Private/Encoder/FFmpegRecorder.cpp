@@ -68,6 +68,7 @@ void UFFmpegRecorder::InitializeRecorderConfig(UWorld* World, FString OutFileNam
 	RecordConfig.VideoBitRate = VideoBitRate;
 	RecordConfig.bUseHardwareEncoding = UseGPU;
 	RecordConfig.AudioSampleRate = DeviceAudioSampleRate;
+	RecordConfig.LoadConsoleVariables();
 
 	RecordConfig.UpdateResolution();
 }
@@ -82,8 +83,7 @@ void UFFmpegRecorder::InitializeDirector(UWorld* World, FString OutFileName, boo
 	// 初始化编码器
 	{
 		AVBufferedEncoder = MakeShared<FAVBufferedEncoder>();
-		AVBufferedEncoder->Initialize();
-		AVBufferedEncoder->GetEncoder()->InitializeEncoder(RecordConfig);
+		AVBufferedEncoder->Initialize(RecordConfig);
 	}
 
 	// 初始化编码线程
@@ -96,6 +96,7 @@ void UFFmpegRecorder::InitializeDirector(UWorld* World, FString OutFileName, boo
 		VideoCapture = MakeShared<FVideoCapture>();
 		VideoCapture->Setup();
 		VideoCapture->Initialize(RecordConfig.Resolution, RecordConfig.CropArea, RecordConfig.FrameRate);
+		VideoCapture->SetWaitForFreeReadback(RecordConfig.VideoQueuePolicy == ERecorderQueuePolicy::Block);
 		VideoCapture->Register(World);
 		VideoCapture->GetOnSendFrame().BindRaw(
 			AVBufferedEncoder.Get(), &FAVBufferedEncoder::EnqueueVideoFrame_RenderThread);
@@ -116,6 +117,25 @@ void UFFmpegRecorder::InitializeDirector(UWorld* World, FString OutFileName, boo
 	bRecording = true;
 }
 
+bool UFFmpegRecorder::SaveReplay(const FString& Path, double Seconds)
+{
+	if (!bRecording || !AVBufferedEncoder)
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("UFFmpegRecorder::SaveReplay(): not recording"));
+		return false;
+	}
+	return AVBufferedEncoder->GetEncoder()->SaveReplay(Path, Seconds);
+}
+
+FRecorderStats UFFmpegRecorder::GetRecorderStats() const
+{
+	if (!bRecording || !AVBufferedEncoder)
+	{
+		return FRecorderStats();
+	}
+	return AVBufferedEncoder->GetLiveStats();
+}
+
 void UFFmpegRecorder::StopRecord()
 {
 	CurrentTime = 0;
@@ -146,4 +166,13 @@ void UFFmpegRecorder::StopRecord()
 
 	// 消费线程处理完了，正常退出，几个线程都执行完了可以删除编码线程了
 	Runnable.Reset();
+
+	// 各级都已经把统计记进报告了
+	if (!RecordConfig.SessionReportPath.IsEmpty())
+	{
+		AVBufferedEncoder->GetSessionReport().Write(RecordConfig.SessionReportPath);
+	}
+
+	// 借给编码线程的 readback 都已经释放，可以 Unmap 了
+	VideoCapture->Teardown();
 }
@@ -0,0 +1,285 @@
+﻿#include "Encoder/FileWriter.h"
+
+#include "GenericPlatform/GenericPlatformProcess.h"
+#include "HAL/PlatformFileManager.h"
+
+#if PLATFORM_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+FBufferedFileWriter::FBufferedFileWriter()
+{
+	BufferFreedEvent = FGenericPlatformProcess::GetSynchEventFromPool();
+}
+
+FBufferedFileWriter::~FBufferedFileWriter()
+{
+	Close();
+	WriterStage.Reset();
+	if (BufferFreedEvent)
+	{
+		FGenericPlatformProcess::ReturnSynchEventToPool(BufferFreedEvent);
+		BufferFreedEvent = nullptr;
+	}
+}
+
+bool FBufferedFileWriter::Open(const FString& Path, int32 BufferSize, int64 PreallocateSize)
+{
+	check(!IOContext)
+
+#if PLATFORM_LINUX
+	FileDescriptor = open(TCHAR_TO_UTF8(*Path), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (FileDescriptor < 0)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("FBufferedFileWriter: open %s failed, errno %d"), *Path, errno)
+		return false;
+	}
+	// 提前占好磁盘空间，减少录制过程中文件系统分配块的开销；KEEP_SIZE 不改变文件大小，关闭时不需要截断
+	if (PreallocateSize > 0 && fallocate(FileDescriptor, FALLOC_FL_KEEP_SIZE, 0, PreallocateSize) != 0)
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("FBufferedFileWriter: fallocate %lld bytes failed, errno %d"),
+		       PreallocateSize, errno)
+	}
+#else
+	FileHandle = FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path, false, true);
+	if (!FileHandle)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("FBufferedFileWriter: open %s failed"), *Path)
+		return false;
+	}
+#endif
+
+	BufferCapacity = Align(FMath::Max(BufferSize, IO_CONTEXT_BUFFER_SIZE), BUFFER_ALIGNMENT);
+	PendingBuffers.Initialize(BUFFER_COUNT);
+	FreeBuffers.Initialize(BUFFER_COUNT);
+	Buffers.Reset(BUFFER_COUNT);
+	for (uint32 Index = 0; Index < BUFFER_COUNT; ++Index)
+	{
+		FreeBuffers.Enqueue(Buffers.Add_GetRef(static_cast<uint8*>(FMemory::Malloc(BufferCapacity, BUFFER_ALIGNMENT))));
+	}
+	FreeBuffers.Dequeue(ActiveBuffer);
+	ActiveFileOffset = 0;
+	ActiveCursor = 0;
+	ActiveSize = 0;
+	FileSize = 0;
+	bWriteFailed.store(false);
+
+	// AVIOContext 的缓存必须用 av_malloc 分配；avio_context_free 不会释放它，由 Close 释放
+	uint8* IOBuffer = static_cast<uint8*>(av_malloc(IO_CONTEXT_BUFFER_SIZE));
+	IOContext = avio_alloc_context(IOBuffer, IO_CONTEXT_BUFFER_SIZE, 1, this, nullptr, &WritePacketCallback,
+	                               &SeekCallback);
+	if (!IOContext)
+	{
+		av_free(IOBuffer);
+		return false;
+	}
+
+	WriterStage = MakeUnique<FPipelineStage>(TEXT("RecorderFileWriterThread"),
+	                                         [this]() { return WriteOneBuffer_WriterThread(); },
+	                                         [this]() { return !PendingBuffers.IsEmpty(); });
+	WriterStage->Start();
+	return true;
+}
+
+bool FBufferedFileWriter::Close()
+{
+	if (IOContext)
+	{
+		// AVIOContext 里可能还留着不满一块的数据
+		avio_flush(IOContext);
+		// avio 可能换过缓存，释放它当前持有的那一块，而不是 Open 里分配的
+		av_freep(&IOContext->buffer);
+		avio_context_free(&IOContext);
+	}
+	if (WriterStage && ActiveBuffer && ActiveSize > 0)
+	{
+		SubmitBuffer(ActiveFileOffset + ActiveSize);
+	}
+	if (WriterStage)
+	{
+		WriterStage->RequestStop();
+		WriterStage->Join();
+	}
+
+#if PLATFORM_LINUX
+	if (FileDescriptor >= 0)
+	{
+		close(FileDescriptor);
+		FileDescriptor = -1;
+	}
+#else
+	delete FileHandle;
+	FileHandle = nullptr;
+#endif
+
+	ActiveBuffer = nullptr;
+	for (uint8*& Buffer : Buffers)
+	{
+		FMemory::Free(Buffer);
+		Buffer = nullptr;
+	}
+	Buffers.Empty();
+	return !bWriteFailed.load();
+}
+
+int FBufferedFileWriter::WritePacketCallback(void* Opaque, uint8_t* Buf, int BufSize)
+{
+	return static_cast<FBufferedFileWriter*>(Opaque)->Write(Buf, BufSize);
+}
+
+int64_t FBufferedFileWriter::SeekCallback(void* Opaque, int64_t Offset, int Whence)
+{
+	return static_cast<FBufferedFileWriter*>(Opaque)->Seek(Offset, Whence);
+}
+
+int FBufferedFileWriter::Write(const uint8* Data, int32 Size)
+{
+	if (bWriteFailed.load(std::memory_order_relaxed))
+	{
+		return AVERROR(EIO);
+	}
+
+	int32 Remaining = Size;
+	while (Remaining > 0)
+	{
+		const int32 Chunk = FMath::Min(Remaining, BufferCapacity - ActiveCursor);
+		FMemory::Memcpy(ActiveBuffer + ActiveCursor, Data, Chunk);
+		ActiveCursor += Chunk;
+		ActiveSize = FMath::Max(ActiveSize, ActiveCursor);
+		Data += Chunk;
+		Remaining -= Chunk;
+
+		if (ActiveCursor == BufferCapacity)
+		{
+			SubmitBuffer(ActiveFileOffset + BufferCapacity);
+		}
+	}
+	FileSize = FMath::Max(FileSize, ActiveFileOffset + ActiveCursor);
+	return Size;
+}
+
+int64 FBufferedFileWriter::Seek(int64 Offset, int Whence)
+{
+	const int64 Position = ActiveFileOffset + ActiveCursor;
+	int64 Target;
+	switch (Whence & ~AVSEEK_FORCE)
+	{
+	case AVSEEK_SIZE:
+		return FileSize;
+	case SEEK_SET:
+		Target = Offset;
+		break;
+	case SEEK_CUR:
+		Target = Position + Offset;
+		break;
+	case SEEK_END:
+		Target = FileSize + Offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+	if (Target < 0)
+	{
+		return AVERROR(EINVAL);
+	}
+
+	// 落在当前缓存已写过的范围里（比如 mov 回填 mdat 的大小时正好还没写盘），直接在缓存里改写
+	if (Target >= ActiveFileOffset && Target <= ActiveFileOffset + ActiveSize)
+	{
+		ActiveCursor = static_cast<int32>(Target - ActiveFileOffset);
+	}
+	else
+	{
+		// 写盘线程按提交顺序写，之后对已经提交的范围的改写会覆盖前面的数据
+		SubmitBuffer(Target);
+	}
+	return Target;
+}
+
+void FBufferedFileWriter::SubmitBuffer(int64 NextFileOffset)
+{
+	if (ActiveSize > 0)
+	{
+		PendingBuffers.Enqueue({ActiveBuffer, ActiveFileOffset, ActiveSize, FPlatformTime::Cycles64()});
+		WriterStage->Wake();
+
+		ActiveBuffer = nullptr;
+		if (!FreeBuffers.Dequeue(ActiveBuffer))
+		{
+			// 写盘线程跟不上，等它写完一块
+			TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("WaitFileWriter");
+			const uint64 StallStartCycles = FPlatformTime::Cycles64();
+			while (!FreeBuffers.Dequeue(ActiveBuffer))
+			{
+				WriterStage->Wake();
+				BufferFreedEvent->Wait(1);
+			}
+			WriterStage->GetStats().RecordStall(FPlatformTime::Cycles64() - StallStartCycles);
+		}
+	}
+	ActiveFileOffset = NextFileOffset;
+	ActiveCursor = 0;
+	ActiveSize = 0;
+}
+
+bool FBufferedFileWriter::WriteOneBuffer_WriterThread()
+{
+	const uint32 QueueDepth = PendingBuffers.Num();
+	FPendingBuffer Buffer;
+	if (!PendingBuffers.Dequeue(Buffer))
+	{
+		return false;
+	}
+
+	// 写失败之后不再写盘，缓存照常归还，封装线程下一次写入时会拿到错误
+	if (!bWriteFailed.load(std::memory_order_relaxed)
+		&& !WriteAt_WriterThread(Buffer.FileOffset, Buffer.Data, Buffer.Size))
+	{
+		bWriteFailed.store(true);
+	}
+	WriterStage->GetStats().RecordItem(Buffer.EnqueueCycles, QueueDepth);
+
+	FreeBuffers.Enqueue(Buffer.Data);
+	BufferFreedEvent->Trigger();
+	return true;
+}
+
+bool FBufferedFileWriter::WriteAt_WriterThread(int64 Offset, const uint8* Data, int64 Size)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("FBufferedFileWriter::WriteAt");
+#if PLATFORM_LINUX
+	while (Size > 0)
+	{
+		const ssize_t Written = pwrite(FileDescriptor, Data, Size, Offset);
+		++WriteCallCount;
+		if (Written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			UE_LOG(LogRecorder, Error, TEXT("FBufferedFileWriter: pwrite %lld bytes at %lld failed, errno %d"),
+			       Size, Offset, errno)
+			return false;
+		}
+		Data += Written;
+		Offset += Written;
+		Size -= Written;
+	}
+	return true;
+#else
+	if (FileHandle->Tell() != Offset)
+	{
+		FileHandle->Seek(Offset);
+	}
+	++WriteCallCount;
+	if (!FileHandle->Write(Data, Size))
+	{
+		UE_LOG(LogRecorder, Error, TEXT("FBufferedFileWriter: write %lld bytes at %lld failed"), Size, Offset)
+		return false;
+	}
+	return true;
+#endif
+}
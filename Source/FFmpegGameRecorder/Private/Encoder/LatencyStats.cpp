@@ -0,0 +1,154 @@
+﻿#include "Encoder/LatencyStats.h"
+
+#include "Misc/FileHelper.h"
+
+FLatencyHistogram::FLatencyHistogram()
+{
+	for (std::atomic<uint32>& Bucket : Buckets)
+	{
+		Bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+int32 FLatencyHistogram::GetBucketIndex(uint64 Micros)
+{
+	if (Micros < SUB_BUCKET_COUNT)
+	{
+		return static_cast<int32>(Micros);
+	}
+	// 最高位之下保留 SUB_BUCKET_BITS 位，其余的位数决定是第几个 2 的幂区间
+	const int32 Shift = static_cast<int32>(FMath::FloorLog2_64(Micros)) - SUB_BUCKET_BITS;
+	if (Shift > MAX_SHIFT)
+	{
+		return BUCKET_COUNT - 1;
+	}
+	const int32 SubBucket = static_cast<int32>(Micros >> Shift) - SUB_BUCKET_COUNT;
+	return SUB_BUCKET_COUNT * (Shift + 1) + SubBucket;
+}
+
+uint64 FLatencyHistogram::GetBucketUpperBound(int32 Index)
+{
+	if (Index < SUB_BUCKET_COUNT)
+	{
+		return Index;
+	}
+	const int32 Shift = Index / SUB_BUCKET_COUNT - 1;
+	const uint64 SubBucket = Index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+	return ((SubBucket + 1) << Shift) - 1;
+}
+
+void FLatencyHistogram::Record(uint64 Cycles)
+{
+	RecordMs(FPlatformTime::ToMilliseconds64(Cycles));
+}
+
+void FLatencyHistogram::RecordMs(double Milliseconds)
+{
+	const uint64 Micros = static_cast<uint64>(FMath::Max(0.0, Milliseconds) * 1000.0);
+	Buckets[GetBucketIndex(Micros)].fetch_add(1, std::memory_order_relaxed);
+	Count.fetch_add(1, std::memory_order_relaxed);
+	SumMicros.fetch_add(Micros, std::memory_order_relaxed);
+
+	// 可能有多个线程同时记录，最大值需要 CAS
+	uint64 Max = MaxMicros.load(std::memory_order_relaxed);
+	while (Micros > Max && !MaxMicros.compare_exchange_weak(Max, Micros, std::memory_order_relaxed))
+	{
+	}
+}
+
+void FLatencyHistogram::Reset()
+{
+	for (std::atomic<uint32>& Bucket : Buckets)
+	{
+		Bucket.store(0, std::memory_order_relaxed);
+	}
+	Count.store(0, std::memory_order_relaxed);
+	SumMicros.store(0, std::memory_order_relaxed);
+	MaxMicros.store(0, std::memory_order_relaxed);
+}
+
+double FLatencyHistogram::GetPercentileMs(double Percent) const
+{
+	const uint64 Total = GetCount();
+	if (Total == 0)
+	{
+		return 0;
+	}
+	const uint64 Rank = FMath::Max<uint64>(1, static_cast<uint64>(FMath::CeilToDouble(Total * Percent / 100.0)));
+	uint64 Accumulated = 0;
+	for (int32 Index = 0; Index < BUCKET_COUNT; ++Index)
+	{
+		Accumulated += Buckets[Index].load(std::memory_order_relaxed);
+		if (Accumulated >= Rank)
+		{
+			return FMath::Min(GetBucketUpperBound(Index), MaxMicros.load(std::memory_order_relaxed)) / 1000.0;
+		}
+	}
+	return GetMaxMs();
+}
+
+double FLatencyHistogram::GetMeanMs() const
+{
+	const uint64 Total = GetCount();
+	return Total ? SumMicros.load(std::memory_order_relaxed) / 1000.0 / Total : 0;
+}
+
+double FLatencyHistogram::GetMaxMs() const
+{
+	return MaxMicros.load(std::memory_order_relaxed) / 1000.0;
+}
+
+void FCaptureLatencyStats::Initialize(int32 MaxCsvSamples)
+{
+	Histogram.Reset();
+	Samples.Empty(MaxCsvSamples);
+}
+
+void FCaptureLatencyStats::Record(double PresentTime, uint64 CaptureCycles)
+{
+	if (CaptureCycles == 0)
+	{
+		return;
+	}
+	const uint64 Now = FPlatformTime::Cycles64();
+	const double LatencyMs = Now > CaptureCycles ? FPlatformTime::ToMilliseconds64(Now - CaptureCycles) : 0;
+
+	Histogram.RecordMs(LatencyMs);
+	// 只用预留的空间，编码线程上不扩容
+	if (Samples.Num() < Samples.Max())
+	{
+		Samples.Add({PresentTime, static_cast<float>(LatencyMs)});
+	}
+}
+
+void FCaptureLatencyStats::Log(const FString& OutputName) const
+{
+	if (Histogram.GetCount() == 0)
+	{
+		return;
+	}
+	UE_LOG(LogRecorder, Display, TEXT("Capture to packet latency of %s: %llu frames, p50 %.1f ms, p99 %.1f ms, max %.1f ms"),
+	       *OutputName, Histogram.GetCount(), Histogram.GetPercentileMs(50), Histogram.GetPercentileMs(99),
+	       Histogram.GetMaxMs())
+}
+
+bool FCaptureLatencyStats::WriteCsv(const FString& Path) const
+{
+	FString Csv = TEXT("present_time,capture_to_packet_ms\n");
+	Csv.Reserve(Samples.Num() * 24);
+	for (const FSample& Sample : Samples)
+	{
+		Csv += FString::Printf(TEXT("%.6f,%.3f\n"), Sample.PresentTime, Sample.LatencyMs);
+	}
+	if (!FFileHelper::SaveStringToFile(Csv, *Path))
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("Capture to packet latency: can not write %s"), *Path)
+		return false;
+	}
+	if (static_cast<uint64>(Samples.Num()) < Histogram.GetCount())
+	{
+		UE_LOG(LogRecorder, Display, TEXT("Capture to packet latency: only the first %d of %llu frames written to %s"),
+		       Samples.Num(), Histogram.GetCount(), *Path)
+	}
+	return true;
+}
@@ -0,0 +1,118 @@
+﻿#include "Encoder/MappedFile.h"
+
+#define RECORDER_MAPPED_FILE_POSIX (PLATFORM_LINUX || PLATFORM_ANDROID || PLATFORM_MAC || PLATFORM_IOS)
+
+#if PLATFORM_WINDOWS
+#include "Windows/AllowWindowsPlatformTypes.h"
+#include <windows.h>
+#include "Windows/HideWindowsPlatformTypes.h"
+#elif RECORDER_MAPPED_FILE_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+FMappedFile::~FMappedFile()
+{
+	Close();
+}
+
+bool FMappedFile::Open(const FString& InPath, uint64 InSize)
+{
+	check(!Data)
+	Path = InPath;
+
+#if PLATFORM_WINDOWS
+	// DELETE_ON_CLOSE：进程异常退出时文件也会被系统删除
+	FileHandle = CreateFileW(*Path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+	                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	if (FileHandle == INVALID_HANDLE_VALUE)
+	{
+		FileHandle = nullptr;
+		UE_LOG(LogRecorder, Error, TEXT("FMappedFile: open %s failed, error %u"), *Path, GetLastError())
+		return false;
+	}
+	// 创建映射时文件会被扩展到 InSize
+	MappingHandle = CreateFileMappingW(FileHandle, nullptr, PAGE_READWRITE, static_cast<DWORD>(InSize >> 32),
+	                                   static_cast<DWORD>(InSize), nullptr);
+	if (MappingHandle)
+	{
+		Data = static_cast<uint8*>(MapViewOfFile(MappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, InSize));
+	}
+	if (!Data)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("FMappedFile: map %llu bytes of %s failed, error %u"), InSize, *Path,
+		       GetLastError())
+		Close();
+		return false;
+	}
+#elif RECORDER_MAPPED_FILE_POSIX
+	FileDescriptor = open(TCHAR_TO_UTF8(*Path), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (FileDescriptor < 0)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("FMappedFile: open %s failed, errno %d"), *Path, errno)
+		return false;
+	}
+#if PLATFORM_LINUX || PLATFORM_ANDROID
+	// 真正分配磁盘块，写满磁盘时在这里失败，而不是在写映射内存时收到 SIGBUS
+	const int AllocateError = posix_fallocate(FileDescriptor, 0, InSize);
+#else
+	const int AllocateError = ftruncate(FileDescriptor, InSize) == 0 ? 0 : errno;
+#endif
+	if (AllocateError != 0)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("FMappedFile: allocate %llu bytes for %s failed, errno %d"), InSize, *Path,
+		       AllocateError)
+		Close();
+		return false;
+	}
+	void* Mapped = mmap(nullptr, InSize, PROT_READ | PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+	if (Mapped == MAP_FAILED)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("FMappedFile: mmap %llu bytes of %s failed, errno %d"), InSize, *Path, errno)
+		Close();
+		return false;
+	}
+	Data = static_cast<uint8*>(Mapped);
+#else
+	UE_LOG(LogRecorder, Warning, TEXT("FMappedFile: memory mapped files are not supported on this platform"))
+	return false;
+#endif
+
+	Size = InSize;
+	return true;
+}
+
+void FMappedFile::Close()
+{
+#if PLATFORM_WINDOWS
+	if (Data)
+	{
+		UnmapViewOfFile(Data);
+	}
+	if (MappingHandle)
+	{
+		CloseHandle(MappingHandle);
+		MappingHandle = nullptr;
+	}
+	if (FileHandle)
+	{
+		CloseHandle(FileHandle);
+		FileHandle = nullptr;
+	}
+#elif RECORDER_MAPPED_FILE_POSIX
+	if (Data)
+	{
+		munmap(Data, Size);
+	}
+	if (FileDescriptor >= 0)
+	{
+		close(FileDescriptor);
+		FileDescriptor = -1;
+		unlink(TCHAR_TO_UTF8(*Path));
+	}
+#endif
+	Data = nullptr;
+	Size = 0;
+}
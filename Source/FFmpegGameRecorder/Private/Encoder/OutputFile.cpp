@@ -0,0 +1,106 @@
+﻿#include "Encoder/OutputFile.h"
+
+namespace recorder
+{
+	const char* GetOutputFormatName(const FString& Path)
+	{
+		if (Path.StartsWith(TEXT("rtmp")))
+		{
+			return "flv";
+		}
+		if (Path.StartsWith(TEXT("udp://")) || Path.StartsWith(TEXT("srt://")))
+		{
+			return "mpegts";
+		}
+		return nullptr;
+	}
+
+	FString RedactOutputUrl(const FString& Path)
+	{
+		const int32 SchemeEnd = Path.Find(TEXT("://"));
+		if (SchemeEnd == INDEX_NONE)
+		{
+			return Path;
+		}
+		FString Authority = Path.Mid(SchemeEnd + 3);
+		int32 Index;
+		if (Authority.FindChar(TEXT('/'), Index))
+		{
+			Authority.LeftInline(Index);
+		}
+		if (Authority.FindChar(TEXT('?'), Index))
+		{
+			Authority.LeftInline(Index);
+		}
+		if (Authority.FindLastChar(TEXT('@'), Index))
+		{
+			Authority.RightChopInline(Index + 1);
+		}
+		return Path.Left(SchemeEnd + 3) + Authority;
+	}
+
+	int OpenOutputIO(AVFormatContext* Context, const FString& Path, const FRecorderConfig& Config,
+	                 TUniquePtr<FBufferedFileWriter>& OutWriter)
+	{
+		// 推流地址仍然交给 FFmpeg 的协议层，本地文件走自己的写缓存
+		if (Config.FileWriteBufferSizeKB > 0 && IsLocalOutputPath(Path))
+		{
+			OutWriter = MakeUnique<FBufferedFileWriter>();
+			if (!OutWriter->Open(Path, Config.FileWriteBufferSizeKB * 1024,
+			                     static_cast<int64>(Config.PreallocateFileSizeMB) * 1024 * 1024))
+			{
+				OutWriter.Reset();
+				return AVERROR(EIO);
+			}
+			Context->pb = OutWriter->GetIOContext();
+			Context->flags |= AVFMT_FLAG_CUSTOM_IO;
+			return 0;
+		}
+		return avio_open2(&Context->pb, TCHAR_TO_UTF8(*Path), AVIO_FLAG_WRITE, &Context->interrupt_callback, nullptr);
+	}
+
+	bool CloseOutputIO(AVFormatContext* Context, TUniquePtr<FBufferedFileWriter>& Writer)
+	{
+		if (!Writer)
+		{
+			avio_closep(&Context->pb);
+			return true;
+		}
+
+		Context->pb = nullptr;
+		const bool bSuccess = Writer->Close();
+		if (!bSuccess)
+		{
+			UE_LOG(LogRecorder, Error, TEXT("Failed to write %s"), Context->url ? UTF8_TO_TCHAR(Context->url) : TEXT(""))
+		}
+		UE_LOG(LogRecorder, Display, TEXT("File writer: %llu write calls"), Writer->GetWriteCallCount())
+		Writer->GetStats()->Log(TEXT("FileIO"));
+		Writer.Reset();
+		return bSuccess;
+	}
+
+	AVDictionary* MakeMuxerOptions(const AVFormatContext* Context, const FRecorderConfig& Config)
+	{
+		AVDictionary* Options = nullptr;
+		if (Config.bFragmentedMP4)
+		{
+			const char* FormatName = Context->oformat->name;
+			if (FCStringAnsi::Strstr(FormatName, "mp4") || FCStringAnsi::Strstr(FormatName, "mov"))
+			{
+				// moov 只有轨道信息，每个关键帧（或者超过 frag_duration）开始一个新的 moof + mdat
+				av_dict_set(&Options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+				if (Config.MaxFragmentDurationMs > 0)
+				{
+					av_dict_set_int(&Options, "frag_duration",
+					                static_cast<int64_t>(Config.MaxFragmentDurationMs) * 1000, 0);
+				}
+			}
+			else
+			{
+				UE_LOG(LogRecorder, Warning, TEXT("bFragmentedMP4 ignored for output format %s"),
+				       ANSI_TO_TCHAR(FormatName))
+			}
+		}
+		return Options;
+	}
+}
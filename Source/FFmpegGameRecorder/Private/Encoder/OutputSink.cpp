@@ -0,0 +1,210 @@
+﻿#include "Encoder/OutputSink.h"
+
+#include "Encoder/OutputFile.h"
+#include "Encoder/SessionReport.h"
+
+FOutputSink::FOutputSink(const FRecorderConfig& InConfig, const AVFormatContext* Template, const FString& InUrl)
+	: Config(InConfig)
+	  , Url(InUrl)
+{
+	// 流在这里就建好，写出线程里只做连接和写文件头，不再访问主输出的上下文
+	if (avformat_alloc_output_context2(&Context, nullptr, recorder::GetOutputFormatName(Url), TCHAR_TO_UTF8(*Url)) < 0)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("Output %s: unknown output format"), *Url)
+		bFailed.store(true);
+		return;
+	}
+	for (uint32 Index = 0; Index < Template->nb_streams; ++Index)
+	{
+		const AVStream* Source = Template->streams[Index];
+		AVStream* Stream = avformat_new_stream(Context, nullptr);
+		if (!Stream || avcodec_parameters_copy(Stream->codecpar, Source->codecpar) < 0)
+		{
+			bFailed.store(true);
+			return;
+		}
+		Stream->codecpar->codec_tag = 0;
+		Stream->time_base = Source->time_base;
+		SourceTimeBases.Add(Source->time_base);
+		if (Source->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+		{
+			VideoIndex = Index;
+		}
+	}
+	Context->interrupt_callback = {&InterruptCallback, this};
+}
+
+FOutputSink::~FOutputSink()
+{
+	Close();
+}
+
+void FOutputSink::Start()
+{
+	Ready.Initialize(QUEUE_CAPACITY);
+	Free.Initialize(QUEUE_CAPACITY);
+	Packets.Reset(QUEUE_CAPACITY);
+	for (uint32 Index = 0; Index < QUEUE_CAPACITY; ++Index)
+	{
+		Free.Enqueue(Packets.Add_GetRef(av_packet_alloc()));
+	}
+
+	SinkStage = MakeUnique<FPipelineStage>(TEXT("RecorderOutputSinkThread"),
+	                                       [this]() { return WriteOnePacket_SinkThread(); },
+	                                       [this]() { return !Ready.IsEmpty(); });
+	SinkStage->Start();
+}
+
+void FOutputSink::Enqueue(const AVPacket* Packet)
+{
+	if (!SinkStage || bFailed.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	const bool bKeyframe = Packet->stream_index == VideoIndex && (Packet->flags & AV_PKT_FLAG_KEY);
+	AVPacket* Queued = nullptr;
+	if (bWaitingForKeyframe && !bKeyframe)
+	{
+		DroppedCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	if (SparePacket)
+	{
+		Swap(Queued, SparePacket);
+	}
+	else if (!Free.Dequeue(Queued))
+	{
+		// 只丢这一路的 packet，之后的帧可能参考丢掉的帧，一直丢到下一个关键帧
+		if (!bWaitingForKeyframe)
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("Output %s can not keep up, dropping until the next keyframe"), *Url)
+		}
+		bWaitingForKeyframe = true;
+		DroppedCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	// 只增加数据缓存的引用计数，不拷贝数据
+	if (av_packet_ref(Queued, Packet) < 0)
+	{
+		SparePacket = Queued;
+		bWaitingForKeyframe = true;
+		DroppedCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	bWaitingForKeyframe = false;
+	Ready.Enqueue({Queued, FPlatformTime::Cycles64()});
+	SinkStage->Wake();
+}
+
+void FOutputSink::Close(FRecorderSessionReport* Report, const FString& ReportName)
+{
+	if (SinkStage)
+	{
+		CloseStartCycles.store(FPlatformTime::Cycles64());
+		SinkStage->RequestStop();
+		SinkStage->Join();
+		SinkStage->GetStats().Log(TEXT("Output ") + ReportName, Report);
+		SinkStage.Reset();
+		UE_LOG(LogRecorder, Display, TEXT("Output %s: %llu packets dropped"), *Url, DroppedCount.load())
+		if (Report)
+		{
+			Report->AddInfo(ReportName, recorder::RedactOutputUrl(Url));
+			Report->AddCounter(ReportName + TEXT("/dropped_packets"), static_cast<int64>(DroppedCount.load()));
+			Report->AddCounter(ReportName + TEXT("/written_bytes"), static_cast<int64>(WrittenBytes));
+		}
+	}
+	if (bOpened)
+	{
+		av_write_trailer(Context);
+		recorder::CloseOutputIO(Context, Writer);
+		bOpened = false;
+	}
+	if (Context)
+	{
+		avformat_free_context(Context);
+		Context = nullptr;
+	}
+	av_packet_free(&SparePacket);
+	for (AVPacket*& Packet : Packets)
+	{
+		av_packet_free(&Packet);
+	}
+	Packets.Empty();
+}
+
+int FOutputSink::InterruptCallback(void* Opaque)
+{
+	// 关闭时还在连接的直接放弃，已经连上的给一段时间把队列里剩下的写完
+	const FOutputSink* Sink = static_cast<FOutputSink*>(Opaque);
+	const uint64 CloseStart = Sink->CloseStartCycles.load(std::memory_order_relaxed);
+	return CloseStart != 0 && (!Sink->bOpened || FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - CloseStart)
+		> CLOSE_TIMEOUT_SEC);
+}
+
+bool FOutputSink::Open_SinkThread()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("FOutputSink::Open");
+	int Ret = recorder::OpenOutputIO(Context, Url, Config, Writer);
+	if (Ret < 0)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("Output %s: open failed (%d)"), *Url, Ret)
+		return false;
+	}
+	AVDictionary* MuxerOptions = recorder::MakeMuxerOptions(Context, Config);
+	Ret = avformat_write_header(Context, &MuxerOptions);
+	av_dict_free(&MuxerOptions);
+	if (Ret < 0)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("Output %s: write header failed (%d)"), *Url, Ret)
+		recorder::CloseOutputIO(Context, Writer);
+		return false;
+	}
+	UE_LOG(LogRecorder, Display, TEXT("Output %s opened"), *Url)
+	bOpened = true;
+	return true;
+}
+
+bool FOutputSink::WriteOnePacket_SinkThread()
+{
+	if (!bOpenAttempted && !bFailed.load())
+	{
+		bOpenAttempted = true;
+		if (!Open_SinkThread())
+		{
+			bFailed.store(true);
+		}
+	}
+
+	const uint32 QueueDepth = Ready.Num();
+	FQueuedPacket Queued;
+	if (!Ready.Dequeue(Queued))
+	{
+		return false;
+	}
+
+	// 失败之后不再写出，packet 照常归还
+	AVPacket* Packet = Queued.Packet;
+	if (!bFailed.load(std::memory_order_relaxed))
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("FOutputSink::WritePacket");
+		av_packet_rescale_ts(Packet, SourceTimeBases[Packet->stream_index],
+		                     Context->streams[Packet->stream_index]->time_base);
+		const int32 Size = Packet->size;
+		const int Ret = av_write_frame(Context, Packet);
+		if (Ret < 0)
+		{
+			UE_LOG(LogRecorder, Error, TEXT("Output %s: write failed (%d), output stopped"), *Url, Ret)
+			bFailed.store(true);
+		}
+		else
+		{
+			WrittenBytes += Size;
+		}
+		SinkStage->GetStats().RecordItem(Queued.EnqueueCycles, QueueDepth);
+	}
+	av_packet_unref(Packet);
+	Free.Enqueue(Packet);
+	return true;
+}
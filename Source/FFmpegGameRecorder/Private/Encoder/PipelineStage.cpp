@@ -0,0 +1,177 @@
+﻿#include "Encoder/PipelineStage.h"
+
+#include "GenericPlatform/GenericPlatformProcess.h"
+#include "HAL/RunnableThread.h"
+#include "Encoder/SessionReport.h"
+
+void FPipelineStageStats::RecordItem(uint64 EnqueueCycles, uint32 QueueDepth)
+{
+	const uint64 Now = FPlatformTime::Cycles64();
+	const uint64 Latency = Now > EnqueueCycles ? Now - EnqueueCycles : 0;
+
+	uint64 Expected = 0;
+	FirstActiveCycles.compare_exchange_strong(Expected, Now);
+
+	ProcessedCount.fetch_add(1, std::memory_order_relaxed);
+	LatencyCycles.fetch_add(Latency, std::memory_order_relaxed);
+	LatencyHistogram.Record(Latency);
+	QueueDepthSum.fetch_add(QueueDepth, std::memory_order_relaxed);
+
+	// 只有处理线程会写，读改写不需要 CAS
+	if (Latency > MaxLatencyCycles.load(std::memory_order_relaxed))
+	{
+		MaxLatencyCycles.store(Latency, std::memory_order_relaxed);
+	}
+	if (QueueDepth > MaxQueueDepth.load(std::memory_order_relaxed))
+	{
+		MaxQueueDepth.store(QueueDepth, std::memory_order_relaxed);
+	}
+}
+
+void FPipelineStageStats::RecordBusy(uint64 Cycles)
+{
+	BusyCycles.fetch_add(Cycles, std::memory_order_relaxed);
+	if (Cycles > MaxBusyCycles.load(std::memory_order_relaxed))
+	{
+		MaxBusyCycles.store(Cycles, std::memory_order_relaxed);
+	}
+}
+
+void FPipelineStageStats::RecordStall(uint64 Cycles)
+{
+	StallCount.fetch_add(1, std::memory_order_relaxed);
+	StallCycles.fetch_add(Cycles, std::memory_order_relaxed);
+
+	// 上游可能不止一个线程，最大值需要 CAS
+	uint64 Max = MaxStallCycles.load(std::memory_order_relaxed);
+	while (Cycles > Max && !MaxStallCycles.compare_exchange_weak(Max, Cycles, std::memory_order_relaxed))
+	{
+	}
+}
+
+double FPipelineStageStats::GetOccupancy() const
+{
+	const uint64 First = FirstActiveCycles.load(std::memory_order_relaxed);
+	const uint64 Now = FPlatformTime::Cycles64();
+	if (First == 0 || Now <= First)
+	{
+		return 0;
+	}
+	return FMath::Min(1.0, static_cast<double>(BusyCycles.load(std::memory_order_relaxed)) / (Now - First));
+}
+
+double FPipelineStageStats::GetAverageLatencyMs() const
+{
+	const uint64 Count = ProcessedCount.load(std::memory_order_relaxed);
+	return Count ? FPlatformTime::ToMilliseconds64(LatencyCycles.load(std::memory_order_relaxed)) / Count : 0;
+}
+
+double FPipelineStageStats::GetMaxLatencyMs() const
+{
+	return FPlatformTime::ToMilliseconds64(MaxLatencyCycles.load(std::memory_order_relaxed));
+}
+
+double FPipelineStageStats::GetAverageQueueDepth() const
+{
+	const uint64 Count = ProcessedCount.load(std::memory_order_relaxed);
+	return Count ? static_cast<double>(QueueDepthSum.load(std::memory_order_relaxed)) / Count : 0;
+}
+
+double FPipelineStageStats::GetStallMs() const
+{
+	return FPlatformTime::ToMilliseconds64(StallCycles.load(std::memory_order_relaxed));
+}
+
+void FPipelineStageStats::Log(const FString& StageName, FRecorderSessionReport* Report) const
+{
+	UE_LOG(LogRecorder, Display,
+	       TEXT("Stage %-8s: %llu items, occupancy %5.1f%%, queue avg %.2f max %u, ")
+	       TEXT("latency avg %.2f ms p50 %.2f ms p99 %.2f ms max %.2f ms, ")
+	       TEXT("busy max %.2f ms, %llu upstream stalls %.2f ms max %.2f ms"),
+	       *StageName, ProcessedCount.load(), GetOccupancy() * 100.0, GetAverageQueueDepth(), MaxQueueDepth.load(),
+	       GetAverageLatencyMs(), LatencyHistogram.GetPercentileMs(50), LatencyHistogram.GetPercentileMs(99),
+	       GetMaxLatencyMs(), FPlatformTime::ToMilliseconds64(MaxBusyCycles.load()), StallCount.load(), GetStallMs(),
+	       FPlatformTime::ToMilliseconds64(MaxStallCycles.load()))
+	if (Report)
+	{
+		Report->AddStage(StageName, *this);
+	}
+}
+
+FPipelineStage::FPipelineStage(const TCHAR* InName, TFunction<bool()> InProcessOne,
+                               TFunction<bool()> InHasPendingWork)
+	: Name(InName)
+	  , ProcessOne(MoveTemp(InProcessOne))
+	  , HasPendingWork(MoveTemp(InHasPendingWork))
+{
+	WorkEvent = FGenericPlatformProcess::GetSynchEventFromPool();
+}
+
+FPipelineStage::~FPipelineStage()
+{
+	if (Thread)
+	{
+		RequestStop();
+		Join();
+	}
+	if (WorkEvent)
+	{
+		FGenericPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+		WorkEvent = nullptr;
+	}
+}
+
+void FPipelineStage::Start()
+{
+	check(!Thread)
+	bStopRequested.store(false);
+	bFinished.store(false);
+	// 线程在构造完成后才创建，Run 里不会访问到没初始化的成员
+	Thread = FRunnableThread::Create(this, *Name);
+}
+
+void FPipelineStage::Wake()
+{
+	WorkEvent->Trigger();
+}
+
+void FPipelineStage::RequestStop()
+{
+	bStopRequested.store(true);
+	WorkEvent->Trigger();
+}
+
+void FPipelineStage::Join()
+{
+	if (Thread)
+	{
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+}
+
+uint32 FPipelineStage::Run()
+{
+	while (true)
+	{
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		if (ProcessOne())
+		{
+			Stats.RecordBusy(FPlatformTime::Cycles64() - StartCycles);
+			continue;
+		}
+		if (bStopRequested.load() && !HasPendingWork())
+		{
+			break;
+		}
+		WorkEvent->Wait(IDLE_WAIT_MS);
+	}
+	bFinished.store(true);
+	return 0;
+}
+
+void FPipelineStage::Stop()
+{
+	RequestStop();
+}
@@ -0,0 +1,749 @@
+﻿#include "Encoder/PixelConvert.h"
+
+#include "Async/ParallelFor.h"
+
+#define RECORDER_PIXEL_CONVERT_SIMD (PLATFORM_WINDOWS && PLATFORM_CPU_X86_FAMILY)
+
+#if RECORDER_PIXEL_CONVERT_SIMD
+#include <intrin.h>
+#include <immintrin.h>
+
+// clang-cl 需要显式打开指令集才能使用对应的 intrinsic，MSVC 不需要
+#if defined(__clang__)
+#define RECORDER_TARGET_SSE41 __attribute__((target("ssse3,sse4.1")))
+#define RECORDER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RECORDER_TARGET_SSE41
+#define RECORDER_TARGET_AVX2
+#endif
+#endif
+
+namespace recorder
+{
+	namespace PixelConvertDetail
+	{
+		/** 输出的 YUV 4:2:0 排列方式 */
+		enum class EYuvLayout : uint8
+		{
+			/** 8bit，Y、U、V 三个平面 */
+			I420,
+			/** 8bit，Y 平面加交错的 UV 平面 */
+			NV12,
+			/** 10bit 存在 16bit 的低位（yuv420p10le），三个平面 */
+			I010,
+			/** 10bit 存在 16bit 的高位，Y 平面加交错的 UV 平面 */
+			P010,
+		};
+
+		constexpr bool IsHighBitDepth(EYuvLayout Layout)
+		{
+			return Layout == EYuvLayout::I010 || Layout == EYuvLayout::P010;
+		}
+
+		/** P010 的采样值左移到 16bit 的高位 */
+		constexpr int32 P010_SHIFT = 6;
+
+		/**
+		 * 一次转换两行，写两行 Y 和一行 U/V
+		 * @param Row1 奇数高度的最后一行与 Row0 相同，此时 DstY1 为 nullptr
+		 * @param DstV 交错排列（NV12/P010）时为 nullptr，DstU 是交错的 UV 行
+		 * @note 10bit 输出的指针仍然按字节寻址，指向 16bit 的采样
+		 */
+		using FRowPairFunction = void (*)(const uint32* Row0, const uint32* Row1, uint8* DstY0, uint8* DstY1,
+		                                  uint8* DstU, uint8* DstV, int32 Width);
+
+		/** 10bit 输出时不量化，直接取 10bit 的通道值 */
+		template <bool bRequantize>
+		FORCEINLINE void UnpackPixel(uint32 Pixel, int32& OutR, int32& OutG, int32& OutB)
+		{
+			OutR = Pixel & 0x3FF;
+			OutG = (Pixel >> 10) & 0x3FF;
+			OutB = (Pixel >> 20) & 0x3FF;
+			if (bRequantize)
+			{
+				OutR = Requantize10To8(OutR);
+				OutG = Requantize10To8(OutG);
+				OutB = Requantize10To8(OutB);
+			}
+		}
+
+		FORCEINLINE uint8 RGBToY(int32 R, int32 G, int32 B)
+		{
+			return static_cast<uint8>(((66 * R + 129 * G + 25 * B + 128) >> 8) + 16);
+		}
+
+		FORCEINLINE uint8 RGBToU(int32 R, int32 G, int32 B)
+		{
+			return static_cast<uint8>((112 * B - 74 * G - 38 * R + 0x8080) >> 8);
+		}
+
+		FORCEINLINE uint8 RGBToV(int32 R, int32 G, int32 B)
+		{
+			return static_cast<uint8>((112 * R - 94 * G - 18 * B + 0x8080) >> 8);
+		}
+
+		/** 与 8bit 相同的系数，偏移换成 10bit 的 64 和 512 */
+		FORCEINLINE uint16 RGBToY10(int32 R, int32 G, int32 B)
+		{
+			return static_cast<uint16>(((66 * R + 129 * G + 25 * B + 128) >> 8) + 64);
+		}
+
+		FORCEINLINE uint16 RGBToU10(int32 R, int32 G, int32 B)
+		{
+			return static_cast<uint16>((112 * B - 74 * G - 38 * R + 0x20080) >> 8);
+		}
+
+		FORCEINLINE uint16 RGBToV10(int32 R, int32 G, int32 B)
+		{
+			return static_cast<uint16>((112 * R - 94 * G - 18 * B + 0x20080) >> 8);
+		}
+
+		template <EYuvLayout Layout>
+		FORCEINLINE void StoreLuma(uint8* Row, int32 X, int32 R, int32 G, int32 B)
+		{
+			if (IsHighBitDepth(Layout))
+			{
+				reinterpret_cast<uint16*>(Row)[X] = static_cast<uint16>(
+					RGBToY10(R, G, B) << (Layout == EYuvLayout::P010 ? P010_SHIFT : 0));
+			}
+			else
+			{
+				Row[X] = RGBToY(R, G, B);
+			}
+		}
+
+		/** 写 X（偶数）和 X + 1 两列共用的一对色度 */
+		template <EYuvLayout Layout>
+		FORCEINLINE void StoreChroma(uint8* DstU, uint8* DstV, int32 X, int32 R, int32 G, int32 B)
+		{
+			switch (Layout)
+			{
+			case EYuvLayout::I420:
+				DstU[X / 2] = RGBToU(R, G, B);
+				DstV[X / 2] = RGBToV(R, G, B);
+				break;
+			case EYuvLayout::NV12:
+				DstU[X] = RGBToU(R, G, B);
+				DstU[X + 1] = RGBToV(R, G, B);
+				break;
+			case EYuvLayout::I010:
+				reinterpret_cast<uint16*>(DstU)[X / 2] = RGBToU10(R, G, B);
+				reinterpret_cast<uint16*>(DstV)[X / 2] = RGBToV10(R, G, B);
+				break;
+			case EYuvLayout::P010:
+				reinterpret_cast<uint16*>(DstU)[X] = static_cast<uint16>(RGBToU10(R, G, B) << P010_SHIFT);
+				reinterpret_cast<uint16*>(DstU)[X + 1] = static_cast<uint16>(RGBToV10(R, G, B) << P010_SHIFT);
+				break;
+			}
+		}
+
+		/** 从 StartX（偶数）开始的标量转换，SIMD 版本用它处理每行剩余的像素 */
+		template <EYuvLayout Layout>
+		void ConvertRowPairScalar(const uint32* Row0, const uint32* Row1, uint8* DstY0, uint8* DstY1,
+		                          uint8* DstU, uint8* DstV, int32 StartX, int32 Width)
+		{
+			constexpr bool bRequantize = !IsHighBitDepth(Layout);
+			int32 R[4], G[4], B[4];
+			for (int32 X = StartX; X < Width; X += 2)
+			{
+				// 奇数宽度的最后一列重复使用自身参与色度平均
+				const int32 NextX = FMath::Min(X + 1, Width - 1);
+				UnpackPixel<bRequantize>(Row0[X], R[0], G[0], B[0]);
+				UnpackPixel<bRequantize>(Row0[NextX], R[1], G[1], B[1]);
+				UnpackPixel<bRequantize>(Row1[X], R[2], G[2], B[2]);
+				UnpackPixel<bRequantize>(Row1[NextX], R[3], G[3], B[3]);
+
+				StoreLuma<Layout>(DstY0, X, R[0], G[0], B[0]);
+				if (NextX != X)
+				{
+					StoreLuma<Layout>(DstY0, NextX, R[1], G[1], B[1]);
+				}
+				if (DstY1)
+				{
+					StoreLuma<Layout>(DstY1, X, R[2], G[2], B[2]);
+					if (NextX != X)
+					{
+						StoreLuma<Layout>(DstY1, NextX, R[3], G[3], B[3]);
+					}
+				}
+
+				const int32 AvgR = (R[0] + R[1] + R[2] + R[3] + 2) >> 2;
+				const int32 AvgG = (G[0] + G[1] + G[2] + G[3] + 2) >> 2;
+				const int32 AvgB = (B[0] + B[1] + B[2] + B[3] + 2) >> 2;
+				StoreChroma<Layout>(DstU, DstV, X, AvgR, AvgG, AvgB);
+			}
+		}
+
+		template <EYuvLayout Layout>
+		void ConvertRowPairScalar(const uint32* Row0, const uint32* Row1, uint8* DstY0, uint8* DstY1,
+		                          uint8* DstU, uint8* DstV, int32 Width)
+		{
+			ConvertRowPairScalar<Layout>(Row0, Row1, DstY0, DstY1, DstU, DstV, 0, Width);
+		}
+
+#if RECORDER_PIXEL_CONVERT_SIMD
+		/** 4 个像素拆成三个通道，8bit 输出时量化到 8bit */
+		template <bool bRequantize>
+		RECORDER_TARGET_SSE41 FORCEINLINE void UnpackSSE41(__m128i Pixels, __m128i& OutR, __m128i& OutG, __m128i& OutB)
+		{
+			const __m128i Mask = _mm_set1_epi32(0x3FF);
+			const __m128i Half = _mm_set1_epi32(1 << 9);
+			__m128i Channels[3] = {
+				_mm_and_si128(Pixels, Mask),
+				_mm_and_si128(_mm_srli_epi32(Pixels, 10), Mask),
+				_mm_and_si128(_mm_srli_epi32(Pixels, 20), Mask)
+			};
+			if (bRequantize)
+			{
+				for (__m128i& Channel : Channels)
+				{
+					// Value * 255 + 512，再 (Temp + (Temp >> 10)) >> 10
+					const __m128i Temp = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(Channel, 8), Channel), Half);
+					Channel = _mm_srli_epi32(_mm_add_epi32(Temp, _mm_srli_epi32(Temp, 10)), 10);
+				}
+			}
+			OutR = Channels[0];
+			OutG = Channels[1];
+			OutB = Channels[2];
+		}
+
+		RECORDER_TARGET_SSE41 FORCEINLINE __m128i LumaSSE41(__m128i R, __m128i G, __m128i B, int32 Offset)
+		{
+			const __m128i Sum = _mm_add_epi32(
+				_mm_add_epi32(_mm_mullo_epi32(R, _mm_set1_epi32(66)), _mm_mullo_epi32(G, _mm_set1_epi32(129))),
+				_mm_add_epi32(_mm_mullo_epi32(B, _mm_set1_epi32(25)), _mm_set1_epi32(128)));
+			return _mm_add_epi32(_mm_srli_epi32(Sum, 8), _mm_set1_epi32(Offset));
+		}
+
+		RECORDER_TARGET_SSE41 FORCEINLINE __m128i ChromaSSE41(__m128i C0, __m128i C1, __m128i C2,
+		                                                      int32 K0, int32 K1, int32 K2, int32 Bias)
+		{
+			// (K0 * C0 - K1 * C1 - K2 * C2 + Bias) >> 8
+			const __m128i Sum = _mm_sub_epi32(
+				_mm_sub_epi32(_mm_mullo_epi32(C0, _mm_set1_epi32(K0)), _mm_mullo_epi32(C1, _mm_set1_epi32(K1))),
+				_mm_mullo_epi32(C2, _mm_set1_epi32(K2)));
+			return _mm_srai_epi32(_mm_add_epi32(Sum, _mm_set1_epi32(Bias)), 8);
+		}
+
+		/** 2x2 求和后取平均，输入是两行各 8 个像素的同一个通道 */
+		RECORDER_TARGET_SSE41 FORCEINLINE __m128i Average2x2SSE41(__m128i Row0Lo, __m128i Row0Hi,
+		                                                          __m128i Row1Lo, __m128i Row1Hi)
+		{
+			const __m128i Sum = _mm_add_epi32(_mm_hadd_epi32(Row0Lo, Row0Hi), _mm_hadd_epi32(Row1Lo, Row1Hi));
+			return _mm_srli_epi32(_mm_add_epi32(Sum, _mm_set1_epi32(2)), 2);
+		}
+
+		RECORDER_TARGET_SSE41 FORCEINLINE void Store8SSE41(uint8* Dst, __m128i Lo, __m128i Hi)
+		{
+			const __m128i Words = _mm_packs_epi32(Lo, Hi);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(Dst), _mm_packus_epi16(Words, Words));
+		}
+
+		RECORDER_TARGET_SSE41 FORCEINLINE void Store4SSE41(uint8* Dst, __m128i Values)
+		{
+			const __m128i Words = _mm_packs_epi32(Values, Values);
+			const int32 Bytes = _mm_cvtsi128_si32(_mm_packus_epi16(Words, Words));
+			FMemory::Memcpy(Dst, &Bytes, sizeof(Bytes));
+		}
+
+		/** 4 个 U 和 4 个 V 交错成 8 个字节 */
+		RECORDER_TARGET_SSE41 FORCEINLINE void StoreInterleaved4SSE41(uint8* Dst, __m128i U, __m128i V)
+		{
+			const __m128i Words = _mm_unpacklo_epi16(_mm_packs_epi32(U, U), _mm_packs_epi32(V, V));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(Dst), _mm_packus_epi16(Words, Words));
+		}
+
+		/** 8 个 32 位的值存成 8 个 16bit 的采样，左移 Shift 位 */
+		RECORDER_TARGET_SSE41 FORCEINLINE void Store8x16SSE41(uint8* Dst, __m128i Lo, __m128i Hi, int32 Shift)
+		{
+			const __m128i Words = _mm_sll_epi16(_mm_packus_epi32(Lo, Hi), _mm_cvtsi32_si128(Shift));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst), Words);
+		}
+
+		RECORDER_TARGET_SSE41 FORCEINLINE void Store4x16SSE41(uint8* Dst, __m128i Values)
+		{
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(Dst), _mm_packus_epi32(Values, Values));
+		}
+
+		/** 4 个 U 和 4 个 V 交错成 8 个 16bit 的采样，左移 Shift 位 */
+		RECORDER_TARGET_SSE41 FORCEINLINE void StoreInterleaved4x16SSE41(uint8* Dst, __m128i U, __m128i V, int32 Shift)
+		{
+			const __m128i Words = _mm_unpacklo_epi16(_mm_packus_epi32(U, U), _mm_packus_epi32(V, V));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst), _mm_sll_epi16(Words, _mm_cvtsi32_si128(Shift)));
+		}
+
+		template <EYuvLayout Layout>
+		RECORDER_TARGET_SSE41 FORCEINLINE void StoreLumaSSE41(uint8* Row, int32 X, __m128i Lo, __m128i Hi)
+		{
+			if (IsHighBitDepth(Layout))
+			{
+				Store8x16SSE41(Row + X * 2, Lo, Hi, Layout == EYuvLayout::P010 ? P010_SHIFT : 0);
+			}
+			else
+			{
+				Store8SSE41(Row + X, Lo, Hi);
+			}
+		}
+
+		/** 写 X 到 X + 7 列共用的 4 对色度 */
+		template <EYuvLayout Layout>
+		RECORDER_TARGET_SSE41 FORCEINLINE void StoreChromaSSE41(uint8* DstU, uint8* DstV, int32 X, __m128i U, __m128i V)
+		{
+			switch (Layout)
+			{
+			case EYuvLayout::I420:
+				Store4SSE41(DstU + X / 2, U);
+				Store4SSE41(DstV + X / 2, V);
+				break;
+			case EYuvLayout::NV12:
+				StoreInterleaved4SSE41(DstU + X, U, V);
+				break;
+			case EYuvLayout::I010:
+				Store4x16SSE41(DstU + X, U);
+				Store4x16SSE41(DstV + X, V);
+				break;
+			case EYuvLayout::P010:
+				StoreInterleaved4x16SSE41(DstU + X * 2, U, V, P010_SHIFT);
+				break;
+			}
+		}
+
+		template <EYuvLayout Layout>
+		RECORDER_TARGET_SSE41 void ConvertRowPairSSE41(const uint32* Row0, const uint32* Row1, uint8* DstY0,
+		                                               uint8* DstY1, uint8* DstU, uint8* DstV, int32 Width)
+		{
+			constexpr bool bHighBitDepth = IsHighBitDepth(Layout);
+			constexpr int32 LumaOffset = bHighBitDepth ? 64 : 16;
+			constexpr int32 ChromaBias = bHighBitDepth ? 0x20080 : 0x8080;
+			int32 X = 0;
+			// 奇数高度的最后一行交给标量实现
+			if (DstY1)
+			{
+				__m128i R[4], G[4], B[4];
+				for (; X + 8 <= Width; X += 8)
+				{
+					UnpackSSE41<!bHighBitDepth>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + X)), R[0], G[0], B[0]);
+					UnpackSSE41<!bHighBitDepth>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + X + 4)), R[1], G[1], B[1]);
+					UnpackSSE41<!bHighBitDepth>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + X)), R[2], G[2], B[2]);
+					UnpackSSE41<!bHighBitDepth>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + X + 4)), R[3], G[3], B[3]);
+
+					StoreLumaSSE41<Layout>(DstY0, X, LumaSSE41(R[0], G[0], B[0], LumaOffset),
+					                       LumaSSE41(R[1], G[1], B[1], LumaOffset));
+					StoreLumaSSE41<Layout>(DstY1, X, LumaSSE41(R[2], G[2], B[2], LumaOffset),
+					                       LumaSSE41(R[3], G[3], B[3], LumaOffset));
+
+					const __m128i AvgR = Average2x2SSE41(R[0], R[1], R[2], R[3]);
+					const __m128i AvgG = Average2x2SSE41(G[0], G[1], G[2], G[3]);
+					const __m128i AvgB = Average2x2SSE41(B[0], B[1], B[2], B[3]);
+					StoreChromaSSE41<Layout>(DstU, DstV, X,
+					                         ChromaSSE41(AvgB, AvgG, AvgR, 112, 74, 38, ChromaBias),
+					                         ChromaSSE41(AvgR, AvgG, AvgB, 112, 94, 18, ChromaBias));
+				}
+			}
+			ConvertRowPairScalar<Layout>(Row0, Row1, DstY0, DstY1, DstU, DstV, X, Width);
+		}
+
+		template <bool bRequantize>
+		RECORDER_TARGET_AVX2 FORCEINLINE void UnpackAVX2(__m256i Pixels, __m256i& OutR, __m256i& OutG, __m256i& OutB)
+		{
+			const __m256i Mask = _mm256_set1_epi32(0x3FF);
+			const __m256i Half = _mm256_set1_epi32(1 << 9);
+			__m256i Channels[3] = {
+				_mm256_and_si256(Pixels, Mask),
+				_mm256_and_si256(_mm256_srli_epi32(Pixels, 10), Mask),
+				_mm256_and_si256(_mm256_srli_epi32(Pixels, 20), Mask)
+			};
+			if (bRequantize)
+			{
+				for (__m256i& Channel : Channels)
+				{
+					const __m256i Temp = _mm256_add_epi32(_mm256_sub_epi32(_mm256_slli_epi32(Channel, 8), Channel), Half);
+					Channel = _mm256_srli_epi32(_mm256_add_epi32(Temp, _mm256_srli_epi32(Temp, 10)), 10);
+				}
+			}
+			OutR = Channels[0];
+			OutG = Channels[1];
+			OutB = Channels[2];
+		}
+
+		RECORDER_TARGET_AVX2 FORCEINLINE __m256i LumaAVX2(__m256i R, __m256i G, __m256i B, int32 Offset)
+		{
+			const __m256i Sum = _mm256_add_epi32(
+				_mm256_add_epi32(_mm256_mullo_epi32(R, _mm256_set1_epi32(66)),
+				                 _mm256_mullo_epi32(G, _mm256_set1_epi32(129))),
+				_mm256_add_epi32(_mm256_mullo_epi32(B, _mm256_set1_epi32(25)), _mm256_set1_epi32(128)));
+			return _mm256_add_epi32(_mm256_srli_epi32(Sum, 8), _mm256_set1_epi32(Offset));
+		}
+
+		RECORDER_TARGET_AVX2 FORCEINLINE __m256i ChromaAVX2(__m256i C0, __m256i C1, __m256i C2,
+		                                                    int32 K0, int32 K1, int32 K2, int32 Bias)
+		{
+			const __m256i Sum = _mm256_sub_epi32(
+				_mm256_sub_epi32(_mm256_mullo_epi32(C0, _mm256_set1_epi32(K0)),
+				                 _mm256_mullo_epi32(C1, _mm256_set1_epi32(K1))),
+				_mm256_mullo_epi32(C2, _mm256_set1_epi32(K2)));
+			return _mm256_srai_epi32(_mm256_add_epi32(Sum, _mm256_set1_epi32(Bias)), 8);
+		}
+
+		/** hadd 只在 128bit 内进行，需要重排一次才能得到按像素顺序排列的 8 个和 */
+		RECORDER_TARGET_AVX2 FORCEINLINE __m256i Average2x2AVX2(__m256i Row0Lo, __m256i Row0Hi,
+		                                                        __m256i Row1Lo, __m256i Row1Hi)
+		{
+			const __m256i Sum = _mm256_add_epi32(_mm256_hadd_epi32(Row0Lo, Row0Hi), _mm256_hadd_epi32(Row1Lo, Row1Hi));
+			const __m256i Ordered = _mm256_permute4x64_epi64(Sum, 0xD8);
+			return _mm256_srli_epi32(_mm256_add_epi32(Ordered, _mm256_set1_epi32(2)), 2);
+		}
+
+		RECORDER_TARGET_AVX2 FORCEINLINE void Store16AVX2(uint8* Dst, __m256i Lo, __m256i Hi)
+		{
+			const __m256i Words = _mm256_permute4x64_epi64(_mm256_packs_epi32(Lo, Hi), 0xD8);
+			const __m256i Bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(Words, Words), 0xD8);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst), _mm256_castsi256_si128(Bytes));
+		}
+
+		/** 8 个 32 位的值饱和到字节，结果在低 8 个字节 */
+		RECORDER_TARGET_AVX2 FORCEINLINE __m128i Pack8AVX2(__m256i Values)
+		{
+			const __m256i Words = _mm256_permute4x64_epi64(_mm256_packs_epi32(Values, Values), 0xD8);
+			return _mm256_castsi256_si128(_mm256_packus_epi16(Words, Words));
+		}
+
+		RECORDER_TARGET_AVX2 FORCEINLINE void Store8AVX2(uint8* Dst, __m256i Values)
+		{
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(Dst), Pack8AVX2(Values));
+		}
+
+		/** 8 个 U 和 8 个 V 交错成 16 个字节 */
+		RECORDER_TARGET_AVX2 FORCEINLINE void StoreInterleaved8AVX2(uint8* Dst, __m256i U, __m256i V)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst), _mm_unpacklo_epi8(Pack8AVX2(U), Pack8AVX2(V)));
+		}
+
+		/** 8 个 32 位的值饱和到 16bit，按顺序放在低 128bit */
+		RECORDER_TARGET_AVX2 FORCEINLINE __m128i Pack8x16AVX2(__m256i Values)
+		{
+			return _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(Values, Values), 0xD8));
+		}
+
+		/** 16 个 32 位的值存成 16 个 16bit 的采样，左移 Shift 位 */
+		RECORDER_TARGET_AVX2 FORCEINLINE void Store16x16AVX2(uint8* Dst, __m256i Lo, __m256i Hi, int32 Shift)
+		{
+			const __m256i Words = _mm256_permute4x64_epi64(_mm256_packus_epi32(Lo, Hi), 0xD8);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(Dst), _mm256_sll_epi16(Words, _mm_cvtsi32_si128(Shift)));
+		}
+
+		/** 8 个 U 和 8 个 V 交错成 16 个 16bit 的采样，左移 Shift 位 */
+		RECORDER_TARGET_AVX2 FORCEINLINE void StoreInterleaved8x16AVX2(uint8* Dst, __m256i U, __m256i V, int32 Shift)
+		{
+			const __m128i ShiftCount = _mm_cvtsi32_si128(Shift);
+			const __m128i U16 = Pack8x16AVX2(U);
+			const __m128i V16 = Pack8x16AVX2(V);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst), _mm_sll_epi16(_mm_unpacklo_epi16(U16, V16), ShiftCount));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst + 16), _mm_sll_epi16(_mm_unpackhi_epi16(U16, V16), ShiftCount));
+		}
+
+		template <EYuvLayout Layout>
+		RECORDER_TARGET_AVX2 FORCEINLINE void StoreLumaAVX2(uint8* Row, int32 X, __m256i Lo, __m256i Hi)
+		{
+			if (IsHighBitDepth(Layout))
+			{
+				Store16x16AVX2(Row + X * 2, Lo, Hi, Layout == EYuvLayout::P010 ? P010_SHIFT : 0);
+			}
+			else
+			{
+				Store16AVX2(Row + X, Lo, Hi);
+			}
+		}
+
+		/** 写 X 到 X + 15 列共用的 8 对色度 */
+		template <EYuvLayout Layout>
+		RECORDER_TARGET_AVX2 FORCEINLINE void StoreChromaAVX2(uint8* DstU, uint8* DstV, int32 X, __m256i U, __m256i V)
+		{
+			switch (Layout)
+			{
+			case EYuvLayout::I420:
+				Store8AVX2(DstU + X / 2, U);
+				Store8AVX2(DstV + X / 2, V);
+				break;
+			case EYuvLayout::NV12:
+				StoreInterleaved8AVX2(DstU + X, U, V);
+				break;
+			case EYuvLayout::I010:
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(DstU + X), Pack8x16AVX2(U));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(DstV + X), Pack8x16AVX2(V));
+				break;
+			case EYuvLayout::P010:
+				StoreInterleaved8x16AVX2(DstU + X * 2, U, V, P010_SHIFT);
+				break;
+			}
+		}
+
+		template <EYuvLayout Layout>
+		RECORDER_TARGET_AVX2 void ConvertRowPairAVX2(const uint32* Row0, const uint32* Row1, uint8* DstY0,
+		                                             uint8* DstY1, uint8* DstU, uint8* DstV, int32 Width)
+		{
+			constexpr bool bHighBitDepth = IsHighBitDepth(Layout);
+			constexpr int32 LumaOffset = bHighBitDepth ? 64 : 16;
+			constexpr int32 ChromaBias = bHighBitDepth ? 0x20080 : 0x8080;
+			int32 X = 0;
+			if (DstY1)
+			{
+				__m256i R[4], G[4], B[4];
+				for (; X + 16 <= Width; X += 16)
+				{
+					UnpackAVX2<!bHighBitDepth>(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row0 + X)), R[0], G[0], B[0]);
+					UnpackAVX2<!bHighBitDepth>(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row0 + X + 8)), R[1], G[1], B[1]);
+					UnpackAVX2<!bHighBitDepth>(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row1 + X)), R[2], G[2], B[2]);
+					UnpackAVX2<!bHighBitDepth>(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row1 + X + 8)), R[3], G[3], B[3]);
+
+					StoreLumaAVX2<Layout>(DstY0, X, LumaAVX2(R[0], G[0], B[0], LumaOffset),
+					                      LumaAVX2(R[1], G[1], B[1], LumaOffset));
+					StoreLumaAVX2<Layout>(DstY1, X, LumaAVX2(R[2], G[2], B[2], LumaOffset),
+					                      LumaAVX2(R[3], G[3], B[3], LumaOffset));
+
+					const __m256i AvgR = Average2x2AVX2(R[0], R[1], R[2], R[3]);
+					const __m256i AvgG = Average2x2AVX2(G[0], G[1], G[2], G[3]);
+					const __m256i AvgB = Average2x2AVX2(B[0], B[1], B[2], B[3]);
+					StoreChromaAVX2<Layout>(DstU, DstV, X,
+					                        ChromaAVX2(AvgB, AvgG, AvgR, 112, 74, 38, ChromaBias),
+					                        ChromaAVX2(AvgR, AvgG, AvgB, 112, 94, 18, ChromaBias));
+				}
+			}
+			ConvertRowPairScalar<Layout>(Row0, Row1, DstY0, DstY1, DstU, DstV, X, Width);
+		}
+
+		enum class ESimdLevel : uint8
+		{
+			Scalar,
+			SSE41,
+			AVX2,
+		};
+
+		ESimdLevel DetectSimdLevel()
+		{
+			int32 Info[4];
+			__cpuid(Info, 0);
+			const int32 MaxLeaf = Info[0];
+
+			__cpuid(Info, 1);
+			const bool bSSSE3 = (Info[2] & (1 << 9)) != 0;
+			const bool bSSE41 = (Info[2] & (1 << 19)) != 0;
+			const bool bOSXSAVE = (Info[2] & (1 << 27)) != 0;
+			const bool bAVX = (Info[2] & (1 << 28)) != 0;
+			if (!bSSSE3 || !bSSE41)
+			{
+				return ESimdLevel::Scalar;
+			}
+
+			// AVX2 还要求操作系统保存 YMM 寄存器
+			if (MaxLeaf >= 7 && bOSXSAVE && bAVX && (_xgetbv(0) & 0x6) == 0x6)
+			{
+				__cpuidex(Info, 7, 0);
+				if ((Info[1] & (1 << 5)) != 0)
+				{
+					return ESimdLevel::AVX2;
+				}
+			}
+			return ESimdLevel::SSE41;
+		}
+
+		ESimdLevel GetSimdLevel()
+		{
+			static const ESimdLevel Level = DetectSimdLevel();
+			return Level;
+		}
+#endif
+
+		template <EYuvLayout Layout>
+		FRowPairFunction SelectRowPairFunction()
+		{
+#if RECORDER_PIXEL_CONVERT_SIMD
+			switch (GetSimdLevel())
+			{
+			case ESimdLevel::AVX2:
+				return &ConvertRowPairAVX2<Layout>;
+			case ESimdLevel::SSE41:
+				return &ConvertRowPairSSE41<Layout>;
+			default:
+				break;
+			}
+#endif
+			return static_cast<FRowPairFunction>(&ConvertRowPairScalar<Layout>);
+		}
+
+		template <EYuvLayout Layout>
+		FRowPairFunction GetScalarRowPairFunction()
+		{
+			return static_cast<FRowPairFunction>(&ConvertRowPairScalar<Layout>);
+		}
+
+		void ConvertFrame(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width, int32 Height,
+		                  FRowPairFunction RowPair)
+		{
+			for (int32 Y = 0; Y < Height; Y += 2)
+			{
+				const bool bHasSecondRow = Y + 1 < Height;
+				const uint32* Row0 = reinterpret_cast<const uint32*>(Src + static_cast<SIZE_T>(Y) * SrcStride);
+				const uint32* Row1 = bHasSecondRow ? reinterpret_cast<const uint32*>(Src + static_cast<SIZE_T>(Y + 1) * SrcStride) : Row0;
+				uint8* DstY0 = Dst.Y + static_cast<SIZE_T>(Y) * Dst.StrideY;
+				uint8* DstY1 = bHasSecondRow ? DstY0 + Dst.StrideY : nullptr;
+				RowPair(Row0, Row1, DstY0, DstY1,
+				        Dst.U + static_cast<SIZE_T>(Y / 2) * Dst.StrideU,
+				        Dst.V + static_cast<SIZE_T>(Y / 2) * Dst.StrideV,
+				        Width);
+			}
+		}
+
+		void ConvertFrame(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width, int32 Height,
+		                  FRowPairFunction RowPair)
+		{
+			// UV 平面当作 U 平面传进去，行函数把 V 交错写在 U 后面
+			ConvertFrame(Src, SrcStride, {Dst.Y, Dst.StrideY, Dst.UV, Dst.StrideUV, nullptr, 0}, Width, Height, RowPair);
+		}
+	}
+
+	using PixelConvertDetail::EYuvLayout;
+
+	void ConvertA2B10G10R10ToI420(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width, int32 Height)
+	{
+		static const PixelConvertDetail::FRowPairFunction RowPair =
+			PixelConvertDetail::SelectRowPairFunction<EYuvLayout::I420>();
+		PixelConvertDetail::ConvertFrame(Src, SrcStride, Dst, Width, Height, RowPair);
+	}
+
+	void ConvertA2B10G10R10ToI420_Scalar(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width,
+	                                     int32 Height)
+	{
+		PixelConvertDetail::ConvertFrame(Src, SrcStride, Dst, Width, Height,
+		                                 PixelConvertDetail::GetScalarRowPairFunction<EYuvLayout::I420>());
+	}
+
+	void ConvertA2B10G10R10ToNV12(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width, int32 Height)
+	{
+		static const PixelConvertDetail::FRowPairFunction RowPair =
+			PixelConvertDetail::SelectRowPairFunction<EYuvLayout::NV12>();
+		PixelConvertDetail::ConvertFrame(Src, SrcStride, Dst, Width, Height, RowPair);
+	}
+
+	void ConvertA2B10G10R10ToNV12_Scalar(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width,
+	                                     int32 Height)
+	{
+		PixelConvertDetail::ConvertFrame(Src, SrcStride, Dst, Width, Height,
+		                                 PixelConvertDetail::GetScalarRowPairFunction<EYuvLayout::NV12>());
+	}
+
+	void ConvertA2B10G10R10ToI010(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width, int32 Height)
+	{
+		static const PixelConvertDetail::FRowPairFunction RowPair =
+			PixelConvertDetail::SelectRowPairFunction<EYuvLayout::I010>();
+		PixelConvertDetail::ConvertFrame(Src, SrcStride, Dst, Width, Height, RowPair);
+	}
+
+	void ConvertA2B10G10R10ToI010_Scalar(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width,
+	                                     int32 Height)
+	{
+		PixelConvertDetail::ConvertFrame(Src, SrcStride, Dst, Width, Height,
+		                                 PixelConvertDetail::GetScalarRowPairFunction<EYuvLayout::I010>());
+	}
+
+	void ConvertA2B10G10R10ToP010(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width, int32 Height)
+	{
+		static const PixelConvertDetail::FRowPairFunction RowPair =
+			PixelConvertDetail::SelectRowPairFunction<EYuvLayout::P010>();
+		PixelConvertDetail::ConvertFrame(Src, SrcStride, Dst, Width, Height, RowPair);
+	}
+
+	void ConvertA2B10G10R10ToP010_Scalar(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width,
+	                                     int32 Height)
+	{
+		PixelConvertDetail::ConvertFrame(Src, SrcStride, Dst, Width, Height,
+		                                 PixelConvertDetail::GetScalarRowPairFunction<EYuvLayout::P010>());
+	}
+
+	void WidenI420ToI010(const FI420Planes& Src, const FI420Planes& Dst, int32 Width, int32 Height)
+	{
+		// 8bit 的 limited range 左移 2 位正好是 10bit 的 limited range（16..235 -> 64..940）
+		const auto WidenPlane = [](const uint8* SrcPlane, int32 SrcStride, uint8* DstPlane, int32 DstStride,
+		                           int32 PlaneWidth, int32 PlaneHeight)
+		{
+			for (int32 Y = 0; Y < PlaneHeight; ++Y)
+			{
+				const uint8* SrcRow = SrcPlane + static_cast<SIZE_T>(Y) * SrcStride;
+				uint16* DstRow = reinterpret_cast<uint16*>(DstPlane + static_cast<SIZE_T>(Y) * DstStride);
+				for (int32 X = 0; X < PlaneWidth; ++X)
+				{
+					DstRow[X] = static_cast<uint16>(SrcRow[X] << 2);
+				}
+			}
+		};
+		const int32 ChromaWidth = (Width + 1) / 2;
+		const int32 ChromaHeight = (Height + 1) / 2;
+		WidenPlane(Src.Y, Src.StrideY, Dst.Y, Dst.StrideY, Width, Height);
+		WidenPlane(Src.U, Src.StrideU, Dst.U, Dst.StrideU, ChromaWidth, ChromaHeight);
+		WidenPlane(Src.V, Src.StrideV, Dst.V, Dst.StrideV, ChromaWidth, ChromaHeight);
+	}
+
+	void WidenI420ToP010(const FI420Planes& Src, const FNV12Planes& Dst, int32 Width, int32 Height)
+	{
+		// 10bit 再放到高位，一共左移 8 位
+		constexpr int32 Shift = 2 + PixelConvertDetail::P010_SHIFT;
+		for (int32 Y = 0; Y < Height; ++Y)
+		{
+			const uint8* SrcRow = Src.Y + static_cast<SIZE_T>(Y) * Src.StrideY;
+			uint16* DstRow = reinterpret_cast<uint16*>(Dst.Y + static_cast<SIZE_T>(Y) * Dst.StrideY);
+			for (int32 X = 0; X < Width; ++X)
+			{
+				DstRow[X] = static_cast<uint16>(SrcRow[X] << Shift);
+			}
+		}
+		const int32 ChromaWidth = (Width + 1) / 2;
+		for (int32 Y = 0; Y < (Height + 1) / 2; ++Y)
+		{
+			const uint8* SrcU = Src.U + static_cast<SIZE_T>(Y) * Src.StrideU;
+			const uint8* SrcV = Src.V + static_cast<SIZE_T>(Y) * Src.StrideV;
+			uint16* DstRow = reinterpret_cast<uint16*>(Dst.UV + static_cast<SIZE_T>(Y) * Dst.StrideUV);
+			for (int32 X = 0; X < ChromaWidth; ++X)
+			{
+				DstRow[X * 2] = static_cast<uint16>(SrcU[X] << Shift);
+				DstRow[X * 2 + 1] = static_cast<uint16>(SrcV[X] << Shift);
+			}
+		}
+	}
+
+	void ParallelForStripes(int32 Height, int32 NumWorkers, TFunctionRef<void(int32 StartRow, int32 NumRows)> Body)
+	{
+		// 条带太窄时调度开销会超过转换本身
+		constexpr int32 MinStripeRows = 64;
+		if (NumWorkers <= 0)
+		{
+			NumWorkers = FMath::Clamp(FPlatformMisc::NumberOfWorkerThreadsToSpawn(), 1, 8);
+		}
+		const int32 NumStripes = FMath::Clamp(Height / MinStripeRows, 1, NumWorkers);
+		const int32 StripeRows = Align(FMath::DivideAndRoundUp(Height, NumStripes), 2);
+
+		ParallelFor(NumStripes, [Height, StripeRows, &Body](int32 Stripe)
+		{
+			const int32 StartRow = Stripe * StripeRows;
+			if (StartRow < Height)
+			{
+				Body(StartRow, FMath::Min(StripeRows, Height - StartRow));
+			}
+		}, NumStripes == 1);
+	}
+
+	const TCHAR* GetPixelConvertImplementationName()
+	{
+#if RECORDER_PIXEL_CONVERT_SIMD
+		switch (PixelConvertDetail::GetSimdLevel())
+		{
+		case PixelConvertDetail::ESimdLevel::AVX2:
+			return TEXT("AVX2");
+		case PixelConvertDetail::ESimdLevel::SSE41:
+			return TEXT("SSE4.1");
+		default:
+			break;
+		}
+#endif
+		return TEXT("Scalar");
+	}
+}
@@ -0,0 +1,52 @@
+﻿#include "Encoder/RecorderStats.h"
+
+#include "ProfilingDebugging/CountersTrace.h"
+#include "Trace/Trace.h"
+
+UE_TRACE_CHANNEL_DEFINE(RecorderChannel)
+
+// 编码线程隔一段时间才采样一次，用不按帧清零的累加型统计
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Video Buffer Depth"), STAT_RecorderVideoBufferDepth, STATGROUP_Recorder);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Audio Buffer Depth"), STAT_RecorderAudioBufferDepth, STATGROUP_Recorder);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Free Video Slots"), STAT_RecorderFreeVideoSlots, STATGROUP_Recorder);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Encoded FPS"), STAT_RecorderEncodedFps, STATGROUP_Recorder);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Encode Time Per Frame (ms)"), STAT_RecorderEncodeMs, STATGROUP_Recorder);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Output Bitrate (kbps)"), STAT_RecorderBitrate, STATGROUP_Recorder);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Dropped Video Frames"), STAT_RecorderDroppedFrames, STATGROUP_Recorder);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("A/V Drift (ms)"), STAT_RecorderAVDrift, STATGROUP_Recorder);
+
+TRACE_DECLARE_INT_COUNTER(RecorderVideoBufferDepth, TEXT("Recorder/VideoBufferDepth"));
+TRACE_DECLARE_INT_COUNTER(RecorderAudioBufferDepth, TEXT("Recorder/AudioBufferDepth"));
+TRACE_DECLARE_INT_COUNTER(RecorderFreeVideoSlots, TEXT("Recorder/FreeVideoSlots"));
+TRACE_DECLARE_FLOAT_COUNTER(RecorderEncodedFps, TEXT("Recorder/EncodedFps"));
+TRACE_DECLARE_FLOAT_COUNTER(RecorderEncodeMs, TEXT("Recorder/EncodeMsPerFrame"));
+TRACE_DECLARE_FLOAT_COUNTER(RecorderBitrate, TEXT("Recorder/OutputBitrateKbps"));
+TRACE_DECLARE_INT_COUNTER(RecorderDroppedFrames, TEXT("Recorder/DroppedVideoFrames"));
+TRACE_DECLARE_FLOAT_COUNTER(RecorderAVDrift, TEXT("Recorder/AVDriftMs"));
+
+namespace recorder
+{
+	void PublishLiveStats(const FRecorderStats& Stats)
+	{
+		SET_DWORD_STAT(STAT_RecorderVideoBufferDepth, Stats.VideoBufferDepth);
+		SET_DWORD_STAT(STAT_RecorderAudioBufferDepth, Stats.AudioBufferDepth);
+		SET_DWORD_STAT(STAT_RecorderFreeVideoSlots, Stats.FreeVideoSlots);
+		SET_FLOAT_STAT(STAT_RecorderEncodedFps, Stats.EncodedFps);
+		SET_FLOAT_STAT(STAT_RecorderEncodeMs, Stats.EncodeMsPerFrame);
+		SET_FLOAT_STAT(STAT_RecorderBitrate, Stats.OutputBitrateKbps);
+		SET_DWORD_STAT(STAT_RecorderDroppedFrames, Stats.DroppedVideoFrames);
+		SET_FLOAT_STAT(STAT_RecorderAVDrift, Stats.AVDriftMs);
+
+		if (UE_TRACE_CHANNELEXPR_IS_ENABLED(RecorderChannel))
+		{
+			TRACE_COUNTER_SET(RecorderVideoBufferDepth, Stats.VideoBufferDepth);
+			TRACE_COUNTER_SET(RecorderAudioBufferDepth, Stats.AudioBufferDepth);
+			TRACE_COUNTER_SET(RecorderFreeVideoSlots, Stats.FreeVideoSlots);
+			TRACE_COUNTER_SET(RecorderEncodedFps, Stats.EncodedFps);
+			TRACE_COUNTER_SET(RecorderEncodeMs, Stats.EncodeMsPerFrame);
+			TRACE_COUNTER_SET(RecorderBitrate, Stats.OutputBitrateKbps);
+			TRACE_COUNTER_SET(RecorderDroppedFrames, Stats.DroppedVideoFrames);
+			TRACE_COUNTER_SET(RecorderAVDrift, Stats.AVDriftMs);
+		}
+	}
+}
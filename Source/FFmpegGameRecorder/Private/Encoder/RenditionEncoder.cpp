@@ -0,0 +1,191 @@
+﻿#include "Encoder/RenditionEncoder.h"
+
+#include "Misc/Paths.h"
+
+FRenditionEncoder::FRenditionEncoder(const FRecorderConfig& MainConfig, const FRecorderRendition& Rendition)
+	: Config(MakeConfig(MainConfig, Rendition))
+	  , Name(FString::Printf(TEXT("%dp"), Rendition.Resolution.Y))
+{
+}
+
+FRenditionEncoder::~FRenditionEncoder()
+{
+	// 正常结束时线程已经在 FinishVideo 里退出了
+	RenditionStage.Reset();
+	av_frame_free(&ScaledFrame);
+	av_frame_free(&SpareFrame);
+	for (AVFrame*& Frame : Frames)
+	{
+		av_frame_free(&Frame);
+	}
+	Frames.Empty();
+}
+
+FRecorderConfig FRenditionEncoder::MakeConfig(const FRecorderConfig& MainConfig, const FRecorderRendition& Rendition)
+{
+	FRecorderConfig Config = MainConfig;
+	// 这一档的输入是主输出编码器的帧，自己的分辨率就是编码分辨率
+	Config.Resolution = Rendition.Resolution;
+	Config.OutputResolution = FIntPoint::ZeroValue;
+	Config.VideoBitRate = Rendition.VideoBitRate;
+	if (!Rendition.Preset.IsEmpty())
+	{
+		Config.VideoPreset = Rendition.Preset;
+	}
+	Config.SaveFilePath = !Rendition.SaveFilePath.IsEmpty()
+		                      ? Rendition.SaveFilePath
+		                      : FPaths::GetPath(MainConfig.SaveFilePath) / FString::Printf(
+			                      TEXT("%s_%dp.%s"), *FPaths::GetBaseFilename(MainConfig.SaveFilePath),
+			                      Rendition.Resolution.Y, *FPaths::GetExtension(MainConfig.SaveFilePath));
+	// 即时回放、额外输出、更多档位和延迟 CSV 只属于主输出
+	Config.ReplayBufferMB = 0;
+	Config.LatencyCsvPath.Reset();
+	Config.AdditionalOutputs.Reset();
+	Config.Renditions.Reset();
+	return Config;
+}
+
+void FRenditionEncoder::Initialize(FRecorderSessionReport* Report)
+{
+	SessionReport = Report;
+	Encoder = MakeUnique<FAVEncoder>();
+	Encoder->InitializeEncoder(Config);
+	Encoder->SetSessionReport(Report, Name + TEXT("/"));
+	UE_LOG(LogRecorder, Display, TEXT("Rendition %s: %dx%d %d bps %s -> %s"), *Name, Config.Resolution.X,
+	       Config.Resolution.Y, Config.VideoBitRate, *Config.VideoPreset, *Config.SaveFilePath)
+
+	ScaledFrame = av_frame_alloc();
+	Ready.Initialize(FRAME_CAPACITY);
+	Free.Initialize(FRAME_CAPACITY);
+	Frames.Reset(FRAME_CAPACITY);
+	for (uint32 Index = 0; Index < FRAME_CAPACITY; ++Index)
+	{
+		Free.Enqueue(Frames.Add_GetRef(av_frame_alloc()));
+	}
+
+	RenditionStage = MakeUnique<FPipelineStage>(*FString::Printf(TEXT("RecorderRenditionThread_%s"), *Name),
+	                                            [this]() { return EncodeOneVideoFrame_RenditionThread(); },
+	                                            [this]() { return !Ready.IsEmpty(); });
+	RenditionStage->Start();
+}
+
+void FRenditionEncoder::EnqueueVideoFrame(const FConvertedVideoFrame& Converted)
+{
+	// 这一帧之前被丢掉的时长对每一档都一样，先累计起来，带到这一档下一个入队的帧上
+	PendingDroppedCount += Converted.DroppedCount;
+	PendingDroppedDuration += Converted.DroppedDuration;
+
+	AVFrame* Frame = nullptr;
+	if (SpareFrame)
+	{
+		Swap(Frame, SpareFrame);
+	}
+	else if (!Free.Dequeue(Frame))
+	{
+		// 这一档还没编完前面的帧，只丢这一档的这一帧
+		++DroppedFrames;
+	}
+	// 转换失败的帧对这一档也是丢帧；只增加主编码器帧缓存的引用计数，不拷贝像素
+	if (!Frame || !Converted.Frame->buf[0] || av_frame_ref(Frame, Converted.Frame) < 0)
+	{
+		SpareFrame = Frame;
+		++PendingDroppedCount;
+		PendingDroppedDuration += Converted.Time.Duration;
+		return;
+	}
+
+	FConvertedVideoFrame Queued;
+	Queued.Frame = Frame;
+	Queued.Time = Converted.Time;
+	Queued.DroppedCount = PendingDroppedCount;
+	Queued.DroppedDuration = PendingDroppedDuration;
+	Queued.EnqueueCycles = FPlatformTime::Cycles64();
+	PendingDroppedCount = 0;
+	PendingDroppedDuration = 0;
+
+	// 帧对象和队列容量一样多，这里不会失败
+	verify(Ready.Enqueue(Queued));
+	RenditionStage->Wake();
+}
+
+bool FRenditionEncoder::EncodeOneVideoFrame_RenditionThread()
+{
+	const uint32 QueueDepth = Ready.Num();
+	FConvertedVideoFrame Queued;
+	if (!Ready.Dequeue(Queued))
+	{
+		return false;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("FRenditionEncoder::EncodeOneVideoFrame");
+	if (Queued.DroppedCount > 0)
+	{
+		if (Config.VideoQueuePolicy == ERecorderQueuePolicy::DuplicateLast)
+		{
+			Encoder->RepeatLastVideoFrame(Queued.DroppedCount, Queued.DroppedDuration);
+		}
+		else
+		{
+			Encoder->ExtendLastVideoFrame(Queued.DroppedDuration);
+		}
+	}
+	if (Encoder->ScaleVideoFrame(Queued.Frame, ScaledFrame))
+	{
+		Encoder->EncodeVideoFrame(ScaledFrame, Queued.Time);
+	}
+	else
+	{
+		++DroppedFrames;
+		Encoder->ExtendLastVideoFrame(Queued.Time.Duration);
+	}
+	RenditionStage->GetStats().RecordItem(Queued.EnqueueCycles, QueueDepth);
+
+	// 放掉对主编码器帧缓存的引用，缓存回到主编码器的池里
+	av_frame_unref(Queued.Frame);
+	Free.Enqueue(Queued.Frame);
+	return true;
+}
+
+void FRenditionEncoder::EncodeAudioFrame(FEncodeData* EncodeData)
+{
+	// 主编码器的时间队列在音频线程入队、由主编码器取走，这一档要有自己的一份，否则产出的 packet 没有时间戳
+	AudioTimeSequence.Enqueue({EncodeData->StartSec, EncodeData->Duration});
+	Encoder->EncodeAudioFrame(AudioTimeSequence, EncodeData);
+}
+
+void FRenditionEncoder::FinishVideo()
+{
+	if (RenditionStage)
+	{
+		RenditionStage->RequestStop();
+		RenditionStage->Join();
+		RenditionStage->GetStats().Log(Name, SessionReport);
+		RenditionStage.Reset();
+	}
+	// 最后几帧被这一档丢掉了，时长补到最后一帧上
+	if (PendingDroppedDuration > 0)
+	{
+		Encoder->ExtendLastVideoFrame(PendingDroppedDuration);
+		PendingDroppedCount = 0;
+		PendingDroppedDuration = 0;
+	}
+	Encoder->EndVideoEncoding();
+	if (const uint64 Dropped = DroppedFrames.load())
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("Rendition %s: %llu video frames dropped"), *Name, Dropped)
+	}
+	if (SessionReport)
+	{
+		SessionReport->AddCounter(Name + TEXT("/video_frames_dropped"), static_cast<int64>(DroppedFrames.load()));
+	}
+}
+
+void FRenditionEncoder::FinishAudio()
+{
+	Encoder->EndAudioEncoding(AudioTimeSequence);
+}
+
+void FRenditionEncoder::Finish()
+{
+	Encoder->EncodeFinish();
+}
@@ -0,0 +1,314 @@
+﻿#include "Encoder/ReplayBuffer.h"
+
+#include "Algo/BinarySearch.h"
+#include "Async/Async.h"
+#include "Misc/ScopeExit.h"
+#include "Encoder/OutputFile.h"
+
+FReplayBuffer::FReplayBuffer(const FRecorderConfig& InConfig, const AVFormatContext* Template)
+	: Config(InConfig)
+{
+	for (uint32 Index = 0; Index < Template->nb_streams; ++Index)
+	{
+		const AVStream* Stream = Template->streams[Index];
+		AVCodecParameters* Parameters = avcodec_parameters_alloc();
+		avcodec_parameters_copy(Parameters, Stream->codecpar);
+		Streams.Add({Parameters, Stream->time_base});
+	}
+
+	Capacity = Align(static_cast<uint64>(Config.ReplayBufferMB) * 1024 * 1024, RECORD_ALIGNMENT);
+	if (Config.bReplayBufferOnDisk)
+	{
+		// 回放模式不写 SaveFilePath，缓存文件放在它旁边
+		MappedFile = MakeUnique<FMappedFile>();
+		if (MappedFile->Open(Config.SaveFilePath + TEXT(".replay"), Capacity))
+		{
+			Memory = MappedFile->GetData();
+		}
+		else
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("Replay buffer: can not map a file, falling back to memory"))
+			MappedFile.Reset();
+		}
+	}
+	if (!Memory)
+	{
+		Memory = static_cast<uint8*>(FMemory::Malloc(Capacity, RECORD_ALIGNMENT));
+	}
+	UE_LOG(LogRecorder, Display, TEXT("Replay buffer: %llu bytes in %s"), Capacity,
+	       MappedFile ? TEXT("a mapped file") : TEXT("memory"))
+}
+
+FReplayBuffer::~FReplayBuffer()
+{
+	{
+		FScopeLock Lock(&PendingSavesMutex);
+		for (TFuture<bool>& Save : PendingSaves)
+		{
+			Save.Wait();
+		}
+		PendingSaves.Empty();
+	}
+	for (FStreamInfo& Stream : Streams)
+	{
+		avcodec_parameters_free(&Stream.Parameters);
+	}
+	if (MappedFile)
+	{
+		MappedFile->Close();
+	}
+	else
+	{
+		FMemory::Free(Memory);
+	}
+}
+
+void FReplayBuffer::AddPacket(const AVPacket* Packet)
+{
+	const FStreamInfo& Stream = Streams[Packet->stream_index];
+	const bool bStartsGop = Stream.Parameters->codec_type == AVMEDIA_TYPE_VIDEO && (Packet->flags & AV_PKT_FLAG_KEY);
+	const double Time = Packet->dts * av_q2d(Stream.TimeBase);
+	const uint32 RecordSize = Align(static_cast<uint32>(sizeof(FRecordHeader) + Packet->size), RECORD_ALIGNMENT);
+
+	FScopeLock Lock(&Mutex);
+	if (bWaitingForKeyframe && !bStartsGop)
+	{
+		return;
+	}
+
+	uint64 Position;
+	const EAllocateResult Result = AllocateRecord(RecordSize, bStartsGop, Time, Position);
+	if (Result == EAllocateResult::TooLarge && ReadCursors.Num() == 0)
+	{
+		// 一个 GOP 就超过了整个缓存，只能全部丢掉，等下一个关键帧
+		UE_LOG(LogRecorder, Warning, TEXT("Replay buffer (%llu bytes) can not hold one GOP, cleared"), Capacity)
+		Clear();
+		return;
+	}
+	if (Result != EAllocateResult::Success)
+	{
+		// 导出还在读最老的 GOP，不能淘汰，丢掉新的 packet 直到下一个关键帧，回放里会留下一段空缺
+		if (!bWaitingForKeyframe)
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("Replay buffer is full while a replay is being saved, dropping packets"))
+		}
+		bWaitingForKeyframe = true;
+		return;
+	}
+	bWaitingForKeyframe = false;
+	NewestTime = FMath::Max(NewestTime, Time);
+
+	uint8* Record = Memory + Position % Capacity;
+	FRecordHeader* Header = reinterpret_cast<FRecordHeader*>(Record);
+	Header->Pts = Packet->pts;
+	Header->Dts = Packet->dts;
+	Header->Duration = Packet->duration;
+	Header->Size = Packet->size;
+	Header->Flags = Packet->flags;
+	Header->StreamIndex = Packet->stream_index;
+	Header->RecordSize = RecordSize;
+	FMemory::Memcpy(Record + sizeof(FRecordHeader), Packet->data, Packet->size);
+}
+
+FReplayBuffer::EAllocateResult FReplayBuffer::AllocateRecord(uint32 RecordSize, bool bStartsGop, double Time,
+                                                             uint64& OutPosition)
+{
+	if (RecordSize > Capacity)
+	{
+		return EAllocateResult::TooLarge;
+	}
+
+	// 一条记录不跨越缓存末尾，放不下时把剩下的部分填充掉，从头开始
+	const uint64 PhysicalTail = Tail % Capacity;
+	const uint64 Padding = PhysicalTail + RecordSize > Capacity ? Capacity - PhysicalTail : 0;
+	const uint64 Position = Tail + Padding;
+
+	while (Position + RecordSize - Head > Capacity)
+	{
+		// 整段淘汰最老的 GOP，淘汰只是移动 Head；新的关键帧自己开始一个 GOP，最多淘汰到它为止
+		uint64 NewHead;
+		if (GopStarts.Num() > 1)
+		{
+			NewHead = GopStarts[1].Position;
+		}
+		else if (bStartsGop)
+		{
+			NewHead = Position;
+		}
+		else
+		{
+			return EAllocateResult::TooLarge;
+		}
+		if (IsPinned(NewHead))
+		{
+			return EAllocateResult::Pinned;
+		}
+		Head = NewHead;
+		if (GopStarts.Num() > 0)
+		{
+			GopStarts.RemoveAt(0, 1, false);
+		}
+	}
+
+	if (Padding >= sizeof(FRecordHeader))
+	{
+		reinterpret_cast<FRecordHeader*>(Memory + PhysicalTail)->Size = -1;
+	}
+	if (bStartsGop)
+	{
+		GopStarts.Add({Position, Time});
+	}
+	OutPosition = Position;
+	Tail = Position + RecordSize;
+	return EAllocateResult::Success;
+}
+
+bool FReplayBuffer::IsPinned(uint64 NewHead) const
+{
+	for (const FReadCursor* Cursor : ReadCursors)
+	{
+		if (Cursor->Position < Cursor->End && Cursor->Position < NewHead)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void FReplayBuffer::Clear()
+{
+	Head = Tail;
+	GopStarts.Reset();
+	bWaitingForKeyframe = true;
+}
+
+double FReplayBuffer::GetRetainedSeconds() const
+{
+	FScopeLock Lock(&Mutex);
+	return GopStarts.Num() > 0 ? NewestTime - GopStarts[0].Time : 0;
+}
+
+bool FReplayBuffer::SaveReplay(const FString& Path, double Seconds)
+{
+	// 只在锁内确定导出的范围并登记读游标，packet 在后台边读边写，不会把整段回放复制进内存
+	TSharedPtr<FReadCursor> Cursor = MakeShared<FReadCursor>();
+	{
+		FScopeLock Lock(&Mutex);
+		if (GopStarts.Num() == 0)
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("SaveReplay: replay buffer is empty"))
+			return false;
+		}
+		// 从不晚于 NewestTime - Seconds 的最后一个关键帧开始，保证保存下来的时长不少于 Seconds
+		const int32 GopIndex = Algo::UpperBoundBy(GopStarts, NewestTime - Seconds, &FGopStart::Time) - 1;
+		Cursor->Position = GopStarts[FMath::Max(GopIndex, 0)].Position;
+		Cursor->End = Tail;
+		ReadCursors.Add(Cursor.Get());
+	}
+
+	FScopeLock Lock(&PendingSavesMutex);
+	PendingSaves.RemoveAll([](const TFuture<bool>& Save) { return Save.IsReady(); });
+	PendingSaves.Add(Async(EAsyncExecution::ThreadPool, [this, Path, Cursor]()
+	{
+		ON_SCOPE_EXIT
+		{
+			FScopeLock Lock(&Mutex);
+			ReadCursors.Remove(Cursor.Get());
+		};
+		return WriteReplay(Path, *Cursor);
+	}));
+	return true;
+}
+
+bool FReplayBuffer::ReadPacket(FReadCursor& Cursor, AVPacket* Packet)
+{
+	// 读游标之后的记录不会被淘汰或者覆盖，读数据不需要加锁，只有推进游标时加锁
+	const auto Advance = [this, &Cursor](uint64 Bytes)
+	{
+		FScopeLock Lock(&Mutex);
+		Cursor.Position += Bytes;
+	};
+
+	while (Cursor.Position < Cursor.End)
+	{
+		const uint64 PhysicalPosition = Cursor.Position % Capacity;
+		const FRecordHeader* Header = reinterpret_cast<const FRecordHeader*>(Memory + PhysicalPosition);
+		if (Capacity - PhysicalPosition < sizeof(FRecordHeader) || Header->Size < 0)
+		{
+			Advance(Capacity - PhysicalPosition);
+			continue;
+		}
+
+		if (av_new_packet(Packet, Header->Size) < 0)
+		{
+			return false;
+		}
+		FMemory::Memcpy(Packet->data, Header + 1, Header->Size);
+		Packet->pts = Header->Pts;
+		Packet->dts = Header->Dts;
+		Packet->duration = Header->Duration;
+		Packet->flags = Header->Flags;
+		Packet->stream_index = Header->StreamIndex;
+		Advance(Header->RecordSize);
+		return true;
+	}
+	return false;
+}
+
+bool FReplayBuffer::WriteReplay(const FString& Path, FReadCursor& Cursor)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("FReplayBuffer::WriteReplay");
+	AVFormatContext* Context = nullptr;
+	TUniquePtr<FBufferedFileWriter> Writer;
+	int Ret = avformat_alloc_output_context2(&Context, nullptr, "mp4", TCHAR_TO_UTF8(*Path));
+	for (int32 Index = 0; Ret >= 0 && Index < Streams.Num(); ++Index)
+	{
+		AVStream* Stream = avformat_new_stream(Context, nullptr);
+		Ret = Stream ? avcodec_parameters_copy(Stream->codecpar, Streams[Index].Parameters) : AVERROR(ENOMEM);
+		if (Ret >= 0)
+		{
+			Stream->codecpar->codec_tag = 0;
+			Stream->time_base = Streams[Index].TimeBase;
+		}
+	}
+	if (Ret >= 0)
+	{
+		// 回放从 0 开始
+		Context->avoid_negative_ts = AVFMT_AVOID_NEG_TS_MAKE_ZERO;
+		Ret = recorder::OpenOutputIO(Context, Path, Config, Writer);
+	}
+	const bool bOpened = Ret >= 0;
+	if (bOpened)
+	{
+		Ret = avformat_write_header(Context, nullptr);
+	}
+
+	// 缓存里的 packet 已经是封装线程交错好的顺序，直接写出
+	AVPacket* Packet = av_packet_alloc();
+	while (Ret >= 0 && ReadPacket(Cursor, Packet))
+	{
+		av_packet_rescale_ts(Packet, Streams[Packet->stream_index].TimeBase,
+		                     Context->streams[Packet->stream_index]->time_base);
+		Ret = av_write_frame(Context, Packet);
+		av_packet_unref(Packet);
+	}
+	av_packet_free(&Packet);
+
+	if (Ret >= 0)
+	{
+		Ret = av_write_trailer(Context);
+	}
+	if (bOpened)
+	{
+		recorder::CloseOutputIO(Context, Writer);
+	}
+	avformat_free_context(Context);
+
+	if (Ret < 0)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("SaveReplay: failed to write %s (%d)"), *Path, Ret)
+		return false;
+	}
+	UE_LOG(LogRecorder, Display, TEXT("SaveReplay: saved %s"), *Path)
+	return true;
+}
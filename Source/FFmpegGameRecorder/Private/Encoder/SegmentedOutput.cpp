@@ -0,0 +1,271 @@
+﻿#include "Encoder/SegmentedOutput.h"
+
+#include "Async/Async.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Encoder/OutputFile.h"
+
+FSegmentedOutput::FSegmentedOutput(const FRecorderConfig& InConfig, AVFormatContext* InTemplate)
+	: Config(InConfig)
+	  , Template(InTemplate)
+	  , FormatName(GetSegmentFormatName(InConfig))
+	  , bWritePlaylist(InConfig.bWriteHLSPlaylist)
+{
+	BasePath = FPaths::GetPath(Config.SaveFilePath) / FPaths::GetBaseFilename(Config.SaveFilePath);
+	Extension = bWritePlaylist ? TEXT("ts") : FPaths::GetExtension(Config.SaveFilePath);
+}
+
+FSegmentedOutput::~FSegmentedOutput()
+{
+	Close();
+}
+
+bool FSegmentedOutput::IsEnabled(const FRecorderConfig& Config)
+{
+	return (Config.SegmentDurationSec > 0 || Config.SegmentSizeMB > 0) && Config.ReplayBufferMB <= 0
+		&& recorder::IsLocalOutputPath(Config.SaveFilePath);
+}
+
+const char* FSegmentedOutput::GetSegmentFormatName(const FRecorderConfig& Config)
+{
+	return Config.bWriteHLSPlaylist ? "mpegts" : nullptr;
+}
+
+bool FSegmentedOutput::Open()
+{
+	Current.Reset(OpenSegment(0));
+	if (!Current)
+	{
+		return false;
+	}
+	PreopenNextSegment();
+	return true;
+}
+
+int FSegmentedOutput::WritePacket(AVPacket* Packet)
+{
+	const AVStream* SourceStream = Template->streams[Packet->stream_index];
+	const double PacketTime = Packet->dts * av_q2d(SourceStream->time_base);
+	if (ShouldSwitchSegment(Packet, PacketTime))
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("SwitchSegment");
+		SwitchSegment();
+	}
+	if (!Current)
+	{
+		return AVERROR(EIO);
+	}
+
+	if (Current->StartTime < 0)
+	{
+		Current->StartTime = PacketTime;
+	}
+	Current->EndTime = FMath::Max(Current->EndTime,
+	                              PacketTime + Packet->duration * av_q2d(SourceStream->time_base));
+	Current->Bytes += Packet->size;
+
+	av_packet_rescale_ts(Packet, SourceStream->time_base, Current->Context->streams[Packet->stream_index]->time_base);
+	return av_write_frame(Current->Context, Packet);
+}
+
+void FSegmentedOutput::Close()
+{
+	if (NextSegment.IsValid())
+	{
+		// 提前打开的分段没有用上，连同文件一起删掉
+		if (FSegment* Unused = NextSegment.Get())
+		{
+			const FString UnusedPath = Unused->Path;
+			DestroySegment(Unused);
+			IFileManager::Get().Delete(*UnusedPath);
+		}
+		NextSegment.Reset();
+	}
+	if (PendingFinish.IsValid())
+	{
+		PendingFinish.Wait();
+		PendingFinish.Reset();
+	}
+	if (Current)
+	{
+		FinishSegment(Current.Release());
+		if (bWritePlaylist)
+		{
+			WritePlaylist(true);
+		}
+	}
+}
+
+FString FSegmentedOutput::GetSegmentPath(int32 Index) const
+{
+	return FString::Printf(TEXT("%s_%05d.%s"), *BasePath, Index, *Extension);
+}
+
+FString FSegmentedOutput::GetPlaylistPath() const
+{
+	return BasePath + TEXT(".m3u8");
+}
+
+FSegmentedOutput::FSegment* FSegmentedOutput::OpenSegment(int32 Index) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("OpenSegment");
+	FSegment* Segment = new FSegment();
+	Segment->Index = Index;
+	Segment->Path = GetSegmentPath(Index);
+
+	int Ret = avformat_alloc_output_context2(&Segment->Context, nullptr, FormatName, TCHAR_TO_UTF8(*Segment->Path));
+	for (uint32 StreamIndex = 0; Ret >= 0 && StreamIndex < Template->nb_streams; ++StreamIndex)
+	{
+		const AVStream* Source = Template->streams[StreamIndex];
+		AVStream* Stream = avformat_new_stream(Segment->Context, nullptr);
+		Ret = Stream ? avcodec_parameters_copy(Stream->codecpar, Source->codecpar) : AVERROR(ENOMEM);
+		if (Ret >= 0)
+		{
+			Stream->codecpar->codec_tag = 0;
+			Stream->time_base = Source->time_base;
+		}
+	}
+	if (Ret >= 0)
+	{
+		// 单独播放的分段从 0 开始；HLS 的分段需要连续的时间戳，保持原样
+		if (!bWritePlaylist)
+		{
+			Segment->Context->avoid_negative_ts = AVFMT_AVOID_NEG_TS_MAKE_ZERO;
+		}
+		Ret = recorder::OpenOutputIO(Segment->Context, Segment->Path, Config, Segment->Writer);
+	}
+	if (Ret >= 0)
+	{
+		AVDictionary* Options = recorder::MakeMuxerOptions(Segment->Context, Config);
+		Ret = avformat_write_header(Segment->Context, &Options);
+		av_dict_free(&Options);
+	}
+	if (Ret < 0)
+	{
+		UE_LOG(LogRecorder, Error, TEXT("Failed to open segment %s (%d)"), *Segment->Path, Ret)
+		DestroySegment(Segment);
+		return nullptr;
+	}
+	return Segment;
+}
+
+void FSegmentedOutput::DestroySegment(FSegment* Segment)
+{
+	if (Segment->Context)
+	{
+		if (Segment->Context->pb)
+		{
+			recorder::CloseOutputIO(Segment->Context, Segment->Writer);
+		}
+		avformat_free_context(Segment->Context);
+	}
+	delete Segment;
+}
+
+void FSegmentedOutput::FinishSegment(FSegment* Segment)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT("FinishSegment");
+	av_write_trailer(Segment->Context);
+	recorder::CloseOutputIO(Segment->Context, Segment->Writer);
+	avformat_free_context(Segment->Context);
+	Segment->Context = nullptr;
+
+	UE_LOG(LogRecorder, Log, TEXT("Segment %s finished: %.2f s, %lld bytes"), *Segment->Path,
+	       Segment->EndTime - Segment->StartTime, Segment->Bytes)
+	FinishedSegments.Add({Segment->Path, FMath::Max(0.0, Segment->EndTime - Segment->StartTime)});
+	delete Segment;
+
+	while (Config.MaxSegmentCount > 0 && FinishedSegments.Num() > Config.MaxSegmentCount)
+	{
+		IFileManager::Get().Delete(*FinishedSegments[0].Path);
+		FinishedSegments.RemoveAt(0);
+		++RemovedSegmentCount;
+	}
+	if (bWritePlaylist)
+	{
+		WritePlaylist(false);
+	}
+}
+
+void FSegmentedOutput::SwitchSegment()
+{
+	FSegment* Next = nullptr;
+	if (NextSegment.IsValid())
+	{
+		// 正常情况下后台早就打开好了，这里的等待只在磁盘非常慢时出现
+		const double StartTime = FPlatformTime::Seconds();
+		Next = NextSegment.Get();
+		NextSegment.Reset();
+		const double WaitMs = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+		if (WaitMs > 1.0)
+		{
+			UE_LOG(LogRecorder, Warning, TEXT("Waited %.2f ms for the next segment to open"), WaitMs)
+		}
+	}
+	if (!Next)
+	{
+		// 下一个分段没能打开，继续写当前分段，稍后再试
+		PreopenNextSegment();
+		return;
+	}
+
+	// 收尾任务依次执行，播放列表和保留数量只在收尾任务里修改
+	if (PendingFinish.IsValid())
+	{
+		PendingFinish.Wait();
+	}
+	FSegment* Finished = Current.Release();
+	PendingFinish = Async(EAsyncExecution::ThreadPool, [this, Finished]() { FinishSegment(Finished); });
+
+	Current.Reset(Next);
+	PreopenNextSegment();
+}
+
+void FSegmentedOutput::PreopenNextSegment()
+{
+	const int32 NextIndex = Current->Index + 1;
+	NextSegment = Async(EAsyncExecution::ThreadPool, [this, NextIndex]() { return OpenSegment(NextIndex); });
+}
+
+bool FSegmentedOutput::ShouldSwitchSegment(const AVPacket* Packet, double PacketTime) const
+{
+	// 只在视频关键帧处切换，保证每个分段都能单独解码
+	if (!Current || Current->Bytes == 0 || !(Packet->flags & AV_PKT_FLAG_KEY)
+		|| Template->streams[Packet->stream_index]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO)
+	{
+		return false;
+	}
+	return (Config.SegmentDurationSec > 0 && PacketTime - Current->StartTime >= Config.SegmentDurationSec)
+		|| (Config.SegmentSizeMB > 0 && Current->Bytes >= static_cast<int64>(Config.SegmentSizeMB) * 1024 * 1024);
+}
+
+void FSegmentedOutput::WritePlaylist(bool bEnded) const
+{
+	double TargetDuration = Config.SegmentDurationSec;
+	for (const FFinishedSegment& Segment : FinishedSegments)
+	{
+		TargetDuration = FMath::Max(TargetDuration, Segment.Duration);
+	}
+
+	FString Playlist = FString::Printf(
+		TEXT("#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n#EXT-X-MEDIA-SEQUENCE:%d\n"),
+		FMath::CeilToInt(TargetDuration), RemovedSegmentCount);
+	for (const FFinishedSegment& Segment : FinishedSegments)
+	{
+		Playlist += FString::Printf(TEXT("#EXTINF:%.3f,\n%s\n"), Segment.Duration,
+		                            *FPaths::GetCleanFilename(Segment.Path));
+	}
+	if (bEnded)
+	{
+		Playlist += TEXT("#EXT-X-ENDLIST\n");
+	}
+
+	// 先写临时文件再替换，播放器不会读到写了一半的列表
+	const FString PlaylistPath = GetPlaylistPath();
+	const FString TempPath = PlaylistPath + TEXT(".tmp");
+	if (!FFileHelper::SaveStringToFile(Playlist, *TempPath) || !IFileManager::Get().Move(*PlaylistPath, *TempPath))
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("Failed to write playlist %s"), *PlaylistPath)
+	}
+}
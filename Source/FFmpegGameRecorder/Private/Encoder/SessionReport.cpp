@@ -0,0 +1,182 @@
+﻿#include "Encoder/SessionReport.h"
+
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Policies/PrettyJsonPrintPolicy.h"
+#include "Serialization/JsonWriter.h"
+#include "Encoder/PipelineStage.h"
+
+void FRecorderSessionReport::AddInfo(const FString& Name, const FString& Value)
+{
+	FScopeLock Lock(&Mutex);
+	Infos.Emplace(Name, Value);
+}
+
+void FRecorderSessionReport::AddStage(const FString& Name, const FPipelineStageStats& Stats)
+{
+	FStageEntry Entry;
+	Entry.Name = Name;
+	Entry.Items = Stats.ProcessedCount.load(std::memory_order_relaxed);
+	Entry.Occupancy = Stats.GetOccupancy();
+	Entry.AverageQueueDepth = Stats.GetAverageQueueDepth();
+	Entry.MaxQueueDepth = Stats.MaxQueueDepth.load(std::memory_order_relaxed);
+	Entry.MaxBusyMs = FPlatformTime::ToMilliseconds64(Stats.MaxBusyCycles.load(std::memory_order_relaxed));
+	Entry.Stalls = Stats.StallCount.load(std::memory_order_relaxed);
+	Entry.StallMs = Stats.GetStallMs();
+	Entry.Latency = Summarize(Stats.LatencyHistogram);
+
+	FScopeLock Lock(&Mutex);
+	Stages.Add(MoveTemp(Entry));
+}
+
+void FRecorderSessionReport::AddLatency(const FString& Name, const FLatencyHistogram& Histogram)
+{
+	const FLatencySummary Summary = Summarize(Histogram);
+	FScopeLock Lock(&Mutex);
+	Latencies.Emplace(Name, Summary);
+}
+
+void FRecorderSessionReport::AddCounter(const FString& Name, int64 Value)
+{
+	FScopeLock Lock(&Mutex);
+	Counters.Emplace(Name, Value);
+}
+
+FRecorderSessionReport::FLatencySummary FRecorderSessionReport::Summarize(const FLatencyHistogram& Histogram)
+{
+	FLatencySummary Summary;
+	Summary.Count = Histogram.GetCount();
+	Summary.MeanMs = Histogram.GetMeanMs();
+	Summary.P50Ms = Histogram.GetPercentileMs(50);
+	Summary.P90Ms = Histogram.GetPercentileMs(90);
+	Summary.P99Ms = Histogram.GetPercentileMs(99);
+	Summary.P999Ms = Histogram.GetPercentileMs(99.9);
+	Summary.MaxMs = Histogram.GetMaxMs();
+	return Summary;
+}
+
+bool FRecorderSessionReport::Write(const FString& Path) const
+{
+	FScopeLock Lock(&Mutex);
+	const bool bCsv = FPaths::GetExtension(Path).Equals(TEXT("csv"), ESearchCase::IgnoreCase);
+	if (!FFileHelper::SaveStringToFile(bCsv ? ToCsv() : ToJson(), *Path, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM))
+	{
+		UE_LOG(LogRecorder, Warning, TEXT("Session report: can not write %s"), *Path)
+		return false;
+	}
+	UE_LOG(LogRecorder, Display, TEXT("Session report written to %s"), *Path)
+	return true;
+}
+
+FString FRecorderSessionReport::ToJson() const
+{
+	FString Json;
+	const TSharedRef<TJsonWriter<TCHAR, TPrettyJsonPrintPolicy<TCHAR>>> Writer =
+		TJsonWriterFactory<TCHAR, TPrettyJsonPrintPolicy<TCHAR>>::Create(&Json);
+	const auto WriteLatency = [&Writer](const FLatencySummary& Latency)
+	{
+		Writer->WriteValue(TEXT("count"), static_cast<int64>(Latency.Count));
+		Writer->WriteValue(TEXT("mean"), Latency.MeanMs);
+		Writer->WriteValue(TEXT("p50"), Latency.P50Ms);
+		Writer->WriteValue(TEXT("p90"), Latency.P90Ms);
+		Writer->WriteValue(TEXT("p99"), Latency.P99Ms);
+		Writer->WriteValue(TEXT("p999"), Latency.P999Ms);
+		Writer->WriteValue(TEXT("max"), Latency.MaxMs);
+	};
+
+	Writer->WriteObjectStart();
+	Writer->WriteObjectStart(TEXT("info"));
+	for (const TPair<FString, FString>& Info : Infos)
+	{
+		Writer->WriteValue(Info.Key, Info.Value);
+	}
+	Writer->WriteObjectEnd();
+
+	Writer->WriteArrayStart(TEXT("stages"));
+	for (const FStageEntry& Stage : Stages)
+	{
+		Writer->WriteObjectStart();
+		Writer->WriteValue(TEXT("name"), Stage.Name);
+		Writer->WriteValue(TEXT("items"), static_cast<int64>(Stage.Items));
+		Writer->WriteValue(TEXT("occupancy"), Stage.Occupancy);
+		Writer->WriteValue(TEXT("queue_avg"), Stage.AverageQueueDepth);
+		Writer->WriteValue(TEXT("queue_max"), static_cast<int64>(Stage.MaxQueueDepth));
+		Writer->WriteValue(TEXT("busy_max_ms"), Stage.MaxBusyMs);
+		Writer->WriteValue(TEXT("stalls"), static_cast<int64>(Stage.Stalls));
+		Writer->WriteValue(TEXT("stall_ms"), Stage.StallMs);
+		Writer->WriteObjectStart(TEXT("latency_ms"));
+		WriteLatency(Stage.Latency);
+		Writer->WriteObjectEnd();
+		Writer->WriteObjectEnd();
+	}
+	Writer->WriteArrayEnd();
+
+	Writer->WriteObjectStart(TEXT("frame_latency_ms"));
+	for (const TPair<FString, FLatencySummary>& Latency : Latencies)
+	{
+		Writer->WriteObjectStart(Latency.Key);
+		WriteLatency(Latency.Value);
+		Writer->WriteObjectEnd();
+	}
+	Writer->WriteObjectEnd();
+
+	Writer->WriteObjectStart(TEXT("counters"));
+	for (const TPair<FString, int64>& Counter : Counters)
+	{
+		Writer->WriteValue(Counter.Key, Counter.Value);
+	}
+	Writer->WriteObjectEnd();
+	Writer->WriteObjectEnd();
+	Writer->Close();
+	return Json;
+}
+
+FString FRecorderSessionReport::ToCsv() const
+{
+	// 名字里可能有 URL，统一加引号
+	const auto Quote = [](const FString& Text)
+	{
+		return TEXT("\"") + Text.Replace(TEXT("\""), TEXT("\"\"")) + TEXT("\"");
+	};
+	FString Csv = TEXT("section,name,metric,value\n");
+	const auto AddRow = [&Csv, &Quote](const TCHAR* Section, const FString& Name, const TCHAR* Metric,
+	                                   const FString& Value)
+	{
+		Csv += FString::Printf(TEXT("%s,%s,%s,%s\n"), Section, *Quote(Name), Metric, *Value);
+	};
+	const auto AddLatencyRows = [&AddRow](const TCHAR* Section, const FString& Name, const FLatencySummary& Latency)
+	{
+		AddRow(Section, Name, TEXT("count"), FString::Printf(TEXT("%llu"), Latency.Count));
+		AddRow(Section, Name, TEXT("mean_ms"), FString::Printf(TEXT("%.3f"), Latency.MeanMs));
+		AddRow(Section, Name, TEXT("p50_ms"), FString::Printf(TEXT("%.3f"), Latency.P50Ms));
+		AddRow(Section, Name, TEXT("p90_ms"), FString::Printf(TEXT("%.3f"), Latency.P90Ms));
+		AddRow(Section, Name, TEXT("p99_ms"), FString::Printf(TEXT("%.3f"), Latency.P99Ms));
+		AddRow(Section, Name, TEXT("p999_ms"), FString::Printf(TEXT("%.3f"), Latency.P999Ms));
+		AddRow(Section, Name, TEXT("max_ms"), FString::Printf(TEXT("%.3f"), Latency.MaxMs));
+	};
+
+	for (const TPair<FString, FString>& Info : Infos)
+	{
+		AddRow(TEXT("info"), Info.Key, TEXT("value"), Quote(Info.Value));
+	}
+	for (const FStageEntry& Stage : Stages)
+	{
+		AddRow(TEXT("stage"), Stage.Name, TEXT("items"), FString::Printf(TEXT("%llu"), Stage.Items));
+		AddRow(TEXT("stage"), Stage.Name, TEXT("occupancy"), FString::Printf(TEXT("%.4f"), Stage.Occupancy));
+		AddRow(TEXT("stage"), Stage.Name, TEXT("queue_avg"), FString::Printf(TEXT("%.3f"), Stage.AverageQueueDepth));
+		AddRow(TEXT("stage"), Stage.Name, TEXT("queue_max"), FString::Printf(TEXT("%u"), Stage.MaxQueueDepth));
+		AddRow(TEXT("stage"), Stage.Name, TEXT("busy_max_ms"), FString::Printf(TEXT("%.3f"), Stage.MaxBusyMs));
+		AddRow(TEXT("stage"), Stage.Name, TEXT("stalls"), FString::Printf(TEXT("%llu"), Stage.Stalls));
+		AddRow(TEXT("stage"), Stage.Name, TEXT("stall_ms"), FString::Printf(TEXT("%.3f"), Stage.StallMs));
+		AddLatencyRows(TEXT("stage"), Stage.Name, Stage.Latency);
+	}
+	for (const TPair<FString, FLatencySummary>& Latency : Latencies)
+	{
+		AddLatencyRows(TEXT("frame_latency"), Latency.Key, Latency.Value);
+	}
+	for (const TPair<FString, int64>& Counter : Counters)
+	{
+		AddRow(TEXT("counter"), Counter.Key, TEXT("value"), FString::Printf(TEXT("%lld"), Counter.Value));
+	}
+	return Csv;
+}
@@ -0,0 +1,413 @@
+﻿#include "Encoder/VideoEncoderBackend.h"
+
+/** x264 的 preset 在 ultrafast..placebo 中的位置，0 最快，其他编码器按它换算成自己的速度档位；不认识的名字按 ultrafast 处理 */
+static int32 GetPresetSpeedIndex(const FString& Preset)
+{
+	static const TCHAR* Presets[] = {
+		TEXT("ultrafast"), TEXT("superfast"), TEXT("veryfast"), TEXT("faster"), TEXT("fast"),
+		TEXT("medium"), TEXT("slow"), TEXT("slower"), TEXT("veryslow"), TEXT("placebo"),
+	};
+	for (int32 Index = 0; Index < UE_ARRAY_COUNT(Presets); ++Index)
+	{
+		if (Preset.Equals(Presets[Index], ESearchCase::IgnoreCase))
+		{
+			return Index;
+		}
+	}
+	return 0;
+}
+
+static bool IsHighBitDepth(const AVCodecContext* Context)
+{
+	const AVPixFmtDescriptor* Descriptor = av_pix_fmt_desc_get(Context->pix_fmt);
+	return Descriptor && Descriptor->comp[0].depth > 8;
+}
+
+/** 原先写在 FAVEncoder 里的码控参数，x264、x265 和 NVENC 共用 */
+static void ConfigureRateControl(AVCodecContext* Context)
+{
+	Context->rc_min_rate = Context->bit_rate;
+	Context->rc_max_rate = Context->bit_rate;
+	Context->max_b_frames = 2;
+	Context->me_range = 16;
+	Context->qcompress = 0.8;
+	Context->max_qdiff = 4;
+	Context->qmin = 18;
+	Context->qmax = 28;
+}
+
+/**
+ * Baseline 和 level 3.0 都不允许 10bit，10bit 时用 High 10，level 交给编码器按分辨率和码率决定
+ * Baseline 由编码器强制关掉 B 帧，High 10 要自己关，两种 profile 下 packet 都按显示顺序产出
+ */
+static void ConfigureH264Profile(AVCodecContext* Context)
+{
+	if (IsHighBitDepth(Context))
+	{
+		Context->profile = FF_PROFILE_H264_HIGH_10;
+		Context->level = FF_LEVEL_UNKNOWN;
+		Context->max_b_frames = 0;
+	}
+	else
+	{
+		Context->profile = FF_PROFILE_H264_BASELINE;
+		Context->level = 30;
+	}
+}
+
+static void SetCrf(AVCodecContext* Context)
+{
+	const FString Crf = FString::Printf(TEXT("%d"), FMath::Clamp(ConstantRateFactor, 0, 51));
+	av_opt_set(Context->priv_data, "crf", TCHAR_TO_UTF8(*Crf), 0);
+}
+
+/** libx264：默认的后端，速度和兼容性最好 */
+class FX264Backend : public IVideoEncoderBackend
+{
+public:
+	virtual const TCHAR* GetName() const override { return TEXT("libx264"); }
+
+	virtual const AVCodec* FindCodec() const override { return avcodec_find_encoder_by_name("libx264"); }
+
+	virtual TConstArrayView<AVPixelFormat> GetPixelFormats() const override
+	{
+		static constexpr AVPixelFormat Formats[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P10};
+		return Formats;
+	}
+
+	/** ultrafast 没有 lookahead，Baseline 没有 B 帧，High 10 在 ConfigureH264Profile 里关掉了 B 帧 */
+	virtual const FVideoEncoderTraits& GetTraits(bool bLowLatency) const override
+	{
+		static const FVideoEncoderTraits Traits{EVideoEncoderThreading::Frame, 0, false};
+		static const FVideoEncoderTraits LowLatencyTraits{EVideoEncoderThreading::Slice, 0, false};
+		return bLowLatency ? LowLatencyTraits : Traits;
+	}
+
+	virtual void Configure(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		ConfigureRateControl(Context);
+		ConfigureH264Profile(Context);
+		av_opt_set(Context->priv_data, "preset", TCHAR_TO_ANSI(*Config.VideoPreset), 0);
+		SetCrf(Context);
+	}
+
+	/** 较慢的 preset 会打开 lookahead 和 mbtree，zerolatency 把它们都关掉；thread_type 只有 slice 时用 sliced-threads */
+	virtual void ConfigureLowLatency(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		IVideoEncoderBackend::ConfigureLowLatency(Context, Config);
+		av_opt_set(Context->priv_data, "tune", "zerolatency", 0);
+	}
+};
+
+/** libopenh264：Constrained Baseline，CPU 占用比 x264 的 ultrafast 还低，同样码率下画质差一些，按 slice 多线程 */
+class FOpenH264Backend : public IVideoEncoderBackend
+{
+public:
+	virtual const TCHAR* GetName() const override { return TEXT("libopenh264"); }
+
+	virtual const AVCodec* FindCodec() const override { return avcodec_find_encoder_by_name("libopenh264"); }
+
+	virtual TConstArrayView<AVPixelFormat> GetPixelFormats() const override
+	{
+		static constexpr AVPixelFormat Formats[] = {AV_PIX_FMT_YUV420P};
+		return Formats;
+	}
+
+	/** 本来就没有 B 帧和 lookahead，低延迟模式下不变 */
+	virtual const FVideoEncoderTraits& GetTraits(bool bLowLatency) const override
+	{
+		static const FVideoEncoderTraits Traits{EVideoEncoderThreading::Slice, 0, false};
+		return Traits;
+	}
+
+	virtual void Configure(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		Context->profile = FF_PROFILE_H264_CONSTRAINED_BASELINE;
+		Context->max_b_frames = 0;
+		// 0 表示按核数自动选择 slice 线程数
+		Context->thread_count = 0;
+		av_opt_set(Context->priv_data, "rc_mode", "bitrate", 0);
+	}
+};
+
+/** libx265：HEVC，同样画质下文件比 x264 小，编码更慢；bHighBitDepth 而 H.264 后端不支持 10bit 时也会换成它 */
+class FX265Backend : public IVideoEncoderBackend
+{
+public:
+	virtual const TCHAR* GetName() const override { return TEXT("libx265"); }
+
+	virtual const AVCodec* FindCodec() const override { return avcodec_find_encoder_by_name("libx265"); }
+
+	virtual TConstArrayView<AVPixelFormat> GetPixelFormats() const override
+	{
+		static constexpr AVPixelFormat Formats[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV420P10};
+		return Formats;
+	}
+
+	/** ultrafast 的 rc-lookahead 是 5 帧；zerolatency 之后只剩 WPP 行级并行 */
+	virtual const FVideoEncoderTraits& GetTraits(bool bLowLatency) const override
+	{
+		static const FVideoEncoderTraits Traits{EVideoEncoderThreading::Frame, 5, true};
+		static const FVideoEncoderTraits LowLatencyTraits{EVideoEncoderThreading::Slice, 0, false};
+		return bLowLatency ? LowLatencyTraits : Traits;
+	}
+
+	virtual void Configure(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		ConfigureRateControl(Context);
+		Context->profile = IsHighBitDepth(Context) ? FF_PROFILE_HEVC_MAIN_10 : FF_PROFILE_HEVC_MAIN;
+		av_opt_set(Context->priv_data, "profile", IsHighBitDepth(Context) ? "main10" : "main", 0);
+		av_opt_set(Context->priv_data, "preset", TCHAR_TO_ANSI(*Config.VideoPreset), 0);
+		SetCrf(Context);
+	}
+
+	/** zerolatency：不用 B 帧和 lookahead，frame-threads 降到 1 */
+	virtual void ConfigureLowLatency(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		IVideoEncoderBackend::ConfigureLowLatency(Context, Config);
+		av_opt_set(Context->priv_data, "tune", "zerolatency", 0);
+	}
+};
+
+/** libvpx-vp9：realtime 模式、没有 lag，按 tile 和行并行；文件比 x264 小，只能写进 MP4/MKV/WebM */
+class FVP9Backend : public IVideoEncoderBackend
+{
+public:
+	virtual const TCHAR* GetName() const override { return TEXT("libvpx-vp9"); }
+
+	virtual const AVCodec* FindCodec() const override { return avcodec_find_encoder_by_name("libvpx-vp9"); }
+
+	virtual TConstArrayView<AVPixelFormat> GetPixelFormats() const override
+	{
+		static constexpr AVPixelFormat Formats[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV420P10};
+		return Formats;
+	}
+
+	/** 本来就没有 lag，低延迟模式下不变 */
+	virtual const FVideoEncoderTraits& GetTraits(bool bLowLatency) const override
+	{
+		static const FVideoEncoderTraits Traits{EVideoEncoderThreading::Slice, 0, false};
+		return Traits;
+	}
+
+	virtual void Configure(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		// 按 VideoBitRate 的平均码率编码；preset 越快 cpu-used 越大，ultrafast 对应 8
+		Context->max_b_frames = 0;
+		Context->thread_count = 0;
+		av_opt_set(Context->priv_data, "deadline", "realtime", 0);
+		av_opt_set_int(Context->priv_data, "cpu-used",
+		               FMath::Clamp(8 - GetPresetSpeedIndex(Config.VideoPreset), 0, 8), 0);
+		av_opt_set_int(Context->priv_data, "lag-in-frames", 0, 0);
+		av_opt_set_int(Context->priv_data, "row-mt", 1, 0);
+		// tile 列宽至少 256 像素，参数是 log2
+		av_opt_set_int(Context->priv_data, "tile-columns",
+		               FMath::Min(FMath::FloorLog2(FMath::Max(Context->width / 256, 1)), 6), 0);
+	}
+};
+
+/** SVT-AV1：文件最小，编码库自己的线程池和流水线，带 mini-GOP 的随机访问结构，延迟较大；只能写进 MP4/MKV/WebM */
+class FSVTAV1Backend : public IVideoEncoderBackend
+{
+public:
+	virtual const TCHAR* GetName() const override { return TEXT("libsvtav1"); }
+
+	virtual const AVCodec* FindCodec() const override { return avcodec_find_encoder_by_name("libsvtav1"); }
+
+	virtual TConstArrayView<AVPixelFormat> GetPixelFormats() const override
+	{
+		static constexpr AVPixelFormat Formats[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV420P10};
+		return Formats;
+	}
+
+	/** 默认的 mini-GOP 是 16 帧 */
+	virtual const FVideoEncoderTraits& GetTraits(bool bLowLatency) const override
+	{
+		static const FVideoEncoderTraits Traits{EVideoEncoderThreading::Internal, 16, true};
+		static const FVideoEncoderTraits LowLatencyTraits{EVideoEncoderThreading::Internal, 0, false};
+		return bLowLatency ? LowLatencyTraits : Traits;
+	}
+
+	virtual void Configure(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		// 按 VideoBitRate 的平均码率编码；preset 0..13 越大越快，ultrafast 对应 12
+		av_opt_set_int(Context->priv_data, "preset", 12 - GetPresetSpeedIndex(Config.VideoPreset), 0);
+	}
+
+	/** 随机访问结构换成只向前参考的低延迟结构，不用 lookahead；最大码率等于码率时按 CBR 编码，低延迟结构支持 CBR */
+	virtual void ConfigureLowLatency(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		IVideoEncoderBackend::ConfigureLowLatency(Context, Config);
+		av_opt_set(Context->priv_data, "svtav1-params", "pred-struct=1:lookahead=0", 0);
+	}
+};
+
+/** NVENC 硬件编码器，参数与原先的 H.264 设置一致；H.264 不支持 10bit，10bit 时用 HEVC */
+class FNvencBackend : public IVideoEncoderBackend
+{
+public:
+	explicit FNvencBackend(bool bInHEVC)
+		: bHEVC(bInHEVC)
+	{
+	}
+
+	virtual const TCHAR* GetName() const override { return bHEVC ? TEXT("hevc_nvenc") : TEXT("h264_nvenc"); }
+
+	virtual const AVCodec* FindCodec() const override
+	{
+		if (bHEVC)
+		{
+			return avcodec_find_encoder_by_name("hevc_nvenc");
+		}
+		// 旧版本的 FFmpeg 里叫 nvenc_h264
+		const AVCodec* Codec = avcodec_find_encoder_by_name("h264_nvenc");
+		return Codec ? Codec : avcodec_find_encoder_by_name("nvenc_h264");
+	}
+
+	virtual TConstArrayView<AVPixelFormat> GetPixelFormats() const override
+	{
+		static constexpr AVPixelFormat H264Formats[] = {AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P};
+		static constexpr AVPixelFormat HEVCFormats[] = {AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P, AV_PIX_FMT_P010};
+		return bHEVC ? TConstArrayView<AVPixelFormat>(HEVCFormats) : TConstArrayView<AVPixelFormat>(H264Formats);
+	}
+
+	virtual const FVideoEncoderTraits& GetTraits(bool bLowLatency) const override
+	{
+		static const FVideoEncoderTraits Traits{EVideoEncoderThreading::Internal, 2, true};
+		static const FVideoEncoderTraits LowLatencyTraits{EVideoEncoderThreading::Internal, 0, false};
+		return bLowLatency ? LowLatencyTraits : Traits;
+	}
+
+	virtual void Configure(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		ConfigureRateControl(Context);
+		if (bHEVC)
+		{
+			Context->profile = IsHighBitDepth(Context) ? FF_PROFILE_HEVC_MAIN_10 : FF_PROFILE_HEVC_MAIN;
+		}
+		else
+		{
+			ConfigureH264Profile(Context);
+		}
+		av_opt_set(Context->priv_data, "preset", TCHAR_TO_ANSI(*Config.VideoPreset), 0);
+	}
+
+	/** delay 是输出 packet 之前异步排队的帧数，zerolatency 不让帧重排 */
+	virtual void ConfigureLowLatency(AVCodecContext* Context, const FRecorderConfig& Config) const override
+	{
+		IVideoEncoderBackend::ConfigureLowLatency(Context, Config);
+		av_opt_set_int(Context->priv_data, "zerolatency", 1, 0);
+		av_opt_set_int(Context->priv_data, "delay", 0, 0);
+		av_opt_set_int(Context->priv_data, "rc-lookahead", 0, 0);
+	}
+
+private:
+	bool bHEVC;
+};
+
+void IVideoEncoderBackend::ConfigureLowLatency(AVCodecContext* Context, const FRecorderConfig& Config) const
+{
+	Context->max_b_frames = 0;
+	// 帧级线程每多一个线程就多攒一帧，slice 线程不增加延迟
+	Context->thread_type = FF_THREAD_SLICE;
+	// VBV 至少放得下一帧平均大小的数据
+	Context->rc_max_rate = Context->bit_rate;
+	Context->rc_buffer_size = static_cast<int>(FMath::Max<int64>(
+		Context->bit_rate * Config.LowLatencyVBVMs / 1000, Context->bit_rate / FMath::Max(Config.FrameRate, 1)));
+}
+
+bool IVideoEncoderBackend::AcceptsPixelFormat(const AVCodec* Codec, AVPixelFormat Format) const
+{
+	if (!GetPixelFormats().Contains(Format))
+	{
+		return false;
+	}
+	// 没有列出格式的编码器按原先的假设只接受 I420
+	if (!Codec->pix_fmts)
+	{
+		return Format == AV_PIX_FMT_YUV420P;
+	}
+	for (const AVPixelFormat* Supported = Codec->pix_fmts; *Supported != AV_PIX_FMT_NONE; ++Supported)
+	{
+		if (*Supported == Format)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool IVideoEncoderBackend::AcceptsHighBitDepth(const AVCodec* Codec) const
+{
+	return AcceptsPixelFormat(Codec, AV_PIX_FMT_P010) || AcceptsPixelFormat(Codec, AV_PIX_FMT_YUV420P10);
+}
+
+AVCodecContext* IVideoEncoderBackend::AllocContext(const AVCodec* Codec, const FRecorderConfig& Config,
+                                                   AVPixelFormat PixelFormat, FIntPoint Size) const
+{
+	AVCodecContext* Context = avcodec_alloc_context3(Codec);
+	if (!Context)
+	{
+		return nullptr;
+	}
+	Context->codec_type = AVMEDIA_TYPE_VIDEO;
+	Context->bit_rate = Config.VideoBitRate;
+	Context->width = Size.X;
+	Context->height = Size.Y;
+	Context->time_base = {1, Config.FrameRate};
+	Context->framerate = {Config.FrameRate, 1};
+	Context->pix_fmt = PixelFormat;
+	Context->gop_size = 25;
+	Configure(Context, Config);
+	if (Config.bLowLatency)
+	{
+		ConfigureLowLatency(Context, Config);
+	}
+	return Context;
+}
+
+namespace recorder
+{
+	static const FX264Backend X264Backend;
+	static const FOpenH264Backend OpenH264Backend;
+	static const FX265Backend X265Backend;
+	static const FVP9Backend VP9Backend;
+	static const FSVTAV1Backend SVTAV1Backend;
+	static const FNvencBackend NvencH264Backend(false);
+	static const FNvencBackend NvencHEVCBackend(true);
+
+	/** 与 ERecorderVideoCodec 的顺序一致 */
+	static const IVideoEncoderBackend* const SoftwareBackends[] = {
+		&X264Backend, &OpenH264Backend, &X265Backend, &VP9Backend, &SVTAV1Backend,
+	};
+	static_assert(UE_ARRAY_COUNT(SoftwareBackends) == static_cast<int32>(ERecorderVideoCodec::SVTAV1) + 1,
+	              "SoftwareBackends must match ERecorderVideoCodec");
+
+	const IVideoEncoderBackend& GetVideoEncoderBackend(ERecorderVideoCodec Codec)
+	{
+		const int32 Index = static_cast<int32>(Codec);
+		return *SoftwareBackends[UE_ARRAY_COUNT(SoftwareBackends) > Index ? Index : 0];
+	}
+
+	const IVideoEncoderBackend& GetHardwareVideoEncoderBackend(bool bHEVC)
+	{
+		return bHEVC ? static_cast<const IVideoEncoderBackend&>(NvencHEVCBackend) : NvencH264Backend;
+	}
+
+	TConstArrayView<const IVideoEncoderBackend*> GetVideoEncoderBackends()
+	{
+		return SoftwareBackends;
+	}
+
+	bool IsVideoEncoderBackendUsable(const IVideoEncoderBackend& Backend, const AVOutputFormat* Format)
+	{
+		const AVCodec* Codec = Backend.FindCodec();
+		if (!Codec)
+		{
+			return false;
+		}
+		// mpegts 这类没有登记编码器列表的封装返回负数，其中只有 H.264 和 HEVC 是 TS 能放的
+		const int Result = avformat_query_codec(Format, Codec->id, FF_COMPLIANCE_NORMAL);
+		return Result == 1 || (Result < 0 && (Codec->id == AV_CODEC_ID_H264 || Codec->id == AV_CODEC_ID_HEVC));
+	}
+}
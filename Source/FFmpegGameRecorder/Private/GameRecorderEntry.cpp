@@ -1,4 +1,4 @@
-// Fill out your copyright notice in the Description page of Project Settings.
+﻿// Fill out your copyright notice in the Description page of Project Settings.
 
 
 #include "GameRecorderEntry.h"
@@ -99,6 +99,32 @@ FString UGameRecorderEntry::ScreenShot(int ScreenX, int ScreenY, int ScreenW, in
     return FString();
 }
 
+FString UGameRecorderEntry::SaveReplay(float Seconds)
+{
+    if (!CurrentDirector.IsValid())
+    {
+        UE_LOG(LogRecorder, Warning, TEXT("UGameRecorderEntry::SaveReplay(): not recording"))
+        return FString();
+    }
+
+    const FString OutFileName = GetSavePath() + FString::Printf(TEXT("Replay-%s.mp4"), *FDateTime::Now().ToString());
+    if (!CurrentDirector->SaveReplay(OutFileName, Seconds))
+    {
+        return FString();
+    }
+    UE_LOG(LogRecorder, Log, TEXT("Replay Save to = %s"), *OutFileName);
+    return OutFileName;
+}
+
+FRecorderStats UGameRecorderEntry::GetRecorderStats()
+{
+    if (!CurrentDirector.IsValid())
+    {
+        return FRecorderStats();
+    }
+    return CurrentDirector->GetRecorderStats();
+}
+
 void UGameRecorderEntry::StopRecord()
 {
     UE_LOG(LogRecorder, Display, TEXT("UFFmpegFunctionLibrary::StopRecord(): stop record CurrentDirectory is %d"),
@@ -4,6 +4,8 @@
 #include "RHIResources.h"
 #include "Widgets/SWindow.h"
 
+#include "RecorderConfig.h"
+
 struct FResolveParams;
 struct FResolveRect;
 class FRHITexture;
@@ -34,10 +36,11 @@ namespace recorder
 			return !Fence || Fence->Poll(GPUMask);
 		}
 
-		void PreEnqueue(double InCapturedTime, double InCapturedDuration)
+		void PreEnqueue(double InCapturedTime, double InCapturedDuration, uint64 InCapturedCycles)
 		{
 			CapturedTime = InCapturedTime;
 			CapturedDuration = InCapturedDuration;
+			CapturedCycles = InCapturedCycles;
 		}
 
 		void EnqueueCopyRDG(FRHICommandList& RHICmdList, FRHITexture* SourceTexture, FResolveRect Rect);
@@ -51,6 +54,17 @@ namespace recorder
 		 */
 		void Unlock();
 
+		/** 把 LockTexture 映射好的内存借出去，借出期间不能再 EnqueueCopy */
+		FMappedFrameViewPtr Lend();
+
+		/** 借出的视图全部释放后在渲染线程 Unmap，返回是否已经回到 Idle */
+		bool TryReclaim();
+
+		FORCEINLINE bool IsIdle() const
+		{
+			return CaptureStatus == ECaptureStatus::Idle;
+		}
+
 		FORCEINLINE ECaptureStatus GetCaptureStatus() const
 		{
 			return CaptureStatus;
@@ -79,6 +93,10 @@ namespace recorder
 		 * 帧展示时长
 		 */
 		double CapturedDuration;
+		/**
+		 * 发起拷贝的真实时间，FPlatformTime::Cycles64()
+		 */
+		uint64 CapturedCycles;
 
 	protected:
 		/**
@@ -90,5 +108,8 @@ namespace recorder
 		void EnqueueCopyInternal(FRHICommandList& RHICmdList, FRHITexture* SourceTexture, FResolveParams Params);
 
 		FTextureRHIRef DestinationStagingTexture;
+
+		/** 借出的视图是否都已经释放 */
+		TSharedRef<std::atomic_bool, ESPMode::ThreadSafe> LendReleased;
 	};
 }
@@ -1,11 +1,78 @@
 ﻿#pragma once
 
+#include <atomic>
+
 #include "CoreMinimal.h"
 #include "PixelFormat.h"
 #include "HAL/IConsoleManager.h"
 
 #include "RecorderConfig.generated.h"
 
+/** 待编码视频队列满时的处理策略 */
+UENUM(BlueprintType)
+enum class ERecorderQueuePolicy : uint8
+{
+	/** 丢弃新来的帧，时长并入上一帧 */
+	DropNewest,
+	/** 编码线程丢弃队列里最老的帧，时长并入上一帧 */
+	DropOldest,
+	/** 阻塞渲染线程直到有空位，适合离线录制 */
+	Block,
+	/** 丢弃新来的帧的像素，由编码器重复上一帧补齐时长，保持恒定帧率 */
+	DuplicateLast,
+};
+
+/** 缩放到输出分辨率时 libyuv 使用的滤波方式，与 libyuv::FilterMode 一一对应 */
+UENUM(BlueprintType)
+enum class ERecorderScaleFilter : uint8
+{
+	/** 最近点采样，最快，缩小时有锯齿 */
+	None,
+	/** 只在水平方向插值 */
+	Linear,
+	/** 双线性插值 */
+	Bilinear,
+	/** 缩小时按面积取平均，画质最好，放大时退化为双线性 */
+	Box,
+};
+
+/** 软件视频编码器，bUseHardwareEncoding 时不生效 */
+UENUM(BlueprintType)
+enum class ERecorderVideoCodec : uint8
+{
+	/** libx264，H.264，速度和兼容性最好 */
+	X264,
+	/** libopenh264，H.264 Constrained Baseline，CPU 占用最低，同样码率下画质差一些 */
+	OpenH264,
+	/** libx265，HEVC，文件比 x264 小，编码更慢 */
+	X265,
+	/** libvpx-vp9 的 realtime 模式，文件小，只能写进 MP4/MKV/WebM */
+	VP9,
+	/** SVT-AV1，文件最小、延迟最大，只能写进 MP4/MKV/WebM */
+	SVTAV1,
+};
+
+/** 编码阶梯中的一档：与主输出共用捕获和颜色转换，缩小后用自己的编码器写到自己的输出 */
+USTRUCT(BlueprintType)
+struct FRecorderRendition
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	FIntPoint Resolution = FIntPoint::ZeroValue;
+
+	UPROPERTY()
+	int32 VideoBitRate = 0;
+
+	/** 编码器的 preset（按 x264 的名字，其他编码器换算成自己的速度档位），为空时与主输出相同 */
+	UPROPERTY()
+	FString Preset;
+
+	/** 为空时写到主输出旁边的 <文件名>_<高度>p.<扩展名> */
+	UPROPERTY()
+	FString SaveFilePath;
+};
+
 USTRUCT(BlueprintType)
 struct FRecorderConfig
 {
@@ -42,12 +109,155 @@ struct FRecorderConfig
 	UPROPERTY()
 	FIntPoint Resolution;
 
+	/** 编码输出的分辨率，为 0 时与截取区域相同；不同时转换成 I420 之后先用 libyuv 缩放再送进编码器 */
+	UPROPERTY()
+	FIntPoint OutputResolution = FIntPoint::ZeroValue;
+
+	/** 缩放到输出分辨率（以及编码阶梯各档）使用的滤波方式 */
+	UPROPERTY()
+	ERecorderScaleFilter ScaleFilter = ERecorderScaleFilter::Box;
+
+	/** 编码器接受 NV12 时直接转换成 NV12，省掉编码器内部把 I420 色度平面交错的一遍重排 */
+	UPROPERTY()
+	bool bPreferNV12 = true;
+
+	/**
+	 * 10bit 编码：10bit 的后台缓冲直接转换成 P010 或 yuv420p10le，用 H.264 High 10 或 HEVC Main 10 编码，保留 10bit 的精度
+	 * VideoCodec 对应的编码器不接受 10bit 输入时换成 HEVC，两者都不行时按 8bit 录制；8bit 的后台缓冲会先转换成 I420 再扩展到 10bit
+	 */
+	UPROPERTY()
+	bool bHighBitDepth = false;
+
+	/** 待编码视频帧队列的最大深度 */
+	UPROPERTY()
+	int32 MaxVideoQueueDepth = 6;
+
+	/** 待编码视频队列满时的处理策略 */
+	UPROPERTY()
+	ERecorderQueuePolicy VideoQueuePolicy = ERecorderQueuePolicy::DropNewest;
+
+	/** 颜色转换使用的线程数，0 表示按 CPU 核数自动选择，1 表示只在编码线程转换 */
+	UPROPERTY()
+	int32 ColorConvertWorkers = 0;
+
+	/** 本地文件的写缓存大小（KB），写满后由后台线程写盘，0 表示使用 FFmpeg 默认的 avio_open */
+	UPROPERTY()
+	int32 FileWriteBufferSizeKB = 4096;
+
+	/** 录制开始时预先为文件分配的磁盘空间（MB），只在 Linux 上生效，0 表示不预分配 */
+	UPROPERTY()
+	int32 PreallocateFileSizeMB = 0;
+
+	/**
+	 * 使用分片 MP4：moov 放在文件开头且不含样本表，之后每个关键帧开始一个分片，
+	 * 录制中途崩溃时文件仍然可以播放到最后一个完整的分片，停止录制时也不需要再写完整的样本表
+	 */
+	UPROPERTY()
+	bool bFragmentedMP4 = false;
+
+	/** 分片 MP4 每个分片的最长时长（毫秒），关键帧间隔较长时也会按这个时长切分 */
+	UPROPERTY()
+	int32 MaxFragmentDurationMs = 2000;
+
+	/** 分段录制：每个分段的时长（秒），到达后在下一个视频关键帧处切换文件，0 表示不按时长分段 */
+	UPROPERTY()
+	int32 SegmentDurationSec = 0;
+
+	/** 分段录制：每个分段的大小上限（MB），0 表示不按大小分段 */
+	UPROPERTY()
+	int32 SegmentSizeMB = 0;
+
+	/** 分段录制时生成 HLS 播放列表（.m3u8），分段使用 .ts 格式 */
+	UPROPERTY()
+	bool bWriteHLSPlaylist = false;
+
+	/** 分段录制时最多保留的已完成分段数，更早的分段会被删除，0 表示全部保留 */
+	UPROPERTY()
+	int32 MaxSegmentCount = 0;
+
+	/** 即时回放缓存的大小（MB），大于 0 时编码结果只保存在内存里，通过 SaveReplay 导出最近的若干秒，不写 SaveFilePath */
+	UPROPERTY()
+	int32 ReplayBufferMB = 0;
+
+	/** 即时回放缓存放在 SaveFilePath 旁边的内存映射文件（.replay）里，而不是进程内存里，录制结束时删除 */
+	UPROPERTY()
+	bool bReplayBufferOnDisk = false;
+
+	/** 除 SaveFilePath 之外同时写出的输出（本地文件、rtmp://、udp:// 等），共用同一个编码器，每一路有自己的写出线程 */
+	UPROPERTY()
+	TArray<FString> AdditionalOutputs;
+
+	/** 软件编码时使用的视频编码器，不可用或者不能写进输出的封装格式时换成第一个可用的 */
+	UPROPERTY()
+	ERecorderVideoCodec VideoCodec = ERecorderVideoCodec::X264;
+
+	/** 视频编码器的 preset，按 x264 的名字，其他编码器换算成自己的速度档位 */
+	UPROPERTY()
+	FString VideoPreset = TEXT("ultrafast");
+
+	/**
+	 * 低延迟模式，用于推流：关闭 B 帧和 lookahead，x264/x265 使用 zerolatency（slice 线程代替帧级线程），NVENC 不攒帧，
+	 * VBV 限制在 LowLatencyVBVMs 的码率以内，每一帧编完马上就能发出去
+	 */
+	UPROPERTY()
+	bool bLowLatency = false;
+
+	/** 低延迟模式下 VBV 缓冲的大小（毫秒），越小每帧大小越平稳、画质波动越大，最小一帧 */
+	UPROPERTY()
+	int32 LowLatencyVBVMs = 250;
+
+	/** 录制结束时把每一帧从捕获到编码器产出 packet 的延迟写到这个 CSV，为空时只在日志里输出 p50/p99 */
+	UPROPERTY()
+	FString LatencyCsvPath;
+
+	/** 录制结束时把这次录制的性能报告（各级的延迟分位数、队列高水位、丢帧数、写出字节数）写到这里，扩展名是 .csv 时写 CSV，否则写 JSON；为空表示不写 */
+	UPROPERTY()
+	FString SessionReportPath;
+
+	/** 编码阶梯：除主输出之外同时编码的较低分辨率版本，各档并行编码，共用一次颜色转换 */
+	UPROPERTY()
+	TArray<FRecorderRendition> Renditions;
+
 	void UpdateResolution()
 	{
 		Resolution = CropArea.Size();
 	}
+
+	/** 编码器实际使用的分辨率，4:2:0 要求宽高是偶数 */
+	FIntPoint GetOutputResolution() const
+	{
+		return OutputResolution.X > 0 && OutputResolution.Y > 0
+			       ? FIntPoint(OutputResolution.X & ~1, OutputResolution.Y & ~1)
+			       : Resolution;
+	}
+
+	/** 用控制台变量覆盖可调参数 */
+	void LoadConsoleVariables();
+};
+
+/**
+ * 借给编码侧的已映射帧内存，最后一个引用释放时置位 ReleasedFlag，
+ * 渲染线程看到之后才会真正 Unmap 对应的 readback
+ */
+class FMappedFrameView
+{
+public:
+	explicit FMappedFrameView(const TSharedRef<std::atomic_bool, ESPMode::ThreadSafe>& InReleasedFlag)
+		: ReleasedFlag(InReleasedFlag)
+	{
+	}
+
+	~FMappedFrameView()
+	{
+		ReleasedFlag->store(true, std::memory_order_release);
+	}
+
+private:
+	TSharedRef<std::atomic_bool, ESPMode::ThreadSafe> ReleasedFlag;
 };
 
+using FMappedFrameViewPtr = TSharedPtr<FMappedFrameView, ESPMode::ThreadSafe>;
+
 struct FCapturedVideoFrame
 {
 	uint8* FrameData;
@@ -57,6 +267,10 @@ struct FCapturedVideoFrame
 	FIntRect CaptureRect;
 	double PresentTime;
 	double Duration;
+	/** 渲染线程拿到这一帧画面的时间，FPlatformTime::Cycles64()；PresentTime 是输出时间轴上的位置，不是真实时间 */
+	uint64 CaptureCycles;
+	/** 不为空时 FrameData 指向借来的 readback 内存，用完释放即可，不需要在渲染线程内拷贝 */
+	FMappedFrameViewPtr View;
 
 	FORCEINLINE_DEBUGGABLE explicit operator bool() const { return FrameData != nullptr; }
 }; 
@@ -88,6 +302,8 @@ public:
 	TArray<float> Data;
 	double StartSec;
 	double Duration;
+	/** 进入待编码队列的时间，FPlatformTime::Cycles64() */
+	uint64 EnqueueCycles = 0;
 
 private:
 	// 禁用复制
@@ -55,8 +55,13 @@ public:
 	/** IAVRecorderBase Implementations */
 	virtual void Register(UWorld* World) override;
 	virtual void Unregister() override;
+	/** 编码线程退出之后调用，回收并释放所有 readback */
+	virtual void Teardown() override;
 
 	FOnSendFrame& GetOnSendFrame() { return OnSendFrame; }
+
+	/** readback 全部借出时是否等待编码侧归还，而不是丢弃这一帧，离线录制时使用 */
+	void SetWaitForFreeReadback(bool bWait) { bWaitForFreeReadback = bWait; }
 	FOnForceStopRecord& GetOnForceStopRecord() { return OnForceStopRecord; }
 
 	bool Initialize(const FIntPoint &InResolution, const FIntRect &InCropArea, const double InFrameRate)
@@ -110,6 +115,12 @@ private:
 	                                         double DurationInSeconds,
 	                                         const FIntRect& RecordArea);
 
+	/** 编码侧已经用完的 readback 在这里 Unmap */
+	void ReclaimReadbacks_RenderThread();
+
+	/** 找一个空闲的 readback 发起拷贝，没有时返回 INDEX_NONE */
+	int32 AcquireReadback_RenderThread();
+
 	void OnPreResizeWindowBackBuffer(void* BackBuffer);
 
 	void OnBackBufferReady_RenderThread(SWindow& SlateWindow, const FTexture2DRHIRef& BackBuffer);
@@ -127,10 +138,17 @@ private:
 	std::atomic_bool bRecording{false};
 	FCriticalSection VideoCaptureCS;
 
-	// 读取 Buffer，这里设为 1 是因为暂时没有设计适应多个 ReadBack 缓存的解析逻辑，后续可以加
-	static constexpr int32 READBACK_BUFFER_COUNT = 3;
+	// 读取 Buffer，映射后的内存会借给编码线程做裁剪和转换，用完才 Unmap，所以要比 GPU 拷贝的延迟多留几个
+	static constexpr int32 READBACK_BUFFER_COUNT = 6;
+	// 发起拷贝后至少等待的帧数，给 GPU 留出完成拷贝的时间
+	static constexpr int32 READBACK_LATENCY = 2;
+	// 等待编码侧归还 readback 的最长时间
+	static constexpr int32 MAX_READBACK_WAIT_MS = 1000;
 	TUniquePtr<recorder::FRHIGPUTextureReadback> GPUTextureReadback[READBACK_BUFFER_COUNT];
 	int32 CurrentReadbackIndex = 0;
+	// 已经发起拷贝、还没有读取的 readback，按发起顺序排列
+	TArray<int32, TInlineAllocator<READBACK_BUFFER_COUNT>> PendingReadbacks;
+	bool bWaitForFreeReadback = false;
 
 	// 设备相关的
 	SWindow* GameWindow;
@@ -7,9 +7,21 @@
 #include "PixelFormat.h"
 #include "FFmpegExt/FFmpegExtension.h"
 #include "Capture/RecorderConfig.h"
+#include "Encoder/FileWriter.h"
+#include "Encoder/FrameRing.h"
+#include "Encoder/LatencyStats.h"
+#include "Encoder/OutputFile.h"
+#include "Encoder/OutputSink.h"
+#include "Encoder/PipelineStage.h"
+#include "Encoder/RecorderStats.h"
+#include "Encoder/ReplayBuffer.h"
+#include "Encoder/SegmentedOutput.h"
+#include "Encoder/SessionReport.h"
+#include "Encoder/VideoEncoderBackend.h"
 
 class FEncoderThread;
 class FEncodeData;
+class FRenditionEncoder;
 
 struct FTimeSeq
 {
@@ -17,6 +29,51 @@ struct FTimeSeq
 	double Current;
 	/** 帧时长 */
 	double Duration;
+	/** 捕获这一帧的 FPlatformTime::Cycles64()，用于统计延迟；重复上一帧补出来的帧为 0 */
+	uint64 CaptureCycles = 0;
+	/** 送进编码器的 FPlatformTime::Cycles64()，由 SendVideoFrame 填写 */
+	uint64 SendCycles = 0;
+};
+
+/**
+ * 视频帧槽位，像素数据和时间戳放在一起流转，避免两个队列之间出现错位
+ * 槽位在录制开始时按分辨率一次性分配，渲染线程写入时不会再分配内存
+ */
+struct FVideoFrameSlot
+{
+	/** 裁剪后的 RGBA 像素 */
+	TArray<uint8> Data;
+	/** 帧位置 */
+	double StartSec = 0;
+	/** 帧时长 */
+	double Duration = 0;
+	/** 捕获这一帧的 FPlatformTime::Cycles64() */
+	uint64 CaptureCycles = 0;
+	/** 紧挨在这一帧之前被丢弃的帧数 */
+	int32 DroppedCount = 0;
+	/** 紧挨在这一帧之前被丢弃的帧的总时长 */
+	double DroppedDuration = 0;
+	/** 还没有拷贝进 Data 的借用帧，转换线程取出后先裁剪到 Data 再释放 */
+	FCapturedVideoFrame Source{};
+	/** 进入待转换队列的时间，FPlatformTime::Cycles64() */
+	uint64 EnqueueCycles = 0;
+
+	FORCEINLINE uint8* GetRawData() { return Data.GetData(); }
+};
+
+/**
+ * 转换好的 I420 或 NV12 帧（10bit 编码时是 yuv420p10le 或 P010），从转换线程交给编码线程
+ */
+struct FConvertedVideoFrame
+{
+	/** 带引用计数的帧，没有缓存（buf[0] 为空）表示转换失败，按丢帧处理 */
+	AVFrame* Frame = nullptr;
+	FTimeSeq Time{0, 0};
+	/** 紧挨在这一帧之前被丢弃的帧数和总时长 */
+	int32 DroppedCount = 0;
+	double DroppedDuration = 0;
+	/** 进入待编码队列的时间，FPlatformTime::Cycles64() */
+	uint64 EnqueueCycles = 0;
 };
 
 class FAVEncoder
@@ -26,33 +83,132 @@ public:
 
 	void InitializeEncoder(FRecorderConfig InRecordConfig);
 	void CreateAudioEncoder(const char* audioencoder_name);
-	void CreateVideoEncoder(bool is_use_NGPU, const char* out_file_name, int bit_rate);
+	void CreateVideoEncoder(bool is_use_NGPU, const char* out_file_name);
 	void ChangeColorFormat(AVFrame* InVideoFrame, uint8_t* FrameDataInRgb) const;
+	/** 捕获的原始格式可以跳过 RGBA 中转缓存、直接转换成 I420 */
+	static bool CanConvertDirectly(const FCapturedVideoFrame& VideoFrame);
+	/** 从捕获的原始像素按 CaptureRect 裁剪并转换到 InVideoFrame，要求 CanConvertDirectly 为 true */
+	void ConvertCapturedFrame(AVFrame* InVideoFrame, const FCapturedVideoFrame& VideoFrame) const;
 
 	void CreateAudioSwr();
 
-	void EncodeVideoFrame(TQueue<FTimeSeq>& VideoTimeSequence, FEncodeData* rgb);
+	/**
+	 * 把槽位里的画面转换到 OutFrame，OutFrame 会先换上缓存池里的一块新缓存；输出分辨率与截取区域不同时再用 libyuv 缩放
+	 * @note 在转换线程调用，不会访问编码器的状态
+	 */
+	bool ConvertVideoFrame(FVideoFrameSlot* Slot, AVFrame* OutFrame) const;
+	/**
+	 * 把另一个编码器转换好的帧缩放到 OutFrame（本编码器的分辨率），OutFrame 会先换上缓存池里的一块新缓存
+	 * @note 不会访问编码器的状态，可以在编码线程以外调用，但同一个编码器只能固定在一个线程调用（P010 缩放有临时缓存）
+	 */
+	bool ScaleVideoFrame(const AVFrame* Source, AVFrame* OutFrame) const;
+	/** 送进编码器，Frame 的引用会被转移到 video_frame，留给之后重复帧使用 */
+	void EncodeVideoFrame(AVFrame* Frame, const FTimeSeq& VideoTime);
+	/** 上一帧的时长延长 ExtraDuration，用于丢帧后保持音画同步 */
+	void ExtendLastVideoFrame(double ExtraDuration);
+	/** 把上一帧的画面重复送进编码器 Count 次，补齐 TotalDuration 的时长 */
+	void RepeatLastVideoFrame(int32 Count, double TotalDuration);
 	void EncodeAudioFrame(TQueue<FTimeSeq>& AudioTimeSequence, FEncodeData* rgb);
 
 	void EndAudioEncoding(TQueue<FTimeSeq>& AudioTimeSequence);
-	void EndVideoEncoding(TQueue<FTimeSeq>& VideoTimeSequence);
+	void EndVideoEncoding();
 	// private:
 	void SetAudioVolume(AVFrame* frame);
 
+	/** 输入画面与编码器要求的尺寸、格式不一致时才需要经过滤镜图 */
+	bool IsVideoFilterRequired() const;
 	void AllocVideoFilter();
 
 	void EncodeFinish();
 
-	FORCEINLINE_DEBUGGABLE int GetAudioFrameSize() const
+	FORCEINLINE const FPipelineStageStats* GetMuxStats() const { return MuxStage ? &MuxStage->GetStats() : nullptr; }
+
+	FORCEINLINE const IVideoEncoderBackend* GetVideoBackend() const { return VideoBackend; }
+
+	/** 以下三个可以在任意线程读取，用于实时统计 */
+	FORCEINLINE uint64 GetSentVideoFrameCount() const { return SentVideoFrameCount.load(std::memory_order_relaxed); }
+	FORCEINLINE uint64 GetMuxedBytes() const { return MuxedBytes.load(std::memory_order_relaxed); }
+	/** 已编码的视频结束时间减去已编码的音频结束时间（秒） */
+	FORCEINLINE double GetEncodedAVDrift() const
 	{
-		return audio_encoder_codec_context->frame_size;
+		return CurrentEncodeVideoTime.load(std::memory_order_relaxed) -
+			CurrentEncodeAudioTime.load(std::memory_order_relaxed);
 	}
 
-	/** 音频时间轴向视频时间轴靠近，所以音频不能过长，这里先固定一个 0.1s 的差值，意味着音频最多比视频长 0.1s */
-	FORCEINLINE_DEBUGGABLE bool ShouldContinueAudioEncoding() const
+	/**
+	 * 编码结束时把封装、输出的统计和逐帧延迟记进 Report，名字前加上 Prefix（编码阶梯各档用来区分）
+	 * @note 需要在 EncodeFinish 之前设置，Report 要活到 EncodeFinish 之后
+	 */
+	void SetSessionReport(FRecorderSessionReport* Report, const FString& Prefix);
+
+	/**
+	 * 即时回放模式下把最近 Seconds 秒保存为 MP4，在后台写文件
+	 * @note 在游戏线程调用，不能与 EncodeFinish 同时进行
+	 */
+	bool SaveReplay(const FString& Path, double Seconds);
+
+private:
+	/** 把 video_frame 中已经转换好的画面送进编码器，并写出产出的 packet */
+	void SendVideoFrame(const FTimeSeq& VideoTime);
+	/** 把一帧送进编码器，写出所有已经产出的 packet */
+	void SendFrameToVideoEncoder(AVFrame* InFrame);
+	/**
+	 * 按编码器产出的 packet 的 pts 取回对应帧的时间，换算成输出时间基下的 pts、dts 和时长，
+	 * dts 严格递增且不大于 pts
+	 * @return 找不到对应的帧时返回 false，这个 packet 不应写出
+	 */
+	bool StampVideoPacket(AVPacket* Packet, FTimeSeq& OutTime);
+	/**
+	 * 用 libyuv 把 Source 缩放到 OutFrame 的大小（I420Scale、NV12Scale，10bit 用对应的 16bit 版本），
+	 * 两者格式必须相同，滤波方式取 RecordConfig.ScaleFilter
+	 */
+	bool ResizeFrame(const AVFrame* Source, AVFrame* OutFrame) const;
+	/** libyuv 的 16bit 交错色度缩放只支持少数几种比例，P010 的色度拆成两个平面分别缩放再交错回去 */
+	bool ResizeP010(const AVFrame* Source, AVFrame* OutFrame, libyuv::FilterMode Filter) const;
+	/** P010 和 yuv420p10le，每个采样占 16bit */
+	static bool IsHighBitDepthFormat(AVPixelFormat Format);
+	/**
+	 * 选择视频编码器后端：硬件编码用 NVENC，否则用 VideoCodec；不可用或者输出格式放不下时换成第一个可用的软件后端，
+	 * bHighBitDepth 而选中的后端不接受 10bit 输入时换成 HEVC
+	 */
+	const IVideoEncoderBackend& SelectVideoBackend(bool bHardware) const;
+	/**
+	 * bHighBitDepth 并且编码器接受时转换成 P010（bPreferNV12）或 yuv420p10le；
+	 * 否则编码器接受 NV12 并且 bPreferNV12 时转换成 NV12，再否则转换成 I420
+	 */
+	AVPixelFormat NegotiateVideoInputFormat(const IVideoEncoderBackend& Backend, const AVCodec* Codec) const;
+	/** 按输出分辨率和 VideoInputFormat 创建帧缓存池 */
+	bool InitializeVideoFramePool();
+	/** Frame 换成池里一块新的缓存，上一块缓存在编码器用完后自动归还 */
+	bool AcquireVideoFrameBuffer(AVFrame* Frame) const;
+	/** 缓存池的分配函数，参数类型随 FFmpeg 版本在 int 与 size_t 之间变化 */
+	template <typename SizeType>
+	static AVBufferRef* AllocVideoFrameBuffer(void* Opaque, SizeType Size);
+
+	/** 按 AdditionalOutputs 创建额外的输出，需要在主输出写好文件头之后调用 */
+	void CreateOutputSinks();
+	/** 启动封装线程，之后所有 packet 都经过 WritePacket 交给它写出 */
+	void StartMuxing();
+	/** 写完队列里剩下的 packet 后停止封装线程 */
+	void StopMuxing();
+	/**
+	 * packet 的引用会被转移走，封装线程跟不上时会阻塞等待
+	 * @note 视频 packet 只能在视频编码线程写入，音频 packet 只能在音频编码线程写入
+	 */
+	int WritePacket(AVPacket* Packet, uint64 CaptureCycles = 0);
+	/** 封装线程调用，从两路队列里取 dts 较小的一个 packet 交错写出，没有可以写出的 packet 时返回 false */
+	bool MuxOnePacket_MuxThread();
+	/** 分发给额外的输出，再写到输出文件（分段输出时写到当前分段，即时回放时写进回放缓存），在封装线程调用 */
+	int WriteOutputPacket(AVPacket* Packet);
+	/** 视频 packet 写出之后记录从捕获到写出的延迟 */
+	void RecordMuxLatency(uint64 CaptureCycles);
+	/** 只有视频（bVideo）或者音频这一路有 packet 时，它的队首是否不必再等另一路 */
+	bool ShouldFlushUnpaired_MuxThread(bool bVideo);
+
+public:
+	FORCEINLINE_DEBUGGABLE int GetAudioFrameSize() const
 	{
-		if (CurrentEncodeVideoTime == 0 && CurrentEncodeAudioTime == 0) { return false; }
-		return CurrentEncodeVideoTime + 0.100 >= CurrentEncodeAudioTime;
+		return audio_encoder_codec_context->frame_size;
 	}
 
 	FRecorderConfig RecordConfig;
@@ -83,6 +239,108 @@ private:
 	AVFrame* audio_frame;
 	AVFrame* video_frame;
 
+	/** 视频编码器后端，在 CreateVideoEncoder 里选定 */
+	const IVideoEncoderBackend* VideoBackend = nullptr;
+
+	/** 颜色转换输出、送进编码器的像素格式，AV_PIX_FMT_YUV420P、AV_PIX_FMT_NV12，10bit 编码时是 AV_PIX_FMT_YUV420P10 或 AV_PIX_FMT_P010 */
+	AVPixelFormat VideoInputFormat = AV_PIX_FMT_YUV420P;
+
+	/** 编码器输入帧的缓存池，每一块是一帧完整的 VideoInputFormat 画面，各个平面的起始地址和行宽都按 64 字节对齐 */
+	static constexpr int32 VIDEO_FRAME_ALIGNMENT = 64;
+	AVBufferPool* video_frame_pool;
+	int32 VideoFramePlaneCount = 3;
+	int32 VideoFrameLinesize[3] = {0, 0, 0};
+	SIZE_T VideoFramePlaneOffset[3] = {0, 0, 0};
+	/** 输出分辨率与截取区域不同时，截取区域大小的转换结果，只在转换线程访问 */
+	AVFrame* capture_frame;
+	/** 10bit 编码时 8bit 源先转换到这一帧（截取区域大小的 I420），再扩展到 10bit，只在转换线程访问 */
+	AVFrame* capture_frame_8bit;
+	/** ResizeP010 拆开的色度平面，大小不变后不再分配；同一个编码器的缩放只在一个线程里进行（转换线程或者编码阶梯这一档的线程） */
+	mutable TArray<uint16> ResizeChromaScratch;
+
+	/** 长期复用的 packet 和滤镜输出帧，avcodec_receive_packet / av_buffersink_get_frame 每次都会先 unref */
+	AVPacket* video_packet;
+	AVPacket* audio_packet;
+	AVFrame* filtered_video_frame;
+
+	/** 送进编码器的帧数，包括重复上一帧补出来的帧 */
+	std::atomic<uint64> SentVideoFrameCount{0};
+
+	struct FQueuedPacket
+	{
+		AVPacket* Packet;
+		uint64 EnqueueCycles;
+		/** 视频 packet 对应的帧的捕获时间，音频为 0 */
+		uint64 CaptureCycles;
+	};
+
+	/**
+	 * 一路流在编码线程与封装线程之间流转的 packet，数量固定，两个队列里只有裸指针
+	 * 音频和视频由不同的线程编码，各用一组队列，保证每个队列都只有一个生产者
+	 */
+	struct FMuxStreamQueue
+	{
+		TArray<AVPacket*> Packets;
+		/** 待写出的 packet，编码线程写入，封装线程读取 */
+		TSpscRing<FQueuedPacket> Ready;
+		/** 空闲的 packet，封装线程归还，编码线程领取 */
+		TSpscRing<AVPacket*> Free;
+		FEvent* FreedEvent = nullptr;
+		/** 这一路不会再有 packet 了，另一路不需要再等它 */
+		std::atomic_bool bEnded{false};
+	};
+
+	static constexpr uint32 MUX_QUEUE_CAPACITY = 64;
+	/**
+	 * 两路队列本身就是交错用的重排缓冲：只有一路有 packet 时先留着，等另一路送来 dts 更大的 packet 再写，
+	 * 以免后到的另一路 packet 落在已经写出的时间之前；一路积压到 MUX_REORDER_DEPTH 个
+	 * 或者最老的 packet 等了 MUX_REORDER_WAIT_MS 仍然没有等到另一路时直接写出，保证延迟和内存都有上限
+	 */
+	static constexpr uint32 MUX_REORDER_DEPTH = 32;
+	static constexpr double MUX_REORDER_WAIT_MS = 200;
+	FMuxStreamQueue VideoMuxQueue;
+	FMuxStreamQueue AudioMuxQueue;
+	TUniquePtr<FPipelineStage> MuxStage;
+
+	/** 本地文件输出时代替 avio_open 的写出端，为空表示 pb 由 avio_open 打开 */
+	TUniquePtr<FBufferedFileWriter> FileWriter;
+	/** 分段输出，不为空时 out_format_context 只是模板，packet 都写到这里 */
+	TUniquePtr<FSegmentedOutput> SegmentedOutput;
+	/** 即时回放缓存，不为空时 out_format_context 只是模板，packet 都保存在内存里 */
+	TUniquePtr<FReplayBuffer> ReplayBuffer;
+	/** 额外的输出，封装线程把 packet 引用一份交给每一路 */
+	TArray<TUniquePtr<FOutputSink>> OutputSinks;
+
+	struct FPendingVideoTime
+	{
+		FTimeSeq Time{0, 0};
+		/** 送进编码器时的帧序号，也是这一帧在编码器时间基下的 pts */
+		int64 Pts = -1;
+		bool bPending = false;
+	};
+
+	/**
+	 * 已送入编码器、还没有产出 packet 的帧时间，按帧序号取模存放，只在编码线程访问
+	 * 有 B 帧的编码器按解码顺序产出 packet，要按 packet 的 pts 找回它是哪一帧，不能按送入的顺序取
+	 */
+	static constexpr uint32 PENDING_VIDEO_TIME_CAPACITY = 256;
+	TArray<FPendingVideoTime> PendingVideoTimes;
+	/** 下一帧送进编码器的帧序号 */
+	int64 NextVideoPts = 0;
+	/** 上一个视频 packet 在输出时间基下的 dts，保证单调递增 */
+	int64 LastVideoDts = INT64_MIN;
+	/** 取出 PendingVideoTimes 时记录这一帧从捕获到产出 packet 的延迟，只在编码线程访问，EncodeFinish 时输出 */
+	FCaptureLatencyStats CaptureLatency;
+	/** 视频帧从 avcodec_send_frame 到产出 packet，只在编码线程记录 */
+	FLatencyHistogram SendToPacketLatency;
+	/** 视频帧从捕获到 packet 写出，在封装线程记录 */
+	FLatencyHistogram CaptureToMuxLatency;
+	/** 写给主输出的字节数，写出 packet 的线程写入，任意线程读取 */
+	std::atomic<uint64> MuxedBytes{0};
+
+	FRecorderSessionReport* SessionReport = nullptr;
+	FString ReportPrefix;
+
 	// int32 CurrentAudioSendBufferIndex;
 	// uint32 FormatSize_X(uint32 x);
 	// [[maybe_unused]] TArray<FColor> Colors;
@@ -97,11 +355,14 @@ private:
 	/**
 	 * 当前编码好的音频结束时间， 在 FixTimeStep 开启时，音视频时间轴没有对齐，所以需要裁剪掉后续的音频，不加入编码队列
 	 */
-	double CurrentEncodeAudioTime = 0;
+	std::atomic<double> CurrentEncodeAudioTime{0};
 	/**
 	 * 当前编码好的视频结束时间，优先保证视频完全编码
 	 */
-	double CurrentEncodeVideoTime = 0;
+	std::atomic<double> CurrentEncodeVideoTime{0};
+
+	/** 最近一次送进编码器的帧时间，用于丢帧后补齐 */
+	FTimeSeq LastSentVideoTime{0, 0};
 };
 
 /**
@@ -113,26 +374,54 @@ class FAVBufferedEncoder
 public:
 	FAVBufferedEncoder();
 	~FAVBufferedEncoder();
-	void Initialize(/*TSharedPtr<FAVEncoder>& InAVEncoder*/);
+	/** 创建编码器并按输出分辨率预分配视频槽位 */
+	void Initialize(const FRecorderConfig& InRecordConfig);
 
 	FORCEINLINE_DEBUGGABLE const TSharedPtr<FAVEncoder>& GetEncoder() const { return Encoder; }
 	FORCEINLINE_DEBUGGABLE TSharedPtr<FAVEncoder>& GetEncoder() { return Encoder; }
 
-	FORCEINLINE_DEBUGGABLE bool IsVideoBufferEmpty() const { return VideoBuffer.IsEmpty(); }
+	FORCEINLINE_DEBUGGABLE bool IsVideoBufferEmpty() const { return ConvertedVideoFrames.IsEmpty(); }
 	FORCEINLINE_DEBUGGABLE bool IsAudioBufferEmpty() const { return AudioBuffer.IsEmpty(); }
 
+	/** 流水线各级的统计：转换、视频编码、音频编码（封装的统计在 FAVEncoder 上） */
+	FORCEINLINE_DEBUGGABLE const FPipelineStageStats* GetConvertStats() const
+	{
+		return ConvertStage ? &ConvertStage->GetStats() : nullptr;
+	}
+	FORCEINLINE_DEBUGGABLE const FPipelineStageStats& GetEncodeStats() const { return EncodeStats; }
+	FORCEINLINE_DEBUGGABLE const FPipelineStageStats* GetAudioEncodeStats() const
+	{
+		return AudioStage ? &AudioStage->GetStats() : nullptr;
+	}
+
+	/** 最近一次采样的实时统计，可以在任意线程调用 */
+	FRecorderStats GetLiveStats() const;
+
+	/** 被丢弃的视频帧数量，可用于报警 */
+	FORCEINLINE_DEBUGGABLE uint64 GetDroppedVideoFrames() const { return DroppedVideoFrames.load(); }
+
+	/** 这次录制的性能报告，各级在结束时记入，Finalize_EncoderThread 之后才完整 */
+	FORCEINLINE_DEBUGGABLE const FRecorderSessionReport& GetSessionReport() const { return SessionReport; }
+
+	/** 编码线程：没有转换好的帧时等待新帧，最多等一个 LIVE_STATS_INTERVAL_SEC，超时后照常采样实时统计 */
 	bool WaitBufferInsert(bool bForce = false);
 	/** 请注意，需要在编码线程结束的时候调用释放信号量 */
 	bool ReleaseBufferWait(bool bForce = false);
 
-	/** 以视频轴为基准，音频向视频对齐 */
+	/** 编码一帧视频，音频由单独的音频编码线程处理 */
 	void EncodeFrame_EncoderThread(bool bWaitIfBufferEmpty);
 
 private:
-	/** 把最新的一帧送到编码器 */
-	void EncodeOneVideoFrame_EncoderThread();
-	/** 把最新的可以编码的帧送到编码器，依赖视频编码进度 */
-	void EncodeAudioFrames_EncoderThread();
+	/** 把转换好的一帧送到编码器，没有可编码的帧时返回 false */
+	bool EncodeOneVideoFrame_EncoderThread();
+	/** 转换线程：把一个槽位转换成 I420，没有待转换的槽位或者没有空闲帧时返回 false */
+	bool ConvertOneVideoFrame_ConvertThread();
+	/** 以视频轴为基准，音频向视频对齐：下一帧音频的开始时间没有超出已捕获的视频太多才能编码 */
+	bool CanEncodeNextAudioFrame();
+	/** 音频编码线程：重采样、调整音量并编码一帧音频，没有可以编码的帧时返回 false */
+	bool EncodeOneAudioFrame_AudioEncodeThread();
+	/** 距离上次采样超过 LIVE_STATS_INTERVAL_SEC 时采样一次实时统计并发布 */
+	void UpdateLiveStats_EncoderThread();
 
 public:
 	void Finalize_EncoderThread();
@@ -148,14 +437,80 @@ public:
 
 private:
 	TSharedPtr<FAVEncoder> Encoder;
+	/** 编码阶梯中主输出之外的各档，共用这里的捕获和颜色转换 */
+	TArray<TUniquePtr<FRenditionEncoder>> Renditions;
 	FEvent* ThreadEvent;
 
-	TQueue<FEncodeData*> VideoBufferPool;
-	TQueue<FEncodeData*> VideoBuffer;
-	TQueue<FTimeSeq> VideoTimeSequence;
-	FCriticalSection VideoMutex;
+private:
+	/** 按 VideoQueuePolicy 领取一个空闲槽位，返回 nullptr 表示这一帧被丢弃 */
+	FVideoFrameSlot* AcquireVideoSlot_RenderThread(double PresentTime, double Duration);
+	/** 记录一次渲染线程侧的丢帧，时长会带到下一个入队的槽位上 */
+	void DropVideoFrame_RenderThread(double PresentTime, double Duration);
+	/** 队列满时丢弃最老的待转换帧，仅 DropOldest 策略使用 */
+	void DropOldestVideoFrames_ConvertThread();
+	/** 槽位还回空闲队列 */
+	void ReleaseVideoSlot_ConvertThread(FVideoFrameSlot* Slot);
+	/** 按 CaptureRect 裁剪、重新量化到槽位的 RGBA 数据中 */
+	static void RepackVideoFrame(const FCapturedVideoFrame& VideoFrame, FVideoFrameSlot* Slot);
+
+	ERecorderQueuePolicy VideoQueuePolicy = ERecorderQueuePolicy::DropNewest;
+	/** 待编码队列的最大深度，槽位会多预留两个：一个正在编码，一个留给渲染线程 */
+	uint32 MaxVideoQueueDepth = 0;
+	TArray<TUniquePtr<FVideoFrameSlot>> VideoSlots;
+	/** 空闲槽位，编码线程归还，渲染线程领取 */
+	TSpscRing<FVideoFrameSlot*> VideoBufferPool;
+	/** 待转换槽位，渲染线程写入，转换线程读取 */
+	TSpscRing<FVideoFrameSlot*> VideoBuffer;
+	/** Block 策略下，转换线程归还槽位后唤醒渲染线程 */
+	FEvent* VideoSlotEvent;
+	std::atomic_bool bVideoFinalizing{false};
+
+	std::atomic<uint64> DroppedVideoFrames{0};
+	/** 渲染线程侧还没有带出去的丢帧信息 */
+	int32 PendingDroppedCount = 0;
+	double PendingDroppedDuration = 0;
+	/** 转换线程侧（DropOldest）还没有带出去的丢帧信息 */
+	int32 ConvertDroppedCount = 0;
+	double ConvertDroppedDuration = 0;
+
+	/** 转换好、等待编码的帧的数量上限，也是帧对象的数量 */
+	static constexpr uint32 CONVERTED_FRAME_CAPACITY = 3;
+	TArray<AVFrame*> VideoFrames;
+	/** 待编码帧，转换线程写入，编码线程读取 */
+	TSpscRing<FConvertedVideoFrame> ConvertedVideoFrames;
+	/** 空闲帧，编码线程归还，转换线程领取 */
+	TSpscRing<AVFrame*> FreeVideoFrames;
+	TUniquePtr<FPipelineStage> ConvertStage;
+	/** 编码线程不是 FPipelineStage，统计单独记录 */
+	FPipelineStageStats EncodeStats;
+
+	FRecorderSessionReport SessionReport;
+	/** 视频帧从渲染线程捕获到进入待转换队列，在渲染线程记录 */
+	FLatencyHistogram CaptureToEnqueueLatency;
+	/** 视频帧从转换完成到开始编码，在编码线程记录 */
+	FLatencyHistogram ConvertedToSendLatency;
+
+	/** 实时统计的采样间隔，速率类的值按这段时间内的增量计算 */
+	static constexpr double LIVE_STATS_INTERVAL_SEC = 0.5;
+	/** 上一次采样时的时间和各个累计值，只在编码线程访问 */
+	uint64 LastLiveStatsCycles = 0;
+	uint64 LastEncodedFrames = 0;
+	uint64 LastEncodeItems = 0;
+	uint64 LastEncodeBusyCycles = 0;
+	uint64 LastMuxedBytes = 0;
+	FRecorderStats LiveStats;
+	mutable FCriticalSection LiveStatsMutex;
+
+	/** 音频最多比已经捕获的视频超前的时长 */
+	static constexpr double MAX_AUDIO_LEAD_SECONDS = 0.1;
+	/** 已经捕获的视频结束时间，渲染线程写入，音频编码线程读取 */
+	std::atomic<double> CapturedVideoTime{0};
+	/** AudioBuffer 的近似深度，只用于统计 */
+	std::atomic<uint32> PendingAudioFrames{0};
+	TUniquePtr<FPipelineStage> AudioStage;
 
 	TQueue<FEncodeData*> AudioBufferPool;
+	/** 待编码音频，音频线程写入，音频编码线程读取 */
 	TQueue<FEncodeData*> AudioBuffer;
 	TQueue<FTimeSeq> AudioTimeSequence;
 	FCriticalSection AudioMutex;
@@ -8,6 +8,7 @@
 
 #include "Capture/AudioCapture.h"
 #include "Capture/RecorderConfig.h"
+#include "Encoder/RecorderStats.h"
 
 #include "FFmpegRecorder.generated.h"
 
@@ -58,6 +59,12 @@ public:
 
     void StopRecord();
 
+    /** 即时回放模式下把最近 Seconds 秒保存到 Path，文件在后台写出 */
+    bool SaveReplay(const FString& Path, double Seconds);
+
+    /** 录制中的实时统计，没有在录制时返回全 0 */
+    FRecorderStats GetRecorderStats() const;
+
     // 配置
     FRecorderConfig RecordConfig;
     bool bUseFixedTimeStep = false;
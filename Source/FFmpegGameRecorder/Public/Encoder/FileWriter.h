@@ -0,0 +1,95 @@
+﻿#pragma once
+
+#include <atomic>
+
+#include "CoreMinimal.h"
+#include "FFmpegExt/FFmpegExtension.h"
+#include "Encoder/FrameRing.h"
+#include "Encoder/PipelineStage.h"
+
+class IFileHandle;
+
+/**
+ * 录制文件的写出端，代替 avio_open 打开的文件
+ * FFmpeg 通过自定义的 AVIOContext 把数据拷贝进一块大的对齐缓存，写满后整块交给后台线程写盘，
+ * 封装线程只做内存拷贝，磁盘的延迟抖动不会直接传到编码器；两块缓存轮流使用，写盘线程跟不上时封装线程才会等待
+ * @note AVIOContext 的回调只能在同一个线程里调用（封装线程，或者封装线程退出后的编码线程）
+ */
+class FBufferedFileWriter
+{
+public:
+	FBufferedFileWriter();
+	~FBufferedFileWriter();
+
+	/**
+	 * @param BufferSize 每一块写缓存的大小，会向上对齐到 BUFFER_ALIGNMENT
+	 * @param PreallocateSize 预先为文件分配的磁盘空间，只在 Linux 上生效，不改变文件大小
+	 */
+	bool Open(const FString& Path, int32 BufferSize, int64 PreallocateSize);
+
+	/** 写完剩下的数据并关闭文件，调用前需要先把 AVFormatContext 的 pb 摘掉 */
+	bool Close();
+
+	FORCEINLINE AVIOContext* GetIOContext() const { return IOContext; }
+
+	/** 实际发起的写盘系统调用次数 */
+	FORCEINLINE uint64 GetWriteCallCount() const { return WriteCallCount.load(); }
+
+	/** 写盘线程的统计，上游等待记录的是封装线程等空闲缓存的时间 */
+	FORCEINLINE const FPipelineStageStats* GetStats() const { return WriterStage ? &WriterStage->GetStats() : nullptr; }
+
+private:
+	static int WritePacketCallback(void* Opaque, uint8_t* Buf, int BufSize);
+	static int64_t SeekCallback(void* Opaque, int64_t Offset, int Whence);
+
+	int Write(const uint8* Data, int32 Size);
+	int64 Seek(int64 Offset, int Whence);
+
+	/** 当前缓存交给写盘线程，换一块空闲缓存，从 NextFileOffset 开始写 */
+	void SubmitBuffer(int64 NextFileOffset);
+
+	/** 写盘线程：写出一块缓存，没有待写的缓存时返回 false */
+	bool WriteOneBuffer_WriterThread();
+	bool WriteAt_WriterThread(int64 Offset, const uint8* Data, int64 Size);
+
+	struct FPendingBuffer
+	{
+		uint8* Data;
+		int64 FileOffset;
+		int32 Size;
+		uint64 EnqueueCycles;
+	};
+
+	static constexpr uint32 BUFFER_COUNT = 2;
+	static constexpr int32 BUFFER_ALIGNMENT = 4096;
+	/** 交给 AVIOContext 的小缓存，avio_write 先写到这里，满了才回调到 Write */
+	static constexpr int32 IO_CONTEXT_BUFFER_SIZE = 64 * 1024;
+
+	AVIOContext* IOContext = nullptr;
+
+#if PLATFORM_LINUX
+	int FileDescriptor = -1;
+#else
+	IFileHandle* FileHandle = nullptr;
+#endif
+
+	int32 BufferCapacity = 0;
+	TArray<uint8*> Buffers;
+	/** 封装线程正在写入的缓存，以及它对应的文件位置 */
+	uint8* ActiveBuffer = nullptr;
+	int64 ActiveFileOffset = 0;
+	int32 ActiveCursor = 0;
+	int32 ActiveSize = 0;
+	/** 写入过的最大文件位置，也就是文件的大小 */
+	int64 FileSize = 0;
+
+	/** 待写盘的缓存，封装线程写入，写盘线程读取 */
+	TSpscRing<FPendingBuffer> PendingBuffers;
+	/** 空闲缓存，写盘线程归还，封装线程领取 */
+	TSpscRing<uint8*> FreeBuffers;
+	FEvent* BufferFreedEvent = nullptr;
+	TUniquePtr<FPipelineStage> WriterStage;
+
+	std::atomic<uint64> WriteCallCount{0};
+	std::atomic_bool bWriteFailed{false};
+};
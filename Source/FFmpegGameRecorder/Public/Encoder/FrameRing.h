@@ -0,0 +1,123 @@
+﻿#pragma once
+
+#include <atomic>
+
+#include "CoreMinimal.h"
+
+/**
+ * 固定容量的单生产者/单消费者无锁环形队列
+ * 读写游标分别独占一个 cache line，避免渲染线程与编码线程互相抢占同一行缓存；
+ * 存储在 Initialize 时一次性分配，之后 Enqueue/Dequeue 都不会再分配内存，也不会阻塞
+ * @note Enqueue 只能在唯一的生产者线程调用，Dequeue 只能在唯一的消费者线程调用
+ */
+template <typename ElementType>
+class TSpscRing
+{
+public:
+	TSpscRing() = default;
+
+	/** 分配存储，需要在生产者和消费者开始工作之前调用 */
+	void Initialize(uint32 InCapacity)
+	{
+		check(InCapacity > 0);
+		Capacity = InCapacity;
+		const uint32 StorageSize = FMath::RoundUpToPowerOfTwo(InCapacity);
+		Mask = StorageSize - 1;
+		Elements.SetNum(StorageSize);
+		Head.Index.store(0, std::memory_order_relaxed);
+		Head.Cached = 0;
+		Tail.Index.store(0, std::memory_order_relaxed);
+		Tail.Cached = 0;
+	}
+
+	/** 生产者调用，队列满时返回 false */
+	bool Enqueue(const ElementType& Item)
+	{
+		const uint32 TailIndex = Tail.Index.load(std::memory_order_relaxed);
+		if (TailIndex - Tail.Cached >= Capacity)
+		{
+			Tail.Cached = Head.Index.load(std::memory_order_acquire);
+			if (TailIndex - Tail.Cached >= Capacity)
+			{
+				return false;
+			}
+		}
+		Elements[TailIndex & Mask] = Item;
+		Tail.Index.store(TailIndex + 1, std::memory_order_release);
+		return true;
+	}
+
+	/** 消费者调用，队列空时返回 false */
+	bool Dequeue(ElementType& OutItem)
+	{
+		const uint32 HeadIndex = Head.Index.load(std::memory_order_relaxed);
+		if (HeadIndex == Head.Cached)
+		{
+			Head.Cached = Tail.Index.load(std::memory_order_acquire);
+			if (HeadIndex == Head.Cached)
+			{
+				return false;
+			}
+		}
+		OutItem = MoveTemp(Elements[HeadIndex & Mask]);
+		Head.Index.store(HeadIndex + 1, std::memory_order_release);
+		return true;
+	}
+
+	/** 消费者调用，返回队首元素但不出队，队列空时返回 nullptr */
+	ElementType* Peek()
+	{
+		const uint32 HeadIndex = Head.Index.load(std::memory_order_relaxed);
+		if (HeadIndex == Head.Cached)
+		{
+			Head.Cached = Tail.Index.load(std::memory_order_acquire);
+			if (HeadIndex == Head.Cached)
+			{
+				return nullptr;
+			}
+		}
+		return &Elements[HeadIndex & Mask];
+	}
+
+	/**
+	 * 最近一次入队、还没有被取走的元素，队列为空时返回 nullptr
+	 * @note 只有生产者和消费者是同一个线程时才安全
+	 */
+	ElementType* GetLastEnqueued()
+	{
+		const uint32 HeadIndex = Head.Index.load(std::memory_order_relaxed);
+		const uint32 TailIndex = Tail.Index.load(std::memory_order_relaxed);
+		return TailIndex != HeadIndex ? &Elements[(TailIndex - 1) & Mask] : nullptr;
+	}
+
+	/** 任意线程调用，结果只是一个近似值 */
+	FORCEINLINE uint32 Num() const
+	{
+		const uint32 HeadIndex = Head.Index.load(std::memory_order_acquire);
+		const uint32 TailIndex = Tail.Index.load(std::memory_order_acquire);
+		return TailIndex - HeadIndex;
+	}
+
+	FORCEINLINE bool IsEmpty() const { return Num() == 0; }
+
+	FORCEINLINE bool IsFull() const { return Num() >= Capacity; }
+
+	FORCEINLINE uint32 GetCapacity() const { return Capacity; }
+
+private:
+	/** 每一端的游标以及对另一端游标的本地缓存，缓存可以减少跨核读取 */
+	struct alignas(PLATFORM_CACHE_LINE_SIZE) FCursor
+	{
+		std::atomic<uint32> Index{0};
+		uint32 Cached = 0;
+	};
+
+	/** 消费者游标 */
+	FCursor Head;
+	/** 生产者游标 */
+	FCursor Tail;
+
+	uint32 Capacity = 0;
+	uint32 Mask = 0;
+	TArray<ElementType> Elements;
+};
@@ -0,0 +1,84 @@
+﻿#pragma once
+
+#include <atomic>
+
+#include "CoreMinimal.h"
+
+/**
+ * 延迟分布，按 HDR Histogram 的方式分桶：以微秒计，每个 2 的幂区间再等分成 SUB_BUCKET_COUNT 份，
+ * 相对误差不超过 1/SUB_BUCKET_COUNT，从 1 微秒到几个小时只需要固定的一千多个计数
+ * 记录只是几次 relaxed 原子加，可以在任意多个线程同时记录，任意线程读取，录制多久都不会分配内存
+ */
+class FLatencyHistogram
+{
+public:
+	FLatencyHistogram();
+
+	void Record(uint64 Cycles);
+	void RecordMs(double Milliseconds);
+
+	/** 清空，不能与 Record 同时调用 */
+	void Reset();
+
+	/** 第 Percent 百分位所在桶的上沿（毫秒），不会超过记录到的最大值 */
+	double GetPercentileMs(double Percent) const;
+
+	FORCEINLINE uint64 GetCount() const { return Count.load(std::memory_order_relaxed); }
+
+	double GetMeanMs() const;
+
+	double GetMaxMs() const;
+
+private:
+	static constexpr int32 SUB_BUCKET_BITS = 5;
+	static constexpr int32 SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+	/** 最大到 2^36 微秒（约 19 小时），更大的落在最后一个桶里 */
+	static constexpr int32 MAX_SHIFT = 31;
+	static constexpr int32 BUCKET_COUNT = SUB_BUCKET_COUNT * (MAX_SHIFT + 2);
+
+	static int32 GetBucketIndex(uint64 Micros);
+	/** 落在这个桶里的最大值（微秒） */
+	static uint64 GetBucketUpperBound(int32 Index);
+
+	std::atomic<uint32> Buckets[BUCKET_COUNT];
+	std::atomic<uint64> Count{0};
+	std::atomic<uint64> SumMicros{0};
+	std::atomic<uint64> MaxMicros{0};
+};
+
+/**
+ * 每一帧从捕获到编码器产出 packet 的延迟，只在视频编码线程记录，编码结束后输出 p50/p99
+ * 分布记在 FLatencyHistogram 里；需要写 CSV 时才保存逐帧的样本
+ */
+class FCaptureLatencyStats
+{
+public:
+	/**
+	 * 在编码开始前调用
+	 * @param MaxCsvSamples 为 CSV 预留的逐帧样本数，超出后只进直方图，0 表示不保存逐帧的样本
+	 */
+	void Initialize(int32 MaxCsvSamples);
+
+	/**
+	 * 编码器产出了 PresentTime 这一帧的 packet
+	 * @param CaptureCycles 捕获这一帧时的 FPlatformTime::Cycles64()，为 0（重复上一帧补的帧）时不计
+	 */
+	void Record(double PresentTime, uint64 CaptureCycles);
+
+	FORCEINLINE const FLatencyHistogram& GetHistogram() const { return Histogram; }
+
+	void Log(const FString& OutputName) const;
+
+	/** 每行一帧：帧位置、捕获到出 packet 的延迟 */
+	bool WriteCsv(const FString& Path) const;
+
+private:
+	struct FSample
+	{
+		double PresentTime;
+		float LatencyMs;
+	};
+
+	FLatencyHistogram Histogram;
+	TArray<FSample> Samples;
+};
@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * 可读写的内存映射文件，打开时按大小预先分配磁盘空间，关闭时删除
+ * 用作即时回放的磁盘缓存：写入只是内存拷贝，脏页由系统在后台写回磁盘，占用的是可以回收的页缓存而不是进程内存
+ * @note 只支持 Windows 和 POSIX 平台，其他平台 Open 返回 false
+ */
+class FMappedFile
+{
+public:
+	FMappedFile() = default;
+	~FMappedFile();
+
+	FMappedFile(const FMappedFile&) = delete;
+	FMappedFile& operator=(const FMappedFile&) = delete;
+
+	/** 创建（或者截断）Path，分配 Size 字节并整个映射进来 */
+	bool Open(const FString& Path, uint64 Size);
+
+	/** 解除映射并删除文件 */
+	void Close();
+
+	FORCEINLINE uint8* GetData() const { return Data; }
+	FORCEINLINE uint64 GetSize() const { return Size; }
+
+private:
+	FString Path;
+	uint8* Data = nullptr;
+	uint64 Size = 0;
+#if PLATFORM_WINDOWS
+	void* FileHandle = nullptr;
+	void* MappingHandle = nullptr;
+#else
+	int FileDescriptor = -1;
+#endif
+};
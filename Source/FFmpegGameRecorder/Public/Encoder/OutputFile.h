@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "FFmpegExt/FFmpegExtension.h"
+#include "Capture/RecorderConfig.h"
+#include "Encoder/FileWriter.h"
+
+namespace recorder
+{
+	/** 不直接写文件的模板上下文（分段输出、即时回放）里视频流的时间基 */
+	constexpr int32 TemplateVideoTimeBase = 90000;
+
+	/** 本地文件（不是推流地址）才能使用 FBufferedFileWriter 和分段输出 */
+	FORCEINLINE bool IsLocalOutputPath(const FString& Path)
+	{
+		return !Path.Contains(TEXT("://"));
+	}
+
+	/** 按地址选择封装格式：RTMP 推流用 flv，UDP/SRT 用 mpegts，其他返回 nullptr，由扩展名决定 */
+	const char* GetOutputFormatName(const FString& Path);
+
+	/**
+	 * 写进报告用的地址：网络地址只保留协议和主机，去掉用户名密码、路径（RTMP 的推流码）和参数（SRT 的 streamid 等），本地路径原样返回
+	 */
+	FString RedactOutputUrl(const FString& Path);
+
+	/**
+	 * 为 Context 打开输出：本地文件且 FileWriteBufferSizeKB > 0 时使用 FBufferedFileWriter，否则使用 avio_open，网络连接可以被 Context 的 interrupt_callback 中断
+	 * @param OutWriter 使用 FBufferedFileWriter 时由它持有写出端，之后交给 CloseOutputIO 关闭
+	 * @return FFmpeg 的错误码
+	 */
+	int OpenOutputIO(AVFormatContext* Context, const FString& Path, const FRecorderConfig& Config,
+	                 TUniquePtr<FBufferedFileWriter>& OutWriter);
+
+	/** 关闭 OpenOutputIO 打开的输出，需要在 av_write_trailer 之后调用 */
+	bool CloseOutputIO(AVFormatContext* Context, TUniquePtr<FBufferedFileWriter>& Writer);
+
+	/** 按配置生成 avformat_write_header 的封装选项，调用者负责 av_dict_free */
+	AVDictionary* MakeMuxerOptions(const AVFormatContext* Context, const FRecorderConfig& Config);
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <atomic>
+
+#include "CoreMinimal.h"
+#include "FFmpegExt/FFmpegExtension.h"
+#include "Capture/RecorderConfig.h"
+#include "Encoder/FileWriter.h"
+#include "Encoder/FrameRing.h"
+#include "Encoder/PipelineStage.h"
+
+/**
+ * 主输出之外的一路额外输出（本地文件、RTMP 推流、UDP 上的 MPEG-TS 等），与主输出共用同一个编码器
+ * 封装线程把每个 packet 引用（不拷贝数据）一份放进这一路自己的有界队列，由这一路自己的线程封装、写出；
+ * 这一路跟不上（网络慢、还在连接）时只丢它自己的 packet，并且一直丢到下一个视频关键帧，封装线程和其他输出不受影响
+ */
+class FOutputSink
+{
+public:
+	/**
+	 * @param Template 已经写好文件头（或者固定了时间基）的主输出上下文，只在构造时复制流参数
+	 */
+	FOutputSink(const FRecorderConfig& InConfig, const AVFormatContext* Template, const FString& InUrl);
+	~FOutputSink();
+
+	/** 启动写出线程，连接、打开文件和写文件头都在写出线程里做，不会阻塞封装线程 */
+	void Start();
+
+	/** 封装线程调用，packet 的时间基为主输出流的时间基 */
+	void Enqueue(const AVPacket* Packet);
+
+	/**
+	 * 写完队列里剩下的 packet，写文件尾并关闭；还没连上或者写出卡住超过 CLOSE_TIMEOUT_SEC 时直接中断
+	 * @param Report 不为空时把这一路的统计、丢弃的 packet 数和写出的字节数记进去
+	 * @param ReportName 这一路在报告里的名字，地址里可能有推流码，不能直接用
+	 */
+	void Close(FRecorderSessionReport* Report = nullptr, const FString& ReportName = FString());
+
+	FORCEINLINE const FString& GetUrl() const { return Url; }
+	FORCEINLINE uint64 GetDroppedCount() const { return DroppedCount.load(); }
+	FORCEINLINE const FPipelineStageStats* GetStats() const { return SinkStage ? &SinkStage->GetStats() : nullptr; }
+
+private:
+	static int InterruptCallback(void* Opaque);
+
+	bool Open_SinkThread();
+	/** 写出一个 packet，没有待写的 packet 时返回 false */
+	bool WriteOnePacket_SinkThread();
+
+	struct FQueuedPacket
+	{
+		AVPacket* Packet;
+		uint64 EnqueueCycles;
+	};
+
+	static constexpr uint32 QUEUE_CAPACITY = 256;
+	static constexpr double CLOSE_TIMEOUT_SEC = 5;
+
+	FRecorderConfig Config;
+	FString Url;
+	AVFormatContext* Context = nullptr;
+	/** 主输出各个流的时间基，写出时换算到这一路的时间基 */
+	TArray<AVRational> SourceTimeBases;
+	int32 VideoIndex = -1;
+	TUniquePtr<FBufferedFileWriter> Writer;
+
+	TArray<AVPacket*> Packets;
+	/** 待写出的 packet，封装线程写入，写出线程读取 */
+	TSpscRing<FQueuedPacket> Ready;
+	/** 空闲的 packet，写出线程归还，封装线程领取 */
+	TSpscRing<AVPacket*> Free;
+	TUniquePtr<FPipelineStage> SinkStage;
+
+	/** 只在封装线程访问 */
+	bool bWaitingForKeyframe = true;
+	AVPacket* SparePacket = nullptr;
+	/** 只在写出线程访问 */
+	bool bOpenAttempted = false;
+	bool bOpened = false;
+	uint64 WrittenBytes = 0;
+
+	std::atomic_bool bFailed{false};
+	std::atomic<uint64> CloseStartCycles{0};
+	std::atomic<uint64> DroppedCount{0};
+};
@@ -0,0 +1,115 @@
+﻿#pragma once
+
+#include <atomic>
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "Encoder/LatencyStats.h"
+
+class FRunnableThread;
+class FRecorderSessionReport;
+
+/**
+ * 流水线某一级的运行统计，处理线程写入，任意线程读取
+ */
+struct FPipelineStageStats
+{
+	/** 处理完的任务数 */
+	std::atomic<uint64> ProcessedCount{0};
+	/** 实际处理任务花掉的时间 */
+	std::atomic<uint64> BusyCycles{0};
+	/** 任务从进入这一级的输入队列到处理完的时间之和，以及最大值 */
+	std::atomic<uint64> LatencyCycles{0};
+	std::atomic<uint64> MaxLatencyCycles{0};
+	/** 同一个延迟的分布，用于输出分位数 */
+	FLatencyHistogram LatencyHistogram;
+	/** 每处理一个任务时对输入队列深度的采样之和，以及最大值 */
+	std::atomic<uint64> QueueDepthSum{0};
+	std::atomic<uint32> MaxQueueDepth{0};
+	/** 第一次处理任务的时间，用来计算占用率 */
+	std::atomic<uint64> FirstActiveCycles{0};
+	/** 单次处理的最长时间，用来发现 I/O 之类的偶发卡顿 */
+	std::atomic<uint64> MaxBusyCycles{0};
+	/** 上游因为输入队列满而阻塞等待的次数、总时间和最大值 */
+	std::atomic<uint64> StallCount{0};
+	std::atomic<uint64> StallCycles{0};
+	std::atomic<uint64> MaxStallCycles{0};
+
+	/**
+	 * 记录处理完的一个任务
+	 * @param EnqueueCycles 任务进入输入队列时的 FPlatformTime::Cycles64()
+	 * @param QueueDepth 取出任务之前输入队列的深度
+	 */
+	void RecordItem(uint64 EnqueueCycles, uint32 QueueDepth);
+
+	/** 记录一段处理时间 */
+	void RecordBusy(uint64 Cycles);
+
+	/** 记录上游的一次阻塞等待，可以在多个上游线程调用 */
+	void RecordStall(uint64 Cycles);
+
+	/** 处理线程实际在干活的时间占比 */
+	double GetOccupancy() const;
+
+	double GetAverageLatencyMs() const;
+
+	double GetMaxLatencyMs() const;
+
+	double GetAverageQueueDepth() const;
+
+	double GetStallMs() const;
+
+	/** 输出到日志，Report 不为空时同时记进会话报告 */
+	void Log(const FString& StageName, FRecorderSessionReport* Report = nullptr) const;
+};
+
+/**
+ * 流水线中的一级：独占一个线程，从上游的有界队列里取任务处理，处理结果放进下游的有界队列
+ * 队列本身由使用者持有，这里只负责线程的调度、唤醒和退出
+ */
+class FPipelineStage : public FRunnable
+{
+public:
+	/**
+	 * @param InProcessOne 处理一个任务，上游为空或者下游已满时返回 false
+	 * @param InHasPendingWork 上游还有没处理的任务，退出前会先把这些任务处理完
+	 */
+	FPipelineStage(const TCHAR* InName, TFunction<bool()> InProcessOne, TFunction<bool()> InHasPendingWork);
+	virtual ~FPipelineStage() override;
+
+	void Start();
+
+	/** 上游放入了任务，或者下游腾出了空间 */
+	void Wake();
+
+	/** 处理完上游剩下的任务后退出，不会阻塞 */
+	void RequestStop();
+
+	FORCEINLINE bool IsFinished() const { return bFinished.load(); }
+
+	/** 阻塞到线程退出，调用前需要先 RequestStop */
+	void Join();
+
+	FORCEINLINE const FPipelineStageStats& GetStats() const { return Stats; }
+	FORCEINLINE FPipelineStageStats& GetStats() { return Stats; }
+
+	//~FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~FRunnable interface
+
+private:
+	/** 没有任务时的最长等待时间，防止漏掉唤醒后一直挂起 */
+	static constexpr uint32 IDLE_WAIT_MS = 10;
+
+	FString Name;
+	TFunction<bool()> ProcessOne;
+	TFunction<bool()> HasPendingWork;
+
+	FRunnableThread* Thread = nullptr;
+	FEvent* WorkEvent = nullptr;
+	std::atomic_bool bStopRequested{false};
+	std::atomic_bool bFinished{false};
+
+	FPipelineStageStats Stats;
+};
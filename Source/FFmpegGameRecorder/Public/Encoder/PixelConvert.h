@@ -0,0 +1,81 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+
+namespace recorder
+{
+	/** I420 的三个输出平面 */
+	struct FI420Planes
+	{
+		uint8* Y;
+		int32 StrideY;
+		uint8* U;
+		int32 StrideU;
+		uint8* V;
+		int32 StrideV;
+	};
+
+	/** NV12 的两个输出平面，UV 平面里 U、V 交错排列 */
+	struct FNV12Planes
+	{
+		uint8* Y;
+		int32 StrideY;
+		uint8* UV;
+		int32 StrideUV;
+	};
+
+	/** 10bit 量化到 8bit，GPU UNorm 的舍入方式，与 (int)((Value10 / 1023.f) * 255.f + 0.5f) 结果一致 */
+	FORCEINLINE uint8 Requantize10To8(uint32 Value10)
+	{
+		const uint32 Temp = Value10 * 255 + (1 << 9);
+		return static_cast<uint8>((Temp + (Temp >> 10)) >> 10);
+	}
+
+	/**
+	 * PF_A2B10G10R10（R 在低位）一次完成量化到 8bit 和 RGB -> I420（BT.601 limited range，系数与 libyuv::ABGRToI420 相同），
+	 * 不经过中间的 RGBA 缓存，按 CPU 支持情况选择 AVX2 / SSE4.1 / 标量实现
+	 * @param Src 指向裁剪区域左上角的像素
+	 * @param SrcStride 源数据每一行的字节数
+	 */
+	void ConvertA2B10G10R10ToI420(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width, int32 Height);
+
+	/** 标量参考实现，SIMD 版本的输出必须与它逐字节一致 */
+	void ConvertA2B10G10R10ToI420_Scalar(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width,
+	                                     int32 Height);
+
+	/** 与 ConvertA2B10G10R10ToI420 相同的转换，色度直接交错写成 NV12，输出的 Y、U、V 值与 I420 版本逐字节一致 */
+	void ConvertA2B10G10R10ToNV12(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width, int32 Height);
+
+	/** NV12 的标量参考实现，rec.bench.NV12 用它校验 SIMD 版本 */
+	void ConvertA2B10G10R10ToNV12_Scalar(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width,
+	                                     int32 Height);
+
+	/**
+	 * 保留 10bit 精度的转换，系数与 8bit 版本相同，Y 偏移 64、色度偏移 512（limited range）
+	 * 输出平面是 16bit 小端的采样，行宽仍然以字节为单位；I010（yuv420p10le）的值在低 10 位
+	 */
+	void ConvertA2B10G10R10ToI010(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width, int32 Height);
+
+	void ConvertA2B10G10R10ToI010_Scalar(const uint8* Src, int32 SrcStride, const FI420Planes& Dst, int32 Width,
+	                                     int32 Height);
+
+	/** 同 ConvertA2B10G10R10ToI010，输出 P010：UV 交错，值在 16bit 的高 10 位 */
+	void ConvertA2B10G10R10ToP010(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width, int32 Height);
+
+	void ConvertA2B10G10R10ToP010_Scalar(const uint8* Src, int32 SrcStride, const FNV12Planes& Dst, int32 Width,
+	                                     int32 Height);
+
+	/** 8bit 的 I420 扩展到 10bit，给 10bit 编码时的 8bit 源使用 */
+	void WidenI420ToI010(const FI420Planes& Src, const FI420Planes& Dst, int32 Width, int32 Height);
+	void WidenI420ToP010(const FI420Planes& Src, const FNV12Planes& Dst, int32 Width, int32 Height);
+
+	/** 当前 CPU 上 ConvertA2B10G10R10ToI420 实际使用的实现 */
+	const TCHAR* GetPixelConvertImplementationName();
+
+	/**
+	 * 把 Height 行切成若干条水平条带并行处理，条带的起始行都是偶数，保证 4:2:0 的色度行不会被两条带共用
+	 * @param NumWorkers 最多使用的线程数，0 表示按 CPU 核数自动选择，1 表示在当前线程串行执行
+	 * @param Body 参数为条带的起始行和行数
+	 */
+	void ParallelForStripes(int32 Height, int32 NumWorkers, TFunctionRef<void(int32 StartRow, int32 NumRows)> Body);
+}
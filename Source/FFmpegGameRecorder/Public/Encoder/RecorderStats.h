@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+
+#include "RecorderStats.generated.h"
+
+DECLARE_STATS_GROUP(TEXT("Recorder"), STATGROUP_Recorder, STATCAT_Advanced);
+
+/**
+ * 录制中的实时统计，编码线程定期采样，可以在 stat Recorder、Unreal Insights 的 Recorder 通道和蓝图里查看
+ * 速率类的值是最近一个采样周期内的平均
+ */
+USTRUCT(BlueprintType)
+struct FFMPEGGAMERECORDER_API FRecorderStats
+{
+	GENERATED_BODY()
+
+	/** 待转换队列（VideoBuffer）里的帧数 */
+	UPROPERTY(BlueprintReadOnly, Category = "Recorder")
+	int32 VideoBufferDepth = 0;
+
+	/** 待编码音频队列（AudioBuffer）里的帧数 */
+	UPROPERTY(BlueprintReadOnly, Category = "Recorder")
+	int32 AudioBufferDepth = 0;
+
+	/** 空闲的视频槽位数，长期为 0 说明渲染线程在等槽位或者在丢帧 */
+	UPROPERTY(BlueprintReadOnly, Category = "Recorder")
+	int32 FreeVideoSlots = 0;
+
+	/** 每秒送进视频编码器的帧数 */
+	UPROPERTY(BlueprintReadOnly, Category = "Recorder")
+	float EncodedFps = 0;
+
+	/** 编码线程处理一帧的平均耗时（毫秒） */
+	UPROPERTY(BlueprintReadOnly, Category = "Recorder")
+	float EncodeMsPerFrame = 0;
+
+	/** 写给主输出的码率（kbps） */
+	UPROPERTY(BlueprintReadOnly, Category = "Recorder")
+	float OutputBitrateKbps = 0;
+
+	/** 录制开始以来丢弃的视频帧数 */
+	UPROPERTY(BlueprintReadOnly, Category = "Recorder")
+	int64 DroppedVideoFrames = 0;
+
+	/** 已编码的视频结束时间减去已编码的音频结束时间（毫秒），正数表示音频落后 */
+	UPROPERTY(BlueprintReadOnly, Category = "Recorder")
+	float AVDriftMs = 0;
+};
+
+namespace recorder
+{
+	/** 把一次采样写到 stat Recorder；Recorder 通道（-trace=counters,recorder）打开时同时写成 Insights 的计数器 */
+	void PublishLiveStats(const FRecorderStats& Stats);
+}
@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include <atomic>
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "Encoder/AVEncoder.h"
+
+/**
+ * 编码阶梯中的一档：与主编码器共用捕获和颜色转换，引用主编码器转换好的全分辨率帧，
+ * 在自己的线程里用 libyuv 缩小到这一档的分辨率，再由自己的 FAVEncoder 编码、写到自己的输出，各档之间并行
+ * 这一档跟不上时只丢它自己的帧，丢掉的时长按 VideoQueuePolicy 并到上一帧或者重复上一帧补齐，主编码器不受影响
+ */
+class FRenditionEncoder
+{
+public:
+	FRenditionEncoder(const FRecorderConfig& MainConfig, const FRecorderRendition& Rendition);
+	~FRenditionEncoder();
+
+	/** 这一档的配置：分辨率、码率、preset 和输出换成这一档的，只保留主输出的本地写出相关设置 */
+	static FRecorderConfig MakeConfig(const FRecorderConfig& MainConfig, const FRecorderRendition& Rendition);
+
+	/**
+	 * 创建编码器并启动这一档的编码线程
+	 * @param Report 这一档的统计以档位名为前缀记进主输出的报告，为空表示不记
+	 */
+	void Initialize(FRecorderSessionReport* Report = nullptr);
+
+	/** 主编码线程调用：引用一份转换好的帧，不拷贝像素 */
+	void EnqueueVideoFrame(const FConvertedVideoFrame& Converted);
+
+	/** 音频编码线程调用 */
+	void EncodeAudioFrame(FEncodeData* EncodeData);
+
+	/** 主编码线程调用：编完队列里剩下的帧，冲刷视频编码器 */
+	void FinishVideo();
+
+	/** 音频编码线程退出之后调用，冲刷音频编码器 */
+	void FinishAudio();
+
+	/** 写文件尾，需要在 FinishVideo 和 FinishAudio 之后调用 */
+	void Finish();
+
+	FORCEINLINE const FString& GetName() const { return Name; }
+
+private:
+	/** 缩放并编码一帧，没有待编码的帧时返回 false */
+	bool EncodeOneVideoFrame_RenditionThread();
+
+	FRecorderConfig Config;
+	FString Name;
+	FRecorderSessionReport* SessionReport = nullptr;
+	TUniquePtr<FAVEncoder> Encoder;
+	/** 这一档送进音频编码器的帧时间，只在音频编码线程访问 */
+	TQueue<FTimeSeq> AudioTimeSequence;
+
+	static constexpr uint32 FRAME_CAPACITY = 3;
+	TArray<AVFrame*> Frames;
+	/** 引用着主编码器帧缓存的待编码帧，主编码线程写入，这一档的线程读取 */
+	TSpscRing<FConvertedVideoFrame> Ready;
+	/** 空闲帧，这一档的线程归还，主编码线程领取 */
+	TSpscRing<AVFrame*> Free;
+	/** 缩放结果，只在这一档的线程访问 */
+	AVFrame* ScaledFrame = nullptr;
+	TUniquePtr<FPipelineStage> RenditionStage;
+
+	/** 只在主编码线程访问：这一档丢掉、还没有带到下一帧上的帧 */
+	AVFrame* SpareFrame = nullptr;
+	int32 PendingDroppedCount = 0;
+	double PendingDroppedDuration = 0;
+	std::atomic<uint64> DroppedFrames{0};
+};
@@ -0,0 +1,117 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "FFmpegExt/FFmpegExtension.h"
+#include "Capture/RecorderConfig.h"
+#include "Encoder/MappedFile.h"
+
+/**
+ * 即时回放：编码好的 packet 不写文件，而是复制进一块固定大小的环形缓存，空间不够时从最老的 GOP 开始整段淘汰，
+ * 保证缓存里的内容总是从一个视频关键帧开始；SaveReplay 在后台把最近若干秒直接封装成 MP4，不重新编码
+ * 缓存的大小就是 ReplayBufferMB，packet 的头信息和数据都放在里面；bReplayBufferOnDisk 时缓存是一个内存映射的文件，
+ * 适合十分钟以上的回放
+ */
+class FReplayBuffer
+{
+public:
+	/**
+	 * @param Template 已经创建好音视频流的上下文，流参数和时间基会被复制一份，之后不再访问
+	 */
+	FReplayBuffer(const FRecorderConfig& InConfig, const AVFormatContext* Template);
+	/** 会等待还没写完的回放文件 */
+	~FReplayBuffer();
+
+	static bool IsEnabled(const FRecorderConfig& Config) { return Config.ReplayBufferMB > 0; }
+
+	/** 封装线程调用，packet 的时间基为模板流的时间基 */
+	void AddPacket(const AVPacket* Packet);
+
+	/**
+	 * 任意线程调用：把缓存里最近 Seconds 秒（从不晚于这个时间点的关键帧开始）的 packet 在后台写成 MP4
+	 * @return 缓存里有可以保存的内容，并且已经开始写
+	 */
+	bool SaveReplay(const FString& Path, double Seconds);
+
+	/** 缓存里的内容覆盖的时长（秒） */
+	double GetRetainedSeconds() const;
+
+	FORCEINLINE bool IsMappedToDisk() const { return MappedFile.IsValid(); }
+
+private:
+	/** 每个 packet 在环形缓存里的头信息，数据紧跟在后面 */
+	struct FRecordHeader
+	{
+		int64 Pts;
+		int64 Dts;
+		int64 Duration;
+		/** 数据大小，-1 表示从这里到缓存末尾都是填充 */
+		int32 Size;
+		int32 Flags;
+		int32 StreamIndex;
+		/** 头信息加数据按 RECORD_ALIGNMENT 对齐后的大小 */
+		uint32 RecordSize;
+	};
+
+	/** 关键帧索引：一个 GOP 的第一个 packet（视频关键帧）的位置和时间 */
+	struct FGopStart
+	{
+		uint64 Position;
+		double Time;
+	};
+
+	/** 正在导出的回放读到的位置，读游标之后的记录不会被淘汰 */
+	struct FReadCursor
+	{
+		uint64 Position;
+		uint64 End;
+	};
+
+	struct FStreamInfo
+	{
+		AVCodecParameters* Parameters;
+		AVRational TimeBase;
+	};
+
+	enum class EAllocateResult
+	{
+		Success,
+		/** 当前的 GOP 加上这条记录就超过了整个缓存 */
+		TooLarge,
+		/** 需要淘汰的 GOP 还没有被导出读完 */
+		Pinned,
+	};
+
+	static constexpr uint32 RECORD_ALIGNMENT = 16;
+
+	/** 在 Tail 处为一条记录腾出空间，必要时淘汰最老的 GOP */
+	EAllocateResult AllocateRecord(uint32 RecordSize, bool bStartsGop, double Time, uint64& OutPosition);
+	/** 有读游标还没读到 NewHead 时不能把 Head 移过去 */
+	bool IsPinned(uint64 NewHead) const;
+	void Clear();
+	/** 后台线程：从 Cursor 读出下一个 packet，读完时返回 false */
+	bool ReadPacket(FReadCursor& Cursor, AVPacket* Packet);
+	/** 后台线程：把 Cursor 范围里的 packet 写成 MP4 */
+	bool WriteReplay(const FString& Path, FReadCursor& Cursor);
+
+	FRecorderConfig Config;
+	TArray<FStreamInfo> Streams;
+
+	/** 缓存的内存，bReplayBufferOnDisk 时指向 MappedFile 的映射 */
+	uint8* Memory = nullptr;
+	uint64 Capacity = 0;
+	TUniquePtr<FMappedFile> MappedFile;
+	/** 最老记录和下一条记录的位置，只增不减，取模 Capacity 得到缓存里的偏移 */
+	uint64 Head = 0;
+	uint64 Tail = 0;
+	/** 按时间顺序的关键帧索引，第一个就是 Head */
+	TArray<FGopStart> GopStarts;
+	double NewestTime = 0;
+	/** 缓存被清空（或者因为导出没读完而丢了 packet）后要等到下一个视频关键帧才开始接收 */
+	bool bWaitingForKeyframe = true;
+	TArray<FReadCursor*> ReadCursors;
+	mutable FCriticalSection Mutex;
+
+	TArray<TFuture<bool>> PendingSaves;
+	FCriticalSection PendingSavesMutex;
+};
@@ -0,0 +1,91 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "FFmpegExt/FFmpegExtension.h"
+#include "Capture/RecorderConfig.h"
+#include "Encoder/FileWriter.h"
+
+/**
+ * 分段录制：按时长或大小在视频关键帧处切换到新文件，可选生成 HLS 播放列表，只保留最近的若干个分段
+ * 下一个分段的文件在后台提前打开并写好文件头，上一个分段的文件尾也在后台写，封装线程切换时只交换指针
+ * @note WritePacket 只能在封装线程调用
+ */
+class FSegmentedOutput
+{
+public:
+	/**
+	 * @param InTemplate 已经创建好音视频流的上下文，只用来复制流参数，本身不写文件
+	 */
+	FSegmentedOutput(const FRecorderConfig& InConfig, AVFormatContext* InTemplate);
+	~FSegmentedOutput();
+
+	/** 配置了分段条件、输出到本地文件，并且没有开启即时回放 */
+	static bool IsEnabled(const FRecorderConfig& Config);
+
+	/** 生成 HLS 播放列表时分段使用 mpegts，否则与 SaveFilePath 的格式相同 */
+	static const char* GetSegmentFormatName(const FRecorderConfig& Config);
+
+	/** 同步打开第一个分段，并在后台准备第二个 */
+	bool Open();
+
+	/**
+	 * 写一个 packet，到达分段条件后在视频关键帧处先切换文件
+	 * @param Packet 时间基为模板流的时间基，写出时会被换算
+	 */
+	int WritePacket(AVPacket* Packet);
+
+	/** 写完当前分段，等待后台任务结束，补全播放列表 */
+	void Close();
+
+private:
+	struct FSegment
+	{
+		int32 Index = 0;
+		FString Path;
+		AVFormatContext* Context = nullptr;
+		TUniquePtr<FBufferedFileWriter> Writer;
+		/** 写入的第一个和最后一个 packet 的时间（秒），以及写入的字节数 */
+		double StartTime = -1;
+		double EndTime = 0;
+		int64 Bytes = 0;
+	};
+
+	/** 已经写完、还留在磁盘上的分段，只在收尾任务里访问 */
+	struct FFinishedSegment
+	{
+		FString Path;
+		double Duration;
+	};
+
+	FString GetSegmentPath(int32 Index) const;
+	FString GetPlaylistPath() const;
+
+	/** 后台线程：创建分段文件并写好文件头，失败时返回 nullptr */
+	FSegment* OpenSegment(int32 Index) const;
+	/** 关闭并释放没有写完的分段 */
+	static void DestroySegment(FSegment* Segment);
+	/** 后台线程：写文件尾、关闭文件、更新播放列表、删除超出保留数量的分段 */
+	void FinishSegment(FSegment* Segment);
+	/** 换到后台准备好的下一个分段，当前分段交给后台收尾 */
+	void SwitchSegment();
+	void PreopenNextSegment();
+	bool ShouldSwitchSegment(const AVPacket* Packet, double PacketTime) const;
+	void WritePlaylist(bool bEnded) const;
+
+	FRecorderConfig Config;
+	AVFormatContext* Template;
+	const char* FormatName;
+	/** SaveFilePath 去掉扩展名，分段和播放列表都以它命名 */
+	FString BasePath;
+	FString Extension;
+	bool bWritePlaylist;
+
+	TUniquePtr<FSegment> Current;
+	TFuture<FSegment*> NextSegment;
+	TFuture<void> PendingFinish;
+
+	TArray<FFinishedSegment> FinishedSegments;
+	/** 已经从播放列表中删掉的分段数，也就是 EXT-X-MEDIA-SEQUENCE */
+	int32 RemovedSegmentCount = 0;
+};
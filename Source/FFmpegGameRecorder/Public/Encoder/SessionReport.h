@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "Encoder/LatencyStats.h"
+
+struct FPipelineStageStats;
+
+/**
+ * 一次录制的性能报告：流水线各级的吞吐、占用率、队列高水位和延迟分位数，逐帧各段的延迟分位数，以及丢帧数、写出字节数等计数
+ * 各级在自己结束时（输出统计日志的地方）把数据记进来，录制停止后由 UFFmpegRecorder 写成 JSON 或 CSV，用于从线上数据发现性能回退
+ * @note 记录可以在任意线程进行；Write 要在所有编码线程退出之后调用
+ */
+class FRecorderSessionReport
+{
+public:
+	/** 会话信息，例如输出路径、编码器、分辨率 */
+	void AddInfo(const FString& Name, const FString& Value);
+
+	/** 流水线中一级结束时的统计快照 */
+	void AddStage(const FString& Name, const FPipelineStageStats& Stats);
+
+	/** 逐帧某一段的延迟分布，例如从捕获到进入待转换队列 */
+	void AddLatency(const FString& Name, const FLatencyHistogram& Histogram);
+
+	/** 丢帧数、写出字节数等计数 */
+	void AddCounter(const FString& Name, int64 Value);
+
+	/** 扩展名是 .csv 时写成 section,name,metric,value 的长表，否则写成 JSON */
+	bool Write(const FString& Path) const;
+
+private:
+	struct FLatencySummary
+	{
+		uint64 Count = 0;
+		double MeanMs = 0;
+		double P50Ms = 0;
+		double P90Ms = 0;
+		double P99Ms = 0;
+		double P999Ms = 0;
+		double MaxMs = 0;
+	};
+
+	struct FStageEntry
+	{
+		FString Name;
+		uint64 Items = 0;
+		double Occupancy = 0;
+		double AverageQueueDepth = 0;
+		uint32 MaxQueueDepth = 0;
+		double MaxBusyMs = 0;
+		uint64 Stalls = 0;
+		double StallMs = 0;
+		FLatencySummary Latency;
+	};
+
+	static FLatencySummary Summarize(const FLatencyHistogram& Histogram);
+
+	FString ToJson() const;
+	FString ToCsv() const;
+
+	mutable FCriticalSection Mutex;
+	TArray<TPair<FString, FString>> Infos;
+	TArray<FStageEntry> Stages;
+	TArray<TPair<FString, FLatencySummary>> Latencies;
+	TArray<TPair<FString, int64>> Counters;
+};
@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include "CoreMinimal.h"
+#include "FFmpegExt/FFmpegExtension.h"
+#include "Capture/RecorderConfig.h"
+
+/** 编码器内部并行的方式 */
+enum class EVideoEncoderThreading : uint8
+{
+	/** 帧级并行（x264、x265），吞吐最高，每多一个线程多一帧延迟 */
+	Frame,
+	/** 帧内按 slice、tile 或者行并行，不增加延迟 */
+	Slice,
+	/** 编码库自己管理线程池和流水线（SVT-AV1、NVENC），FFmpeg 的线程设置不起作用 */
+	Internal,
+};
+
+/** 编码器后端固定的特征，选择后端和评估代价时使用 */
+struct FVideoEncoderTraits
+{
+	EVideoEncoderThreading Threading = EVideoEncoderThreading::Frame;
+	/** 按这里的设置，第一个 packet 出来之前编码器要先攒下的帧数（不算帧级线程带来的延迟），0 表示一进一出 */
+	int32 DelayFrames = 0;
+	/** 会输出 B 帧，dts 落后于 pts */
+	bool bReordersFrames = false;
+};
+
+/**
+ * 一种视频编码器：FFmpeg 里对应的编码器、能接受的输入格式、线程和延迟特征，以及它专有的码控、preset 和 profile 设置
+ * FAVEncoder 只负责与编码器无关的部分（分辨率、时间基、像素格式协商、全局头），其余都交给后端
+ */
+class IVideoEncoderBackend
+{
+public:
+	virtual ~IVideoEncoderBackend() = default;
+
+	/** 日志和基准里使用的名字 */
+	virtual const TCHAR* GetName() const = 0;
+
+	/** FFmpeg 里对应的编码器，没有编译进来时返回 nullptr */
+	virtual const AVCodec* FindCodec() const = 0;
+
+	/** 后端愿意接收的输入格式（颜色转换能直接输出的 I420、NV12、yuv420p10le、P010 中的一部分） */
+	virtual TConstArrayView<AVPixelFormat> GetPixelFormats() const = 0;
+
+	/** bLowLatency 时是 ConfigureLowLatency 之后的特征 */
+	virtual const FVideoEncoderTraits& GetTraits(bool bLowLatency) const = 0;
+
+	/** avcodec_open2 之前设置后端专有的参数，Context 的分辨率、时间基、码率和 pix_fmt 已经设置好 */
+	virtual void Configure(AVCodecContext* Context, const FRecorderConfig& Config) const = 0;
+
+	/**
+	 * Config.bLowLatency 时在 Configure 之后调用：不用 B 帧，帧级线程换成 slice 线程，VBV 限制在 LowLatencyVBVMs 的码率以内
+	 * 后端在此之上再去掉自己的 lookahead（x264/x265 的 zerolatency、NVENC 的 delay 等）
+	 */
+	virtual void ConfigureLowLatency(AVCodecContext* Context, const FRecorderConfig& Config) const;
+
+	/** 后端声明了 Format，并且 Codec 的格式列表里也有（没有列出格式的编码器按只接受 I420 处理） */
+	bool AcceptsPixelFormat(const AVCodec* Codec, AVPixelFormat Format) const;
+
+	/** 接受 P010 或 yuv420p10le */
+	bool AcceptsHighBitDepth(const AVCodec* Codec) const;
+
+	/**
+	 * 按 Config 创建编码器上下文：设置与编码器无关的字段后调用 Configure（以及 ConfigureLowLatency），还没有 avcodec_open2
+	 * @param PixelFormat 送进编码器的格式
+	 * @param Size 编码分辨率
+	 */
+	AVCodecContext* AllocContext(const AVCodec* Codec, const FRecorderConfig& Config, AVPixelFormat PixelFormat,
+	                             FIntPoint Size) const;
+};
+
+namespace recorder
+{
+	/** VideoCodec 对应的软件编码器后端，生命期与进程相同 */
+	const IVideoEncoderBackend& GetVideoEncoderBackend(ERecorderVideoCodec Codec);
+
+	/** NVENC 硬件编码器后端，bHEVC 时是 hevc_nvenc */
+	const IVideoEncoderBackend& GetHardwareVideoEncoderBackend(bool bHEVC);
+
+	/** 所有软件后端，按 ERecorderVideoCodec 的顺序 */
+	TConstArrayView<const IVideoEncoderBackend*> GetVideoEncoderBackends();
+
+	/** 编码器编译进来了，并且它的码流能写进 Format 封装 */
+	bool IsVideoEncoderBackendUsable(const IVideoEncoderBackend& Backend, const AVOutputFormat* Format);
+}
@@ -21,6 +21,9 @@ extern "C"
 #include "libavutil/error.h"
 #include "libswresample/swresample.h"
 #include "libyuv/convert.h"
+#include "libyuv/convert_from_argb.h"
+#include "libyuv/planar_functions.h"
+#include "libyuv/scale.h"
 }
 
 THIRD_PARTY_INCLUDES_END
@@ -2,6 +2,7 @@
 
 #include "CoreMinimal.h"
 #include "Kismet/BlueprintFunctionLibrary.h"
+#include "Encoder/RecorderStats.h"
 
 #include "GameRecorderEntry.generated.h"
 
@@ -33,5 +34,13 @@ public:
     UFUNCTION(BlueprintCallable)
     static void StopRecord();
 
+    /** 即时回放（rec.ReplayBufferMB > 0）时把最近 Seconds 秒保存为 MP4，返回文件路径，失败时返回空字符串 */
+    UFUNCTION(BlueprintCallable)
+    static FString SaveReplay(float Seconds = 30);
+
+    /** 录制中的实时统计：队列深度、编码帧率、每帧编码耗时、输出码率、丢帧数和音画偏差，没有在录制时返回全 0 */
+    UFUNCTION(BlueprintCallable)
+    static FRecorderStats GetRecorderStats();
+
     static TWeakObjectPtr<UFFmpegRecorder> CurrentDirector;
 };